@@ -0,0 +1,480 @@
+/**
+ * @brief Concatenate the NNFit DataFrames of many HDF5 files into one file.
+ * Multi-threaded replacement of scripts/merge_nnfit.py, which loads every
+ * file into one DataFrame first. A first pass reads only the sizes of the
+ * inputs, so the output datasets are created with their final extent. The
+ * output is then produced chunk by chunk: each worker thread gathers the rows
+ * of one output chunk from the inputs, compresses it (shuffle + deflate) and
+ * stores it with H5Dwrite_chunk. Memory depends only on the number of threads
+ * and the chunk size, not on the number of inputs.
+ *
+ * The HDF5 library is not thread-safe in general, so every HDF5 call is made
+ * under one mutex. Compressed input chunks (deflate, optionally shuffled) are
+ * read raw and decoded by the workers outside of it, like the compression of
+ * the output.
+ *
+ * The output is a DataFrame in pandas "fixed" format with a RangeIndex, the
+ * layout written by save_to_hdf5(), which MergeNNFit reads directly. Only the
+ * numeric columns are kept; object columns such as File are dropped.
+ *
+ * Usage: ConcatNNFit <output hdf5> [<input hdf5> ...] [--list <txt file>] [--dir <input folder>]
+ *        [--key <hdf5 group>] [--threads N] [--chunk-rows 65536] [--level 4] [--trace out.json]
+ *        [--metrics <file> [--metrics-interval 10]]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hdf5.h>
+#include <zlib.h>
+
+#include "PandasHDF5.h"
+#include "ProgressMetrics.h"
+#include "StageOptions.h"
+#include "Trace.h"
+
+using namespace std;
+
+// Guards every call into the HDF5 library
+mutex hdf5_mutex;
+
+// Numeric block of the frames, with the same columns in every input
+struct BlockSchema
+{
+    size_t input_block; // blockN_values of the inputs, object blocks are skipped
+    vector<string> items;
+    hid_t type;         // native type of the values
+    size_t row_bytes;
+    size_t type_size;
+};
+
+struct Input
+{
+    string path;
+    hsize_t rows;
+    hsize_t first; // row of the output where the input starts
+};
+
+// Compressed chunk of an input, decoded outside of the lock
+struct RawChunk
+{
+    size_t block;
+    hsize_t first_row, rows; // rows of the input covered by the chunk
+    vector<H5Z_filter_t> filters;
+    unsigned filter_mask;
+    vector<char> data;
+};
+
+void fail(const string &message)
+{
+    cerr << "Error: " << message << endl;
+    exit(1);
+}
+
+//===========================================================
+// Shuffle and deflate, as the HDF5 filters of the same name
+//===========================================================
+
+// Byte j of element i goes to position j * n + i; trailing bytes are kept in place
+void shuffle_bytes(const char *in, char *out, size_t nbytes, size_t size)
+{
+    size_t n = nbytes / size;
+    for (size_t j = 0; j < size; j++)
+        for (size_t i = 0; i < n; i++)
+            out[j * n + i] = in[i * size + j];
+    memcpy(out + n * size, in + n * size, nbytes - n * size);
+}
+
+void unshuffle_bytes(const char *in, char *out, size_t nbytes, size_t size)
+{
+    size_t n = nbytes / size;
+    for (size_t j = 0; j < size; j++)
+        for (size_t i = 0; i < n; i++)
+            out[i * size + j] = in[j * n + i];
+    memcpy(out + n * size, in + n * size, nbytes - n * size);
+}
+
+// Undo the filters of a raw chunk; out holds the nbytes of the full chunk
+void decode_chunk(const RawChunk &chunk, size_t type_size, size_t nbytes, vector<char> &out, vector<char> &scratch)
+{
+    out = chunk.data;
+    for (size_t k = chunk.filters.size(); k-- > 0;)
+    {
+        if (chunk.filter_mask & (1u << k))
+            continue;
+        scratch.resize(nbytes);
+        if (chunk.filters[k] == H5Z_FILTER_DEFLATE)
+        {
+            uLongf size = nbytes;
+            if (uncompress((Bytef *)scratch.data(), &size, (const Bytef *)out.data(), out.size()) != Z_OK || size != nbytes)
+                fail("could not inflate an input chunk");
+        }
+        else
+            unshuffle_bytes(out.data(), scratch.data(), nbytes, type_size);
+        out.swap(scratch);
+    }
+    if (out.size() != nbytes)
+        fail("input chunk of unexpected size");
+}
+
+// Filters of a dataset that can be read raw and decoded here, false for any other layout
+bool raw_readable(hid_t dataset, const BlockSchema &block, hsize_t &chunk_rows, vector<H5Z_filter_t> &filters)
+{
+    hid_t dcpl = H5Dget_create_plist(dataset);
+    bool readable = H5Pget_layout(dcpl) == H5D_CHUNKED;
+    hsize_t chunk[2] = {0, 0};
+    readable = readable && H5Pget_chunk(dcpl, 2, chunk) == 2 && chunk[1] == block.items.size();
+
+    filters.clear();
+    int nfilters = readable ? H5Pget_nfilters(dcpl) : 0;
+    for (int k = 0; k < nfilters; k++)
+    {
+        unsigned flags, values[8];
+        size_t nvalues = 8;
+        H5Z_filter_t filter = H5Pget_filter2(dcpl, k, &flags, &nvalues, values, 0, NULL, NULL);
+        readable = readable && (filter == H5Z_FILTER_DEFLATE || filter == H5Z_FILTER_SHUFFLE);
+        filters.push_back(filter);
+    }
+    // unfiltered chunks are read faster by H5Dread itself
+    readable = readable && nfilters > 0;
+    H5Pclose(dcpl);
+
+    if (readable)
+    {
+        hid_t type = H5Dget_type(dataset);
+        readable = H5Tequal(type, block.type) > 0;
+        H5Tclose(type);
+    }
+    chunk_rows = chunk[0];
+    return readable;
+}
+
+//===========================================================
+// Workers
+//===========================================================
+
+class Worker
+{
+public:
+    Worker(const vector<BlockSchema> &blocks, const vector<Input> &inputs, const string &key,
+           PandasFrameWriter &writer, int level)
+        : fBlocks(blocks), fInputs(inputs), fKey(key), fWriter(writer), fLevel(level), fRaw(blocks.size())
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+            fStarts.push_back(inputs[i].first);
+        for (size_t b = 0; b < blocks.size(); b++)
+            fRaw[b].resize(writer.ChunkRows() * blocks[b].row_bytes);
+    }
+
+    void Run(hsize_t c)
+    {
+        hsize_t rows = fWriter.ChunkRows();
+        hsize_t g0 = c * rows, g1 = min(g0 + rows, fWriter.NRows());
+
+        // the tail of the last chunk is padding
+        if (g1 - g0 < rows)
+            for (size_t b = 0; b < fBlocks.size(); b++)
+                fill(fRaw[b].begin(), fRaw[b].end(), 0);
+
+        size_t f = upper_bound(fStarts.begin(), fStarts.end(), g0) - fStarts.begin() - 1;
+        for (; f < fInputs.size() && fInputs[f].first < g1; f++)
+        {
+            const Input &input = fInputs[f];
+            if (input.rows == 0)
+                continue;
+            hsize_t first = max(g0, input.first), last = min(g1, input.first + input.rows);
+            ReadInput(input, first - input.first, last - first, first - g0);
+        }
+
+        vector<long long> index(rows);
+        for (hsize_t i = 0; i < rows; i++)
+            index[i] = g0 + i;
+        Store(-1, c, (const char *)index.data(), rows * sizeof(long long), sizeof(long long));
+        for (size_t b = 0; b < fBlocks.size(); b++)
+            Store(b, c, fRaw[b].data(), fRaw[b].size(), fBlocks[b].type_size);
+    }
+
+private:
+    // Copy rows [first, first + n) of the input to row `at` of the chunk buffers
+    void ReadInput(const Input &input, hsize_t first, hsize_t n, hsize_t at)
+    {
+        vector<RawChunk> chunks;
+        {
+            // includes the wait for the lock
+            TRACE_SCOPE("ReadRaw");
+            lock_guard<mutex> lock(hdf5_mutex);
+            hid_t file = H5Fopen(input.path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+            if (file < 0)
+                fail("could not open " + input.path);
+
+            for (size_t b = 0; b < fBlocks.size(); b++)
+            {
+                const BlockSchema &block = fBlocks[b];
+                string name = fKey + "/block" + to_string(block.input_block) + "_values";
+                hid_t dataset = H5Dopen2(file, name.c_str(), H5P_DEFAULT);
+                if (dataset < 0)
+                    fail(input.path + ": missing " + name);
+
+                hsize_t chunk_rows;
+                vector<H5Z_filter_t> filters;
+                if (raw_readable(dataset, block, chunk_rows, filters))
+                {
+                    for (hsize_t k = first / chunk_rows; k * chunk_rows < first + n; k++)
+                    {
+                        RawChunk chunk = {b, k * chunk_rows, chunk_rows, filters, 0, vector<char>()};
+                        hsize_t offset[2] = {k * chunk_rows, 0};
+                        hsize_t size = 0;
+                        H5Dget_chunk_storage_size(dataset, offset, &size);
+                        chunk.data.resize(size);
+                        if (size > 0 && H5Dread_chunk(dataset, H5P_DEFAULT, offset, &chunk.filter_mask, chunk.data.data()) < 0)
+                            fail(input.path + ": could not read a chunk of " + name);
+                        chunks.push_back(chunk);
+                    }
+                }
+                else
+                {
+                    hsize_t start[2] = {first, 0}, count[2] = {n, block.items.size()};
+                    hid_t file_space = H5Dget_space(dataset);
+                    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+                    hid_t mem_space = H5Screate_simple(2, count, NULL);
+                    herr_t status = H5Dread(dataset, block.type, mem_space, file_space, H5P_DEFAULT, &fRaw[b][at * block.row_bytes]);
+                    H5Sclose(mem_space);
+                    H5Sclose(file_space);
+                    if (status < 0)
+                        fail(input.path + ": could not read " + name);
+                }
+                H5Dclose(dataset);
+            }
+            H5Fclose(file);
+        }
+
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            TRACE_SCOPE("Decode");
+            const RawChunk &chunk = chunks[i];
+            const BlockSchema &block = fBlocks[chunk.block];
+            size_t nbytes = chunk.rows * block.row_bytes;
+            // chunks that were never written hold zeros
+            if (chunk.data.empty())
+                fDecoded.assign(nbytes, 0);
+            else
+                decode_chunk(chunk, block.type_size, nbytes, fDecoded, fScratch);
+
+            hsize_t lo = max(first, chunk.first_row), hi = min(first + n, chunk.first_row + chunk.rows);
+            memcpy(&fRaw[chunk.block][(at + lo - first) * block.row_bytes], &fDecoded[(lo - chunk.first_row) * block.row_bytes],
+                   (hi - lo) * block.row_bytes);
+        }
+    }
+
+    // Compress one chunk and write it
+    void Store(int b, hsize_t c, const char *data, size_t nbytes, size_t type_size)
+    {
+        uLongf size = compressBound(nbytes);
+        {
+            TRACE_SCOPE("Compress");
+            fScratch.resize(nbytes);
+            shuffle_bytes(data, fScratch.data(), nbytes, type_size);
+            fCompressed.resize(size);
+            if (compress2((Bytef *)fCompressed.data(), &size, (const Bytef *)fScratch.data(), nbytes, fLevel) != Z_OK)
+                fail("could not compress an output chunk");
+        }
+
+        TRACE_SCOPE("WriteChunk");
+        lock_guard<mutex> lock(hdf5_mutex);
+        fWriter.WriteChunk(b, c, fCompressed.data(), size);
+    }
+
+    const vector<BlockSchema> &fBlocks;
+    const vector<Input> &fInputs;
+    string fKey;
+    PandasFrameWriter &fWriter;
+    int fLevel;
+    vector<hsize_t> fStarts;
+    vector<vector<char>> fRaw;
+    vector<char> fDecoded, fScratch, fCompressed;
+};
+
+//===========================================================
+// Main
+//===========================================================
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <output hdf5> [<input hdf5> ...] [--list <txt file>] [--dir <input folder>]"
+         << " [--key <hdf5 group>] [--threads N] [--chunk-rows 65536] [--level 4] [--trace out.json]"
+         << " [--metrics <file> [--metrics-interval 10]]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"list", "dir", "key", "threads", "chunk-rows", "level", "trace", "metrics", "metrics-interval"});
+    const vector<string> &args = options.Positional();
+    if (args.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string output_file = args[0];
+    string dir = options.Get("dir");
+    if (!dir.empty() && dir[dir.size() - 1] != '/')
+        dir += "/";
+    string hdf5_key = options.Get("key");
+    unsigned nthreads = atoi(options.Get("threads", to_string(max(thread::hardware_concurrency(), 1u))).c_str());
+    hsize_t chunk_rows = atol(options.Get("chunk-rows", "65536").c_str());
+    int level = atoi(options.Get("level", "4").c_str());
+    if (nthreads < 1 || chunk_rows < 1 || level < 0 || level > 9)
+        fail("--threads and --chunk-rows must be positive, --level between 0 and 9");
+
+    // as in merge_nnfit.py, a list holds one file name per line
+    vector<string> names(args.begin() + 1, args.end());
+    if (options.Has("list"))
+    {
+        ifstream list(options.Get("list").c_str());
+        if (!list)
+            fail("list " + options.Get("list") + " not found");
+        string line;
+        while (getline(list, line))
+        {
+            line.erase(0, line.find_first_not_of(" \t\r"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.size() > 5 && line.compare(line.size() - 5, 5, ".hdf5") == 0)
+                names.push_back(line);
+        }
+    }
+    if (names.empty())
+        fail("no input files");
+
+    // --trace out.json: time the phases of the workers (Trace.h, make TRACE=1)
+    TRACE_START(options.Get("trace"));
+    // --metrics <file>: progress in rows, rate and ETA for monitoring (ProgressMetrics.h)
+    ProgressMetrics progress("ConcatNNFit", output_file, options);
+    auto start = chrono::steady_clock::now();
+
+    //===========================================================
+    // Sizes and columns of the inputs
+    //===========================================================
+    vector<Input> inputs;
+    vector<BlockSchema> blocks;
+    vector<PandasColumn> columns;
+    string key;
+    hsize_t total = 0;
+
+    for (size_t f = 0; f < names.size(); f++)
+    {
+        TRACE_SCOPE("ScanInput");
+        string path = names[f][0] == '/' ? names[f] : dir + names[f];
+        PandasFrameReader reader(path, hdf5_key, f == 0);
+        if (f == 0)
+        {
+            key = reader.Key();
+            columns = reader.Columns();
+            for (size_t c = 0; c < columns.size(); c++)
+            {
+                if (blocks.empty() || blocks.back().input_block != columns[c].block)
+                {
+                    BlockSchema block = {columns[c].block, vector<string>(), -1, 0, columns[c].type_size};
+                    blocks.push_back(block);
+                }
+                blocks.back().items.push_back(columns[c].name);
+            }
+        }
+        else
+        {
+            const vector<PandasColumn> &other = reader.Columns();
+            bool same = other.size() == columns.size();
+            for (size_t c = 0; same && c < columns.size(); c++)
+                same = other[c].name == columns[c].name && other[c].block == columns[c].block &&
+                       other[c].item == columns[c].item && other[c].type_class == columns[c].type_class &&
+                       other[c].type_size == columns[c].type_size;
+            if (!same)
+                fail(path + " does not have the columns of " + inputs[0].path);
+        }
+        Input input = {path, reader.NRows(), total};
+        inputs.push_back(input);
+        total += reader.NRows();
+    }
+
+    // the stored types of the first input are kept
+    {
+        hid_t file = H5Fopen(inputs[0].path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+            string name = key + "/block" + to_string(blocks[b].input_block) + "_values";
+            hid_t dataset = H5Dopen2(file, name.c_str(), H5P_DEFAULT);
+            hid_t type = H5Dget_type(dataset);
+            blocks[b].type = H5Tget_native_type(type, H5T_DIR_ASCEND);
+            blocks[b].row_bytes = blocks[b].items.size() * blocks[b].type_size;
+            H5Tclose(type);
+            H5Dclose(dataset);
+        }
+        H5Fclose(file);
+    }
+
+    cout << "Inputs: " << inputs.size() << " files, " << total << " rows, " << columns.size() << " columns in "
+         << blocks.size() << " blocks" << endl;
+
+    //===========================================================
+    // Output, one task per chunk
+    //===========================================================
+    PandasFrameWriter writer(output_file, key, total, chunk_rows, level);
+    for (size_t b = 0; b < blocks.size(); b++)
+        writer.AddBlock(blocks[b].items, blocks[b].type);
+
+    hsize_t nchunks = writer.NChunks();
+    nthreads = (unsigned)min<hsize_t>(nthreads, max<hsize_t>(nchunks, 1));
+    size_t chunk_bytes = 0;
+    for (size_t b = 0; b < blocks.size(); b++)
+        chunk_bytes += chunk_rows * blocks[b].row_bytes;
+    cout << "Writing " << nchunks << " chunks of " << chunk_rows << " rows with " << nthreads << " threads (about "
+         << 3 * nthreads * chunk_bytes / (1 << 20) << " MB of buffers)" << endl;
+
+    atomic<hsize_t> next_chunk(0);
+    progress.Begin("concat", total);
+    auto work = [&]() {
+        Worker worker(blocks, inputs, key, writer, level);
+        hsize_t c;
+        while ((c = next_chunk++) < nchunks)
+        {
+            {
+                TRACE_SCOPE("Chunk");
+                worker.Run(c);
+            }
+            progress.Add(min(chunk_rows, total - c * chunk_rows));
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned t = 0; t < nthreads; t++)
+        threads.push_back(thread(work));
+    for (unsigned t = 0; t < nthreads; t++)
+        threads[t].join();
+
+    {
+        TRACE_SCOPE("Close");
+        writer.Close();
+    }
+    progress.Finish();
+    TRACE_STOP();
+    for (size_t b = 0; b < blocks.size(); b++)
+        H5Tclose(blocks[b].type);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "\n========================================" << endl;
+    cout << "Files:    " << inputs.size() << endl;
+    cout << "Rows:     " << total << endl;
+    cout << "Columns:  " << columns.size() << endl;
+    cout << "Output:   " << output_file << endl;
+    cout << "Time:     " << seconds << " s" << endl;
+    cout << "========================================" << endl;
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/**
+ * @brief Add the NNFit reconstruction columns to the sel tree of a ROOT file.
+ * Streaming replacement of scripts/add_new_branches.py, which loads both sides
+ * into pandas. The NNFit rows are left joined on the tree entries by event
+ * key (run_id, frame_index, event_counter_trigger) with a bounded amount of
+ * memory, see NNFitJoin.h: every entry of the tree is kept and entries
+ * without an NNFit reconstruction get NaN.
+ *
+ * The NNFit files are DataFrames in HDF5 "fixed" format (as written by
+ * scripts/merge_nnfit.py). float32 columns become Float_t branches, all other
+ * numeric columns Double_t, like the merged DataFrame with missing rows.
+ *
+ * With --entries or --shard only those entries are written. The join still
+ * runs over the keys of the whole tree (they are small), so the counts of the
+ * summary are those of the whole tree.
+ *
+ * Usage: MergeNNFit <input rootfile> <output rootfile> <nnfit hdf5> [<nnfit hdf5> ...]
+ *        [--key <hdf5 group>] [--tree sel] [--mem-mb 1024] [--tmpdir <dir>] [--trace out.json]
+ *        [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]
+ *        [--entries first:last | --shard k/N] [--cache] [--read-cache <MB|off>] [--prefetch]
+ *        [--async-write [--write-queue <MB>]]
+ */
+
+#include <TFile.h>
+#include <TStopwatch.h>
+#include <TTree.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AsyncTreeWriter.h"
+#include "NNFitJoin.h"
+#include "SelMetadata.h"
+#include "StageContext.h"
+#include "Trace.h"
+
+using namespace std;
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <input rootfile> <output rootfile> <nnfit hdf5> [<nnfit hdf5> ...]"
+         << " [--key <hdf5 group>] [--tree sel] [--mem-mb 1024] [--tmpdir <dir>] [--trace out.json]"
+         << " [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]"
+         << " [--entries first:last | --shard k/N] [--cache] [--read-cache <MB|off>] [--prefetch]"
+         << " [--async-write [--write-queue <MB>]]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options = ParseStageOptions(argc, argv, {"key", "tree", "mem-mb", "tmpdir"});
+    const vector<string> &args = options.Positional();
+    if (args.size() < 3)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string input_file = args[0];
+    string output_file = args[1];
+    vector<string> nnfit_files(args.begin() + 2, args.end());
+    string hdf5_key = options.Get("key");
+    string tree_name = options.Get("tree", "sel");
+    string tmpdir = options.Get("tmpdir");
+
+    // --cache, --trace, --metrics, --mem-budget, --codec-plan, --entries, --shard, --read-cache (StageContext.h)
+    StageContext stage("MergeNNFit", output_file, options);
+    stage.cache.Input(input_file);
+    for (const string &nnfit_file : nnfit_files)
+        stage.cache.Input(nnfit_file);
+    stage.cache.Output(output_file);
+    if (!stage.Start())
+        return 0;
+
+    // shared by the three sorters; half of what --mem-budget leaves if --mem-mb is not given
+    size_t budget = (size_t)atol(options.Get("mem-mb", "1024").c_str()) << 20;
+    if (stage.memory.Enabled() && !options.Has("mem-mb"))
+        budget = max(stage.memory.TreeBytes() / 2, 64LL << 20);
+    stage.memory.Reserve("NNFit sort buffers", budget);
+
+    TStopwatch timer;
+
+    TFile *infile = TFile::Open(input_file.c_str(), "READ");
+    if (!infile || infile->IsZombie())
+    {
+        cerr << "Error: file " << input_file << " not found" << endl;
+        return 1;
+    }
+    TTree *tree = dynamic_cast<TTree *>(infile->Get(tree_name.c_str()));
+    if (!tree)
+    {
+        cerr << "Error: tree " << tree_name << " not found" << endl;
+        return 1;
+    }
+    Long64_t nentries = tree->GetEntries();
+    stage.range.Resolve(tree);
+
+    //===========================================================
+    // NNFit reconstructions, sorted by key
+    //===========================================================
+    NNFitJoin join(nnfit_files, hdf5_key, budget, tmpdir);
+    const vector<string> &columns = join.Columns();
+    size_t ncols = join.NColumns();
+    for (size_t c = 0; c < ncols; c++)
+    {
+        if (tree->GetBranch(columns[c].c_str()))
+        {
+            cerr << "Error: branch " << columns[c] << " already exists in " << input_file << endl;
+            return 1;
+        }
+    }
+
+    //===========================================================
+    // Sort-merge join
+    //===========================================================
+    tree->SetBranchStatus("*", 0);
+    join.Start(infile, tree);
+
+    //===========================================================
+    // Output tree
+    //===========================================================
+    tree->SetBranchStatus("*", 1);
+    TFile *outfile = new TFile(output_file.c_str(), "RECREATE");
+    TTree *newtree = tree->CloneTree(0);
+
+    vector<double> dvalues(ncols);
+    vector<float> fvalues(ncols);
+    for (size_t c = 0; c < ncols; c++)
+    {
+        if (join.IsFloat()[c])
+            newtree->Branch(columns[c].c_str(), &fvalues[c], (columns[c] + "/F").c_str());
+        else
+            newtree->Branch(columns[c].c_str(), &dvalues[c], (columns[c] + "/D").c_str());
+    }
+    // --async-write: the entries are filled and compressed on a writer thread (AsyncTreeWriter.h)
+    AsyncTreeWriter writer(newtree, options, stage.memory);
+    stage.memory.ConfigureInput(tree, 0.25);
+    stage.input.Configure(tree);
+    stage.memory.ConfigureOutput(newtree, 0.75);
+    stage.codecs.Apply(newtree);
+
+    Long64_t entry;
+    const double *values;
+    stage.Progress().Begin("join", stage.range.Entries());
+    while (join.Next(entry, values))
+    {
+        // the entries come in order; outside the range only the key is read
+        if (entry < stage.range.First() || entry >= stage.range.Last())
+            continue;
+        {
+            TRACE_SCOPE("ReadEvent");
+            tree->GetEntry(entry);
+        }
+        for (size_t c = 0; c < ncols; c++)
+        {
+            dvalues[c] = values[c];
+            fvalues[c] = (float)values[c];
+        }
+        {
+            TRACE_SCOPE("Fill");
+            writer.Fill();
+        }
+        stage.Progress().Add();
+    }
+    if (join.Duplicates() > 0)
+        cerr << "Warning: " << join.Duplicates() << " NNFit rows repeat the key of an earlier row, only the first one is joined"
+             << endl;
+    writer.Finish();
+
+    outfile->cd();
+    {
+        TRACE_SCOPE("Write");
+        newtree->Write();
+    }
+    stage.input.Report(tree);
+    outfile->Close();
+    infile->Close();
+    // the input file is kept, the event index of the join points to one of its trees
+    delete outfile;
+    AnnotateSelFile(output_file, tree_name);
+    stage.Finish();
+
+    timer.Stop();
+    cout << "\n========================================" << endl;
+    cout << "Entries:                 " << nentries << endl;
+    if (stage.range.Enabled())
+        cout << "Written:                 " << stage.range.Entries() << " [" << stage.range.First() << ", " << stage.range.Last() << ")" << endl;
+    cout << "With NNFit:              " << join.Matched() << endl;
+    cout << "Without NNFit (NaN):     " << nentries - join.Matched() << endl;
+    cout << "Duplicate NNFit rows:    " << join.Duplicates() << (join.Duplicates() > 0 ? " (not joined)" : "") << endl;
+    cout << "NNFit rows not in tree:  " << join.Unused() << endl;
+    cout << "Time:                    " << timer.RealTime() << " s" << endl;
+    cout << "========================================" << endl;
+
+    return 0;
+}
@@ -3,6 +3,16 @@
 
 #include <string>
 
-void addBranches(std::string old_root_file, std::string new_root_file);
+class CodecPlan;
+class EntryRange;
+class InputCache;
+class MemoryBudget;
+class ProgressMetrics;
+
+void addBranches(std::string old_root_file, std::string new_root_file, ProgressMetrics &progress, MemoryBudget &memory, const CodecPlan &codecs,
+                 const InputCache &input, EntryRange &range);
+void addSwimFriend(std::string old_root_file, std::string new_root_file, ProgressMetrics &progress, MemoryBudget &memory, const CodecPlan &codecs,
+                   const InputCache &input, EntryRange &range);
+void addBranchesRDF(std::string old_root_file, std::string new_root_file, ProgressMetrics &progress);
 
 #endif // ADDBRANCHES_H
@@ -2,22 +2,56 @@
 #include <iostream>
 #include "addBranches.h"
 #include "addCanANTARES.h"
+#include "StageContext.h"
+#include "StageRDF.h"
+#include "Trace.h"
 
 using namespace std;
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    StageOptions options = ParseStageOptions(argc, argv, {"threads"});
+    const vector<string> &args = options.Positional();
+
+    if (args.size() != 2)
     {
-        cout << "Usage: " << argv[0] << " <rootfile>" << endl;
+        cout << "Usage: " << argv[0] << " <input rootfile> <output rootfile> [--friend | --rdf [--threads N]] [--trace out.json]"
+             << " [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]"
+             << " [--entries first:last | --shard k/N] [--cache] [--read-cache <MB|off>] [--prefetch]" << endl;
         return 1;
     }
 
-    string input_file = argv[1];
-    string output_file = argv[2];
+    string input_file = args[0];
+    string output_file = args[1];
+
+    // --cache, --trace, --metrics, --mem-budget, --codec-plan, --entries, --shard, --read-cache (StageContext.h)
+    StageContext stage("add_SWIM_Branches", output_file, options);
+    stage.cache.Input(input_file);
+    stage.cache.Output(output_file);
+    if (!stage.Start())
+        return 0;
+    if (stage.range.Enabled() && options.Has("rdf"))
+    {
+        cerr << "Error: --entries and --shard are not supported with --rdf" << endl;
+        return 1;
+    }
 
-    addBranches(input_file, output_file);
-    addCanANTARES(output_file);
+    // --friend: write only the derived columns as the friend tree "sel_swim"
+    if (options.Has("friend"))
+        addSwimFriend(input_file, output_file, stage.Progress(), stage.memory, stage.codecs, stage.input, stage.range);
+    // --rdf: RDataFrame implementation with implicit multi-threading (StageRDF.h)
+    else if (options.Has("rdf"))
+    {
+        EnableStageMT(options);
+        addBranchesRDF(input_file, output_file, stage.Progress());
+    }
+    else
+        addBranches(input_file, output_file, stage.Progress(), stage.memory, stage.codecs, stage.input, stage.range);
+    {
+        TRACE_SCOPE("AddCan");
+        addCanANTARES(output_file);
+    }
+    stage.Finish();
 
     return 0;
 }
@@ -3,13 +3,72 @@
 #include <TTree.h>
 #include <TBranch.h>
 #include <TObject.h>
+#include <TNamed.h>
+#include <TParameter.h>
 #include <cmath>
 #include <string>
 #include "addBranches.h"
+#include "AppendColumns.h"
+#include "CodecPlan.h"
+#include "ColumnReader.h"
+#include "EntryRange.h"
+#include "InputCache.h"
+#include "MathKernels.h"
+#include "MemoryBudget.h"
+#include "ProgressMetrics.h"
+#include "SelMetadata.h"
+#include "Trace.h"
 
 using namespace std;
 
-void addBranches(string old_root_file, string new_root_file)
+// Number of entries transformed per batch
+const Long64_t kBlockSize = 4096;
+
+// NNFit inputs of the derived columns. The branches are bound to the columns,
+// so a clone of the tree made afterwards copies the same values.
+struct SwimInputs
+{
+    Column<float> shower_theta, track_theta, shower_logE, track_logE;
+
+    SwimInputs(TTree *tree)
+        : shower_theta(tree, "NNFitShower_Theta"), track_theta(tree, "NNFitTrack_Theta"),
+          shower_logE(tree, "NNFitShower_Log10Energy"), track_logE(tree, "NNFitTrack_Log10Energy") {}
+};
+
+// Derived columns of one block of entries
+struct SwimBlock
+{
+    AlignedVector<double> shower_energy, track_energy, shower_cos_zenith, track_cos_zenith;
+};
+
+// Read the entries [first, first + n) of the inputs and compute the derived columns in batch
+static void ComputeSwimBlock(SwimInputs &in, Long64_t first, Long64_t n, SwimBlock &out)
+{
+    in.shower_theta.Read(first, n);
+    in.track_theta.Read(first, n);
+    in.shower_logE.Read(first, n);
+    in.track_logE.Read(first, n);
+
+    out.shower_energy.resize(n);
+    out.track_energy.resize(n);
+    out.shower_cos_zenith.resize(n);
+    out.track_cos_zenith.resize(n);
+
+    Pow10(in.shower_logE.Data(), out.shower_energy.data(), n);
+    Pow10(in.track_logE.Data(), out.track_energy.data(), n);
+    CosDeg(in.shower_theta.Data(), out.shower_cos_zenith.data(), n);
+    CosDeg(in.track_theta.Data(), out.track_cos_zenith.data(), n);
+
+    // theta is the direction of origin, the zenith of the track is its opposite
+    for (Long64_t j = 0; j < n; j++)
+    {
+        out.shower_cos_zenith[j] = -out.shower_cos_zenith[j];
+        out.track_cos_zenith[j] = -out.track_cos_zenith[j];
+    }
+}
+
+void addBranches(string old_root_file, string new_root_file, ProgressMetrics &progress, MemoryBudget &memory, const CodecPlan &codecs,
+                 const InputCache &input, EntryRange &range)
 {
     cout << "Starting the program" << endl;
 
@@ -35,64 +94,196 @@ void addBranches(string old_root_file, string new_root_file)
     }
 
     // Define variables
-    Float_t nnfit_shower_theta, nnfit_track_theta, nnfit_shower_logE, nnfit_track_logE;
     Double_t energy_true, cos_zenith_true, energy_recoTrue, cos_zenith_recoTrue, bjorken_y_recoTrue;
     Double_t nnfit_shower_cos_zenith, nnfit_track_cos_zenith, nnfit_shower_energy, nnfit_track_energy, nnfit_bjorken_y;
 
     // Create a new branch
     cout << "Creating new branch" << endl;
 
-    // Create the new branches
-    oldtree->SetBranchAddress("NNFitShower_Theta", &nnfit_shower_theta);
-    oldtree->SetBranchAddress("NNFitTrack_Theta", &nnfit_track_theta);
-    oldtree->SetBranchAddress("NNFitShower_Log10Energy", &nnfit_shower_logE);
-    oldtree->SetBranchAddress("NNFitTrack_Log10Energy", &nnfit_track_logE);
-    oldtree->SetBranchAddress("energy_true", &energy_true);
-    oldtree->SetBranchAddress("cos_zenith_true", &cos_zenith_true);
-
+    // The existing branches are copied basket by basket, only the new ones are filled
+    range.Resolve(oldtree);
     TFile *newfile = new TFile(new_root_file.c_str(), "RECREATE");
-    TTree *newtree = oldtree->CloneTree(0);
+    AppendColumnsWriter newtree(oldtree, {}, range.First(), range.Last());
 
-    newtree->Branch("NNFitShower_Energy", &nnfit_shower_energy, "NNFitShower_Energy/D");
-    newtree->Branch("NNFitTrack_Energy", &nnfit_track_energy, "NNFitTrack_Energy/D");
-    newtree->Branch("NNFitShower_cos_zenith", &nnfit_shower_cos_zenith, "NNFitShower_CosZenith/D");
-    newtree->Branch("NNFitTrack_cos_zenith", &nnfit_track_cos_zenith, "NNFitTrack_CosZenith/D");
-    newtree->Branch("NNFit_Bjorken_y", &nnfit_bjorken_y, "NNFit_Bjorken_y/D");
-    newtree->Branch("energy_recoTrue", &energy_recoTrue, "energy_recoTrue/D");
-    newtree->Branch("cos_zenith_recoTrue", &cos_zenith_recoTrue, "cos_zenith_recoTrue/D");
-    newtree->Branch("bjorken_y_recoTrue", &bjorken_y_recoTrue, "bjorken_y_recoTrue/D");
+    // Only the inputs of the new branches are read
+    oldtree->SetBranchStatus("*", 0);
+    SwimInputs inputs(oldtree);
+    oldtree->SetBranchStatus("energy_true", 1);
+    oldtree->SetBranchStatus("cos_zenith_true", 1);
+    oldtree->SetBranchAddress("energy_true", &energy_true);
+    oldtree->SetBranchAddress("cos_zenith_true", &cos_zenith_true);
 
-    double pi = 3.14159265359;
+    newtree.AddColumn("NNFitShower_Energy", &nnfit_shower_energy, "NNFitShower_Energy/D");
+    newtree.AddColumn("NNFitTrack_Energy", &nnfit_track_energy, "NNFitTrack_Energy/D");
+    newtree.AddColumn("NNFitShower_cos_zenith", &nnfit_shower_cos_zenith, "NNFitShower_CosZenith/D");
+    newtree.AddColumn("NNFitTrack_cos_zenith", &nnfit_track_cos_zenith, "NNFitTrack_CosZenith/D");
+    newtree.AddColumn("NNFit_Bjorken_y", &nnfit_bjorken_y, "NNFit_Bjorken_y/D");
+    newtree.AddColumn("energy_recoTrue", &energy_recoTrue, "energy_recoTrue/D");
+    newtree.AddColumn("cos_zenith_recoTrue", &cos_zenith_recoTrue, "cos_zenith_recoTrue/D");
+    newtree.AddColumn("bjorken_y_recoTrue", &bjorken_y_recoTrue, "bjorken_y_recoTrue/D");
+    memory.ConfigureInput(oldtree, 0.25);
+    input.Configure(oldtree);
+    memory.ConfigureOutput(newtree.Tree(), 0.75);
+    codecs.Apply(newtree.Tree());
 
     cout << "Setting new branches" << "\nStarting loop over the entries of the tree" << endl;
 
-    Int_t numEntries = oldtree->GetEntries();
-    // Set the new branches
-    for (int i = 0; i < numEntries; i++)
+    progress.Begin("swim", range.Entries());
+    SwimBlock block;
+    // Set the new branches, one block of entries at a time
+    for (Long64_t first = range.First(); first < range.Last(); first += kBlockSize)
     {
-        oldtree->GetEntry(i);
-
-        // Set the new branches
-        energy_recoTrue = energy_true;
-        cos_zenith_recoTrue = cos_zenith_true;
-        bjorken_y_recoTrue = 0.5;
-        nnfit_bjorken_y = 0.5;
-        nnfit_shower_energy = pow(10, nnfit_shower_logE);
-        nnfit_track_energy = pow(10, nnfit_track_logE);
-        nnfit_shower_cos_zenith = - cos(nnfit_shower_theta * pi / 180);
-        nnfit_track_cos_zenith = - cos(nnfit_track_theta * pi / 180);
-        
-        newtree->Fill();
-        
-        // Print the progress
-        if(i % (numEntries/100) == 0){
-            cout << "Progress: " << i << " / " << numEntries  << endl;
+        Long64_t n = min(kBlockSize, range.Last() - first);
+        {
+            TRACE_SCOPE("SwimBlock");
+            ComputeSwimBlock(inputs, first, n, block);
+        }
+
+        for (Long64_t j = 0; j < n; j++)
+        {
+            Long64_t i = first + j;
+            {
+                TRACE_SCOPE("ReadEvent");
+                oldtree->GetEntry(i);
+            }
+
+            // Set the new branches
+            energy_recoTrue = energy_true;
+            cos_zenith_recoTrue = cos_zenith_true;
+            bjorken_y_recoTrue = 0.5;
+            nnfit_bjorken_y = 0.5;
+            nnfit_shower_energy = block.shower_energy[j];
+            nnfit_track_energy = block.track_energy[j];
+            nnfit_shower_cos_zenith = block.shower_cos_zenith[j];
+            nnfit_track_cos_zenith = block.track_cos_zenith[j];
+
+            {
+                TRACE_SCOPE("Fill");
+                newtree.Fill();
+            }
         }
+        progress.Add(n);
     }
 
     // Write the new branches
     cout << "Writing new branches" << endl;
     newfile->cd();
-    newfile->Write();
+    {
+        TRACE_SCOPE("Write");
+        newtree.Write();
+    }
+    input.Report(oldtree);
+    newfile->Close();
+    oldfile->Close();
+    delete newfile;
+    delete oldfile;
+
+    AnnotateSelFile(new_root_file);
+}
+
+/**
+ * @brief Write only the derived SWIM columns, as a friend tree of the input sel tree.
+ * The friend tree "sel_swim" is entry-aligned with the parent and holds the four
+ * columns that are actually computed. The copies of the true variables become
+ * aliases of the parent branches and the constant Bjorken y values are stored
+ * once as TParameter objects (and as aliases, so formulas keep working).
+ * With --entries or --shard, the friend holds only those entries of the parent;
+ * merged in order, the shards are the friend of the whole parent.
+ * Usage: sel->AddFriend("sel_swim", "<output file>");
+ */
+void addSwimFriend(string old_root_file, string new_root_file, ProgressMetrics &progress, MemoryBudget &memory, const CodecPlan &codecs,
+                   const InputCache &input, EntryRange &range)
+{
+    cout << "Starting the program (friend tree mode)" << endl;
+
+    // Open the ROOT file
+    cout << "Opening file: " << old_root_file << endl;
+
+    TFile *oldfile = new TFile(old_root_file.c_str(), "READ");
+
+    if (oldfile->IsZombie())
+    {
+        cout << "Error opening file" << endl;
+        return;
+    }
+
+    TTree *oldtree = (TTree *)oldfile->Get("sel");
+
+    if (oldtree == NULL)
+    {
+        cout << "Error opening tree" << endl;
+        return;
+    }
+
+    // Only the NNFit inputs of the derived columns are read
+    Double_t nnfit_shower_cos_zenith, nnfit_track_cos_zenith, nnfit_shower_energy, nnfit_track_energy;
+
+    oldtree->SetBranchStatus("*", 0);
+    SwimInputs inputs(oldtree);
+    range.Resolve(oldtree);
+
+    TFile *newfile = new TFile(new_root_file.c_str(), "RECREATE");
+    TTree *friendtree = new TTree("sel_swim", "Derived SWIM columns, friend of sel");
+
+    friendtree->Branch("NNFitShower_Energy", &nnfit_shower_energy, "NNFitShower_Energy/D");
+    friendtree->Branch("NNFitTrack_Energy", &nnfit_track_energy, "NNFitTrack_Energy/D");
+    friendtree->Branch("NNFitShower_cos_zenith", &nnfit_shower_cos_zenith, "NNFitShower_CosZenith/D");
+    friendtree->Branch("NNFitTrack_cos_zenith", &nnfit_track_cos_zenith, "NNFitTrack_CosZenith/D");
+
+    // Plain copies and constants
+    friendtree->SetAlias("energy_recoTrue", "energy_true");
+    friendtree->SetAlias("cos_zenith_recoTrue", "cos_zenith_true");
+    friendtree->SetAlias("bjorken_y_recoTrue", "0.5");
+    friendtree->SetAlias("NNFit_Bjorken_y", "0.5");
+    memory.ConfigureInput(oldtree, 0.25);
+    input.Configure(oldtree);
+    memory.ConfigureOutput(friendtree, 0.75);
+    codecs.Apply(friendtree);
+
+    Long64_t numEntries = oldtree->GetEntries();
+    cout << "Filling the friend tree for " << range.Entries() << " entries" << endl;
+    progress.Begin("swim", range.Entries());
+    SwimBlock block;
+    for (Long64_t first = range.First(); first < range.Last(); first += kBlockSize)
+    {
+        Long64_t n = min(kBlockSize, range.Last() - first);
+        {
+            TRACE_SCOPE("SwimBlock");
+            ComputeSwimBlock(inputs, first, n, block);
+        }
+
+        for (Long64_t j = 0; j < n; j++)
+        {
+            nnfit_shower_energy = block.shower_energy[j];
+            nnfit_track_energy = block.track_energy[j];
+            nnfit_shower_cos_zenith = block.shower_cos_zenith[j];
+            nnfit_track_cos_zenith = block.track_cos_zenith[j];
+
+            TRACE_SCOPE("Fill");
+            friendtree->Fill();
+        }
+        progress.Add(n);
+    }
+
+    newfile->cd();
+    {
+        TRACE_SCOPE("Write");
+        friendtree->Write();
+    }
+
+    TParameter<double>("NNFit_Bjorken_y", 0.5).Write();
+    TParameter<double>("bjorken_y_recoTrue", 0.5).Write();
+
+    // Record the parent, the friend is only valid for the same entries
+    TNamed("sel_swim_parent", old_root_file.c_str()).Write();
+    TParameter<Long64_t>("sel_swim_parent_entries", numEntries).Write();
+    // a shard holds the entries from this one on, the merged shards are the whole friend
+    if (range.Enabled())
+        TParameter<Long64_t>("sel_swim_parent_first", range.First()).Write();
+
+    input.Report(oldtree);
     newfile->Close();
+    oldfile->Close();
+    delete newfile;
+    delete oldfile;
 }
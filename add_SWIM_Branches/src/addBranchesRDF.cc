@@ -0,0 +1,51 @@
+#include <iostream>
+#include <string>
+#include "addBranches.h"
+#include "MathKernels.h"
+#include "SelMetadata.h"
+#include "StageRDF.h"
+
+using namespace std;
+
+// NNFit energy from its log10, with the kernel of the event loop path
+static double NNFitEnergy(float log10_energy)
+{
+    double energy;
+    Pow10(&log10_energy, &energy, 1);
+    return energy;
+}
+
+// theta is the direction of origin, the zenith of the track is its opposite
+static double NNFitCosZenith(float theta)
+{
+    double cos_theta;
+    CosDeg(&theta, &cos_theta, 1);
+    return -cos_theta;
+}
+
+/**
+ * @brief RDataFrame version of addBranches: the SWIM columns are Define nodes written with Snapshot.
+ * Same columns and values as addBranches; the multi-threading is set by the caller (EnableStageMT).
+ */
+void addBranchesRDF(string old_root_file, string new_root_file, ProgressMetrics &progress)
+{
+    cout << "Starting the program (RDataFrame)" << endl;
+    cout << "Opening file: " << old_root_file << endl;
+
+    ROOT::RDataFrame df("sel", old_root_file);
+    ROOT::RDF::RNode node = df.Define("NNFitShower_Energy", NNFitEnergy, {"NNFitShower_Log10Energy"})
+                                .Define("NNFitTrack_Energy", NNFitEnergy, {"NNFitTrack_Log10Energy"})
+                                .Define("NNFitShower_cos_zenith", NNFitCosZenith, {"NNFitShower_Theta"})
+                                .Define("NNFitTrack_cos_zenith", NNFitCosZenith, {"NNFitTrack_Theta"})
+                                .Define("NNFit_Bjorken_y", []() { return 0.5; })
+                                .Define("energy_recoTrue", [](double energy_true) { return energy_true; }, {"energy_true"})
+                                .Define("cos_zenith_recoTrue", [](double cos_zenith_true) { return cos_zenith_true; }, {"cos_zenith_true"})
+                                .Define("bjorken_y_recoTrue", []() { return 0.5; });
+
+    cout << "Writing the tree with the new branches" << endl;
+    ROOT::RDF::RResultPtr<ULong64_t> counted = TrackProgress(df, progress, "swim", "sel", old_root_file);
+    SnapshotStage(node, "sel", new_root_file, old_root_file);
+    progress.Set(*counted);
+
+    AnnotateSelFile(new_root_file);
+}
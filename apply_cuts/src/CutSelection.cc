@@ -1,60 +1,26 @@
 #include <TFile.h>
 #include <TTree.h>
+#include <TStopwatch.h>
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cmath>    
+#include <cstdint>
+
+#include "AsyncTreeWriter.h"
+#include "ColumnReader.h"
+#include "CutKernels.h"
+#include "SelMetadata.h"
+#include "StageContext.h"
+#include "StageRDF.h"
+#include "Trace.h"
 
 using namespace std;
 
 // Global variables
 TFile *file;
 
-bool ApplyCuts(string cut_selection, double energy_true, double nnfit_track_cos_zenith, double nnfit_shower_cos_zenith, double nnfit_track_sigma_z_closest, double nnfit_track_sigma_r_closest, double nnfit_shower_sigma_z_vertex, double nnfit_shower_sigma_r_vertex, string topology)
-{
-    bool selected = false;
-
-    if (cut_selection == "muon_free"){
-        if (energy_true < 1e2 && energy_true > 1e1)
-            selected = true;
-    }
-    else if (cut_selection == "nnfit_loose_cuts"){
-        if ((topology == "shower" && nnfit_shower_cos_zenith < 0) || (topology == "track" && nnfit_track_cos_zenith < 0))
-            selected = true;
-    }
-    else if (cut_selection == "nnfit_hard_cuts"){
-        if ((topology == "shower" && nnfit_shower_cos_zenith < 0 && nnfit_shower_sigma_z_vertex < 15 && nnfit_shower_sigma_r_vertex < 15) || (topology == "track" && nnfit_track_cos_zenith < 0 && nnfit_track_sigma_z_closest < 10 && nnfit_track_sigma_r_closest < 7))
-            selected = true;
-    }
-    else
-    {
-        cerr << "Error: cut selection not found" << endl;
-        exit(1);
-    }
-
-    return selected;
-}
-
-string GetTopology(double type, double interaction_type)
-{
-    string topology;
-
-    if ( (abs(type) == 14 && interaction_type ==  1) || (abs(type) == 16 && interaction_type ==  2) || (abs(type) == 13) )
-    {
-        topology = "track";
-    }
-    else if ( (abs(type) == 12) || (abs(type) == 14 && interaction_type ==  0) || (abs(type) == 16 && interaction_type !=  2) )
-    {
-        topology = "shower";
-    }
-    else
-    {
-        cerr << "Error: topology not found" << endl;
-        printf("type: %f, interaction_type: %f\n", type, interaction_type);
-    }
-    return topology;
-}    
-
 // Open the tree
 TTree *OpenTree(string input, string tree_name, string option)
 {
@@ -76,21 +42,11 @@ TTree *OpenTree(string input, string tree_name, string option)
     return input_tree;
 }
 
-int main(int argc, char *argv[])
+// Original event loop: read the predicate branches entry by entry and apply the scalar cuts
+void SelectScalar(TTree *input_tree, string cut_selection, const EntryRange &range, vector<Long64_t> &selected_entries,
+                  ProgressMetrics &progress)
 {
-    if (argc != 4)
-    {
-        cerr << "Usage: " << argv[0] << " <input> <output> <cut_selection>" << endl;
-        return 1;
-    }
-
-    string input_file = argv[1];
-    string output_file = argv[2];
-    string cut_selection = argv[3];
-
-    // Open the tree
-    TTree *input_tree = OpenTree(input_file, "sel", "READ");
-
+    TRACE_SCOPE("Select");
     int type, interaction_type;
     double energy_true, cos_zenith_true;
     double nnfit_track_cos_zenith, nnfit_shower_cos_zenith;
@@ -110,44 +66,313 @@ int main(int argc, char *argv[])
     input_tree->SetBranchAddress("NNFitShower_SigmaRVertex", &nnfit_shower_sigma_r_vertex);
     input_tree->SetBranchAddress("NNFitShower_SigmaZVertex", &nnfit_shower_sigma_z_vertex);
 
-    // Create a new file
-    TFile *output = TFile::Open(output_file.c_str(), "RECREATE");
-    TTree *output_tree = input_tree->CloneTree(0);
-
-    // Get the number of events
-    int ntot = input_tree->GetEntries();
-    int nsel = 0;
-
-    // Define 
     string topology;
+    progress.Begin("select", range.Entries());
 
-    // Loop over the events
-    for (int i = 0; i < ntot; i++)
+    for (Long64_t i = range.First(); i < range.Last(); i++)
     {
         input_tree->GetEntry(i);
-    
 
         // Get the topology
         topology = GetTopology(type, interaction_type);
 
         // Apply the cuts
         if (ApplyCuts(cut_selection, energy_true, nnfit_track_cos_zenith, nnfit_shower_cos_zenith, nnfit_track_sigma_z_closest, nnfit_track_sigma_r_closest, nnfit_shower_sigma_z_vertex, nnfit_shower_sigma_r_vertex, topology))
+            selected_entries.push_back(i);
+        progress.Add();
+    }
+
+    // The branches are bound to local variables, release them before the copy pass
+    input_tree->ResetBranchAddresses();
+}
+
+// Columnar event loop: read the predicate columns cluster by cluster and evaluate the cuts as masks.
+// Clusters whose zone map ranges cannot pass the cut are skipped without being read.
+void SelectColumnar(TTree *input_tree, string cut_selection, const ZoneMap &zones, const EntryRange &range,
+                    vector<Long64_t> &selected_entries, ProgressMetrics &progress)
+{
+    TRACE_SCOPE("Select");
+    ECutSelection cut = ParseCutSelection(cut_selection);
+
+    Column<double> energy_true(input_tree, "energy_true");
+    Column<int> type(input_tree, "type");
+    Column<int> interaction_type(input_tree, "interaction_type");
+    Column<double> nnfit_track_cos_zenith(input_tree, "NNFitTrack_cos_zenith");
+    Column<double> nnfit_shower_cos_zenith(input_tree, "NNFitShower_cos_zenith");
+    Column<float> nnfit_track_sigma_z_closest(input_tree, "NNFitTrack_SigmaZClosest");
+    Column<float> nnfit_track_sigma_r_closest(input_tree, "NNFitTrack_SigmaRClosest");
+    Column<float> nnfit_shower_sigma_z_vertex(input_tree, "NNFitShower_SigmaZVertex");
+    Column<float> nnfit_shower_sigma_r_vertex(input_tree, "NNFitShower_SigmaRVertex");
+
+    // Upper bound of a block, in case the file has no (or very large) clusters
+    const Long64_t max_block = 1 << 20;
+
+    Long64_t ntot = range.Entries();
+    size_t n_unknown = 0;
+    AlignedVector<uint8_t> mask;
+
+    // Entry ranges to process: the zones of the zone map if there is one, the clusters otherwise,
+    // cut to the entries of --entries or --shard
+    vector<pair<Long64_t, Long64_t>> ranges;
+    Long64_t nskipped_zones = 0, nskipped_entries = 0, nzones = 0;
+    if (zones.NZones() > 0)
+    {
+        for (size_t z = 0; z < zones.NZones(); z++)
+        {
+            Long64_t zone_start = max(zones.First(z), range.First()), zone_end = min(zones.Last(z), range.Last());
+            if (zone_start >= zone_end)
+                continue;
+            nzones++;
+            if (CutMayPass(cut, zones, z))
+                ranges.push_back(make_pair(zone_start, zone_end));
+            else
+            {
+                nskipped_zones++;
+                nskipped_entries += zone_end - zone_start;
+            }
+        }
+        cout << "Zone map: skipping " << nskipped_zones << " of " << nzones << " clusters ("
+             << nskipped_entries << " of " << ntot << " events)" << endl;
+    }
+    else
+    {
+        TTree::TClusterIterator clusters = input_tree->GetClusterIterator(range.First());
+        Long64_t cluster_start;
+        while ((cluster_start = clusters()) < range.Last())
+            ranges.push_back(make_pair(max(cluster_start, range.First()), min(clusters.GetNextEntry(), range.Last())));
+    }
+    // the skipped zones count as processed
+    progress.Begin("select", ntot);
+    progress.Add(nskipped_entries);
+
+    for (const pair<Long64_t, Long64_t> &range : ranges)
+    {
+        Long64_t cluster_start = range.first, cluster_end = range.second;
+
+        for (Long64_t first = cluster_start; first < cluster_end; first += max_block)
         {
-            nsel++;
-            output_tree->Fill();
+            Long64_t n = min(max_block, cluster_end - first);
+
+            // Only the cut columns that the selection needs are read
+            type.Read(first, n);
+            interaction_type.Read(first, n);
+            if (cut == kMuonFree)
+                energy_true.Read(first, n);
+            else
+            {
+                nnfit_track_cos_zenith.Read(first, n);
+                nnfit_shower_cos_zenith.Read(first, n);
+            }
+            if (cut == kNNFitHardCuts)
+            {
+                nnfit_track_sigma_z_closest.Read(first, n);
+                nnfit_track_sigma_r_closest.Read(first, n);
+                nnfit_shower_sigma_z_vertex.Read(first, n);
+                nnfit_shower_sigma_r_vertex.Read(first, n);
+            }
+
+            CutColumns columns = {energy_true.Data(), type.Data(), interaction_type.Data(),
+                                  nnfit_track_cos_zenith.Data(), nnfit_shower_cos_zenith.Data(),
+                                  nnfit_track_sigma_z_closest.Data(), nnfit_track_sigma_r_closest.Data(),
+                                  nnfit_shower_sigma_z_vertex.Data(), nnfit_shower_sigma_r_vertex.Data()};
+
+            mask.resize(n);
+            {
+                TRACE_SCOPE("EvaluateCuts");
+                n_unknown += EvaluateCuts(cut, columns, n, mask.data());
+            }
+
+            for (Long64_t i = 0; i < n; i++)
+                if (mask[i])
+                    selected_entries.push_back(first + i);
+            progress.Add(n);
         }
+    }
+
+    if (n_unknown > 0)
+        cerr << "Warning: " << n_unknown << " events without a track or shower topology" << endl;
+
+    // The branches point to the column buffers, which go out of scope here
+    input_tree->ResetBranchAddresses();
+}
+
+// Cut of one event, with the same kernel as the columnar path
+inline bool PassesCut(ECutSelection cut, const CutColumns &columns)
+{
+    uint8_t selected;
+    EvaluateCuts(cut, columns, 1, &selected);
+    return selected;
+}
+
+// RDataFrame path: the cut is a Filter node and the accepted entries are written with Snapshot.
+// Only the columns of the selection are read by the filter, as in the columnar path.
+void SelectRDF(string input_file, string output_file, string cut_selection, ProgressMetrics &progress)
+{
+    ECutSelection cut = ParseCutSelection(cut_selection);
+
+    ROOT::RDataFrame df("sel", input_file);
+    ROOT::RDF::RNode node = df;
+    if (cut == kMuonFree)
+        node = df.Filter([](int type, int interaction_type, double energy_true) {
+            const double nan_d = NAN;
+            const float nan_f = NAN;
+            CutColumns columns = {&energy_true, &type, &interaction_type, &nan_d, &nan_d, &nan_f, &nan_f, &nan_f, &nan_f};
+            return PassesCut(kMuonFree, columns);
+        }, {"type", "interaction_type", "energy_true"}, cut_selection);
+    else if (cut == kNNFitLooseCuts)
+        node = df.Filter([](int type, int interaction_type, double track_cos_zenith, double shower_cos_zenith) {
+            const double nan_d = NAN;
+            const float nan_f = NAN;
+            CutColumns columns = {&nan_d, &type, &interaction_type, &track_cos_zenith, &shower_cos_zenith, &nan_f, &nan_f, &nan_f, &nan_f};
+            return PassesCut(kNNFitLooseCuts, columns);
+        }, {"type", "interaction_type", "NNFitTrack_cos_zenith", "NNFitShower_cos_zenith"}, cut_selection);
+    else
+        node = df.Filter([](int type, int interaction_type, double track_cos_zenith, double shower_cos_zenith,
+                            float track_sigma_z, float track_sigma_r, float shower_sigma_z, float shower_sigma_r) {
+            const double nan_d = NAN;
+            CutColumns columns = {&nan_d, &type, &interaction_type, &track_cos_zenith, &shower_cos_zenith,
+                                  &track_sigma_z, &track_sigma_r, &shower_sigma_z, &shower_sigma_r};
+            return PassesCut(kNNFitHardCuts, columns);
+        }, {"type", "interaction_type", "NNFitTrack_cos_zenith", "NNFitShower_cos_zenith",
+            "NNFitTrack_SigmaZClosest", "NNFitTrack_SigmaRClosest", "NNFitShower_SigmaZVertex", "NNFitShower_SigmaRVertex"}, cut_selection);
+
+    // Booked before the Snapshot, so that both come from the same event loop
+    ROOT::RDF::RResultPtr<ROOT::RDF::RCutFlowReport> report = node.Report();
+    ROOT::RDF::RResultPtr<ULong64_t> counted = TrackProgress(df, progress, "select", "sel", input_file);
+
+    TStopwatch timer;
+    SnapshotStage(node, "sel", output_file, input_file);
+    timer.Stop();
+    progress.Set(*counted);
+
+    cout << "\nSummary:" << endl
+         << "Selected " << (*report)[cut_selection].GetPass() << " events out of " << (*report)[cut_selection].GetAll() << endl
+         << "RDataFrame pass: " << timer.RealTime() << " s" << endl;
+}
 
-        // Print the progress
-        if (i % (ntot / 50) == 0)
-            cout << "Processed " << i << " events out of " << ntot << endl;
+int main(int argc, char *argv[])
+{
+    StageOptions options = ParseStageOptions(argc, argv, {"threads"});
+    const vector<string> &args = options.Positional();
+
+    if (args.size() != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <input> <output> <cut_selection> [--scalar | --rdf [--threads N]] [--trace out.json]"
+             << " [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]"
+             << " [--entries first:last | --shard k/N] [--cache] [--read-cache <MB|off>] [--prefetch]"
+             << " [--async-write [--write-queue <MB>]]" << endl;
+        return 1;
     }
 
+    string input_file = args[0];
+    string output_file = args[1];
+    string cut_selection = args[2];
+    bool use_scalar = options.Has("scalar");
+
+    // --cache, --trace, --metrics, --mem-budget (copy pass), --codec-plan, --read-cache, --entries, --shard (StageContext.h)
+    StageContext stage("CutSelection", output_file, options);
+    stage.cache.Input(input_file);
+    stage.cache.Output(output_file);
+    if (!stage.Start())
+        return 0;
+
+    // --rdf: RDataFrame implementation with implicit multi-threading (StageRDF.h)
+    if (options.Has("rdf"))
+    {
+        if (stage.range.Enabled())
+        {
+            cerr << "Error: --entries and --shard are not supported with --rdf" << endl;
+            return 1;
+        }
+        EnableStageMT(options);
+        SelectRDF(input_file, output_file, cut_selection, stage.Progress());
+        AnnotateSelFile(output_file);
+        stage.Finish();
+        return 0;
+    }
+
+    // Open the tree
+    TTree *input_tree = OpenTree(input_file, "sel", "READ");
+
+    // Get the number of events
+    stage.range.Resolve(input_tree);
+    Long64_t ntot = stage.range.Entries();
+    Long64_t nsel = 0;
+
+    // Phase 1: decide the selection reading only the predicate branches,
+    // so the baskets of all other branches are never decompressed
+    TStopwatch timer_select;
+    input_tree->SetBranchStatus("*", 0);
+    const char *predicate_branches[] = {
+        "energy_true", "cos_zenith_true", "type", "interaction_type",
+        "NNFitTrack_cos_zenith", "NNFitShower_cos_zenith",
+        "NNFitTrack_SigmaTheta", "NNFitShower_SigmaTheta",
+        "NNFitTrack_SigmaRClosest", "NNFitTrack_SigmaZClosest",
+        "NNFitShower_SigmaRVertex", "NNFitShower_SigmaZVertex"};
+    for (const char *name : predicate_branches)
+        input_tree->SetBranchStatus(name, 1);
+    // the cache is sized for the predicate branches and learns those that the cut reads
+    stage.memory.ConfigureInput(input_tree, 0.25);
+    stage.input.Configure(input_tree);
+
+    vector<Long64_t> selected_entries;
+    if (use_scalar)
+        SelectScalar(input_tree, cut_selection, stage.range, selected_entries, stage.Progress());
+    else
+        SelectColumnar(input_tree, cut_selection, ReadZoneMap(file, input_tree->GetEntries()), stage.range, selected_entries, stage.Progress());
+
+    timer_select.Stop();
+    nsel = selected_entries.size();
+    stage.memory.Reserve("selected entries", nsel * sizeof(Long64_t));
+
+    // Phase 2: copy the full content of the accepted entries only
+    TStopwatch timer_copy;
+    input_tree->SetBranchStatus("*", 1);
+
+    // Create a new file
+    TFile *output = TFile::Open(output_file.c_str(), "RECREATE");
+    TTree *output_tree = input_tree->CloneTree(0);
+    // --async-write: the entries are filled and compressed on a writer thread (AsyncTreeWriter.h)
+    AsyncTreeWriter writer(output_tree, options, stage.memory);
+    stage.input.Configure(input_tree);
+    stage.memory.ConfigureOutput(output_tree, 0.75);
+    stage.codecs.Apply(output_tree);
+
+    stage.Progress().Begin("copy", nsel);
+    for (Long64_t entry : selected_entries)
+    {
+        {
+            TRACE_SCOPE("ReadEvent");
+            input_tree->GetEntry(entry);
+        }
+        {
+            TRACE_SCOPE("Fill");
+            writer.Fill();
+        }
+        stage.Progress().Add();
+    }
+    writer.Finish();
+    timer_copy.Stop();
+
     cout << "\nSummary:" << endl
          << "Processed " << ntot << " events out of " << ntot << endl
-         << "Selected " << nsel << " events out of " << ntot << endl;
+         << "Selected " << nsel << " events out of " << ntot << endl
+         << "Selection pass (" << (use_scalar ? "scalar" : "columnar") << "): " << timer_select.RealTime() << " s, "
+         << (timer_select.RealTime() > 0 ? ntot / timer_select.RealTime() : 0) << " events/s" << endl
+         << "Copy pass (" << nsel << " entries): " << timer_copy.RealTime() << " s" << endl;
 
     // Write the tree
-    file->Close();
-    output_tree->Write();
+    output->cd();
+    {
+        TRACE_SCOPE("Write");
+        output_tree->Write();
+    }
+    stage.input.Report(input_tree);
     output->Close();
+    file->Close();
+    delete output;
+    delete file;
+
+    AnnotateSelFile(output_file);
+    stage.Finish();
 }
\ No newline at end of file
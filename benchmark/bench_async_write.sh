@@ -0,0 +1,81 @@
+#!/bin/bash
+## Usage:
+#   ./bench_async_write.sh [ENTRIES]
+#
+## Example:
+#   ANTDST=/sps/km3net/users/${USER}/AntDST/MC_054321_numuCC.root ./bench_async_write.sh 10000000
+#
+## Arguments:
+#   ENTRIES: size of the synthetic sel tree (default 10000000)
+#   ANTDST: an AntDST file, to measure ExtractAntDSTInfo as well (optional)
+#   WORKDIR: where the trees are written (default $TMPDIR)
+#
+# Runs the duplicate removal of CorrectTree on a generated sel tree (bin/GenerateSel),
+# and ExtractAntDSTInfo on ANTDST if given, under bin/MeasureStage:
+#   sync   Fill on the event loop thread, as before
+#   async  --async-write, the entries are filled and compressed on a writer thread (common/include/AsyncTreeWriter.h)
+# For each run, the wall time, the events per second and how long each
+# thread waited for the other are printed. The two outputs must have the
+# same size, since the writer thread fills the same entries in the same order.
+# Build first: make all in benchmark/, and make in corrections/ and extract_dst/.
+
+ENTRIES=${1:-10000000}
+BASE=$(cd $(dirname $0)/.. && pwd)
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/bench_async_write_$$
+MEASURE=${BASE}/benchmark/bin/MeasureStage
+
+for exe in benchmark/bin/GenerateSel benchmark/bin/MeasureStage corrections/bin/CorrectTree; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 [ENTRIES] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+if [ -n "${ANTDST}" ] && [ ! -x "${BASE}/extract_dst/bin/ExtractAntDSTInfo" ]; then
+    echo "Usage: $0 [ENTRIES] (build extract_dst/bin/ExtractAntDSTInfo with make first)"
+    exit 1
+fi
+mkdir -p ${WORKDIR}
+
+${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/sel.root --entries ${ENTRIES} > ${WORKDIR}/GenerateSel.log 2>&1
+
+# run <name> <mode> <entries> <output> <command...>: one step under MeasureStage, then the report of its writer
+run() {
+    local name=$1
+    local mode=$2
+    local entries=$3
+    local output=$4
+    shift 4
+    local log=${WORKDIR}/${name}_${mode}.log
+    echo "  ${mode}: $(${MEASURE} ${name} ${entries} ${log} ${output} -- "$@")"
+    grep "^Writer of" ${log} | tail -n 1 | sed 's/^/    /'
+}
+
+# compare <output> <output>: the two modes write files of the same size
+compare() {
+    local sync=$(stat -c %s $1)
+    local async=$(stat -c %s $2)
+    if [ "${sync}" = "${async}" ]; then
+        echo "  same size: ${sync} bytes"
+    else
+        echo "  sizes differ: ${sync} (sync), ${async} (async)"
+    fi
+}
+
+# is_weighted 1: the duplicate removal only, the pass that fills a whole tree
+echo "CorrectTree (${ENTRIES} entries)"
+run CorrectTree sync ${ENTRIES} ${WORKDIR}/corrected_sync.root \
+    ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_sync.root 1
+run CorrectTree async ${ENTRIES} ${WORKDIR}/corrected_async.root \
+    ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_async.root 1 --async-write
+compare ${WORKDIR}/corrected_sync.root ${WORKDIR}/corrected_async.root
+
+if [ -n "${ANTDST}" ]; then
+    echo "ExtractAntDSTInfo (${ANTDST})"
+    run ExtractAntDSTInfo sync 0 ${WORKDIR}/extract_sync.root \
+        ${BASE}/extract_dst/bin/ExtractAntDSTInfo ${WORKDIR}/extract_sync.root ${ANTDST}
+    run ExtractAntDSTInfo async 0 ${WORKDIR}/extract_async.root \
+        ${BASE}/extract_dst/bin/ExtractAntDSTInfo ${WORKDIR}/extract_async.root ${ANTDST} --async-write
+    compare ${WORKDIR}/extract_sync.root ${WORKDIR}/extract_async.root
+fi
+
+echo "Logs in ${WORKDIR}"
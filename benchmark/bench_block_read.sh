@@ -0,0 +1,88 @@
+#!/bin/bash
+## Usage:
+#   ./bench_block_read.sh <BASELINE_REV> [ENTRIES]
+#
+## Example:
+#   CUT=nnfit_hard_cuts ./bench_block_read.sh e36bf87 10000000
+#
+## Arguments:
+#   BASELINE_REV: git revision whose CorrectTree and CutSelection read entry by entry (before the column blocks)
+#   ENTRIES: size of the synthetic sel tree (default 10000000)
+#   CUT: selection of CutSelection (default nnfit_hard_cuts)
+#   WORKDIR: where the trees and the baseline checkout are written (default $TMPDIR)
+#
+# Measures the column reads (common/include/ColumnReader.h, EventBlock.h)
+# against the entry by entry loops they replace. BASELINE_REV is checked out
+# in a git worktree, where corrections/ and apply_cuts/ are built. On a
+# generated sel tree (bin/GenerateSel) with the SWIM columns added, each run
+# goes under bin/MeasureStage, which prints its wall time, events per second
+# and bytes read:
+#   CutSelection   baseline, --scalar (predicate branches entry by entry, scalar cuts), default (predicate columns, cut masks)
+#   CorrectTree    baseline, default (event blocks); is_weighted 1, the duplicate removal only
+# The CutSelection runs must write the same number of entries.
+# Build first: make all in benchmark/, and make in corrections/, add_SWIM_Branches/ and apply_cuts/.
+
+BASELINE_REV=${1}
+ENTRIES=${2:-10000000}
+CUT=${CUT:-nnfit_hard_cuts}
+BASE=$(cd $(dirname $0)/.. && pwd)
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/bench_block_read_$$
+MEASURE=${BASE}/benchmark/bin/MeasureStage
+
+for exe in benchmark/bin/GenerateSel benchmark/bin/MeasureStage corrections/bin/CorrectTree \
+           add_SWIM_Branches/bin/main apply_cuts/bin/CutSelection; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 <BASELINE_REV> [ENTRIES] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+if [ -z "${BASELINE_REV}" ] || ! git -C ${BASE} rev-parse --verify -q ${BASELINE_REV} > /dev/null; then
+    echo "Usage: $0 <BASELINE_REV> [ENTRIES]"
+    exit 1
+fi
+mkdir -p ${WORKDIR}
+
+# Baseline executables
+BASELINE=${WORKDIR}/baseline
+git -C ${BASE} worktree add --detach ${BASELINE} ${BASELINE_REV} > ${WORKDIR}/worktree.log 2>&1
+for dir in corrections apply_cuts; do
+    if ! make -C ${BASELINE}/${dir} > ${WORKDIR}/make_${dir}.log 2>&1; then
+        echo "Cannot build ${dir} of ${BASELINE_REV}, see ${WORKDIR}/make_${dir}.log"
+        exit 1
+    fi
+done
+
+${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/sel.root --entries ${ENTRIES} > ${WORKDIR}/GenerateSel.log 2>&1
+${BASE}/add_SWIM_Branches/bin/main ${WORKDIR}/sel.root ${WORKDIR}/swim.root > ${WORKDIR}/add_SWIM_Branches.log 2>&1
+
+# run <name> <mode> <output> <command...>: one step under MeasureStage
+run() {
+    local name=$1
+    local mode=$2
+    local output=$3
+    shift 3
+    echo "  ${mode}: $(${MEASURE} ${name} ${ENTRIES} ${WORKDIR}/${name}_${mode}.log ${output} -- "$@")"
+}
+
+entries() {
+    root -l -b -q -e "TFile f(\"$1\"); cout << ((TTree*)f.Get(\"sel\"))->GetEntries() << endl;" 2>/dev/null | tail -1
+}
+
+echo "CutSelection ${CUT} (${ENTRIES} entries)"
+run CutSelection baseline ${WORKDIR}/cut_baseline.root \
+    ${BASELINE}/apply_cuts/bin/CutSelection ${WORKDIR}/swim.root ${WORKDIR}/cut_baseline.root ${CUT}
+run CutSelection scalar ${WORKDIR}/cut_scalar.root \
+    ${BASE}/apply_cuts/bin/CutSelection ${WORKDIR}/swim.root ${WORKDIR}/cut_scalar.root ${CUT} --scalar
+run CutSelection default ${WORKDIR}/cut_default.root \
+    ${BASE}/apply_cuts/bin/CutSelection ${WORKDIR}/swim.root ${WORKDIR}/cut_default.root ${CUT}
+echo "  entries written: $(entries ${WORKDIR}/cut_baseline.root) (baseline)," \
+     "$(entries ${WORKDIR}/cut_scalar.root) (--scalar), $(entries ${WORKDIR}/cut_default.root) (default)"
+
+echo "CorrectTree (${ENTRIES} entries)"
+run CorrectTree baseline ${WORKDIR}/corrected_baseline.root \
+    ${BASELINE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_baseline.root 1
+run CorrectTree default ${WORKDIR}/corrected_default.root \
+    ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_default.root 1
+
+git -C ${BASE} worktree remove --force ${BASELINE}
+echo "Logs in ${WORKDIR}"
@@ -0,0 +1,84 @@
+#!/bin/bash
+## Usage:
+#   ./bench_input_cache.sh <INPUT_DIR> [ENTRIES]
+#
+## Example:
+#   ./bench_input_cache.sh /sps/km3net/users/${USER}/bench 10000000
+#
+## Arguments:
+#   INPUT_DIR: a directory on the filesystem to test (network mount or throttled local directory)
+#   ENTRIES: size of the synthetic sel tree (default 10000000)
+#   CUT: selection of CutSelection (default nnfit_loose_cuts)
+#   WORKDIR: where the outputs and logs are written (default $TMPDIR), local so that only the reads are remote
+#   DROP_CACHES=1: drop the page cache before each run (needs root)
+#
+# Generates a synthetic sel tree (bin/GenerateSel) and copies it to
+# INPUT_DIR once per setting, so that no run reads a file that an earlier
+# one left in the page cache of the client. CorrectTree and CutSelection
+# then read it under bin/MeasureStage with:
+#   off       --read-cache off, the default of ROOT
+#   learned   the TTreeCache of common/include/InputCache.h
+#   prefetch  the same with --prefetch
+# For each run, the wall time, the events per second and the read cache
+# report of the step (hit rate, read calls, bytes read) are printed.
+# A throttled local directory can be set up with e.g. an NFS export of a
+# local disk mounted over the loopback, with `tc qdisc add dev lo root netem delay 2ms`.
+# Build first: make all in benchmark/, and make in corrections/ and apply_cuts/.
+
+INPUT_DIR=$1
+ENTRIES=${2:-10000000}
+CUT=${CUT:-nnfit_loose_cuts}
+BASE=$(cd $(dirname $0)/.. && pwd)
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/bench_input_cache_$$
+MEASURE=${BASE}/benchmark/bin/MeasureStage
+
+if [ -z "${INPUT_DIR}" ] || [ ! -d "${INPUT_DIR}" ]; then
+    echo "Usage: $0 <INPUT_DIR> [ENTRIES]"
+    exit 1
+fi
+for exe in benchmark/bin/GenerateSel benchmark/bin/MeasureStage corrections/bin/CorrectTree apply_cuts/bin/CutSelection; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 <INPUT_DIR> [ENTRIES] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+mkdir -p ${WORKDIR}
+
+${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/sel.root --entries ${ENTRIES} > ${WORKDIR}/GenerateSel.log 2>&1
+
+# run <name> <setting> <outputs> <command...>: one step under MeasureStage, then its read cache report
+run() {
+    local name=$1
+    local setting=$2
+    local outputs=$3
+    shift 3
+    if [ "${DROP_CACHES}" = "1" ]; then
+        sync && echo 3 > /proc/sys/vm/drop_caches
+    fi
+    local log=${WORKDIR}/${name}_${setting}.log
+    echo "  ${setting}: $(${MEASURE} ${name} ${ENTRIES} ${log} ${outputs} -- "$@")"
+    grep "^Read cache of" ${log} | tail -n 1 | sed 's/^/    /'
+}
+
+declare -A options=([off]="--read-cache off" [learned]="" [prefetch]="--prefetch")
+for setting in off learned prefetch; do
+    cp ${WORKDIR}/sel.root ${INPUT_DIR}/bench_input_cache_${setting}_$$.root
+done
+
+echo "CorrectTree (${ENTRIES} entries, all branches)"
+for setting in off learned prefetch; do
+    run CorrectTree ${setting} "${WORKDIR}/corrected_${setting}.root ${WORKDIR}/corrected_${setting}_weighted.root" \
+        ${BASE}/corrections/bin/CorrectTree ${INPUT_DIR}/bench_input_cache_${setting}_$$.root sel ${WORKDIR}/corrected_${setting}.root 0 \
+        ${options[${setting}]}
+done
+
+# the files were read once, the selection pass now reads them from the cache of the client unless DROP_CACHES=1
+echo "CutSelection (${CUT}, predicate branches then the selected entries)"
+for setting in off learned prefetch; do
+    run CutSelection ${setting} ${WORKDIR}/cut_${setting}.root \
+        ${BASE}/apply_cuts/bin/CutSelection ${INPUT_DIR}/bench_input_cache_${setting}_$$.root ${WORKDIR}/cut_${setting}.root ${CUT} \
+        ${options[${setting}]}
+done
+
+rm -f ${INPUT_DIR}/bench_input_cache_*_$$.root
+echo "Logs in ${WORKDIR}"
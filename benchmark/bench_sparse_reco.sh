@@ -0,0 +1,51 @@
+#!/bin/bash
+## Usage:
+#   ./bench_sparse_reco.sh [ENTRIES]
+#
+## Example:
+#   ./bench_sparse_reco.sh 10000000
+#
+## Arguments:
+#   ENTRIES: size of the synthetic sel trees (default 10000000)
+#   WORKDIR: where the trees are written (default $TMPDIR)
+#
+# Generates the same sel tree twice with bin/GenerateSel (same seed):
+#   dense   every reconstruction column for every event, stale values where the flag is false
+#   sparse  --sparse-reco, the columns of each strategy in a tree of their own (common/include/SparseReco.h)
+# prints the size of both, then runs the duplicate removal of CorrectTree on
+# each under bin/MeasureStage: the dense input is masked, the sparse one is
+# read back as NaN where a strategy is absent. Both outputs are dense and
+# hold the same values.
+# Build first: make all in benchmark/, and make in corrections/.
+
+ENTRIES=${1:-10000000}
+BASE=$(cd $(dirname $0)/.. && pwd)
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/bench_sparse_reco_$$
+MEASURE=${BASE}/benchmark/bin/MeasureStage
+
+for exe in benchmark/bin/GenerateSel benchmark/bin/MeasureStage corrections/bin/CorrectTree; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 [ENTRIES] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+mkdir -p ${WORKDIR}
+
+${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/dense.root --entries ${ENTRIES} > ${WORKDIR}/GenerateSel_dense.log 2>&1
+${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/sparse.root --entries ${ENTRIES} --sparse-reco > ${WORKDIR}/GenerateSel_sparse.log 2>&1
+
+echo "Extracted trees (${ENTRIES} entries)"
+for layout in dense sparse; do
+    printf "  %-8s %10s MB\n" ${layout} $(du -m ${WORKDIR}/${layout}.root | cut -f1)
+done
+
+# is_weighted 1: the duplicate removal only, the pass that masks the reconstructions
+echo "CorrectTree"
+for layout in dense sparse; do
+    log=${WORKDIR}/CorrectTree_${layout}.log
+    echo "  ${layout}: $(${MEASURE} CorrectTree ${ENTRIES} ${log} ${WORKDIR}/corrected_${layout}.root -- \
+        ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/${layout}.root sel ${WORKDIR}/corrected_${layout}.root 1)"
+    grep "^Sparse reconstruction:" ${log} | sed 's/^/    /'
+done
+
+echo "Logs in ${WORKDIR}"
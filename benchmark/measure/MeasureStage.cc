@@ -0,0 +1,118 @@
+/**
+ * @brief Run one stage executable and report its cost as a JSON object.
+ * The stage runs as a child process with its output sent to a log file.
+ * Wall time, peak RSS (getrusage of the child) and bytes read and written
+ * (rchar and wchar of /proc/<pid>/io, read while the child is a zombie) are
+ * printed on stdout, with the events per second for the given entries.
+ * rchar and wchar count every read and write system call of the stage,
+ * including ROOT's own start-up files. No ROOT needed.
+ *
+ * Usage: MeasureStage <name> <entries> <log> [<output file>...] -- <command> [args...]
+ */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// rchar and wchar of a process, -1 if /proc is not readable
+static void ReadProcIO(pid_t pid, long long &bytes_read, long long &bytes_written)
+{
+    bytes_read = bytes_written = -1;
+    ifstream io("/proc/" + to_string(pid) + "/io");
+    string key;
+    long long value;
+    while (io >> key >> value)
+    {
+        if (key == "rchar:")
+            bytes_read = value;
+        else if (key == "wchar:")
+            bytes_written = value;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int separator = 0;
+    for (int i = 1; i < argc; i++)
+        if (string(argv[i]) == "--")
+        {
+            separator = i;
+            break;
+        }
+
+    if (separator < 4 || separator + 1 >= argc)
+    {
+        cerr << "Usage: " << argv[0] << " <name> <entries> <log> [<output file>...] -- <command> [args...]" << endl;
+        return 1;
+    }
+
+    string name = argv[1];
+    long long entries = atoll(argv[2]);
+    string log = argv[3];
+    vector<string> outputs(argv + 4, argv + separator);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execvp(argv[separator + 1], argv + separator + 1);
+        perror("execvp");
+        _exit(127);
+    }
+
+    // Wait for the exit without reaping, so that /proc/<pid>/io still has the totals
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    long long bytes_read, bytes_written;
+    ReadProcIO(pid, bytes_read, bytes_written);
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    long long output_bytes = 0;
+    for (const string &output : outputs)
+    {
+        struct stat st;
+        if (stat(output.c_str(), &st) == 0)
+            output_bytes += st.st_size;
+    }
+
+    double seconds = chrono::duration<double>(end - start).count();
+    printf("{\"stage\": \"%s\", \"entries\": %lld, \"exit_code\": %d, \"wall_seconds\": %.3f, \"events_per_second\": %.1f, "
+           "\"bytes_read\": %lld, \"bytes_written\": %lld, \"output_bytes\": %lld, \"peak_rss_kb\": %ld}\n",
+           name.c_str(), entries, exit_code, seconds, seconds > 0 ? entries / seconds : 0.,
+           bytes_read, bytes_written, output_bytes, usage.ru_maxrss);
+
+    return exit_code;
+}
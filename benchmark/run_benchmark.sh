@@ -0,0 +1,89 @@
+#!/bin/bash
+## Usage:
+#   ./run_benchmark.sh [ENTRIES...]
+#
+## Example:
+#   CUT=nnfit_hard_cuts OUTPUT=results/laptop.json ./run_benchmark.sh 1000000 10000000
+#
+## Arguments:
+#   ENTRIES: sizes of the synthetic sel trees (default 1000000 10000000 100000000)
+#   CUT: selection of CutSelection (default nnfit_loose_cuts)
+#   OUTPUT: JSON report (default results/benchmark_<date>.json)
+#   WORKDIR: where the trees are written (default $TMPDIR), they are removed after each size unless KEEP=1
+#
+# For each size, generates a synthetic sel tree (bin/GenerateSel) with the
+# flux stand-in, then runs CorrectTree, OscillationWeights, add_SWIM_Branches
+# and CutSelection on it, one after the other. Every step runs under
+# bin/MeasureStage, which records the events per second, the bytes read and
+# written and the peak RSS. The report has one object per size and step,
+# with the commit and host, to track regressions between commits.
+# Build first: make all in benchmark/, and make in the four step directories.
+
+SIZES=${@:-"1000000 10000000 100000000"}
+CUT=${CUT:-nnfit_loose_cuts}
+BASE=$(cd $(dirname $0)/.. && pwd)
+OUTPUT=${OUTPUT:-${BASE}/benchmark/results/benchmark_$(date +%Y%m%d_%H%M%S).json}
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/benchmark_$$
+MEASURE=${BASE}/benchmark/bin/MeasureStage
+
+for exe in benchmark/bin/GenerateSel benchmark/bin/MeasureStage corrections/bin/CorrectTree \
+           oscillation_weights/bin/OscillationWeights add_SWIM_Branches/bin/main apply_cuts/bin/CutSelection; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 [ENTRIES...] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+mkdir -p ${WORKDIR} $(dirname ${OUTPUT})
+
+# measure <name> <entries> <outputs> <command...>: run a step under MeasureStage and collect its JSON object
+results=()
+measure() {
+    local name=$1
+    local entries=$2
+    local outputs=$3
+    shift 3
+    local result=$(${MEASURE} ${name} ${entries} ${WORKDIR}/${name}_${entries}.log ${outputs} -- "$@")
+    echo "  ${result}"
+    results+=("${result}")
+}
+
+for n in ${SIZES}; do
+    echo "Entries: ${n}"
+    dir=${WORKDIR}/${n}
+    mkdir -p ${dir}
+
+    measure GenerateSel ${n} "${dir}/sel.root ${dir}/flux.root" \
+        ${BASE}/benchmark/bin/GenerateSel ${dir}/sel.root --entries ${n} --flux ${dir}/flux.root
+    measure CorrectTree ${n} "${dir}/corrected.root ${dir}/corrected_weighted.root" \
+        ${BASE}/corrections/bin/CorrectTree ${dir}/sel.root sel ${dir}/corrected.root 0
+    measure OscillationWeights ${n} ${dir}/oscillated.root \
+        ${BASE}/oscillation_weights/bin/OscillationWeights ${dir}/corrected_weighted.root ${dir}/oscillated.root woody --flux ${dir}/flux.root
+    measure add_SWIM_Branches ${n} ${dir}/swim.root \
+        ${BASE}/add_SWIM_Branches/bin/main ${dir}/oscillated.root ${dir}/swim.root
+    measure CutSelection ${n} ${dir}/cut.root \
+        ${BASE}/apply_cuts/bin/CutSelection ${dir}/swim.root ${dir}/cut.root ${CUT}
+
+    if [ "${KEEP}" != "1" ]; then
+        rm -rf ${dir}
+    fi
+done
+
+# Report
+{
+    echo "{"
+    echo "  \"commit\": \"$(git -C ${BASE} rev-parse --short HEAD 2>/dev/null)\","
+    echo "  \"host\": \"$(hostname)\","
+    echo "  \"cpus\": $(nproc),"
+    echo "  \"date\": \"$(date -Iseconds)\","
+    echo "  \"cut\": \"${CUT}\","
+    echo "  \"results\": ["
+    for ((i = 0; i < ${#results[@]}; i++)); do
+        separator=","
+        if [ $i -eq $((${#results[@]} - 1)) ]; then separator=""; fi
+        echo "    ${results[$i]}${separator}"
+    done
+    echo "  ]"
+    echo "}"
+} > ${OUTPUT}
+
+echo "Report written to ${OUTPUT}, logs in ${WORKDIR}"
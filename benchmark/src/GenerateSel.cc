@@ -0,0 +1,295 @@
+/**
+ * @brief Generate a synthetic sel tree for benchmarking the pipeline stages.
+ * The tree has every branch of the extraction (SelSchema.h) plus the NNFit
+ * columns that the later stages read, so that CorrectTree, OscillationWeights,
+ * add_SWIM_Branches and CutSelection can run on it without AntDST or NNFit
+ * inputs. The events come in runs, with the flags, stale values of failed
+ * reconstructions (as the extraction leaves them) and NaN density of real
+ * files. With --flux it also writes a smooth stand-in of the Honda flux tables.
+ * With --sparse-reco the reconstruction columns go to the strategy trees, as
+ * ExtractAntDSTInfo --sparse-reco writes them (SparseReco.h).
+ *
+ * Usage: GenerateSel <output.root> [--entries N] [--seed S] [--events-per-run N]
+ *                    [--nan-fraction f] [--flux <flux.root>] [--sparse-reco]
+ */
+
+#include <TFile.h>
+#include <TH2D.h>
+#include <TMath.h>
+#include <TRandom3.h>
+#include <TTree.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SelMetadata.h"
+#include "SelSchema.h"
+#include "SparseReco.h"
+#include "StageOptions.h"
+
+using namespace std;
+
+// One entry of the extracted tree, with the branches of the schema
+struct SelRow
+{
+#define X(type, name, strategy) type name;
+    SEL_SCHEMA(X)
+#undef X
+};
+
+// NNFit columns read by add_SWIM_Branches and CutSelection, as written by MergeNNFit
+struct NNFitRow
+{
+    float track_theta, shower_theta, track_log10_energy, shower_log10_energy;
+    float track_sigma_theta, shower_sigma_theta;
+    float track_sigma_r_closest, track_sigma_z_closest, shower_sigma_r_vertex, shower_sigma_z_vertex;
+};
+
+// Fraction of events with a successful fit, per strategy (ERecoStrategy order)
+const double kRecoEfficiency[kNRecoStrategies] = {0.90, 0.95, 0.80, 0.90, 0.60, 0.70};
+
+// Reconstructed double column of the schema, and how its value is drawn
+enum ERecoKind { kGeneric, kCosZenith, kZenith, kEnergy };
+struct RecoSlot
+{
+    double *value;
+    ERecoStrategy strategy;
+    ERecoKind kind;
+};
+
+static bool EndsWith(const string &name, const string &suffix)
+{
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void AddRecoSlot(vector<RecoSlot> &slots, double &value, const string &name, ERecoStrategy strategy)
+{
+    if (strategy == kNoStrategy)
+        return;
+    ERecoKind kind = kGeneric;
+    if (EndsWith(name, "_cos_zenith"))
+        kind = kCosZenith;
+    else if (EndsWith(name, "_zenith_deg"))
+        kind = kZenith;
+    else if (name.find("energy") != string::npos)
+        kind = kEnergy;
+    slots.push_back({&value, strategy, kind});
+}
+
+// Only the double columns are reconstructed values
+template <typename T>
+static void AddRecoSlot(vector<RecoSlot> &, T &, const string &, ERecoStrategy) {}
+
+// Data/MC ratio of the years, roughly as in the extraction
+static float DataMCRatioOfYear(int year)
+{
+    return 1.0 + 0.2 * ((year * 7) % 10) / 10.;
+}
+
+// Smooth stand-in of the Honda tables: log10 flux falling as E^-3.7, larger near the horizon
+static void WriteFluxStandIn(const string &path)
+{
+    const char *names[4] = {"h_nue_logElogF", "h_anue_logElogF", "h_numu_logElogF", "h_anumu_logElogF"};
+    const double norm[4] = {2.2, 2.1, 2.5, 2.4};
+
+    TFile *file = TFile::Open(path.c_str(), "RECREATE");
+    for (int h = 0; h < 4; h++)
+    {
+        TH2D hist(names[h], names[h], 100, -1, 5, 40, -1, 1);
+        for (int i = 1; i <= hist.GetNbinsX(); i++)
+            for (int j = 1; j <= hist.GetNbinsY(); j++)
+            {
+                double log_E = hist.GetXaxis()->GetBinCenter(i);
+                double cos_zen = hist.GetYaxis()->GetBinCenter(j);
+                hist.SetBinContent(i, j, norm[h] - 3.7 * log_E + 0.3 * (1 - fabs(cos_zen)));
+            }
+        hist.Write();
+    }
+    file->Close();
+    cout << "Flux stand-in written to " << path << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"entries", "seed", "events-per-run", "nan-fraction", "flux"});
+    const vector<string> &args = options.Positional();
+
+    if (args.size() != 1)
+    {
+        cerr << "Usage: " << argv[0] << " <output.root> [--entries N] [--seed S] [--events-per-run N] [--nan-fraction f] [--flux <flux.root>] [--sparse-reco]" << endl;
+        return 1;
+    }
+
+    string output_file = args[0];
+    Long64_t entries = atoll(options.Get("entries", "1000000").c_str());
+    TRandom3 random(atoi(options.Get("seed", "1").c_str()));
+    double events_per_run = atof(options.Get("events-per-run", "2000").c_str());
+    double nan_fraction = atof(options.Get("nan-fraction", "0.001").c_str());
+
+    if (options.Has("flux"))
+        WriteFluxStandIn(options.Get("flux"));
+
+    cout << "Generating " << entries << " entries in " << output_file << endl;
+
+    TFile *file = TFile::Open(output_file.c_str(), "RECREATE");
+    TTree *tree = new TTree("sel", "Synthetic selected events");
+
+    // The reconstruction variables keep their value when a fit fails, as in the extraction
+    SelRow row = SelRow();
+    NNFitRow nnfit = NNFitRow();
+    vector<RecoSlot> slots;
+    SparseRecoWriter reco(tree, options);
+#define X(type, name, strategy)         \
+    reco.Branch(#name, &row.name);      \
+    AddRecoSlot(slots, row.name, #name, strategy);
+    SEL_SCHEMA(X)
+#undef X
+
+    tree->Branch("NNFitTrack_Theta", &nnfit.track_theta, "NNFitTrack_Theta/F");
+    tree->Branch("NNFitShower_Theta", &nnfit.shower_theta, "NNFitShower_Theta/F");
+    tree->Branch("NNFitTrack_Log10Energy", &nnfit.track_log10_energy, "NNFitTrack_Log10Energy/F");
+    tree->Branch("NNFitShower_Log10Energy", &nnfit.shower_log10_energy, "NNFitShower_Log10Energy/F");
+    tree->Branch("NNFitTrack_SigmaTheta", &nnfit.track_sigma_theta, "NNFitTrack_SigmaTheta/F");
+    tree->Branch("NNFitShower_SigmaTheta", &nnfit.shower_sigma_theta, "NNFitShower_SigmaTheta/F");
+    tree->Branch("NNFitTrack_SigmaRClosest", &nnfit.track_sigma_r_closest, "NNFitTrack_SigmaRClosest/F");
+    tree->Branch("NNFitTrack_SigmaZClosest", &nnfit.track_sigma_z_closest, "NNFitTrack_SigmaZClosest/F");
+    tree->Branch("NNFitShower_SigmaRVertex", &nnfit.shower_sigma_r_vertex, "NNFitShower_SigmaRVertex/F");
+    tree->Branch("NNFitShower_SigmaZVertex", &nnfit.shower_sigma_z_vertex, "NNFitShower_SigmaZVertex/F");
+
+    // Run structure: the runs span the 16 years of data taking
+    Long64_t nruns = max(1LL, (Long64_t)(entries / events_per_run));
+    Long64_t events_left_in_run = 0;
+    Long64_t run_index = -1;
+    unsigned long long event_id = 0;
+
+    const int flavours[6] = {12, -12, 14, -14, 16, -16};
+    const double flavour_cdf[6] = {0.18, 0.30, 0.62, 0.85, 0.93, 1.0};
+
+    for (Long64_t i = 0; i < entries; i++)
+    {
+        if (events_left_in_run == 0)
+        {
+            run_index++;
+            events_left_in_run = 1 + random.Poisson(events_per_run);
+            event_id = 0;
+
+            int year = 2007 + (int)(16 * min(run_index, nruns - 1) / nruns);
+            int day_of_year = (int)(365 * (double)(run_index % max(1LL, nruns / 16)) / max(1LL, nruns / 16));
+            row.run = 25416 + (int)run_index;
+            row.run_id = row.run;
+            row.Date = year * 10000 + (1 + day_of_year / 31) * 100 + 1 + day_of_year % 28;
+            row.MJD = 54101 + 365.25 * (year - 2007) + day_of_year;
+            row.run_duration = random.Uniform(7200, 14400);
+            row.run_duration_dq = row.run_duration * random.Uniform(0.9, 1);
+            row.RunDurationYear = row.run_duration / (365.25 * 86400);
+            row.RunQuality = random.Integer(5);
+            row.Scan = random.Integer(2);
+            row.BaselineRate = random.Gaus(60, 10);
+            row.BurstFraction = random.Uniform(0, 0.4);
+            row.RatioActive = random.Uniform(0.6, 1);
+            row.DataMCRatio = DataMCRatioOfYear(year);
+            row.ngen = 1e10;
+            row.E_min_gen = 1;
+            row.E_max_gen = 1e4;
+        }
+        events_left_in_run--;
+
+        // Event
+        row.event_id = event_id++;
+        row.event_counter_trigger = row.event_id;
+        row.frame_index = random.Integer(100000);
+        row.t3N_active = random.Rndm() < 0.9;
+        row.tT2_active = random.Rndm() < 0.5;
+        row.tT3_active = random.Rndm() < 0.8;
+        row.tTQ_active = random.Rndm() < 0.3;
+
+        // True neutrino (or atmospheric muon)
+        bool is_muon = random.Rndm() < 0.05;
+        double u = random.Rndm();
+        int f = 0;
+        while (flavour_cdf[f] < u)
+            f++;
+        row.type = is_muon ? 13 : flavours[f];
+        row.is_neutrino = !is_muon;
+        int abs_type = abs(row.type);
+        if (is_muon)
+            row.interaction_type = 1;
+        else if (random.Rndm() < 0.25)
+            row.interaction_type = 0;
+        else
+            row.interaction_type = (abs_type == 16 && random.Rndm() < 0.17) ? 2 : 1;
+        row.is_cc = row.interaction_type != 0;
+
+        row.energy_true = pow(10, random.Uniform(0, 4));
+        row.cos_zenith_true = random.Uniform(-1, 1);
+        row.azimuthdeg_true = random.Uniform(0, 360);
+        row.bjorken_y_true = random.Rndm();
+        row.pos_x_true = random.Uniform(-200, 200);
+        row.pos_y_true = random.Uniform(-200, 200);
+        row.pos_z_true = random.Uniform(-250, 250);
+        row.w2 = pow(10, random.Gaus(8, 1));
+        row.w3 = row.w2 * pow(10, random.Gaus(-12, 0.5));
+        row.w_honda = row.w3;
+        row.w_muon = is_muon ? random.Exp(1e-3) : 0;
+
+        // Reconstructions: the flags, then the values of the successful fits
+        bool passed[kNRecoStrategies];
+        double reco_cos_zenith[kNRecoStrategies];
+        for (int s = 0; s < kNRecoStrategies; s++)
+        {
+            passed[s] = random.Rndm() < kRecoEfficiency[s];
+            reco_cos_zenith[s] = max(-1., min(1., row.cos_zenith_true + random.Gaus(0, 0.1)));
+        }
+#define S(strategy, flag) row.flag = passed[strategy];
+        SEL_STRATEGY_FLAGS(S)
+#undef S
+
+        for (const RecoSlot &slot : slots)
+        {
+            if (!passed[slot.strategy])
+                continue;
+            if (random.Rndm() < nan_fraction)
+                *slot.value = NAN;
+            else if (slot.kind == kCosZenith)
+                *slot.value = reco_cos_zenith[slot.strategy];
+            else if (slot.kind == kZenith)
+                *slot.value = acos(reco_cos_zenith[slot.strategy]) * TMath::RadToDeg();
+            else if (slot.kind == kEnergy)
+                *slot.value = row.energy_true * pow(10, random.Gaus(0, 0.3));
+            else
+                *slot.value = random.Uniform(0, 100);
+        }
+
+        // NNFit: theta is the direction of origin, log10 energy with 0.2 dex resolution
+        double theta_true = acos(-row.cos_zenith_true) * TMath::RadToDeg();
+        nnfit.track_theta = theta_true + random.Gaus(0, 3);
+        nnfit.shower_theta = theta_true + random.Gaus(0, 10);
+        nnfit.track_log10_energy = log10(row.energy_true) + random.Gaus(0, 0.2);
+        nnfit.shower_log10_energy = log10(row.energy_true) + random.Gaus(0, 0.15);
+        nnfit.track_sigma_theta = random.Exp(3);
+        nnfit.shower_sigma_theta = random.Exp(10);
+        nnfit.track_sigma_r_closest = random.Exp(6);
+        nnfit.track_sigma_z_closest = random.Exp(8);
+        nnfit.shower_sigma_r_vertex = random.Exp(12);
+        nnfit.shower_sigma_z_vertex = random.Exp(12);
+
+        tree->Fill();
+        reco.Fill();
+
+        if ((i + 1) % 1000000 == 0)
+            cout << "Generated " << i + 1 << " entries out of " << entries << endl;
+    }
+
+    file->cd();
+    tree->Write();
+    for (TTree *strategy : reco.Trees())
+        strategy->Write();
+    file->Close();
+    AnnotateSelFile(output_file);
+
+    cout << "Generated " << entries << " entries in " << run_index + 1 << " runs" << endl;
+    return 0;
+}
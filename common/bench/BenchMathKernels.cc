@@ -0,0 +1,111 @@
+/**
+ * @brief Accuracy and throughput of the batched math kernels against libm.
+ * For each kernel, uniform inputs over the range used in the pipeline are
+ * transformed by the kernel and by the scalar libm call. The error of both is
+ * measured in ULP against a long double reference.
+ *
+ * Usage: bin/BenchMathKernels [n_values] (default 10M)
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "AlignedVector.h"
+#include "MathKernels.h"
+
+using namespace std;
+
+// |y - ref| in units of the last place of ref
+double UlpError(double y, long double ref)
+{
+    if (isnan(y) && isnan(ref))
+        return 0;
+    double r = (double)ref;
+    if (r == 0)
+        return y == 0 ? 0 : INFINITY;
+    long double ulp = ldexpl(1.0L, ilogb(r) - 52);
+    return (double)(fabsl((long double)y - ref) / ulp);
+}
+
+double Seconds(function<void()> f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void Bench(const string &name, double low, double high, bool log_uniform, size_t n,
+           function<void(const double *, double *, size_t)> kernel,
+           function<double(double)> scalar,
+           function<long double(long double)> reference)
+{
+    mt19937_64 rng(12345);
+    uniform_real_distribution<double> dist(log_uniform ? log10(low) : low, log_uniform ? log10(high) : high);
+    AlignedVector<double> x(n), y_kernel(n), y_scalar(n);
+    for (size_t i = 0; i < n; i++)
+        x[i] = log_uniform ? pow(10, dist(rng)) : dist(rng);
+
+    double t_kernel = Seconds([&]() { kernel(x.data(), y_kernel.data(), n); });
+    double t_scalar = Seconds([&]() { for (size_t i = 0; i < n; i++) y_scalar[i] = scalar(x[i]); });
+
+    double max_kernel = 0, max_scalar = 0;
+    size_t n_exact = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        long double ref = reference(x[i]);
+        double e_kernel = UlpError(y_kernel[i], ref);
+        max_kernel = max(max_kernel, e_kernel);
+        max_scalar = max(max_scalar, UlpError(y_scalar[i], ref));
+        if (e_kernel <= 0.5)
+            n_exact++;
+    }
+
+    printf("%-10s [%9.3g, %9.3g]  kernel %6.2f ns  libm %6.2f ns  speedup %5.1fx  "
+           "max ulp kernel %.2f libm %.2f  correctly rounded %.2f%%\n",
+           name.c_str(), low, high, 1e9 * t_kernel / n, 1e9 * t_scalar / n, t_scalar / t_kernel,
+           max_kernel, max_scalar, 100.0 * n_exact / n);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    const long double pi = 3.141592653589793238462643383279502884L;
+
+    Bench("Pow10", -3, 8, false, n,
+          [](const double *x, double *y, size_t m) { Pow10(x, y, m); },
+          [](double x) { return pow(10.0, x); },
+          [](long double x) { return powl(10.0L, x); });
+    Bench("Log10", 1e-3, 1e9, true, n,
+          [](const double *x, double *y, size_t m) { Log10(x, y, m); },
+          [](double x) { return log10(x); },
+          [](long double x) { return log10l(x); });
+    Bench("Cos", 0, M_PI, false, n,
+          [](const double *x, double *y, size_t m) { Cos(x, y, m); },
+          [](double x) { return cos(x); },
+          [](long double x) { return cosl(x); });
+    Bench("Cos", -1e4, 1e4, false, n,
+          [](const double *x, double *y, size_t m) { Cos(x, y, m); },
+          [](double x) { return cos(x); },
+          [](long double x) { return cosl(x); });
+    Bench("CosDeg", -360, 360, false, n,
+          [](const double *x, double *y, size_t m) { CosDeg(x, y, m); },
+          [](double x) { return cos(x * M_PI / 180.0); },
+          [pi](long double x) {
+              // reduce in degrees first, exactly, so the zeros at 90 + 180 k are resolved
+              long double k = nearbyintl(x / 90.0L), r = (x - 90.0L * k) * pi / 180.0L;
+              long double v = fmodl(fabsl(k), 2.0L) == 1.0L ? sinl(r) : cosl(r);
+              long double q = fmodl(fmodl(k, 4.0L) + 4.0L, 4.0L);
+              return (q == 1.0L || q == 2.0L) ? -v : v;
+          });
+    Bench("RadToDeg", -M_PI, M_PI, false, n,
+          [](const double *x, double *y, size_t m) { RadToDeg(x, y, m); },
+          [](double x) { return x * (180.0 / M_PI); },
+          [pi](long double x) { return x * 180.0L / pi; });
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file AlignedVector.h
+ * @brief std::vector with cache-line aligned storage for the columnar kernels.
+ */
+
+#ifndef ALIGNEDVECTOR_H
+#define ALIGNEDVECTOR_H
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocator handing out 64-byte aligned storage (one cache line / AVX-512 register)
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    static const std::size_t alignment = 64;
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        std::size_t bytes = ((n * sizeof(T) + alignment - 1) / alignment) * alignment;
+        void *p = std::aligned_alloc(alignment, bytes > 0 ? bytes : alignment);
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, std::size_t) { std::free(p); }
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U> other;
+    };
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif // ALIGNEDVECTOR_H
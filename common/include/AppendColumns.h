@@ -0,0 +1,174 @@
+/**
+ * @file AppendColumns.h
+ * @brief Output tree of a stage that only adds (or recomputes) a few columns.
+ * The branches that are not touched are copied with their compressed baskets
+ * as they are (CloneTree "fast"), without being read, decompressed or
+ * compressed again. Only the new columns are filled, with TBranch::BackFill,
+ * which flushes their baskets at the cluster boundaries of the copied tree.
+ * The cost of a stage then scales with the number of columns it writes.
+ *
+ * Columns that are recomputed from their old values are listed as replaced:
+ * they are left out of the copy, stay readable from the input tree, and are
+ * added again with AddColumn. Write() puts them back at the place they had
+ * in the input, so the order of the branches is that of a CloneTree(0)
+ * copy; the new columns follow, in the order they were added.
+ *
+ * For a range of entries that is not the whole tree (--entries, --shard, see
+ * EntryRange.h) the baskets cannot be copied: the copied branches are read
+ * and filled entry by entry, whatever their branch status, which costs as
+ * much as a CloneTree(0) copy.
+ *
+ * Usage:
+ *   output_file->cd();
+ *   AppendColumnsWriter writer(input_tree, {"w2"});
+ *   writer.AddColumn("w_osc", &w_osc, "w_osc/D");
+ *   writer.AddColumn("w2", &w2, "w2/D");
+ *   for (Long64_t i = 0; i < n; i++) { ...; writer.Fill(); }
+ *   writer.Write();
+ */
+
+#ifndef APPENDCOLUMNS_H
+#define APPENDCOLUMNS_H
+
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class AppendColumnsWriter
+{
+public:
+    // The copy of the entries [first, last) (all by default) is created in the current directory, like CloneTree
+    AppendColumnsWriter(TTree *input, const std::vector<std::string> &replaced = {}, Long64_t first = 0, Long64_t last = -1)
+        : fFirst(first), fFilled(0)
+    {
+        TObjArray *input_branches = input->GetListOfBranches();
+        for (int b = 0; b < input_branches->GetEntriesFast(); b++)
+            fInputOrder.push_back(input_branches->At(b)->GetName());
+        for (const std::string &name : replaced)
+        {
+            if (!input->GetBranch(name.c_str()))
+            {
+                std::cerr << "Error: branch " << name << " to replace not found" << std::endl;
+                exit(1);
+            }
+            input->SetBranchStatus(name.c_str(), 0);
+        }
+        Long64_t nentries = input->GetEntries();
+        fEntries = last < 0 ? nentries - first : last - first;
+        fFast = first == 0 && fEntries == nentries;
+        // inactive branches are not cloned
+        fOutput = input->CloneTree(fFast ? -1 : 0, fFast ? "fast" : "");
+        if (fOutput && !fFast)
+        {
+            TObjArray *branches = fOutput->GetListOfBranches();
+            for (int b = 0; b < branches->GetEntriesFast(); b++)
+                fCopied.push_back(input->GetBranch(branches->At(b)->GetName()));
+        }
+        for (const std::string &name : replaced)
+            input->SetBranchStatus(name.c_str(), 1);
+
+        if (!fOutput || (fFast && fOutput->GetEntries() != nentries))
+        {
+            std::cerr << "Error: could not copy the tree " << input->GetName() << std::endl;
+            exit(1);
+        }
+    }
+
+    AppendColumnsWriter(const AppendColumnsWriter &) = delete;
+    AppendColumnsWriter &operator=(const AppendColumnsWriter &) = delete;
+
+    // New column filled from address at every Fill(); leaflist as in TTree::Branch, e.g. "w_osc/D"
+    TBranch *AddColumn(const char *name, void *address, const char *leaflist)
+    {
+        if (fFilled > 0)
+        {
+            std::cerr << "Error: column " << name << " added after the first Fill" << std::endl;
+            exit(1);
+        }
+        if (fOutput->GetBranch(name))
+        {
+            std::cerr << "Error: branch " << name << " already exists, list it as replaced" << std::endl;
+            exit(1);
+        }
+        TBranch *branch = fOutput->Branch(name, address, leaflist);
+        fColumns.push_back(branch);
+        return branch;
+    }
+
+    // Fill the new columns of the next entry
+    void Fill()
+    {
+        if (fFast)
+        {
+            for (std::size_t c = 0; c < fColumns.size(); c++)
+                fColumns[c]->BackFill();
+        }
+        else
+        {
+            // the clone shares the buffers of the input branches
+            for (std::size_t b = 0; b < fCopied.size(); b++)
+                fCopied[b]->GetEntry(fFirst + fFilled, 1);
+            fOutput->Fill();
+        }
+        fFilled++;
+    }
+
+    TTree *Tree() const { return fOutput; }
+    Long64_t GetEntries() const { return fOutput->GetEntries(); }
+
+    // Write the tree to its directory, once every entry has been filled
+    void Write()
+    {
+        if ((!fFast || !fColumns.empty()) && fFilled != fEntries)
+        {
+            std::cerr << "Error: " << fFilled << " entries filled out of " << fEntries << std::endl;
+            exit(1);
+        }
+        RestoreOrder();
+        fOutput->Write("", TObject::kOverwrite);
+    }
+
+private:
+    // Order the branches, and their leaves, as in the input; the branches that are not in the input go last
+    void RestoreOrder()
+    {
+        TObjArray *branches = fOutput->GetListOfBranches();
+        std::vector<TBranch *> order;
+        for (const std::string &name : fInputOrder)
+            if (TBranch *branch = fOutput->GetBranch(name.c_str()))
+                order.push_back(branch);
+        for (int b = 0; b < branches->GetEntriesFast(); b++)
+            if (std::find(order.begin(), order.end(), branches->At(b)) == order.end())
+                order.push_back(static_cast<TBranch *>(branches->At(b)));
+
+        std::vector<TObject *> leaves;
+        for (TBranch *branch : order)
+            for (int l = 0; l < branch->GetListOfLeaves()->GetEntriesFast(); l++)
+                leaves.push_back(branch->GetListOfLeaves()->At(l));
+        // the slots are overwritten in place, the lists do not own the branches
+        for (std::size_t b = 0; b < order.size(); b++)
+            branches->AddAt(order[b], b);
+        TObjArray *tree_leaves = fOutput->GetListOfLeaves();
+        if ((int)leaves.size() == tree_leaves->GetEntriesFast())
+            for (std::size_t l = 0; l < leaves.size(); l++)
+                tree_leaves->AddAt(leaves[l], l);
+    }
+
+    TTree *fOutput;
+    // branch names of the input, in order
+    std::vector<std::string> fInputOrder;
+    std::vector<TBranch *> fColumns;
+    // branches of the input read for the copy of a range
+    std::vector<TBranch *> fCopied;
+    bool fFast;
+    Long64_t fFirst, fEntries, fFilled;
+};
+
+#endif // APPENDCOLUMNS_H
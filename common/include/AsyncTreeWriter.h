@@ -0,0 +1,279 @@
+/**
+ * @file AsyncTreeWriter.h
+ * @brief --async-write: fill an output tree on a writer thread, so that the compression of its baskets overlaps the event loop.
+ * TTree::Fill compresses a basket when it is full and flushes the baskets of
+ * a cluster at every SetAutoFlush boundary; on the event loop thread, the
+ * loop waits for it. With --async-write, Fill() copies the values of the
+ * entry from the branch buffers into a chunk of rows and returns. A writer
+ * thread takes the chunks in order, copies each row into buffers of its own,
+ * which the branches point to, and calls TTree::Fill.
+ *
+ * The tree is filled by one thread with the same entries in the same order,
+ * so the baskets, clusters and file layout are those of a synchronous run.
+ * ROOT's implicit multi-threading compresses the baskets of a flush in
+ * parallel but writes them in the order the tasks finish, which changes the
+ * layout from one run to the next; it is not used.
+ *
+ * The queue holds --write-queue <MB> of rows (64 by default), in four
+ * chunks; the event loop waits when they are all full. Finish() prints how
+ * long each side waited for the other: a writer that is never idle means
+ * the step is bound by the compression.
+ *
+ * The branches must be scalars or fixed-size arrays with one leaf (the sel
+ * schema, the NNFit and SWIM columns); other trees are filled on the event
+ * loop thread, as without the option. The trees of AppendColumnsWriter fill
+ * only the new columns with BackFill and are not handled.
+ *
+ * Usage:
+ *   AsyncTreeWriter writer(output_tree, options, memory);   // options {"write-queue"}, after the branches are created
+ *   for (...) { ...; writer.Fill(); }
+ *   writer.Finish();                                         // before output_tree->Write()
+ */
+
+#ifndef ASYNCTREEWRITER_H
+#define ASYNCTREEWRITER_H
+
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MemoryBudget.h"
+#include "StageOptions.h"
+#include "Trace.h"
+
+class AsyncTreeWriter
+{
+public:
+    AsyncTreeWriter(TTree *tree, const StageOptions &options, MemoryBudget &memory)
+        : fTree(tree), fEnabled(options.Has("async-write")), fRowBytes(0), fRowsPerChunk(0), fCurrent(NULL),
+          fStop(false), fWaitFull(0), fWaitEmpty(0), fQueued(0), fFailed(0)
+    {
+        if (!fEnabled)
+            return;
+        Long64_t queue = (Long64_t)(atof(options.Get("write-queue", "64").c_str()) * kMB);
+        if (queue <= 0)
+        {
+            std::cerr << "Error: --write-queue " << options.Get("write-queue") << " is not a size in MB" << std::endl;
+            exit(1);
+        }
+        if (!Layout())
+        {
+            fEnabled = false;
+            return;
+        }
+        fRowsPerChunk = std::max(queue / kChunks / (Long64_t)fRowBytes, 1LL);
+        fChunks.resize(kChunks);
+        for (Chunk &chunk : fChunks)
+        {
+            chunk.data.resize(fRowsPerChunk * fRowBytes / sizeof(double));
+            fFree.push_back(&chunk);
+        }
+        memory.Reserve(std::string(tree->GetName()) + " (write queue)", kChunks * fRowsPerChunk * fRowBytes);
+
+        // the branches now read the rows from the buffers of the writer thread
+        for (Column &column : fColumns)
+            column.branch->SetAddress(reinterpret_cast<char *>(fRow.data()) + column.offset);
+        ROOT::EnableThreadSafety();
+        fWriter = std::thread(&AsyncTreeWriter::Write, this);
+        printf("Writer of %s: asynchronous, %lld rows of %zu bytes per chunk, %d chunks\n", tree->GetName(),
+               fRowsPerChunk, fRowBytes, kChunks);
+    }
+
+    ~AsyncTreeWriter() { Finish(); }
+
+    AsyncTreeWriter(const AsyncTreeWriter &) = delete;
+    AsyncTreeWriter &operator=(const AsyncTreeWriter &) = delete;
+
+    // Fill the entry that is in the branch buffers now
+    void Fill()
+    {
+        if (!fEnabled)
+        {
+            fTree->Fill();
+            return;
+        }
+        if (!fCurrent)
+            fCurrent = Acquire();
+        char *row = reinterpret_cast<char *>(fCurrent->data.data()) + fCurrent->rows * fRowBytes;
+        for (const Column &column : fColumns)
+            memcpy(row + column.offset, column.source, column.size);
+        if (++fCurrent->rows == fRowsPerChunk)
+        {
+            Submit(fCurrent);
+            fCurrent = NULL;
+        }
+    }
+
+    // Wait until every entry is in the tree; the tree can then be written
+    void Finish()
+    {
+        if (!fWriter.joinable())
+            return;
+        if (fCurrent && fCurrent->rows > 0)
+            Submit(fCurrent);
+        fCurrent = NULL;
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fStop = true;
+        }
+        fFilled.notify_one();
+        fWriter.join();
+
+        if (fFailed > 0)
+        {
+            std::cerr << "Error: " << fFailed << " entries of " << fTree->GetName() << " could not be written" << std::endl;
+            exit(1);
+        }
+        printf("Writer of %s: %lld entries, event loop waited %.2f s for a free chunk, writer idle %.2f s\n",
+               fTree->GetName(), fQueued, fWaitFull, fWaitEmpty);
+    }
+
+private:
+    static constexpr double kMB = 1024. * 1024.;
+    static const int kChunks = 4;
+
+    struct Column
+    {
+        TBranch *branch;
+        const char *source;
+        std::size_t offset, size;
+    };
+
+    struct Chunk
+    {
+        // doubles, so that every column of a row is aligned
+        std::vector<double> data;
+        Long64_t rows = 0;
+    };
+
+    // Offsets of the branches in a row; false if a branch cannot be copied as bytes
+    bool Layout()
+    {
+        TObjArray *branches = fTree->GetListOfBranches();
+        for (int b = 0; b < branches->GetEntriesFast(); b++)
+        {
+            TBranch *branch = static_cast<TBranch *>(branches->At(b));
+            TObjArray *leaves = branch->GetListOfLeaves();
+            TLeaf *leaf = leaves->GetEntriesFast() == 1 ? static_cast<TLeaf *>(leaves->At(0)) : NULL;
+            if (branch->IsA() != TBranch::Class() || !leaf || leaf->GetLeafCount() || leaf->InheritsFrom("TLeafC") ||
+                !leaf->GetValuePointer())
+            {
+                std::cerr << "Warning: branch " << branch->GetName() << " of " << fTree->GetName()
+                          << " is not a scalar or fixed-size array, the tree is filled on the event loop thread" << std::endl;
+                return false;
+            }
+            std::size_t size = (std::size_t)leaf->GetLenType() * leaf->GetLen();
+            // the current buffer of the branch, a CloneTree shares that of the input
+            fColumns.push_back(Column{branch, static_cast<const char *>(leaf->GetValuePointer()), fRowBytes, size});
+            fRowBytes += (size + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+        }
+        if (fColumns.empty())
+            return false;
+        fRow.resize(fRowBytes / sizeof(double));
+        return true;
+    }
+
+    Chunk *Acquire()
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        if (fFree.empty())
+        {
+            TRACE_SCOPE("WaitForWriter");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            fDrained.wait(lock, [this] { return !fFree.empty(); });
+            fWaitFull += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        Chunk *chunk = fFree.front();
+        fFree.pop_front();
+        chunk->rows = 0;
+        return chunk;
+    }
+
+    void Submit(Chunk *chunk)
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fReady.push_back(chunk);
+            fQueued += chunk->rows;
+        }
+        fFilled.notify_one();
+    }
+
+    // The writer thread: the chunks in the order they were submitted
+    void Write()
+    {
+        for (;;)
+        {
+            Chunk *chunk;
+            {
+                std::unique_lock<std::mutex> lock(fMutex);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                fFilled.wait(lock, [this] { return !fReady.empty() || fStop; });
+                fWaitEmpty += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (fReady.empty())
+                    return;
+                chunk = fReady.front();
+                fReady.pop_front();
+            }
+
+            {
+                TRACE_SCOPE("WriterFill");
+                const char *row = reinterpret_cast<const char *>(chunk->data.data());
+                char *target = reinterpret_cast<char *>(fRow.data());
+                for (Long64_t r = 0; r < chunk->rows; r++, row += fRowBytes)
+                {
+                    for (const Column &column : fColumns)
+                        memcpy(target + column.offset, row + column.offset, column.size);
+                    if (fTree->Fill() < 0)
+                        fFailed++;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(fMutex);
+                fFree.push_back(chunk);
+            }
+            fDrained.notify_one();
+        }
+    }
+
+    TTree *fTree;
+    bool fEnabled;
+    std::vector<Column> fColumns;
+    std::size_t fRowBytes;
+    Long64_t fRowsPerChunk;
+    // the row that the branches point to, written by the writer thread only
+    std::vector<double> fRow;
+    std::vector<Chunk> fChunks;
+    Chunk *fCurrent;
+
+    // guarded by fMutex
+    std::mutex fMutex;
+    std::condition_variable fFilled, fDrained;
+    std::deque<Chunk *> fReady, fFree;
+    bool fStop;
+    double fWaitFull, fWaitEmpty;
+    Long64_t fQueued;
+
+    // written by the writer thread, read after it has joined
+    Long64_t fFailed;
+
+    std::thread fWriter;
+};
+
+#endif // ASYNCTREEWRITER_H
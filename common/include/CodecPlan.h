@@ -0,0 +1,163 @@
+/**
+ * @file CodecPlan.h
+ * @brief --codec-plan: compression of every branch of the output trees, from a plan written by AutotuneCodecs.
+ * A plan is a text file with one "<branch> <ROOT setting>" per line, the
+ * setting being 100 * algorithm + level as for TFile (505 is ZSTD 5, 404 is
+ * LZ4 4). The branch "*" sets the branches that are not listed, e.g. the
+ * columns added by the later steps; without it they keep the compression of
+ * the file. Everything after a '#' is a comment:
+ *
+ *   *              505
+ *   run_id         404   # LZ4 4, ratio 41.2, 2650 MB/s
+ *   aafit_lambda   207   # LZMA 7, ratio 1.9, 95 MB/s
+ *
+ * The settings apply to the baskets written after Apply(). Baskets copied as
+ * they are (CloneTree "fast" in AppendColumnsWriter, the basket copy of
+ * MergeSel) keep the compression they were written with.
+ *
+ * Usage:
+ *   CodecPlan codecs(options);   // options {"codec-plan"}
+ *   codecs.Apply(output_tree);   // after all its branches are created
+ */
+
+#ifndef CODECPLAN_H
+#define CODECPLAN_H
+
+#include <Compression.h>
+#include <TBranch.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "StageOptions.h"
+
+class CodecPlan
+{
+public:
+    CodecPlan() {}
+
+    explicit CodecPlan(const StageOptions &options)
+    {
+        if (options.Has("codec-plan"))
+            Read(options.Get("codec-plan"));
+    }
+
+    bool Enabled() const { return !fSettings.empty(); }
+
+    // ROOT setting of a branch, that of "*" if it is not listed, 0 for none
+    int Setting(const std::string &branch) const
+    {
+        std::map<std::string, int>::const_iterator it = fSettings.find(branch);
+        if (it == fSettings.end())
+            it = fSettings.find("*");
+        return it == fSettings.end() ? 0 : it->second;
+    }
+
+    void Set(const std::string &branch, int setting, const std::string &comment = "")
+    {
+        fSettings[branch] = setting;
+        fComments[branch] = comment;
+    }
+
+    void Read(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::cerr << "Error: codec plan " << path << " not found" << std::endl;
+            exit(1);
+        }
+        std::string line;
+        for (int n = 1; std::getline(in, line); n++)
+        {
+            std::string comment;
+            std::string::size_type hash = line.find('#');
+            if (hash != std::string::npos)
+            {
+                comment = line.substr(hash + 1);
+                line.erase(hash);
+            }
+            std::istringstream fields(line);
+            std::string branch, extra;
+            int setting = 0;
+            if (!(fields >> branch))
+                continue;
+            if (!(fields >> setting) || (fields >> extra) || !Valid(setting))
+            {
+                std::cerr << "Error: line " << n << " of the codec plan " << path << " is not \"<branch> <ROOT setting>\"" << std::endl;
+                exit(1);
+            }
+            Set(branch, setting, comment);
+        }
+    }
+
+    void Write(const std::string &path, const std::string &header) const
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            std::cerr << "Error: cannot write the codec plan " << path << std::endl;
+            exit(1);
+        }
+        out << header;
+        // "*" sorts before the branch names
+        for (const std::pair<const std::string, int> &entry : fSettings)
+        {
+            char line[256];
+            const std::string &comment = fComments.at(entry.first);
+            snprintf(line, sizeof(line), "%-32s %4d%s%s\n", entry.first.c_str(), entry.second,
+                     comment.empty() ? "" : "   #", comment.c_str());
+            out << line;
+        }
+    }
+
+    // Compression of the branches of an output tree, after they are created
+    void Apply(TTree *tree) const
+    {
+        if (!Enabled())
+            return;
+        int nset = 0;
+        TObjArray *branches = tree->GetListOfBranches();
+        for (int b = 0; b < branches->GetEntriesFast(); b++)
+        {
+            TBranch *branch = static_cast<TBranch *>(branches->At(b));
+            int setting = Setting(branch->GetName());
+            if (setting <= 0)
+                continue;
+            // also sets the sub-branches
+            branch->SetCompressionSettings(setting);
+            nset++;
+        }
+        std::cout << "Codec plan: " << nset << " of " << branches->GetEntriesFast() << " branches of " << tree->GetName() << " set" << std::endl;
+    }
+
+    // "ZSTD 5" for 505
+    static std::string Name(int setting)
+    {
+        static const char *names[] = {"default", "ZLIB", "LZMA", "old ZLIB", "LZ4", "ZSTD"};
+        int algorithm = setting / 100;
+        std::string name = algorithm >= 0 && algorithm <= 5 ? names[algorithm] : "unknown";
+        return name + " " + std::to_string(setting % 100);
+    }
+
+    // A compressing ROOT setting: a known algorithm and a level of 1 or more
+    static bool Valid(int setting)
+    {
+        int algorithm = setting / 100;
+        return setting % 100 > 0 && (algorithm == ROOT::RCompressionSetting::EAlgorithm::kZLIB || algorithm == ROOT::RCompressionSetting::EAlgorithm::kLZMA ||
+                                     algorithm == ROOT::RCompressionSetting::EAlgorithm::kLZ4 || algorithm == ROOT::RCompressionSetting::EAlgorithm::kZSTD);
+    }
+
+private:
+    std::map<std::string, int> fSettings;
+    std::map<std::string, std::string> fComments;
+};
+
+#endif // CODECPLAN_H
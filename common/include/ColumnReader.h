@@ -0,0 +1,140 @@
+/**
+ * @file ColumnReader.h
+ * @brief Column-wise reading of scalar branches into aligned arrays.
+ * A Column owns the read buffer of one branch and fills a contiguous,
+ * 64-byte aligned array for an entry range (typically one cluster), so that
+ * per-event kernels can run as simple vectorisable loops. Only the branch of
+ * the column is touched, the remaining branches of the tree stay untouched.
+ *
+ * The baskets of the range are read whole through the bulk API of TBranch
+ * (GetBulkEntries): each basket is decompressed once and its values are
+ * byte-swapped in place and copied to the array, instead of one GetEntry per
+ * entry. A basket starts at its own first entry, which may be before the
+ * range; the entries before the range are skipped. A branch that the bulk
+ * API does not support (e.g. split objects, or a basket ROOT refuses) is
+ * read entry by entry from there on.
+ */
+
+#ifndef COLUMNREADER_H
+#define COLUMNREADER_H
+
+#include <TBranch.h>
+#include <TBufferFile.h>
+#include <TLeaf.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AlignedVector.h"
+
+// ROOT leaf type name expected for each C++ column type
+template <typename T> inline const char *RootTypeName();
+template <> inline const char *RootTypeName<double>() { return "Double_t"; }
+template <> inline const char *RootTypeName<float>() { return "Float_t"; }
+template <> inline const char *RootTypeName<int>() { return "Int_t"; }
+template <> inline const char *RootTypeName<unsigned int>() { return "UInt_t"; }
+template <> inline const char *RootTypeName<bool>() { return "Bool_t"; }
+template <> inline const char *RootTypeName<long long>() { return "Long64_t"; }
+template <> inline const char *RootTypeName<unsigned long long>() { return "ULong64_t"; }
+
+// Array element of each column type; bool is stored as bytes so that the array stays contiguous
+template <typename T> struct ColumnStorage { typedef T type; };
+template <> struct ColumnStorage<bool> { typedef unsigned char type; };
+
+template <typename T>
+class Column
+{
+public:
+    typedef typename ColumnStorage<T>::type Storage;
+
+    Column(TTree *tree, const std::string &name) : fName(name), fValue(), fBuffer(TBuffer::kWrite, 32000)
+    {
+        fBranch = tree->GetBranch(name.c_str());
+        if (!fBranch)
+        {
+            std::cerr << "Error: branch " << name << " not found" << std::endl;
+            exit(1);
+        }
+
+        TLeaf *leaf = static_cast<TLeaf *>(fBranch->GetListOfLeaves()->At(0));
+        if (!leaf || std::string(leaf->GetTypeName()) != RootTypeName<T>())
+        {
+            std::cerr << "Error: branch " << name << " has type " << (leaf ? leaf->GetTypeName() : "unknown")
+                      << ", expected " << RootTypeName<T>() << std::endl;
+            exit(1);
+        }
+
+        tree->SetBranchStatus(name.c_str(), 1);
+        tree->SetBranchAddress(name.c_str(), &fValue);
+        fBulk = fBranch->GetBulkRead().SupportsBulkRead();
+    }
+
+    // The branch keeps a pointer to fValue, so the column must stay in place
+    Column(const Column &) = delete;
+    Column &operator=(const Column &) = delete;
+
+    // Read the entries [first, first + n) of the branch into the array
+    void Read(Long64_t first, Long64_t n)
+    {
+        fData.resize(n);
+        Long64_t i = fBulk ? ReadBaskets(first, n) : 0;
+        for (; i < n; i++)
+        {
+            fBranch->GetEntry(first + i);
+            fData[i] = fValue;
+        }
+    }
+
+    const Storage *Data() const { return fData.data(); }
+    Storage *Data() { return fData.data(); }
+    std::size_t Size() const { return fData.size(); }
+    const Storage &operator[](std::size_t i) const { return fData[i]; }
+
+    // Value of the last entry read entry by entry through the branch (also what a clone of the tree sees);
+    // the bulk reads do not set it
+    T &Value() { return fValue; }
+    const std::string &Name() const { return fName; }
+    TBranch *Branch() const { return fBranch; }
+
+private:
+    // Read [first, first + n) basket by basket; returns the entries read, fewer if the bulk API refuses a basket
+    Long64_t ReadBaskets(Long64_t first, Long64_t n)
+    {
+        const Long64_t *basket_entry = fBranch->GetBasketEntry();
+        Int_t nbaskets = fBranch->GetWriteBasket() + 1;
+        Long64_t i = 0;
+        while (i < n)
+        {
+            Long64_t entry = first + i;
+            // the basket that holds entry starts at basket_entry[b]
+            Int_t b = std::upper_bound(basket_entry, basket_entry + nbaskets, entry) - basket_entry - 1;
+            Int_t count = b < 0 ? -1 : fBranch->GetBulkRead().GetBulkEntries(entry, fBuffer);
+            Long64_t skip = entry - (b < 0 ? 0 : basket_entry[b]);
+            if (count <= skip)
+            {
+                fBulk = false;
+                break;
+            }
+            Long64_t take = std::min<Long64_t>(count - skip, n - i);
+            // the values follow the key of the basket, not necessarily aligned
+            std::memcpy(&fData[i], fBuffer.GetCurrent() + skip * sizeof(Storage), take * sizeof(Storage));
+            i += take;
+        }
+        return i;
+    }
+
+    std::string fName;
+    TBranch *fBranch;
+    T fValue;
+    AlignedVector<Storage> fData;
+    // basket buffer of the bulk reads
+    TBufferFile fBuffer;
+    bool fBulk;
+};
+
+#endif // COLUMNREADER_H
@@ -0,0 +1,115 @@
+/**
+ * @file Corrections.h
+ * @brief Corrections of the corrections step (CorrectTree).
+ * Shared by CorrectTree and the in-process pipeline driver, so that both
+ * write the same values.
+ */
+
+#ifndef CORRECTIONS_H
+#define CORRECTIONS_H
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "EventBlock.h"
+#include "SelSchema.h"
+
+// Reconstruction strategy: its flag branch and the columns set to NaN when the flag is false
+struct RecoStrategy
+{
+    const char *flag;
+    std::vector<const char *> columns;
+};
+
+// Strategies in the order of ERecoStrategy, with the columns of the sel schema (SelSchema.h)
+inline const std::vector<RecoStrategy> &RecoStrategies()
+{
+    static const std::vector<RecoStrategy> strategies = []() {
+        std::vector<RecoStrategy> table(kNRecoStrategies);
+        for (int s = 0; s < kNRecoStrategies; s++)
+            table[s].flag = RecoFlag(static_cast<ERecoStrategy>(s));
+        const SelField *fields = SelFields();
+        for (std::size_t f = 0; f < NSelFields(); f++)
+            if (fields[f].strategy != kNoStrategy)
+                table[fields[f].strategy].columns.push_back(fields[f].name);
+        return table;
+    }();
+    return strategies;
+}
+
+/**
+ * @brief Set the reconstruction columns to NaN where the flag of their strategy is false.
+ * Masked fill over the arrays of the last block loaded; the block must hold
+ * the flags and columns of every strategy.
+ */
+inline void MaskFailedReconstructions(EventBlock &block)
+{
+    const Long64_t n = block.Size();
+    for (const RecoStrategy &strategy : RecoStrategies())
+    {
+        const unsigned char *flag = block.Get<bool>(strategy.flag);
+        for (const char *name : strategy.columns)
+        {
+            double *x = block.Get<double>(name);
+#pragma omp simd
+            for (Long64_t i = 0; i < n; i++)
+                x[i] = flag[i] ? x[i] : NAN;
+        }
+    }
+}
+
+inline int LivetimeDataTotalDays(int year)
+{
+    // Set the number of days of data taking in ANTARES
+
+    if(year == 2007) return 205.552;
+    else if(year == 2008) return 213.276;
+    else if(year == 2009) return 228.674;
+    else if(year == 2010) return 241.034;
+    else if(year == 2011) return 281.724;
+    else if(year == 2012) return 250.137;
+    else if(year == 2013) return 281.724;
+    else if(year == 2014) return 338.085;
+    else if(year == 2015) return 352.942;
+    else if(year == 2016) return 356.574;
+    else if(year == 2017) return 355.512;
+    else if(year == 2018) return 339.637;
+    else if(year == 2019) return 351.093;
+    else if(year == 2020) return 355.093;
+    else if(year == 2021) return 350.116;
+    else if(year == 2022) return 40.824;
+    else {
+        std::cout << "Year not found" << std::endl;
+        return 0;
+    }
+}
+
+// Inputs and outputs of the weight correction of one event; w2, w3, w_honda and w_muon are corrected in place
+struct EventWeights
+{
+    double w2, w3, w_honda, w_non_osc, weight_one_year, ngen, run_duration;
+    float w_muon, DataMCRatio; // DataMCRatio is the ratio of data to MC events
+    int year, date, run_id;
+};
+
+inline void CorrectWeights(EventWeights &w)
+{
+    // Get the year from the date
+    w.year = w.date / 10000;
+
+    // Correction for runs <30412
+    if (w.run_id < 30412){w.w2 *= 0.8 ; w.w3 *= 0.8 ; w.w_honda *= 0.8 ; w.w_muon *= 0.8;}
+
+    // Apply Data/MC ratio
+    w.w2 *= w.DataMCRatio;
+    w.w3 *= w.DataMCRatio;
+    w.w_honda *= w.DataMCRatio;
+    w.w_muon *= w.DataMCRatio;
+
+    // Calculate the weight correction
+    w.w_non_osc = w.w3/w.ngen * w.run_duration;
+    w.weight_one_year = w.w_muon * 365.25 / LivetimeDataTotalDays(w.year);
+}
+
+#endif // CORRECTIONS_H
@@ -0,0 +1,159 @@
+/**
+ * @file CutKernels.h
+ * @brief Cut selections of the apply_cuts step.
+ * ApplyCuts() is the original per-event implementation and is kept as the
+ * reference. EvaluateCuts() computes the same selection over a block of
+ * columns as branch-free mask operations, which the compiler turns into SIMD
+ * code (build with -O3 -fopenmp-simd, optionally -march=native).
+ */
+
+#ifndef CUTKERNELS_H
+#define CUTKERNELS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "ZoneMap.h"
+
+enum ECutSelection
+{
+    kMuonFree,
+    kNNFitLooseCuts,
+    kNNFitHardCuts
+};
+
+inline ECutSelection ParseCutSelection(const std::string &cut_selection)
+{
+    if (cut_selection == "muon_free")
+        return kMuonFree;
+    if (cut_selection == "nnfit_loose_cuts")
+        return kNNFitLooseCuts;
+    if (cut_selection == "nnfit_hard_cuts")
+        return kNNFitHardCuts;
+
+    std::cerr << "Error: cut selection not found" << std::endl;
+    exit(1);
+}
+
+inline bool ApplyCuts(std::string cut_selection, double energy_true, double nnfit_track_cos_zenith, double nnfit_shower_cos_zenith, double nnfit_track_sigma_z_closest, double nnfit_track_sigma_r_closest, double nnfit_shower_sigma_z_vertex, double nnfit_shower_sigma_r_vertex, std::string topology)
+{
+    bool selected = false;
+
+    if (cut_selection == "muon_free"){
+        if (energy_true < 1e2 && energy_true > 1e1)
+            selected = true;
+    }
+    else if (cut_selection == "nnfit_loose_cuts"){
+        if ((topology == "shower" && nnfit_shower_cos_zenith < 0) || (topology == "track" && nnfit_track_cos_zenith < 0))
+            selected = true;
+    }
+    else if (cut_selection == "nnfit_hard_cuts"){
+        if ((topology == "shower" && nnfit_shower_cos_zenith < 0 && nnfit_shower_sigma_z_vertex < 15 && nnfit_shower_sigma_r_vertex < 15) || (topology == "track" && nnfit_track_cos_zenith < 0 && nnfit_track_sigma_z_closest < 10 && nnfit_track_sigma_r_closest < 7))
+            selected = true;
+    }
+    else
+    {
+        std::cerr << "Error: cut selection not found" << std::endl;
+        exit(1);
+    }
+
+    return selected;
+}
+
+inline std::string GetTopology(double type, double interaction_type)
+{
+    std::string topology;
+
+    if ( (std::abs(type) == 14 && interaction_type ==  1) || (std::abs(type) == 16 && interaction_type ==  2) || (std::abs(type) == 13) )
+    {
+        topology = "track";
+    }
+    else if ( (std::abs(type) == 12) || (std::abs(type) == 14 && interaction_type ==  0) || (std::abs(type) == 16 && interaction_type !=  2) )
+    {
+        topology = "shower";
+    }
+    else
+    {
+        std::cerr << "Error: topology not found" << std::endl;
+        printf("type: %f, interaction_type: %f\n", type, interaction_type);
+    }
+    return topology;
+}
+
+// Columns of one block of events, as read from the sel tree
+struct CutColumns
+{
+    const double *energy_true;
+    const int *type;
+    const int *interaction_type;
+    const double *nnfit_track_cos_zenith;
+    const double *nnfit_shower_cos_zenith;
+    const float *nnfit_track_sigma_z_closest;
+    const float *nnfit_track_sigma_r_closest;
+    const float *nnfit_shower_sigma_z_vertex;
+    const float *nnfit_shower_sigma_r_vertex;
+};
+
+/**
+ * @brief Evaluate a cut selection over n events, writing 1 (selected) or 0 to the bitmap.
+ * Same result as GetTopology() + ApplyCuts() for every event, including NaN
+ * inputs (every comparison with NaN is false). Events without a topology are
+ * rejected by the NNFit cuts and counted instead of printed.
+ *
+ * @return Number of events without a track or shower topology
+ */
+inline std::size_t EvaluateCuts(ECutSelection cut, const CutColumns &c, std::size_t n, std::uint8_t *selected)
+{
+    std::size_t n_unknown = 0;
+
+#pragma omp simd reduction(+ : n_unknown)
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const int abs_type = c.type[i] < 0 ? -c.type[i] : c.type[i];
+        const int itype = c.interaction_type[i];
+
+        const std::uint8_t track = ((abs_type == 14) & (itype == 1)) | ((abs_type == 16) & (itype == 2)) | (abs_type == 13);
+        const std::uint8_t shower = ((abs_type == 12) | ((abs_type == 14) & (itype == 0)) | ((abs_type == 16) & (itype != 2))) & !track;
+        n_unknown += !(track | shower);
+
+        std::uint8_t pass;
+        if (cut == kMuonFree)
+            pass = (c.energy_true[i] < 1e2) & (c.energy_true[i] > 1e1);
+        else if (cut == kNNFitLooseCuts)
+            pass = (shower & (c.nnfit_shower_cos_zenith[i] < 0)) | (track & (c.nnfit_track_cos_zenith[i] < 0));
+        else
+            pass = (shower & (c.nnfit_shower_cos_zenith[i] < 0) & (c.nnfit_shower_sigma_z_vertex[i] < 15) & (c.nnfit_shower_sigma_r_vertex[i] < 15)) |
+                   (track & (c.nnfit_track_cos_zenith[i] < 0) & (c.nnfit_track_sigma_z_closest[i] < 10) & (c.nnfit_track_sigma_r_closest[i] < 7));
+
+        selected[i] = pass;
+    }
+
+    return n_unknown;
+}
+
+/**
+ * @brief Check a cut against the min/max ranges of one zone of the input.
+ * Returns false only if no event of the zone can pass, so the zone can be
+ * skipped without reading it. Columns missing from the zone map never exclude.
+ */
+inline bool CutMayPass(ECutSelection cut, const ZoneMap &zones, std::size_t zone)
+{
+    if (cut == kMuonFree)
+        return zones.MayBeAbove("energy_true", zone, 1e1) && zones.MayBeBelow("energy_true", zone, 1e2);
+
+    bool shower = zones.MayBeBelow("NNFitShower_cos_zenith", zone, 0);
+    bool track = zones.MayBeBelow("NNFitTrack_cos_zenith", zone, 0);
+    if (cut == kNNFitHardCuts)
+    {
+        shower = shower && zones.MayBeBelow("NNFitShower_SigmaZVertex", zone, 15) && zones.MayBeBelow("NNFitShower_SigmaRVertex", zone, 15);
+        track = track && zones.MayBeBelow("NNFitTrack_SigmaZClosest", zone, 10) && zones.MayBeBelow("NNFitTrack_SigmaRClosest", zone, 7);
+    }
+    return shower || track;
+}
+
+#endif // CUTKERNELS_H
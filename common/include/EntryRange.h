@@ -0,0 +1,115 @@
+/**
+ * @file EntryRange.h
+ * @brief --entries first:last and --shard k/N: the entries of the input tree that a step processes.
+ * --entries takes the entries [first, last); without last, up to the end of
+ * the tree. --shard k/N takes the k-th (0 .. N-1) of N contiguous parts of
+ * nearly equal size. The boundaries of the parts are moved to the next
+ * cluster boundary of the input tree, so that a shard reads whole baskets.
+ *
+ * The shards 0/N .. N-1/N cover every entry once and in order. Merging their
+ * outputs in that order (MergeSel, which copies the baskets) gives the
+ * entries of the unsharded output. Without either option, the whole tree is
+ * processed and nothing changes.
+ *
+ * Usage:
+ *   EntryRange range(options);   // options {"entries", "shard"}
+ *   range.Resolve(tree);         // once the input tree is open
+ *   for (Long64_t i = range.First(); i < range.Last(); i++) ...
+ */
+
+#ifndef ENTRYRANGE_H
+#define ENTRYRANGE_H
+
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "StageOptions.h"
+
+class EntryRange
+{
+public:
+    explicit EntryRange(const StageOptions &options)
+        : fFirst(0), fLast(-1), fShard(0), fShards(0), fEntries(-1)
+    {
+        if (options.Has("entries") && options.Has("shard"))
+            Fail("--entries and --shard exclude each other");
+        if (options.Has("entries"))
+        {
+            std::string value = options.Get("entries");
+            char *end = NULL;
+            fFirst = strtoll(value.c_str(), &end, 10);
+            if (end == value.c_str() || *end != ':' || fFirst < 0)
+                Fail("--entries " + value + " is not first:last");
+            std::string last(end + 1);
+            if (!last.empty())
+            {
+                fLast = strtoll(last.c_str(), &end, 10);
+                if (*end != '\0' || fLast < fFirst)
+                    Fail("--entries " + value + " is not first:last with first <= last");
+            }
+        }
+        if (options.Has("shard"))
+        {
+            std::string value = options.Get("shard");
+            if (sscanf(value.c_str(), "%d/%d", &fShard, &fShards) != 2 || fShards < 1 || fShard < 0 || fShard >= fShards)
+                Fail("--shard " + value + " is not k/N with 0 <= k < N");
+        }
+    }
+
+    // Whether only a part of the tree is processed
+    bool Enabled() const { return fShards > 0 || fFirst > 0 || fLast >= 0; }
+
+    // Bounds on the entries of the input tree, before the event loop
+    void Resolve(TTree *tree) { Resolve(tree->GetEntries(), tree); }
+
+    // Same for an input that is not a tree (the AntDST files): the shards are not aligned
+    void Resolve(Long64_t entries, TTree *tree = NULL)
+    {
+        fEntries = entries;
+        if (fShards > 0)
+        {
+            fFirst = ClusterBoundary(tree, fEntries, fEntries * fShard / fShards);
+            fLast = ClusterBoundary(tree, fEntries, fEntries * (fShard + 1) / fShards);
+        }
+        else
+        {
+            fFirst = std::min(fFirst, fEntries);
+            fLast = fLast < 0 ? fEntries : std::min(fLast, fEntries);
+        }
+        if (Enabled())
+            std::cout << "Entries [" << fFirst << ", " << fLast << ") of " << fEntries
+                      << (fShards > 0 ? " (shard " + std::to_string(fShard) + "/" + std::to_string(fShards) + ")" : "") << std::endl;
+    }
+
+    Long64_t First() const { return fFirst; }
+    Long64_t Last() const { return fLast; }
+    Long64_t Entries() const { return fLast - fFirst; }
+
+private:
+    // First cluster boundary at or after entry; the end of the tree at the latest
+    static Long64_t ClusterBoundary(TTree *tree, Long64_t nentries, Long64_t entry)
+    {
+        if (!tree || entry <= 0 || entry >= nentries)
+            return std::max(std::min(entry, nentries), 0LL);
+        TTree::TClusterIterator it = tree->GetClusterIterator(entry);
+        Long64_t start = it.Next();
+        return start >= entry ? start : std::min(it.GetNextEntry(), nentries);
+    }
+
+    static void Fail(const std::string &message)
+    {
+        std::cerr << "Error: " << message << std::endl;
+        exit(1);
+    }
+
+    Long64_t fFirst, fLast;
+    int fShard, fShards;
+    Long64_t fEntries;
+};
+
+#endif // ENTRYRANGE_H
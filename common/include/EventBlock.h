@@ -0,0 +1,188 @@
+/**
+ * @file EventBlock.h
+ * @brief Struct-of-arrays block of entries of a flat tree.
+ * Every bound branch is a Column (ColumnReader.h): Load reads a range of
+ * entries column by column into contiguous arrays, whole baskets at a time,
+ * which the stage kernels get through Get<T>(name). Restore copies entry j
+ * of the block back into the branch buffers, so that a CloneTree(0) of the
+ * input, made after the block is built, writes the modified entries with
+ * Fill. Restore reads nothing: it is one memcpy per column, from a table of
+ * (buffer, array, size) built by Load.
+ *
+ * Usage:
+ *   EventBlock block(tree);
+ *   TTree *out = tree->CloneTree(0);
+ *   for (Long64_t first = 0; first < tree->GetEntries(); first += block.Capacity())
+ *   {
+ *       Long64_t n = block.Load(first);
+ *       double *energy = block.Get<double>("energy_true");
+ *       ...
+ *       for (Long64_t j = 0; j < n; j++) { block.Restore(j); out->Fill(); }
+ *   }
+ */
+
+#ifndef EVENTBLOCK_H
+#define EVENTBLOCK_H
+
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ColumnReader.h"
+
+class EventBlock
+{
+public:
+    // Bind the listed branches, or every branch of the tree when the list is empty
+    EventBlock(TTree *tree, const std::vector<std::string> &names = {}, Long64_t capacity = 4096)
+        : fTree(tree), fCapacity(capacity), fSize(0)
+    {
+        std::vector<std::string> branches = names;
+        if (branches.empty())
+        {
+            TObjArray *list = tree->GetListOfBranches();
+            for (int b = 0; b < list->GetEntriesFast(); b++)
+                branches.push_back(list->At(b)->GetName());
+        }
+        for (const std::string &name : branches)
+            Bind(name);
+    }
+
+    EventBlock(const EventBlock &) = delete;
+    EventBlock &operator=(const EventBlock &) = delete;
+
+    // Read the entries [first, first + Capacity()) that exist; returns the number read
+    Long64_t Load(Long64_t first)
+    {
+        fSize = std::min(fCapacity, fTree->GetEntries() - first);
+        if (fSize < 0)
+            fSize = 0;
+        fSlots.clear();
+        for (auto &column : fColumns)
+        {
+            column->Read(first, fSize);
+            fSlots.push_back(column->Slot());
+        }
+        return fSize;
+    }
+
+    // Contiguous array of a column of the last block loaded; bool columns are bytes
+    template <typename T>
+    typename Column<T>::Storage *Get(const std::string &name)
+    {
+        std::map<std::string, std::size_t>::const_iterator it = fIndex.find(name);
+        if (it == fIndex.end())
+        {
+            std::cerr << "Error: branch " << name << " is not in the event block" << std::endl;
+            exit(1);
+        }
+        TypedColumn<T> *column = dynamic_cast<TypedColumn<T> *>(fColumns[it->second].get());
+        if (!column)
+        {
+            std::cerr << "Error: branch " << name << " is not of type " << RootTypeName<T>() << std::endl;
+            exit(1);
+        }
+        return column->fColumn.Data();
+    }
+
+    bool Has(const std::string &name) const { return fIndex.count(name) > 0; }
+
+    // Copy entry j of the block into the branch buffers
+    void Restore(Long64_t j)
+    {
+        for (const RestoreSlot &slot : fSlots)
+            std::memcpy(slot.value, slot.data + j * slot.size, slot.size);
+    }
+
+    Long64_t Size() const { return fSize; }
+    Long64_t Capacity() const { return fCapacity; }
+
+    // Memory of the column arrays
+    Long64_t Bytes() const
+    {
+        Long64_t row = 0;
+        for (const auto &column : fColumns)
+            row += column->ElementSize();
+        return fCapacity * row;
+    }
+
+private:
+    // Branch buffer of a column and its array; bool columns are bytes 0 or 1 on both sides
+    struct RestoreSlot
+    {
+        void *value;
+        const char *data;
+        std::size_t size;
+    };
+
+    struct ColumnBase
+    {
+        virtual ~ColumnBase() {}
+        virtual void Read(Long64_t first, Long64_t n) = 0;
+        virtual RestoreSlot Slot() = 0;
+        virtual std::size_t ElementSize() const = 0;
+    };
+
+    template <typename T>
+    struct TypedColumn : ColumnBase
+    {
+        static_assert(sizeof(T) == sizeof(typename Column<T>::Storage), "a value and its array element must have the same size");
+        TypedColumn(TTree *tree, const std::string &name) : fColumn(tree, name) {}
+        void Read(Long64_t first, Long64_t n) override { fColumn.Read(first, n); }
+        RestoreSlot Slot() override { return {&fColumn.Value(), reinterpret_cast<const char *>(fColumn.Data()), sizeof(T)}; }
+        std::size_t ElementSize() const override { return sizeof(typename Column<T>::Storage); }
+        Column<T> fColumn;
+    };
+
+    void Bind(const std::string &name)
+    {
+        TBranch *branch = fTree->GetBranch(name.c_str());
+        if (!branch)
+        {
+            std::cerr << "Error: branch " << name << " not found" << std::endl;
+            exit(1);
+        }
+        TLeaf *leaf = branch->GetListOfLeaves()->GetEntriesFast() == 1 ? static_cast<TLeaf *>(branch->GetListOfLeaves()->At(0)) : NULL;
+        if (!leaf || leaf->GetLenStatic() != 1 || leaf->GetLeafCount())
+        {
+            std::cerr << "Error: branch " << name << " is not a scalar" << std::endl;
+            exit(1);
+        }
+
+        std::string type = leaf->GetTypeName();
+        ColumnBase *column = NULL;
+        if (type == "Double_t") column = new TypedColumn<double>(fTree, name);
+        else if (type == "Float_t") column = new TypedColumn<float>(fTree, name);
+        else if (type == "Int_t") column = new TypedColumn<int>(fTree, name);
+        else if (type == "UInt_t") column = new TypedColumn<unsigned int>(fTree, name);
+        else if (type == "Bool_t") column = new TypedColumn<bool>(fTree, name);
+        else if (type == "Long64_t") column = new TypedColumn<long long>(fTree, name);
+        else if (type == "ULong64_t") column = new TypedColumn<unsigned long long>(fTree, name);
+        else
+        {
+            std::cerr << "Error: branch " << name << " has unsupported type " << type << std::endl;
+            exit(1);
+        }
+        fIndex[name] = fColumns.size();
+        fColumns.emplace_back(column);
+    }
+
+    TTree *fTree;
+    Long64_t fCapacity;
+    Long64_t fSize;
+    std::vector<std::unique_ptr<ColumnBase>> fColumns;
+    std::vector<RestoreSlot> fSlots;
+    std::map<std::string, std::size_t> fIndex;
+};
+
+#endif // EVENTBLOCK_H
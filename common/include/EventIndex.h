@@ -0,0 +1,282 @@
+/**
+ * @file EventIndex.h
+ * @brief Sorted event key index stored next to the sel tree.
+ * The small tree "sel_index" holds the keys of all sel entries in key order
+ * (branches run_id, frame_index, event_counter_trigger, entry). It is written
+ * by AnnotateSelFile() with a bounded amount of memory. EventIndex looks keys
+ * up by binary search on that tree, reading only the baskets it touches, and
+ * JoinIndices() matches two files in one sequential pass over both indices.
+ *
+ * The TNamed "sel_index_source" records the tree the index was built for:
+ * its name, its number of entries and the UUID of the file. hadd concatenates
+ * the index trees of its inputs, which then have the entry count of the
+ * merged tree but are each sorted on their own; the merged file has a new
+ * UUID, so its index is ignored. Check() also reads the whole index once, to
+ * make sure the keys are in order and the entries are those of the tree.
+ *
+ * Usage:
+ *   EventIndex index(file, tree);
+ *   if (index.Valid() && index.Check())
+ *       Long64_t entry = index.Find(key);  // -1 if the event is not in the tree
+ */
+
+#ifndef EVENTINDEX_H
+#define EVENTINDEX_H
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TNamed.h>
+#include <TTree.h>
+#include <TUUID.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "EventKey.h"
+#include "ExternalSort.h"
+
+const char *const kEventIndexTreeName = "sel_index";
+const char *const kEventIndexSourceName = "sel_index_source";
+
+// The tree an index belongs to: "<tree> <entries> <file UUID>"
+inline std::string EventIndexSource(TFile *file, TTree *tree)
+{
+    return std::string(tree->GetName()) + " " + std::to_string(tree->GetEntries()) + " " + file->GetUUID().AsString();
+}
+
+// Reads the key of single entries, whatever integer or floating type the key branches have
+class EventKeyReader
+{
+public:
+    EventKeyReader(TTree *tree)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            fBranches[k] = tree->GetBranch(kEventKeyBranches[k]);
+            if (!fBranches[k])
+            {
+                std::cerr << "Error: branch " << kEventKeyBranches[k] << " not found" << std::endl;
+                exit(1);
+            }
+            tree->SetBranchStatus(kEventKeyBranches[k], 1);
+            fLeaves[k] = static_cast<TLeaf *>(fBranches[k]->GetListOfLeaves()->At(0));
+        }
+    }
+
+    // True if the tree has all the key branches
+    static bool HasKey(TTree *tree)
+    {
+        for (int k = 0; k < 3; k++)
+            if (!tree->GetBranch(kEventKeyBranches[k]))
+                return false;
+        return true;
+    }
+
+    EventKey Read(Long64_t entry)
+    {
+        Long64_t value[3];
+        for (int k = 0; k < 3; k++)
+        {
+            fBranches[k]->GetEntry(entry);
+            value[k] = fLeaves[k]->GetValueLong64();
+        }
+        EventKey key = {value[0], value[1], value[2]};
+        return key;
+    }
+
+private:
+    TBranch *fBranches[3];
+    TLeaf *fLeaves[3];
+};
+
+// Entry of the tree with its key, the record of the index
+struct EventIndexRecord
+{
+    EventKey key;
+    Long64_t entry;
+};
+
+inline bool EventIndexRecordLess(const char *a, const char *b)
+{
+    EventKey ka, kb;
+    std::memcpy(&ka, a, sizeof(EventKey));
+    std::memcpy(&kb, b, sizeof(EventKey));
+    return ka < kb;
+}
+
+// Sort the keys of tree (externally, within budget bytes) and write them as the index of file.
+// Returns the number of keys that appear more than once.
+inline Long64_t WriteEventIndex(TFile *file, TTree *tree, std::size_t budget = 256 << 20)
+{
+    EventKeyReader keys(tree);
+    ExternalSorter sorter(sizeof(EventIndexRecord), budget, EventIndexRecordLess);
+    Long64_t ntot = tree->GetEntries();
+    for (Long64_t i = 0; i < ntot; i++)
+    {
+        EventIndexRecord record = {keys.Read(i), i};
+        sorter.Add(&record);
+    }
+    sorter.Finish();
+
+    file->cd();
+    TTree index_tree(kEventIndexTreeName, "sel entries sorted by (run_id, frame_index, event_counter_trigger)");
+    EventIndexRecord record;
+    index_tree.Branch("run_id", &record.key.run_id, "run_id/L");
+    index_tree.Branch("frame_index", &record.key.frame_index, "frame_index/L");
+    index_tree.Branch("event_counter_trigger", &record.key.trigger_counter, "event_counter_trigger/L");
+    index_tree.Branch("entry", &record.entry, "entry/L");
+
+    Long64_t duplicates = 0;
+    EventKey previous = {0, 0, 0};
+    for (Long64_t i = 0; sorter.Next(&record); i++)
+    {
+        if (i > 0 && record.key == previous)
+            duplicates++;
+        previous = record.key;
+        index_tree.Fill();
+    }
+    index_tree.Write("", TObject::kOverwrite);
+    TNamed source(kEventIndexSourceName, EventIndexSource(file, tree).c_str());
+    source.Write("", TObject::kOverwrite);
+    return duplicates;
+}
+
+class EventIndex
+{
+public:
+    // Opens the index of tree in file; Valid() is false if it is missing or was not built for this tree
+    EventIndex(TFile *file, TTree *tree) : fTree(NULL), fSize(0), fLoaded(-1), fName(file->GetName())
+    {
+        fTree = dynamic_cast<TTree *>(file->Get(kEventIndexTreeName));
+        if (!fTree)
+            return;
+        TNamed *source = dynamic_cast<TNamed *>(file->Get(kEventIndexSourceName));
+        if (!source || source->GetTitle() != EventIndexSource(file, tree) || fTree->GetEntries() != tree->GetEntries())
+        {
+            std::cerr << "Warning: event index of " << fName << " was not built for the tree " << tree->GetName()
+                      << " of this file, ignoring it" << std::endl;
+            fTree = NULL;
+            return;
+        }
+        fSize = tree->GetEntries();
+        fTree->SetBranchAddress("run_id", static_cast<void *>(&fRecord.key.run_id));
+        fTree->SetBranchAddress("frame_index", static_cast<void *>(&fRecord.key.frame_index));
+        fTree->SetBranchAddress("event_counter_trigger", static_cast<void *>(&fRecord.key.trigger_counter));
+        fTree->SetBranchAddress("entry", static_cast<void *>(&fRecord.entry));
+    }
+
+    ~EventIndex()
+    {
+        if (fTree)
+            fTree->ResetBranchAddresses();
+    }
+
+    EventIndex(const EventIndex &) = delete;
+    EventIndex &operator=(const EventIndex &) = delete;
+
+    bool Valid() const { return fTree != NULL; }
+    Long64_t Size() const { return fSize; }
+
+    // Read the whole index once: the keys must be in order and the entries each entry of the tree once.
+    // On failure the index is no longer Valid().
+    bool Check()
+    {
+        if (!fTree)
+            return false;
+        std::vector<bool> seen(fSize, false);
+        EventKey previous = {0, 0, 0};
+        for (Long64_t i = 0; i < fSize; i++)
+        {
+            const EventIndexRecord &record = Load(i);
+            bool in_order = i == 0 || !(record.key < previous);
+            bool new_entry = record.entry >= 0 && record.entry < fSize && !seen[record.entry];
+            if (!in_order || !new_entry)
+            {
+                std::cerr << "Warning: event index of " << fName << (in_order ? " repeats or misses tree entries" : " is not in key order")
+                          << " at position " << i << ", ignoring it" << std::endl;
+                fTree->ResetBranchAddresses();
+                fTree = NULL;
+                return false;
+            }
+            seen[record.entry] = true;
+            previous = record.key;
+        }
+        return true;
+    }
+
+    // Key and entry at position i of the key order
+    const EventKey &Key(Long64_t i) { return Load(i).key; }
+    Long64_t Entry(Long64_t i) { return Load(i).entry; }
+
+    // First position whose key is not less than key (binary search, O(log n) reads)
+    Long64_t LowerBound(const EventKey &key)
+    {
+        Long64_t low = 0, high = fSize;
+        while (low < high)
+        {
+            Long64_t mid = low + (high - low) / 2;
+            if (Key(mid) < key)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return low;
+    }
+
+    // Entry of the event with this key, -1 if it is not in the tree
+    Long64_t Find(const EventKey &key)
+    {
+        Long64_t i = LowerBound(key);
+        return i < fSize && Key(i) == key ? Entry(i) : -1;
+    }
+
+private:
+    const EventIndexRecord &Load(Long64_t i)
+    {
+        if (i != fLoaded)
+        {
+            fTree->GetEntry(i);
+            fLoaded = i;
+        }
+        return fRecord;
+    }
+
+    TTree *fTree;
+    Long64_t fSize, fLoaded;
+    EventIndexRecord fRecord;
+    std::string fName;
+};
+
+// Walk two indices in key order and call f(entry_a, entry_b) for every pair of entries
+// with the same key. Returns the number of pairs.
+template <typename F>
+Long64_t JoinIndices(EventIndex &a, EventIndex &b, F f)
+{
+    Long64_t i = 0, j = 0, pairs = 0;
+    while (i < a.Size() && j < b.Size())
+    {
+        EventKey ka = a.Key(i), kb = b.Key(j);
+        if (ka < kb)
+            i++;
+        else if (kb < ka)
+            j++;
+        else
+        {
+            // all entries of the key on both sides
+            Long64_t j_end = j;
+            while (j_end < b.Size() && b.Key(j_end) == ka)
+                j_end++;
+            for (; i < a.Size() && a.Key(i) == ka; i++)
+                for (Long64_t jj = j; jj < j_end; jj++, pairs++)
+                    f(a.Entry(i), b.Entry(jj));
+            j = j_end;
+        }
+    }
+    return pairs;
+}
+
+#endif // EVENTINDEX_H
@@ -0,0 +1,42 @@
+/**
+ * @file EventKey.h
+ * @brief Identifier of an event shared by the ANTDST trees and the NNFit reconstructions.
+ * An event is identified by (run_id, frame_index, event_counter_trigger), the
+ * NNFit files call the same quantities (RunID, EventID, TrigCount).
+ */
+
+#ifndef EVENTKEY_H
+#define EVENTKEY_H
+
+#include <cstdint>
+
+// Branch names of the key in the sel tree, in comparison order
+const char *const kEventKeyBranches[3] = {"run_id", "frame_index", "event_counter_trigger"};
+
+// Column names of the key in the NNFit HDF5 files, in the same order
+const char *const kNNFitKeyColumns[3] = {"RunID", "EventID", "TrigCount"};
+
+struct EventKey
+{
+    std::int64_t run_id;
+    std::int64_t frame_index;
+    std::int64_t trigger_counter;
+
+    bool operator<(const EventKey &other) const
+    {
+        if (run_id != other.run_id)
+            return run_id < other.run_id;
+        if (frame_index != other.frame_index)
+            return frame_index < other.frame_index;
+        return trigger_counter < other.trigger_counter;
+    }
+
+    bool operator==(const EventKey &other) const
+    {
+        return run_id == other.run_id && frame_index == other.frame_index && trigger_counter == other.trigger_counter;
+    }
+
+    bool operator!=(const EventKey &other) const { return !(*this == other); }
+};
+
+#endif // EVENTKEY_H
@@ -0,0 +1,215 @@
+/**
+ * @file ExternalSort.h
+ * @brief Sort of fixed-size records with bounded memory.
+ * Records are collected in a buffer of at most the given memory budget. Full
+ * buffers are sorted and spilled to temporary files (runs), which are merged
+ * back with a k-way merge when the records are read. When everything fits in
+ * the budget nothing is written to disk.
+ *
+ * Usage:
+ *   ExternalSorter sorter(record_size, budget_bytes, less);
+ *   for (...) sorter.Add(record);
+ *   sorter.Finish();
+ *   while (sorter.Next(record)) ...
+ */
+
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+class ExternalSorter
+{
+public:
+    typedef std::function<bool(const char *, const char *)> Less;
+
+    // Temporary files go to tmpdir, or $TMPDIR, or /tmp
+    ExternalSorter(std::size_t record_size, std::size_t budget_bytes, Less less, std::string tmpdir = "")
+        : fRecordSize(record_size), fLess(less), fTmpDir(tmpdir), fFinished(false), fNext(0), fRecords(0)
+    {
+        if (fTmpDir.empty())
+            fTmpDir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+        fCapacity = std::max<std::size_t>(budget_bytes / (record_size + sizeof(std::size_t)), 1);
+        fBudget = budget_bytes;
+    }
+
+    ~ExternalSorter()
+    {
+        for (std::size_t r = 0; r < fRuns.size(); r++)
+            fclose(fRuns[r].file);
+    }
+
+    ExternalSorter(const ExternalSorter &) = delete;
+    ExternalSorter &operator=(const ExternalSorter &) = delete;
+
+    void Add(const void *record)
+    {
+        if (fFinished)
+        {
+            std::cerr << "Error: ExternalSorter::Add after Finish" << std::endl;
+            exit(1);
+        }
+        if (fBuffer.size() / fRecordSize == fCapacity)
+            Spill();
+        const char *p = static_cast<const char *>(record);
+        fBuffer.insert(fBuffer.end(), p, p + fRecordSize);
+        fRecords++;
+    }
+
+    // Sort the buffered records; afterwards records are read back with Next()
+    void Finish()
+    {
+        fFinished = true;
+        if (fRuns.empty())
+        {
+            SortBuffer();
+            return;
+        }
+        if (!fBuffer.empty())
+            Spill();
+        fBuffer.clear();
+        fBuffer.shrink_to_fit();
+
+        // The read buffers of the runs share the budget
+        std::size_t per_run = std::max<std::size_t>(fBudget / fRuns.size() / fRecordSize, 1);
+        for (std::size_t r = 0; r < fRuns.size(); r++)
+        {
+            rewind(fRuns[r].file);
+            fRuns[r].buffer.resize(per_run * fRecordSize);
+            fRuns[r].size = fRuns[r].pos = 0;
+            if (Refill(fRuns[r]))
+                fHeap.push(r);
+        }
+    }
+
+    // Copy the next record in sorted order to record, false when exhausted
+    bool Next(void *record)
+    {
+        if (fRuns.empty())
+        {
+            if (fNext >= fOrder.size())
+                return false;
+            std::memcpy(record, &fBuffer[fOrder[fNext++] * fRecordSize], fRecordSize);
+            return true;
+        }
+
+        if (fHeap.empty())
+            return false;
+        std::size_t r = fHeap.top();
+        fHeap.pop();
+        Run &run = fRuns[r];
+        std::memcpy(record, &run.buffer[run.pos], fRecordSize);
+        run.pos += fRecordSize;
+        if (run.pos < run.size || Refill(run))
+            fHeap.push(r);
+        return true;
+    }
+
+    std::size_t NRecords() const { return fRecords; }
+    std::size_t NRuns() const { return fRuns.size(); }
+
+private:
+    struct Run
+    {
+        FILE *file;
+        std::vector<char> buffer;
+        std::size_t size, pos;
+    };
+
+    // Orders the heap so that the run with the smallest current record is on top;
+    // equal records come from the earlier run first, so the sort is stable overall
+    struct HeapOrder
+    {
+        const ExternalSorter *sorter;
+        bool operator()(std::size_t a, std::size_t b) const
+        {
+            const Run &ra = sorter->fRuns[a], &rb = sorter->fRuns[b];
+            if (sorter->fLess(&rb.buffer[rb.pos], &ra.buffer[ra.pos]))
+                return true;
+            if (sorter->fLess(&ra.buffer[ra.pos], &rb.buffer[rb.pos]))
+                return false;
+            return a > b;
+        }
+    };
+
+    void SortBuffer()
+    {
+        std::size_t n = fBuffer.size() / fRecordSize;
+        fOrder.resize(n);
+        for (std::size_t i = 0; i < n; i++)
+            fOrder[i] = i;
+        const char *base = fBuffer.data();
+        std::size_t size = fRecordSize;
+        Less &less = fLess;
+        std::stable_sort(fOrder.begin(), fOrder.end(), [base, size, &less](std::size_t a, std::size_t b) {
+            return less(base + a * size, base + b * size);
+        });
+        fNext = 0;
+    }
+
+    void Spill()
+    {
+        SortBuffer();
+
+        std::string path = fTmpDir + "/sortrun_XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(name.data());
+        FILE *file = fd < 0 ? NULL : fdopen(fd, "w+b");
+        if (!file)
+        {
+            std::cerr << "Error: could not create a temporary file in " << fTmpDir << std::endl;
+            exit(1);
+        }
+        // the file lives on until it is closed
+        unlink(name.data());
+
+        for (std::size_t i = 0; i < fOrder.size(); i++)
+        {
+            if (fwrite(&fBuffer[fOrder[i] * fRecordSize], fRecordSize, 1, file) != 1)
+            {
+                std::cerr << "Error: could not write a sort run to " << fTmpDir << std::endl;
+                exit(1);
+            }
+        }
+
+        Run run;
+        run.file = file;
+        run.size = run.pos = 0;
+        fRuns.push_back(run);
+        fBuffer.clear();
+        fOrder.clear();
+    }
+
+    bool Refill(Run &run)
+    {
+        std::size_t n = fread(run.buffer.data(), fRecordSize, run.buffer.size() / fRecordSize, run.file);
+        run.size = n * fRecordSize;
+        run.pos = 0;
+        return n > 0;
+    }
+
+    std::size_t fRecordSize, fCapacity, fBudget;
+    Less fLess;
+    std::string fTmpDir;
+    bool fFinished;
+
+    std::vector<char> fBuffer;
+    std::vector<std::size_t> fOrder;
+    std::size_t fNext, fRecords;
+
+    std::vector<Run> fRuns;
+    std::priority_queue<std::size_t, std::vector<std::size_t>, HeapOrder> fHeap{HeapOrder{this}};
+};
+
+#endif // EXTERNALSORT_H
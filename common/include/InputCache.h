@@ -0,0 +1,131 @@
+/**
+ * @file InputCache.h
+ * @brief TTreeCache of the input trees, learned on the first cluster, with --prefetch and a report of the reads.
+ * Without a cache, every basket that a step reads is a read call of its own,
+ * which on a network filesystem (/sps, /home/wecapstor3) is a round trip.
+ * Configure() sizes the TTreeCache of an input tree to one cluster of the
+ * compressed baskets of its active branches, two with --prefetch, capped by
+ * --read-cache <MB> (256 by default) or by the share that --mem-budget gave
+ * the tree. The cache learns which branches are read during the first
+ * cluster, then fetches the baskets of those branches for a whole cluster
+ * in one vectored read.
+ *
+ * --prefetch turns on the asynchronous prefetching of ROOT (TFilePrefetch):
+ * a background thread reads the next cluster while the current one is
+ * processed. It has to be set before the input files are opened.
+ *
+ * Report() prints the cache size, the learned branches, the hit rate (reads
+ * served by the cache), the read calls to the file and the bytes read.
+ * --read-cache off leaves the default of ROOT, e.g. to compare.
+ *
+ * Usage:
+ *   InputCache input(options, memory);   // options {"read-cache"}, before opening the inputs
+ *   input.Configure(tree);               // after memory.ConfigureInput, once the branches of a pass are enabled
+ *   ...
+ *   input.Report(tree);                  // before the input file is closed
+ */
+
+#ifndef INPUTCACHE_H
+#define INPUTCACHE_H
+
+#include <TBranch.h>
+#include <TEnv.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TTree.h>
+#include <TTreeCache.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "MemoryBudget.h"
+#include "StageOptions.h"
+
+class InputCache
+{
+public:
+    InputCache(const StageOptions &options, const MemoryBudget &memory)
+        : fEnabled(options.Get("read-cache") != "off"), fPrefetch(options.Has("prefetch")), fMemory(memory),
+          fCap((Long64_t)(atof(options.Get("read-cache", "256").c_str()) * kMB))
+    {
+        if (fEnabled && fCap <= 0)
+        {
+            std::cerr << "Error: --read-cache " << options.Get("read-cache") << " is not a size in MB or off" << std::endl;
+            exit(1);
+        }
+        // read by TFile::Open, so before any input is opened
+        if (fEnabled && fPrefetch)
+            gEnv->SetValue("TFile.AsyncPrefetching", 1);
+    }
+
+    bool Enabled() const { return fEnabled; }
+
+    // Size the cache for the active branches and learn them again on the next cluster read
+    void Configure(TTree *tree) const
+    {
+        TFile *file = tree->GetCurrentFile();
+        Long64_t nentries = tree->GetEntries();
+        if (!fEnabled || !file || nentries <= 0)
+            return;
+
+        TTree::TClusterIterator clusters = tree->GetClusterIterator(0);
+        Long64_t start = clusters();
+        Long64_t cluster = std::max(std::min(clusters.GetNextEntry(), nentries) - start, 1LL);
+
+        Long64_t zip = 0;
+        TObjArray *branches = tree->GetListOfBranches();
+        for (int b = 0; b < branches->GetEntriesFast(); b++)
+        {
+            TBranch *branch = static_cast<TBranch *>(branches->At(b));
+            if (tree->GetBranchStatus(branch->GetName()))
+                zip += branch->GetZipBytes("*");
+        }
+        // one cluster of baskets, the next one as well while it is prefetched, and some slack for uneven clusters
+        Long64_t size = (Long64_t)(1.25 * zip / nentries * cluster) * (fPrefetch ? 2 : 1) + kMinBytes;
+        // --mem-budget has already given the cache its share
+        Long64_t cap = fMemory.Enabled() ? std::max(tree->GetCacheSize(), kMinBytes) : fCap;
+        size = std::min(size, cap);
+
+        tree->SetCacheSize(size);
+        tree->SetCacheLearnEntries((Int_t)std::min(cluster, (Long64_t)kMaxLearnEntries));
+        TTreeCache *cache = tree->GetReadCache(file);
+        if (cache)
+            cache->StartLearningPhase();
+        printf("Read cache of %s: %.1f MB, learning on %lld entries%s\n", tree->GetName(), size / kMB,
+               std::min(cluster, (Long64_t)kMaxLearnEntries), fPrefetch ? ", asynchronous prefetch" : "");
+    }
+
+    void Report(TTree *tree) const
+    {
+        TFile *file = tree->GetCurrentFile();
+        if (!file)
+            return;
+        // with --read-cache off, the cache that ROOT made by default, if any
+        TTreeCache *cache = tree->GetReadCache(file);
+        if (cache)
+            printf("Read cache of %s: %.1f MB, %d branches learned, hit rate %.1f%%, %.1f%% of the prefetched baskets used, "
+                   "%d read calls (%d outside the cache), %.1f MB read\n",
+                   tree->GetName(), cache->GetBufferSize() / kMB, cache->GetCachedBranches()->GetEntriesFast(),
+                   100 * cache->GetEfficiencyRel(), 100 * cache->GetEfficiency(), file->GetReadCalls(),
+                   cache->GetNoCacheReadCalls(), file->GetBytesRead() / kMB);
+        else
+            printf("Read cache of %s: none, %d read calls, %.1f MB read\n", tree->GetName(), file->GetReadCalls(),
+                   file->GetBytesRead() / kMB);
+    }
+
+private:
+    static constexpr double kMB = 1024. * 1024.;
+    static constexpr Long64_t kMinBytes = 1LL << 20;
+    // the learning phase reads basket by basket, it stops after a cluster or this many entries
+    static constexpr Long64_t kMaxLearnEntries = 100000;
+
+    bool fEnabled;
+    bool fPrefetch;
+    const MemoryBudget &fMemory;
+    Long64_t fCap;
+};
+
+#endif // INPUTCACHE_H
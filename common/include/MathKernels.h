@@ -0,0 +1,320 @@
+/**
+ * @file MathKernels.h
+ * @brief Batched math kernels for the per-event transforms of the pipeline.
+ * Each kernel transforms a contiguous array in one loop that the compiler
+ * vectorises (build with -O3 -fopenmp-simd, optionally -march=native), then
+ * hands the rare inputs outside the fast range (NaN, inf, overflow, huge
+ * angles) to libm in a second scalar pass. Inputs may be float or double,
+ * results are always double.
+ *
+ * Maximum error against a long double reference, measured on 10M uniform
+ * inputs (the default of common/bench/BenchMathKernels.cc):
+ *
+ *   kernel     range              FMA (-march=native)   no FMA    libm
+ *   Pow10      [-3, 8]            0.97 ULP              1.23 ULP  0.51 ULP
+ *   Log10      [1e-3, 1e9]        0.87 ULP              1.16 ULP  1.58 ULP
+ *   Cos        [-1e4, 1e4] rad    1.25 ULP              1.44 ULP  0.52 ULP
+ *   CosDeg     [-360, 360] deg    1.26 ULP              1.50 ULP  -
+ *   DegToRad / RadToDeg           one rounded multiplication, as TMath
+ *
+ * CosDeg reduces the angle in degrees, so cos(90) is exactly 0 where
+ * cos(90 * pi / 180) is 6e-17.
+ */
+
+#ifndef MATHKERNELS_H
+#define MATHKERNELS_H
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Without hardware FMA (no -march flag on x86) std::fma is a library call,
+// so the polynomials fall back to multiply-add and the exact products to Dekker
+#if defined(__FMA__) || defined(__FP_FAST_FMA) || defined(__aarch64__)
+#define MATHKERNELS_HAS_FMA 1
+#endif
+
+namespace MathKernelsDetail
+{
+    // 1.5 * 2^52: adding it rounds to the nearest integer, kept in the low mantissa bits
+    const double kRoundMagic = 6755399441055744.0;
+
+    inline std::uint64_t Bits(double x)
+    {
+        std::uint64_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        return u;
+    }
+
+    inline double FromBits(std::uint64_t u)
+    {
+        double x;
+        std::memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+
+    inline double MulAdd(double a, double b, double c)
+    {
+#ifdef MATHKERNELS_HAS_FMA
+        return std::fma(a, b, c);
+#else
+        return a * b + c;
+#endif
+    }
+
+    // Rounding error of the product p = a * b
+    inline double ProductError(double a, double b, double p)
+    {
+#ifdef MATHKERNELS_HAS_FMA
+        return std::fma(a, b, -p);
+#else
+        const double split = 134217729.0; // 2^27 + 1
+        double ca = split * a, cb = split * b;
+        double a_hi = ca - (ca - a), b_hi = cb - (cb - b);
+        double a_lo = a - a_hi, b_lo = b - b_hi;
+        return ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+#endif
+    }
+
+    // Nearest integer of |x| < 2^51, as double and as int64
+    inline double RoundToInt(double x, std::int64_t &k)
+    {
+        double shifted = x + kRoundMagic;
+        k = (std::int64_t)(Bits(shifted) - Bits(kRoundMagic));
+        return shifted - kRoundMagic;
+    }
+
+    // 2^f for |f| <= 0.5 (Taylor series of exp(f ln2), truncation < 5e-18)
+    inline double Exp2Reduced(double f)
+    {
+        double p = 1.3691488853904128e-12;
+        p = MulAdd(p, f, 2.5678435993488206e-11);
+        p = MulAdd(p, f, 4.4455382718708116e-10);
+        p = MulAdd(p, f, 7.054911620801123e-09);
+        p = MulAdd(p, f, 1.01780860092397e-07);
+        p = MulAdd(p, f, 1.321548679014431e-06);
+        p = MulAdd(p, f, 1.5252733804059841e-05);
+        p = MulAdd(p, f, 0.0001540353039338161);
+        p = MulAdd(p, f, 0.0013333558146428443);
+        p = MulAdd(p, f, 0.009618129107628477);
+        p = MulAdd(p, f, 0.05550410866482158);
+        p = MulAdd(p, f, 0.24022650695910072);
+        p = MulAdd(p, f, 0.6931471805599453);
+        return MulAdd(p, f, 1.0);
+    }
+
+    // cos(r) and sin(r) for |r| <= pi/4 (Taylor series, truncation < 1e-17)
+    inline double CosReduced(double r2)
+    {
+        double p = 1.0 / 6402373705728000.0;
+        p = MulAdd(p, r2, -1.0 / 20922789888000.0);
+        p = MulAdd(p, r2, 1.0 / 87178291200.0);
+        p = MulAdd(p, r2, -1.0 / 479001600.0);
+        p = MulAdd(p, r2, 1.0 / 3628800.0);
+        p = MulAdd(p, r2, -1.0 / 40320.0);
+        p = MulAdd(p, r2, 1.0 / 720.0);
+        p = MulAdd(p, r2, -1.0 / 24.0);
+        p = MulAdd(p, r2, 0.5);
+        return MulAdd(-p, r2, 1.0);
+    }
+
+    inline double SinReduced(double r, double r2)
+    {
+        double p = 1.0 / 121645100408832000.0;
+        p = MulAdd(p, r2, -1.0 / 355687428096000.0);
+        p = MulAdd(p, r2, 1.0 / 1307674368000.0);
+        p = MulAdd(p, r2, -1.0 / 6227020800.0);
+        p = MulAdd(p, r2, 1.0 / 39916800.0);
+        p = MulAdd(p, r2, -1.0 / 362880.0);
+        p = MulAdd(p, r2, 1.0 / 5040.0);
+        p = MulAdd(p, r2, -1.0 / 120.0);
+        p = MulAdd(p, r2, 1.0 / 6.0);
+        return MulAdd(-p * r2, r, r);
+    }
+
+    // cos(k pi/2 + r + dr) from the reduced argument, its low part dr and the quadrant k
+    inline double CosQuadrant(double r, double dr, std::int64_t k)
+    {
+        double r2 = r * r;
+        double c = CosReduced(r2);
+        double s = SinReduced(r, r2);
+        double cos_r = MulAdd(-s, dr, c);
+        double sin_r = MulAdd(c, dr, s);
+        // quadrant select and sign flip on the bits, which keeps the loop
+        // vectorisable even without 64-bit integer compares (plain SSE2)
+        std::uint64_t odd = 0 - ((std::uint64_t)k & 1);
+        std::uint64_t v = (Bits(sin_r) & odd) | (Bits(cos_r) & ~odd);
+        return FromBits(v ^ (((std::uint64_t)(k + 1) & 2) << 62));
+    }
+}
+
+/**
+ * @brief y[i] = 10^x[i]
+ */
+template <typename TIn>
+inline void Pow10(const TIn *x, double *y, std::size_t n)
+{
+    using namespace MathKernelsDetail;
+    const double log2_10_hi = 3.321928094887362;
+    const double log2_10_lo = 1.661617516973592e-16;
+
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+    {
+        double xi = x[i];
+        // x log2(10) in double-double so that the fraction keeps full precision
+        double yh = xi * log2_10_hi;
+        double yl = ProductError(xi, log2_10_hi, yh) + xi * log2_10_lo;
+        std::int64_t k;
+        double kd = RoundToInt(yh, k);
+        double p = Exp2Reduced((yh - kd) + yl);
+        y[i] = FromBits(Bits(p) + ((std::uint64_t)k << 52));
+    }
+
+    for (std::size_t i = 0; i < n; i++)
+        if (!(std::fabs((double)x[i]) <= 307.0))
+            y[i] = std::pow(10.0, (double)x[i]);
+}
+
+/**
+ * @brief y[i] = log10(x[i])
+ */
+template <typename TIn>
+inline void Log10(const TIn *x, double *y, std::size_t n)
+{
+    using namespace MathKernelsDetail;
+    const double log10_2_hi = 0.3010299956639812;
+    const double log10_2_lo = -2.8037281277851704e-18;
+    const double inv_ln10_hi = 0.4342944819032518;
+    const double inv_ln10_lo = 1.098319650216765e-17;
+
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+    {
+        double xi = x[i];
+        // x = m 2^e with m in [sqrt(1/2), sqrt(2)): the offset by the bits of
+        // sqrt(1/2) moves the exponent boundary there, without selects
+        std::uint64_t tmp = Bits(xi) - 0x3fe6a09e667f3bcdULL;
+        std::uint64_t e_biased = ((tmp >> 52) + 0x800) & 0xfff;
+        double e = FromBits(Bits(kRoundMagic) + e_biased) - (kRoundMagic + 2048.0);
+        double m = FromBits(Bits(xi) - (tmp & 0xfff0000000000000ULL));
+
+        // ln(m) = 2 atanh(s), s = (m-1)/(m+1), |s| < 0.172; m-1 is exact,
+        // m+1 and the division are carried with their rounding errors
+        double f = m - 1.0;
+        double d = m + 1.0;
+        double d_lo = m - (d - 1.0);
+        double s = f / d;
+        double s_lo = ((f - s * d) - ProductError(s, d, s * d) - s * d_lo) / d;
+        double s2 = s * s;
+        double p = 1.0 / 23.0;
+        p = MulAdd(p, s2, 1.0 / 21.0);
+        p = MulAdd(p, s2, 1.0 / 19.0);
+        p = MulAdd(p, s2, 1.0 / 17.0);
+        p = MulAdd(p, s2, 1.0 / 15.0);
+        p = MulAdd(p, s2, 1.0 / 13.0);
+        p = MulAdd(p, s2, 1.0 / 11.0);
+        p = MulAdd(p, s2, 1.0 / 9.0);
+        p = MulAdd(p, s2, 1.0 / 7.0);
+        p = MulAdd(p, s2, 1.0 / 5.0);
+        p = MulAdd(p, s2, 1.0 / 3.0);
+        double ln_m = 2.0 * s;
+        double ln_m_lo = 2.0 * s_lo + 2.0 * s * s2 * p;
+
+        double log10_m = MulAdd(ln_m, inv_ln10_hi, MulAdd(ln_m, inv_ln10_lo, ln_m_lo * inv_ln10_hi));
+        y[i] = MulAdd(e, log10_2_hi, MulAdd(e, log10_2_lo, log10_m));
+    }
+
+    for (std::size_t i = 0; i < n; i++)
+        if (!(x[i] >= DBL_MIN && x[i] <= DBL_MAX))
+            y[i] = std::log10((double)x[i]);
+}
+
+/**
+ * @brief y[i] = cos(x[i]), x in radians
+ */
+template <typename TIn>
+inline void Cos(const TIn *x, double *y, std::size_t n)
+{
+    using namespace MathKernelsDetail;
+    // pi/2 split in three parts (fdlibm), the first two with trailing zero bits
+    const double two_over_pi = 0.6366197723675814;
+    const double pio2_1 = 1.57079632673412561417e+00;
+    const double pio2_2 = 6.07710050630396597660e-11;
+    const double pio2_3 = 2.02226624871116645580e-21;
+
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+    {
+        double xi = x[i];
+        std::int64_t k;
+        double kd = RoundToInt(xi * two_over_pi, k);
+        // the first two products are exact for |k| < 2^20
+        double t = xi - kd * pio2_1;
+        double w = kd * pio2_2;
+        double r = t - w;
+        double dr = ((t - r) - w) - kd * pio2_3;
+        y[i] = CosQuadrant(r, dr, k);
+    }
+
+    for (std::size_t i = 0; i < n; i++)
+        if (!(std::fabs((double)x[i]) <= 1e5))
+            y[i] = std::cos((double)x[i]);
+}
+
+/**
+ * @brief y[i] = cos(x[i]), x in degrees.
+ * The reduction to [-45, 45] degrees is exact, so multiples of 90 degrees
+ * give exact results.
+ */
+template <typename TIn>
+inline void CosDeg(const TIn *x, double *y, std::size_t n)
+{
+    using namespace MathKernelsDetail;
+    const double deg_to_rad_hi = 0.017453292519943295;
+    const double deg_to_rad_lo = 2.9486522708701687e-19;
+
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+    {
+        double xi = x[i];
+        std::int64_t k;
+        double kd = RoundToInt(xi * (1.0 / 90.0), k);
+        double rdeg = xi - 90.0 * kd;
+        double r = rdeg * deg_to_rad_hi;
+        double dr = ProductError(rdeg, deg_to_rad_hi, r) + rdeg * deg_to_rad_lo;
+        y[i] = CosQuadrant(r, dr, k);
+    }
+
+    for (std::size_t i = 0; i < n; i++)
+        if (!(std::fabs((double)x[i]) <= 1e7))
+            y[i] = std::cos(std::fmod((double)x[i], 360.0) * M_PI / 180.0);
+}
+
+/**
+ * @brief y[i] = x[i] * pi / 180
+ */
+template <typename TIn>
+inline void DegToRad(const TIn *x, double *y, std::size_t n)
+{
+    const double deg_to_rad = M_PI / 180.0;
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+        y[i] = x[i] * deg_to_rad;
+}
+
+/**
+ * @brief y[i] = x[i] * 180 / pi
+ */
+template <typename TIn>
+inline void RadToDeg(const TIn *x, double *y, std::size_t n)
+{
+    const double rad_to_deg = 180.0 / M_PI;
+#pragma omp simd
+    for (std::size_t i = 0; i < n; i++)
+        y[i] = x[i] * rad_to_deg;
+}
+
+#endif // MATHKERNELS_H
@@ -0,0 +1,229 @@
+/**
+ * @file MemoryBudget.h
+ * @brief --mem-budget: size the tree buffers of a step from a memory budget, and account for it at exit.
+ * The budget (in MB, or with a K/M/G suffix like SLURM's --mem, e.g. 3G) is
+ * shared as follows:
+ *
+ *   - the process at start (ROOT libraries and dictionaries), measured;
+ *   - what the step reserves itself: histograms, column blocks, sort buffers;
+ *   - a headroom of 10% for ROOT's own buffers and the allocator;
+ *   - the trees, the rest: each input or output takes the share given to it.
+ *
+ * An input tree gets a TTreeCache of half its share and SetMaxVirtualSize the
+ * other half. An output tree that is filled entry by entry holds one cluster
+ * of uncompressed baskets plus the buffers they are compressed into: its
+ * share sets SetAutoFlush (entries per cluster, from the width of a row) and
+ * the basket size of every branch. The trees of AppendColumnsWriter keep the
+ * clusters of the copied tree, which the new columns must follow.
+ *
+ * Without --mem-budget nothing is changed and nothing is printed. With it,
+ * Report() prints the planned bytes of every item next to the peak RSS.
+ *
+ * Usage:
+ *   MemoryBudget memory("CorrectTree", options);   // options {"mem-budget"}
+ *   memory.Reserve("event block", block_bytes);
+ *   memory.ConfigureInput(input_tree, 0.25);
+ *   memory.ConfigureOutput(output_tree, 0.75);
+ *   ...
+ *   memory.Report();
+ */
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "StageOptions.h"
+
+class MemoryBudget
+{
+public:
+    MemoryBudget(const std::string &stage, const StageOptions &options)
+        : fStage(stage), fBudget(ParseBytes(options.Get("mem-budget"))), fBaseline(CurrentRss()), fReserved(0)
+    {
+        if (options.Has("mem-budget") && fBudget <= 0)
+        {
+            std::cerr << "Error: --mem-budget " << options.Get("mem-budget") << " is not a size, e.g. 3000 (MB) or 3G" << std::endl;
+            exit(1);
+        }
+        if (Enabled() && TreeBytes() <= 0)
+            std::cerr << "Warning: --mem-budget " << fBudget / kMB << " MB is below the " << fBaseline / kMB
+                      << " MB of the process at start, the trees get their minimum buffers" << std::endl;
+    }
+
+    bool Enabled() const { return fBudget > 0; }
+    Long64_t Budget() const { return fBudget; }
+
+    // Memory of the step besides its trees; reserve it before configuring the trees
+    void Reserve(const std::string &what, Long64_t bytes)
+    {
+        fItems.push_back(Item{what, bytes, ""});
+        fReserved += bytes;
+    }
+
+    // Bytes left for the trees
+    Long64_t TreeBytes() const
+    {
+        return (Long64_t)(0.9 * fBudget) - fBaseline - fReserved;
+    }
+
+    // Cache and in-memory baskets of an input tree, after its branch status is set
+    void ConfigureInput(TTree *tree, double share)
+    {
+        if (!Enabled())
+            return;
+        Long64_t bytes = std::max(kMinTreeBytes, (Long64_t)(share * TreeBytes()));
+        tree->SetCacheSize(bytes / 2);
+        tree->SetMaxVirtualSize(bytes / 2);
+        char detail[128];
+        snprintf(detail, sizeof(detail), "cache %.1f MB, %lld bytes per entry read", bytes / 2. / kMB, RowBytes(tree, true));
+        fItems.push_back(Item{std::string(tree->GetName()) + " (input)", bytes, detail});
+    }
+
+    // Clusters and baskets of an output tree, after all its branches are created
+    void ConfigureOutput(TTree *tree, double share)
+    {
+        if (!Enabled())
+            return;
+        Long64_t bytes = std::max(kMinTreeBytes, (Long64_t)(share * TreeBytes()));
+        Long64_t row = std::max(RowBytes(tree, false), 1LL);
+        char detail[128];
+        if (tree->GetEntries() > 0)
+        {
+            // the copied baskets are written as they are, the new columns follow their clusters
+            snprintf(detail, sizeof(detail), "clusters of the copied tree kept (%lld entries)", tree->GetAutoFlush());
+        }
+        else
+        {
+            // one cluster of uncompressed baskets and their compressed copies
+            Long64_t entries = std::max(kMinClusterEntries, bytes / (2 * row));
+            tree->SetAutoFlush(entries);
+            TObjArray *branches = tree->GetListOfBranches();
+            for (int b = 0; b < branches->GetEntriesFast(); b++)
+            {
+                TBranch *branch = static_cast<TBranch *>(branches->At(b));
+                Long64_t basket = entries * BranchBytes(branch) + kBasketOverhead;
+                branch->SetBasketSize((Int_t)std::min(basket, kMaxBasketBytes));
+            }
+            snprintf(detail, sizeof(detail), "clusters of %lld entries, %lld bytes per entry", entries, row);
+        }
+        tree->SetMaxVirtualSize(bytes);
+        fItems.push_back(Item{std::string(tree->GetName()) + " (output)", bytes, detail});
+    }
+
+    // Where the memory was planned to go, and the peak RSS
+    void Report() const
+    {
+        if (!Enabled())
+            return;
+        Long64_t planned = fBaseline;
+        std::cout << "\nMemory budget of " << fStage << ": " << fBudget / kMB << " MB" << std::endl;
+        printf("  %-32s %10.1f MB\n", "process at start", fBaseline / kMB);
+        for (const Item &item : fItems)
+        {
+            printf("  %-32s %10.1f MB  %s\n", item.what.c_str(), item.bytes / kMB, item.detail.c_str());
+            planned += item.bytes;
+        }
+        printf("  %-32s %10.1f MB\n", "planned", planned / kMB);
+        Long64_t peak = PeakRss();
+        printf("  %-32s %10.1f MB  %s\n", "peak RSS", peak / kMB, peak <= fBudget ? "within the budget" : "over the budget");
+        printf("  %-32s %10.1f MB\n", "not accounted for", std::max(peak - planned, 0LL) / kMB);
+    }
+
+    // "3000" (MB), "3000M", "3G", "512K"; 0 for an empty or invalid size
+    static Long64_t ParseBytes(const std::string &size)
+    {
+        char *end = NULL;
+        double value = strtod(size.c_str(), &end);
+        if (size.empty() || end == size.c_str() || value <= 0)
+            return 0;
+        std::string unit(end);
+        if (unit.size() > 1 && (unit[1] == 'B' || unit[1] == 'b'))
+            unit.erase(1);
+        if (unit.empty() || unit == "M" || unit == "m")
+            return (Long64_t)(value * kMB);
+        if (unit == "G" || unit == "g")
+            return (Long64_t)(value * 1024 * kMB);
+        if (unit == "K" || unit == "k")
+            return (Long64_t)(value * 1024);
+        return 0;
+    }
+
+    static Long64_t CurrentRss()
+    {
+        std::ifstream statm("/proc/self/statm");
+        long long size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    static Long64_t PeakRss()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss * 1024LL;
+    }
+
+private:
+    struct Item
+    {
+        std::string what;
+        Long64_t bytes;
+        std::string detail;
+    };
+
+    // Uncompressed bytes of an entry of a branch
+    static Long64_t BranchBytes(TBranch *branch)
+    {
+        Long64_t bytes = 0;
+        TObjArray *leaves = branch->GetListOfLeaves();
+        for (int l = 0; l < leaves->GetEntriesFast(); l++)
+        {
+            TLeaf *leaf = static_cast<TLeaf *>(leaves->At(l));
+            bytes += (Long64_t)leaf->GetLenType() * std::max(leaf->GetLenStatic(), 1);
+        }
+        return bytes;
+    }
+
+    // Uncompressed bytes of an entry, of the active branches only if active_only
+    static Long64_t RowBytes(TTree *tree, bool active_only)
+    {
+        Long64_t bytes = 0;
+        TObjArray *branches = tree->GetListOfBranches();
+        for (int b = 0; b < branches->GetEntriesFast(); b++)
+        {
+            TBranch *branch = static_cast<TBranch *>(branches->At(b));
+            if (!active_only || tree->GetBranchStatus(branch->GetName()))
+                bytes += BranchBytes(branch);
+        }
+        return bytes;
+    }
+
+    static constexpr double kMB = 1024. * 1024.;
+    static constexpr Long64_t kMinTreeBytes = 4LL << 20;
+    static constexpr Long64_t kMinClusterEntries = 1000;
+    static constexpr Long64_t kMaxBasketBytes = 64LL << 20;
+    static constexpr Long64_t kBasketOverhead = 512;
+
+    std::string fStage;
+    Long64_t fBudget;
+    Long64_t fBaseline;
+    Long64_t fReserved;
+    std::vector<Item> fItems;
+};
+
+#endif // MEMORYBUDGET_H
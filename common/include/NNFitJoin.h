@@ -0,0 +1,348 @@
+/**
+ * @file NNFitJoin.h
+ * @brief Left join of the NNFit reconstructions on the entries of a sel tree.
+ * The NNFit rows are sorted by the event key (run_id, frame_index,
+ * event_counter_trigger) with a bounded amount of memory, spilling sorted
+ * runs to temporary files when needed, and joined with the tree entries in
+ * key order (sort-merge join). Every entry of the tree is kept, once:
+ * entries without an NNFit reconstruction get NaN, and only the first row
+ * of a duplicated key is joined. Unlike the pandas left merge, which gives
+ * one row per match, a duplicated key does not add entries; Duplicates()
+ * counts the rows left out.
+ *
+ * The tree side is read in key order from the tree itself when it is sorted,
+ * else from its event index (sel_index, see EventIndex.h) when it was built
+ * for this tree and passes Check(), else it is sorted.
+ * For a sorted tree the join is streamed; otherwise the joined values are
+ * sorted back to the order of the tree before Next() returns them.
+ *
+ * The NNFit files are DataFrames in HDF5 "fixed" format (as written by
+ * scripts/merge_nnfit.py). The columns of the first file, without the key
+ * columns, are the joined columns; IsFloat() tells the float32 ones.
+ *
+ * Usage:
+ *   NNFitJoin join(nnfit_files, hdf5_key, budget, tmpdir);
+ *   join.Start(file, tree);
+ *   Long64_t entry; const double *values;
+ *   while (join.Next(entry, values)) { ... }  // entry = 0, 1, 2, ...
+ */
+
+#ifndef NNFITJOIN_H
+#define NNFITJOIN_H
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventIndex.h"
+#include "EventKey.h"
+#include "ExternalSort.h"
+#include "PandasHDF5.h"
+#include "Trace.h"
+
+// Entry of the tree with its key
+struct NNFitTreeRecord
+{
+    EventKey key;
+    Long64_t entry;
+};
+
+// Records of the sorters start with an EventKey or an entry number
+inline bool NNFitKeyLess(const char *a, const char *b)
+{
+    EventKey ka, kb;
+    std::memcpy(&ka, a, sizeof(EventKey));
+    std::memcpy(&kb, b, sizeof(EventKey));
+    return ka < kb;
+}
+
+inline bool NNFitEntryLess(const char *a, const char *b)
+{
+    Long64_t ea, eb;
+    std::memcpy(&ea, a, sizeof(Long64_t));
+    std::memcpy(&eb, b, sizeof(Long64_t));
+    return ea < eb;
+}
+
+class NNFitJoin
+{
+public:
+    // Rows read from the HDF5 files at once
+    static const hsize_t kChunkRows = 65536;
+
+    // Reads and sorts the NNFit rows; budget bytes are shared by the three sorters
+    NNFitJoin(const std::vector<std::string> &nnfit_files, const std::string &hdf5_key, std::size_t budget, const std::string &tmpdir = "")
+        : fBudget(budget), fTmpDir(tmpdir), fRows(0), fBadKeys(0), fEntries(0), fSorted(true), fIndex(NULL),
+          fNextEntry(0), fHaveRight(false), fRightUsed(false), fMatched(0), fDuplicates(0), fUnused(0)
+    {
+        TRACE_SCOPE("ReadNNFit");
+        std::vector<char> record;
+        std::vector<double> chunk;
+
+        for (std::size_t f = 0; f < nnfit_files.size(); f++)
+        {
+            PandasFrameReader reader(nnfit_files[f], hdf5_key);
+            std::cout << "Reading " << nnfit_files[f] << " (" << reader.NRows() << " rows)" << std::endl;
+
+            std::vector<int> cols;
+            for (int k = 0; k < 3; k++)
+                cols.push_back(FindColumn(reader, nnfit_files[f], kNNFitKeyColumns[k]));
+
+            // the columns of the first file define the joined columns
+            if (f == 0)
+            {
+                for (std::size_t c = 0; c < reader.Columns().size(); c++)
+                {
+                    const PandasColumn &column = reader.Columns()[c];
+                    if (column.name == kNNFitKeyColumns[0] || column.name == kNNFitKeyColumns[1] || column.name == kNNFitKeyColumns[2])
+                        continue;
+                    fColumns.push_back(column.name);
+                    fIsFloat.push_back(column.type_class == H5T_FLOAT && column.type_size == 4);
+                }
+                record.resize(sizeof(EventKey) + fColumns.size() * sizeof(double));
+                fNNFitSorter.reset(new ExternalSorter(record.size(), fBudget / 3, NNFitKeyLess, fTmpDir));
+            }
+            for (std::size_t c = 0; c < fColumns.size(); c++)
+                cols.push_back(FindColumn(reader, nnfit_files[f], fColumns[c]));
+
+            for (hsize_t first = 0; first < reader.NRows(); first += kChunkRows)
+            {
+                hsize_t n = std::min(kChunkRows, reader.NRows() - first);
+                reader.Read(first, n, cols, chunk);
+                for (hsize_t r = 0; r < n; r++)
+                {
+                    const double *row = &chunk[r * cols.size()];
+                    if (!std::isfinite(row[0]) || !std::isfinite(row[1]) || !std::isfinite(row[2]))
+                    {
+                        fBadKeys++;
+                        continue;
+                    }
+                    EventKey key = {std::llround(row[0]), std::llround(row[1]), std::llround(row[2])};
+                    std::memcpy(&record[0], &key, sizeof(EventKey));
+                    std::memcpy(&record[sizeof(EventKey)], row + 3, fColumns.size() * sizeof(double));
+                    fNNFitSorter->Add(&record[0]);
+                    fRows++;
+                }
+            }
+        }
+        if (!fNNFitSorter)
+        {
+            std::cerr << "Error: no NNFit files" << std::endl;
+            exit(1);
+        }
+        fNNFitSorter->Finish();
+        std::cout << "NNFit: " << fRows << " rows, " << fColumns.size() << " columns, " << fNNFitSorter->NRuns() << " sort runs" << std::endl;
+        if (fBadKeys)
+            std::cout << "NNFit: " << fBadKeys << " rows without a valid key skipped" << std::endl;
+    }
+
+    NNFitJoin(const NNFitJoin &) = delete;
+    NNFitJoin &operator=(const NNFitJoin &) = delete;
+
+    const std::vector<std::string> &Columns() const { return fColumns; }
+    const std::vector<bool> &IsFloat() const { return fIsFloat; }
+    std::size_t NColumns() const { return fColumns.size(); }
+
+    // Position of a joined column, -1 if the NNFit files do not have it
+    int Find(const std::string &name) const
+    {
+        for (std::size_t c = 0; c < fColumns.size(); c++)
+            if (fColumns[c] == name)
+                return c;
+        return -1;
+    }
+
+    // Prepare the join with the entries of tree (stored in file, for its event index).
+    // Only the key branches of the tree are read; their status is left enabled.
+    void Start(TFile *file, TTree *tree)
+    {
+        TRACE_SCOPE("JoinStart");
+        fEntries = tree->GetEntries();
+        fKeys.reset(new EventKeyReader(tree));
+
+        // the key branches are small, check the order first and only sort when needed
+        fSorted = true;
+        EventKey previous = {0, 0, 0};
+        for (Long64_t i = 0; i < fEntries && fSorted; i++)
+        {
+            EventKey key = fKeys->Read(i);
+            fSorted = i == 0 || !(key < previous);
+            previous = key;
+        }
+        fEventIndex.reset(new EventIndex(file, tree));
+        fIndex = !fSorted && fEventIndex->Valid() && fEventIndex->Check() ? fEventIndex.get() : NULL;
+        std::cout << "Tree " << tree->GetName() << ": " << fEntries << " entries, "
+                  << (fSorted ? "already in key order" : fIndex ? "reading the event index" : "sorting by key") << std::endl;
+
+        if (!fSorted && !fIndex)
+        {
+            fTreeSorter.reset(new ExternalSorter(sizeof(NNFitTreeRecord), fBudget / 3, NNFitKeyLess, fTmpDir));
+            for (Long64_t i = 0; i < fEntries; i++)
+            {
+                NNFitTreeRecord record = {fKeys->Read(i), i};
+                fTreeSorter->Add(&record);
+            }
+            fTreeSorter->Finish();
+        }
+
+        fLeftNext = 0;
+        fRight.resize(sizeof(EventKey) + fColumns.size() * sizeof(double));
+        fJoined.resize(sizeof(Long64_t) + fColumns.size() * sizeof(double));
+        fMissing.assign(fColumns.size(), std::numeric_limits<double>::quiet_NaN());
+        fHaveRight = fNNFitSorter->Next(&fRight[0]);
+        if (fHaveRight)
+            std::memcpy(&fRightKey, &fRight[0], sizeof(EventKey));
+        fRightUsed = false;
+        fNextEntry = 0;
+
+        // back to the order of the tree
+        if (!fSorted)
+        {
+            fOutputSorter.reset(new ExternalSorter(fJoined.size(), fBudget / 3, NNFitEntryLess, fTmpDir));
+            Long64_t entry;
+            const double *values;
+            while (JoinNext(entry, values))
+            {
+                std::memcpy(&fJoined[0], &entry, sizeof(Long64_t));
+                std::memcpy(&fJoined[sizeof(Long64_t)], values, fColumns.size() * sizeof(double));
+                fOutputSorter->Add(&fJoined[0]);
+            }
+            fOutputSorter->Finish();
+        }
+    }
+
+    // Next entry of the tree, in entry order, with its NNFit values (NaN if none).
+    // values stays valid until the next call.
+    bool Next(Long64_t &entry, const double *&values)
+    {
+        bool more;
+        if (fSorted)
+            more = JoinNext(entry, values);
+        else
+        {
+            more = fOutputSorter->Next(&fJoined[0]);
+            if (more)
+            {
+                std::memcpy(&entry, &fJoined[0], sizeof(Long64_t));
+                values = (const double *)&fJoined[sizeof(Long64_t)];
+            }
+        }
+        if (!more)
+            return false;
+        if (entry != fNextEntry)
+        {
+            std::cerr << "Error: joined entry " << entry << " out of order, expected " << fNextEntry << std::endl;
+            exit(1);
+        }
+        fNextEntry++;
+        return true;
+    }
+
+    Long64_t Rows() const { return fRows; }
+    Long64_t Matched() const { return fMatched; }
+    Long64_t Duplicates() const { return fDuplicates; }
+    Long64_t Unused() const { return fUnused; }
+
+private:
+    static int FindColumn(const PandasFrameReader &reader, const std::string &path, const std::string &name)
+    {
+        int c = reader.Find(name);
+        if (c < 0)
+        {
+            std::cerr << "Error: " << path << " has no column " << name << std::endl;
+            exit(1);
+        }
+        return c;
+    }
+
+    // Left side: the entries of the tree in key order
+    bool NextLeft(NNFitTreeRecord &record)
+    {
+        if (fTreeSorter)
+            return fTreeSorter->Next(&record);
+        if (fLeftNext >= fEntries)
+            return false;
+        if (fIndex)
+        {
+            record.key = fIndex->Key(fLeftNext);
+            record.entry = fIndex->Entry(fLeftNext);
+        }
+        else
+        {
+            record.key = fKeys->Read(fLeftNext);
+            record.entry = fLeftNext;
+        }
+        fLeftNext++;
+        return true;
+    }
+
+    // Move to the next NNFit row; only the first row of a key is joined
+    void AdvanceRight()
+    {
+        if (!fRightUsed)
+            fUnused++;
+        EventKey previous = fRightKey;
+        fHaveRight = fNNFitSorter->Next(&fRight[0]);
+        if (!fHaveRight)
+            return;
+        std::memcpy(&fRightKey, &fRight[0], sizeof(EventKey));
+        fRightUsed = fRightKey == previous;
+        if (fRightUsed)
+            fDuplicates++;
+    }
+
+    // Next entry of the tree in key order with its NNFit values
+    bool JoinNext(Long64_t &entry, const double *&values)
+    {
+        NNFitTreeRecord record;
+        if (!NextLeft(record))
+        {
+            while (fHaveRight)
+                AdvanceRight();
+            return false;
+        }
+
+        while (fHaveRight && fRightKey < record.key)
+            AdvanceRight();
+
+        entry = record.entry;
+        values = fMissing.data();
+        if (fHaveRight && fRightKey == record.key)
+        {
+            values = (const double *)&fRight[sizeof(EventKey)];
+            fRightUsed = true;
+            fMatched++;
+        }
+        return true;
+    }
+
+    std::size_t fBudget;
+    std::string fTmpDir;
+    std::vector<std::string> fColumns;
+    std::vector<bool> fIsFloat;
+    std::unique_ptr<ExternalSorter> fNNFitSorter, fTreeSorter, fOutputSorter;
+    Long64_t fRows, fBadKeys;
+
+    Long64_t fEntries;
+    bool fSorted;
+    std::unique_ptr<EventKeyReader> fKeys;
+    std::unique_ptr<EventIndex> fEventIndex;
+    EventIndex *fIndex;
+    Long64_t fLeftNext, fNextEntry;
+
+    std::vector<char> fRight, fJoined;
+    std::vector<double> fMissing;
+    EventKey fRightKey;
+    bool fHaveRight, fRightUsed;
+    Long64_t fMatched, fDuplicates, fUnused;
+};
+
+#endif // NNFITJOIN_H
@@ -0,0 +1,177 @@
+/**
+ * @file OscillationKernels.h
+ * @brief Atmospheric flux and oscillation probabilities of the oscillation_weights step.
+ * Shared by OscillationWeights and the in-process pipeline driver, so that
+ * both compute the same w_osc. Needs OscProb (PremModel, PMNS_Fast).
+ */
+
+#ifndef OSCILLATIONKERNELS_H
+#define OSCILLATIONKERNELS_H
+
+#include <TFile.h>
+#include <TH2D.h>
+#include <TMath.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "PMNS_Fast.h"
+#include "PremModel.h"
+
+// Conversion of w2 from cm^2 to m^2
+const int scm_to_sm = 1e+4;
+
+// Honda flux tables of the cluster ("woody" or "in2p3")
+inline std::string FluxModelFile(const std::string &cluster)
+{
+    std::string hist_path;
+    if (cluster == "woody")
+    {
+        std::cout << "Running on Woody" << std::endl;
+        hist_path = "/home/saturn/capn/mppi133h/master_thesis/antares_dst/oscillation_weights/models/";
+    }
+    else if (cluster == "in2p3")
+    {
+        std::cout << "Running on IN2P3" << std::endl;
+        hist_path = "/sps/km3net/users/mchadoli/masters_thesis/antares_dst/oscillation_weights/models/";
+    }
+    return hist_path + "Honda2014_frj-solmin-aa_ORCA6_hist.root";
+}
+
+// Read the log10 flux histograms of nue, anue, numu and anumu; the copies are owned by the caller
+inline void LoadFluxHistograms(const std::string &flux_file, TH2D *FluxHist_copy[4])
+{
+    const std::string hist_names[4] = {"h_nue_logElogF", "h_anue_logElogF", "h_numu_logElogF", "h_anumu_logElogF"};
+
+    TFile *FluxInput = TFile::Open(flux_file.c_str());
+    if (!FluxInput || FluxInput->IsZombie())
+    {
+        std::cerr << "Error: Could not open the input ROOT file." << std::endl;
+        exit(1);
+    }
+
+    std::cout << "Retrieving Histograms" << std::endl;
+    for (int i = 0; i < 4; i++)
+    {
+        TH2D *hist = NULL;
+        FluxInput->GetObject(hist_names[i].c_str(), hist);
+        if (!hist)
+        {
+            std::cerr << "Error: histogram " << hist_names[i] << " not found in " << flux_file << std::endl;
+            exit(1);
+        }
+        FluxHist_copy[i] = dynamic_cast<TH2D *>(hist->Clone(("clone_" + hist_names[i]).c_str()));
+        FluxHist_copy[i]->SetDirectory(0);
+    }
+    FluxInput->Close();
+    delete FluxInput;
+}
+
+// Memory of the flux histograms
+inline Long64_t FluxHistogramBytes(TH2D *FluxHist_copy[4])
+{
+    Long64_t bytes = 0;
+    for (int i = 0; i < 4; i++)
+        bytes += (Long64_t)FluxHist_copy[i]->GetNcells() * sizeof(double);
+    return bytes;
+}
+
+// Data according to  JHEP 09 (2020) 178 ---> assuming Normal Ordering without SK atmospheric data
+inline void SetOscillationParameters(OscProb::PMNS_Fast &pmns)
+{
+    double dm_21 = 7.42e-5;
+    double dm_31 = 2.514e-3;
+    double theta_12 = 0.5836;
+    double theta_23 = 0.8552;
+    double theta_13 = 0.1496;
+    double dcp = (195 * TMath::Pi()) / 180;
+
+    pmns.SetDm(2, dm_21);
+    pmns.SetDm(3, dm_31);
+    pmns.SetAngle(1, 2, theta_12);
+    pmns.SetAngle(1, 3, theta_13);
+    pmns.SetAngle(2, 3, theta_23);
+    pmns.SetDelta(1, 3, dcp);
+}
+
+// Input neutrino flavour corresponding to OscProb arguments
+inline std::map<int, int> OscProbFlavours()
+{
+    std::map<int, int> flavour_cor;
+    flavour_cor.insert(std::pair<int, int>(12, 0));
+    flavour_cor.insert(std::pair<int, int>(-12, 0));
+    flavour_cor.insert(std::pair<int, int>(14, 1));
+    flavour_cor.insert(std::pair<int, int>(-14, 1));
+    flavour_cor.insert(std::pair<int, int>(16, 2));
+    flavour_cor.insert(std::pair<int, int>(-16, 2));
+    return flavour_cor;
+}
+
+/**
+ * @brief Function to calculate the neutrino flux, in log10 form
+ * The conversion to the flux is done in batch by the caller (Pow10).
+ *
+ * @param flavour
+ * @param log_E log10 of the energy
+ * @param cos_zen run_duration_calc
+ * @return log10 of the Honda flux for the current E and cos_zenith
+ */
+inline double GetLogFlux(TH2D **FluxHist_copy, int flavour, double log_E, double cos_zen)
+{
+    int i = 0; // option
+
+    if (flavour == 12) { i = 0; }
+    if (flavour == -12) { i = 1; }
+    if (flavour == 14) { i = 2; }
+    if (flavour == -14) { i = 3; }
+
+    double log_flux = FluxHist_copy[i]->Interpolate(log_E, cos_zen); // it's in logF form
+    return log_flux;
+}
+
+/**
+ * @brief Function to calculate neutrino oscillation probability
+ * pmns and prem are reused between events; the path and the neutrino or
+ * antineutrino mode are set on every call.
+ *
+ * @param pmns The PMNS matrix
+ * @param prem  The PREM (Earth model)
+ * @param flavour_cor The mapping of the neutrino flavours
+ * @param type_f  The final neutrino flavour
+ * @param E       The neutrino energy
+ * @param cos_zen  The cosine of the zenith angle
+ * @return Oscillation probabilities from nu_e and from nu_mu to the final flavour
+ */
+inline std::pair<double, double> Get_Osc_Prob(OscProb::PMNS_Fast &pmns, OscProb::PremModel &prem, std::map<int, int> &flavour_cor, int type_f, double E, double cos_zen)
+{
+    bool is_nubar = type_f < 0;
+    int flv_f = flavour_cor[type_f];
+
+    prem.FillPath(cos_zen);
+    pmns.SetPath(prem.GetNuPath());
+    pmns.SetIsNuBar(is_nubar); // in case of antiparticle
+
+    double prob_nue = pmns.Prob(0, flv_f, E);
+    double prob_numu = pmns.Prob(1, flv_f, E);
+
+    return std::make_pair(prob_nue, prob_numu);
+}
+
+/**
+ * @brief Typical sgn function
+ *
+ * @param x
+ * @return -1 for negative values and +1 for positive ones
+ */
+inline int sgn(double x)
+{
+    int sign = 0;
+    if (x > 0) { sign = 1; }
+    if (x < 0) { sign = -1; }
+    return sign;
+}
+
+#endif // OSCILLATIONKERNELS_H
@@ -0,0 +1,425 @@
+/**
+ * @file PandasHDF5.h
+ * @brief Chunked reader of DataFrames stored by pandas in HDF5 "fixed" format.
+ * This is the format written by DataFrame.to_hdf() with the default options,
+ * e.g. by save_to_hdf5() in external_library/file_management.py. A frame is
+ * a group holding one 2D dataset per dtype block, blockN_values with shape
+ * [rows, items], and its column names in blockN_items. Numeric columns are
+ * read as double for any row range; object columns (strings) are skipped.
+ * Frames in "table" format are not supported, load and save them again with
+ * save_to_hdf5() first.
+ *
+ * PandasFrameWriter writes frames in the same layout, preallocated and
+ * chunked, from chunks that are already filtered by the caller.
+ */
+
+#ifndef PANDASHDF5_H
+#define PANDASHDF5_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <hdf5.h>
+
+struct PandasColumn
+{
+    std::string name;
+    std::size_t block;
+    hsize_t item;         // position of the column inside its block
+    H5T_class_t type_class; // H5T_INTEGER or H5T_FLOAT
+    std::size_t type_size;  // bytes of the stored type
+};
+
+class PandasFrameReader
+{
+public:
+    // key is the group of the frame, by default the first group of the file
+    PandasFrameReader(const std::string &path, const std::string &key = "", bool verbose = true)
+        : fPath(path), fNRows(0), fVerbose(verbose)
+    {
+        fFile = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (fFile < 0)
+            Fail("could not open the file");
+
+        fKey = key.empty() ? FirstGroup() : key;
+        fGroup = H5Gopen2(fFile, fKey.c_str(), H5P_DEFAULT);
+        if (fGroup < 0)
+            Fail("no frame " + fKey);
+        if (H5Lexists(fGroup, "table", H5P_DEFAULT) > 0)
+            Fail("frame " + fKey + " is in table format, only the fixed format is supported");
+
+        for (std::size_t b = 0;; b++)
+        {
+            std::string values = "block" + std::to_string(b) + "_values";
+            std::string items = "block" + std::to_string(b) + "_items";
+            if (H5Lexists(fGroup, values.c_str(), H5P_DEFAULT) <= 0)
+                break;
+            OpenBlock(b, values, items);
+        }
+        if (fBlocks.empty())
+            Fail("frame " + fKey + " has no blocks");
+    }
+
+    ~PandasFrameReader()
+    {
+        for (std::size_t b = 0; b < fBlocks.size(); b++)
+            if (fBlocks[b].dataset >= 0)
+                H5Dclose(fBlocks[b].dataset);
+        H5Gclose(fGroup);
+        H5Fclose(fFile);
+    }
+
+    PandasFrameReader(const PandasFrameReader &) = delete;
+    PandasFrameReader &operator=(const PandasFrameReader &) = delete;
+
+    hsize_t NRows() const { return fNRows; }
+    const std::string &Key() const { return fKey; }
+
+    // Numeric columns of the frame, in block order
+    const std::vector<PandasColumn> &Columns() const { return fColumns; }
+
+    int Find(const std::string &name) const
+    {
+        for (std::size_t c = 0; c < fColumns.size(); c++)
+            if (fColumns[c].name == name)
+                return (int)c;
+        return -1;
+    }
+
+    // Rows [first, first + n) of the columns cols (indices into Columns()),
+    // as doubles in row-major order: out[row * cols.size() + k]
+    void Read(hsize_t first, hsize_t n, const std::vector<int> &cols, std::vector<double> &out)
+    {
+        out.assign(n * cols.size(), 0);
+        if (n == 0)
+            return;
+        if (first + n > fNRows)
+            Fail("row range beyond the end of the frame");
+
+        for (std::size_t b = 0; b < fBlocks.size(); b++)
+        {
+            Block &block = fBlocks[b];
+            if (block.dataset < 0)
+                continue;
+            bool needed = false;
+            for (std::size_t k = 0; k < cols.size(); k++)
+                needed |= fColumns[cols[k]].block == b;
+            if (!needed)
+                continue;
+
+            // whole rows of the block, converted to double by HDF5
+            hsize_t start[2] = {first, 0}, count[2] = {n, block.nitems};
+            hid_t file_space = H5Dget_space(block.dataset);
+            H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+            hid_t mem_space = H5Screate_simple(2, count, NULL);
+            fScratch.resize(n * block.nitems);
+            herr_t status = H5Dread(block.dataset, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, fScratch.data());
+            H5Sclose(mem_space);
+            H5Sclose(file_space);
+            if (status < 0)
+                Fail("could not read block " + std::to_string(b));
+
+            for (std::size_t k = 0; k < cols.size(); k++)
+            {
+                const PandasColumn &column = fColumns[cols[k]];
+                if (column.block != b)
+                    continue;
+                for (hsize_t r = 0; r < n; r++)
+                    out[r * cols.size() + k] = fScratch[r * block.nitems + column.item];
+            }
+        }
+    }
+
+private:
+    struct Block
+    {
+        hid_t dataset;
+        hsize_t nitems;
+    };
+
+    void Fail(const std::string &message) const
+    {
+        std::cerr << "Error: " << fPath << ": " << message << std::endl;
+        exit(1);
+    }
+
+    std::string FirstGroup()
+    {
+        H5G_info_t info;
+        H5Gget_info(fFile, &info);
+        for (hsize_t i = 0; i < info.nlinks; i++)
+        {
+            char name[1024];
+            if (H5Lget_name_by_idx(fFile, ".", H5_INDEX_NAME, H5_ITER_INC, i, name, sizeof(name), H5P_DEFAULT) < 0)
+                continue;
+            hid_t object = H5Oopen(fFile, name, H5P_DEFAULT);
+            bool is_group = object >= 0 && H5Iget_type(object) == H5I_GROUP;
+            if (object >= 0)
+                H5Oclose(object);
+            if (is_group)
+                return name;
+        }
+        Fail("no frame found");
+        return "";
+    }
+
+    std::vector<std::string> ReadNames(const std::string &dataset_name)
+    {
+        hid_t dataset = H5Dopen2(fGroup, dataset_name.c_str(), H5P_DEFAULT);
+        if (dataset < 0)
+            Fail("missing " + dataset_name);
+        hid_t type = H5Dget_type(dataset);
+        hid_t space = H5Dget_space(dataset);
+        hssize_t n = H5Sget_simple_extent_npoints(space);
+        std::vector<std::string> names;
+
+        if (H5Tget_class(type) == H5T_STRING && !H5Tis_variable_str(type))
+        {
+            std::size_t size = H5Tget_size(type);
+            hid_t mem_type = H5Tcopy(H5T_C_S1);
+            H5Tset_size(mem_type, size);
+            H5Tset_strpad(mem_type, H5T_STR_NULLPAD);
+            std::vector<char> buffer(n * size);
+            H5Dread(dataset, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buffer.data());
+            for (hssize_t i = 0; i < n; i++)
+            {
+                // fixed length strings are padded with zeros
+                std::string name(&buffer[i * size], size);
+                names.push_back(name.substr(0, name.find('\0')));
+            }
+            H5Tclose(mem_type);
+        }
+        else
+            Fail(dataset_name + " does not hold fixed length strings");
+
+        H5Sclose(space);
+        H5Tclose(type);
+        H5Dclose(dataset);
+        return names;
+    }
+
+    void OpenBlock(std::size_t b, const std::string &values, const std::string &items)
+    {
+        Block block;
+        block.dataset = H5Dopen2(fGroup, values.c_str(), H5P_DEFAULT);
+        block.nitems = 0;
+        if (block.dataset < 0)
+            Fail("could not open " + values);
+
+        hid_t type = H5Dget_type(block.dataset);
+        H5T_class_t type_class = H5Tget_class(type);
+        std::size_t type_size = H5Tget_size(type);
+        H5Tclose(type);
+
+        hid_t space = H5Dget_space(block.dataset);
+        int rank = H5Sget_simple_extent_ndims(space);
+        hsize_t dims[2] = {0, 0};
+        if (rank == 2)
+            H5Sget_simple_extent_dims(space, dims, NULL);
+        H5Sclose(space);
+
+        std::vector<std::string> names = ReadNames(items);
+        if (rank != 2 || (type_class != H5T_INTEGER && type_class != H5T_FLOAT))
+        {
+            // object (string) blocks are stored as pickled arrays
+            if (fVerbose)
+            {
+                std::cout << "PandasFrameReader: skipping non-numeric columns of " << values << ":";
+                for (std::size_t i = 0; i < names.size(); i++)
+                    std::cout << " " << names[i];
+                std::cout << std::endl;
+            }
+            H5Dclose(block.dataset);
+            block.dataset = -1;
+            fBlocks.push_back(block);
+            return;
+        }
+        if (dims[1] != names.size())
+            Fail(values + " does not match " + items);
+        if (!fColumns.empty() && fNRows != dims[0])
+            Fail(values + " has a different number of rows");
+
+        fNRows = dims[0];
+        block.nitems = dims[1];
+        for (hsize_t i = 0; i < dims[1]; i++)
+        {
+            PandasColumn column = {names[i], b, i, type_class, type_size};
+            fColumns.push_back(column);
+        }
+        fBlocks.push_back(block);
+    }
+
+    std::string fPath, fKey;
+    hid_t fFile, fGroup;
+    hsize_t fNRows;
+    bool fVerbose;
+    std::vector<Block> fBlocks;
+    std::vector<PandasColumn> fColumns;
+    std::vector<double> fScratch;
+};
+
+class PandasFrameWriter
+{
+public:
+    // All datasets are created with nrows rows, chunked by chunk_rows rows and
+    // filtered with shuffle + deflate at the given level; the index is 0 .. nrows-1
+    PandasFrameWriter(const std::string &path, const std::string &key, hsize_t nrows, hsize_t chunk_rows, int level)
+        : fPath(path), fNRows(nrows), fChunkRows(chunk_rows), fLevel(level)
+    {
+        fFile = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if (fFile < 0)
+            Fail("could not create the file");
+        fGroup = H5Gcreate2(fFile, key.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (fGroup < 0)
+            Fail("could not create the group " + key);
+
+        hid_t index_type = H5Tcopy(H5T_NATIVE_INT64);
+        fIndex = CreateChunked("axis1", index_type, 1, 1);
+        H5Tclose(index_type);
+        WriteStringAttribute(fIndex, "kind", "integer");
+    }
+
+    ~PandasFrameWriter() { Close(); }
+
+    PandasFrameWriter(const PandasFrameWriter &) = delete;
+    PandasFrameWriter &operator=(const PandasFrameWriter &) = delete;
+
+    hsize_t NRows() const { return fNRows; }
+    hsize_t ChunkRows() const { return fChunkRows; }
+    hsize_t NChunks() const { return fChunkRows ? (fNRows + fChunkRows - 1) / fChunkRows : 0; }
+
+    // Add a block of columns of the given type, returns its number
+    std::size_t AddBlock(const std::vector<std::string> &items, hid_t type)
+    {
+        std::size_t b = fBlocks.size();
+        std::string name = "block" + std::to_string(b);
+        hid_t dataset = CreateChunked(name + "_values", type, 2, items.size());
+        // pandas stores the transpose of its [items, rows] block values
+        WriteIntegerAttribute(dataset, "transposed", 1);
+        fBlocks.push_back(dataset);
+
+        hid_t names = WriteNames(name + "_items", items);
+        H5Dclose(names);
+        fColumns.insert(fColumns.end(), items.begin(), items.end());
+        return b;
+    }
+
+    // Store the filtered chunk c of block b, or of the index for b = -1
+    void WriteChunk(int b, hsize_t c, const void *data, std::size_t size)
+    {
+        hid_t dataset = b < 0 ? fIndex : fBlocks[b];
+        hsize_t offset[2] = {c * fChunkRows, 0};
+        if (H5Dwrite_chunk(dataset, H5P_DEFAULT, 0, offset, size, data) < 0)
+            Fail("could not write chunk " + std::to_string(c));
+    }
+
+    // Write the column axis and the pandas attributes, and close the file
+    void Close()
+    {
+        if (fFile < 0)
+            return;
+        // columns in block order, pandas places the blocks by name when reading
+        H5Dclose(WriteNames("axis0", fColumns));
+
+        WriteStringAttribute(fGroup, "pandas_type", "frame");
+        WriteStringAttribute(fGroup, "pandas_version", "0.15.2");
+        WriteStringAttribute(fGroup, "encoding", "UTF-8");
+        WriteStringAttribute(fGroup, "errors", "strict");
+        WriteIntegerAttribute(fGroup, "ndim", 2);
+        WriteIntegerAttribute(fGroup, "nblocks", fBlocks.size());
+        WriteStringAttribute(fGroup, "axis0_variety", "regular");
+        WriteStringAttribute(fGroup, "axis1_variety", "regular");
+        for (std::size_t b = 0; b < fBlocks.size(); b++)
+        {
+            WriteStringAttribute(fGroup, "block" + std::to_string(b) + "_items_variety", "regular");
+            H5Dclose(fBlocks[b]);
+        }
+        H5Dclose(fIndex);
+        H5Gclose(fGroup);
+        H5Fclose(fFile);
+        fFile = -1;
+    }
+
+private:
+    void Fail(const std::string &message) const
+    {
+        std::cerr << "Error: " << fPath << ": " << message << std::endl;
+        exit(1);
+    }
+
+    hid_t CreateChunked(const std::string &name, hid_t type, int rank, hsize_t nitems)
+    {
+        // unlimited rows allow chunks longer than the frame
+        hsize_t dims[2] = {fNRows, nitems}, max_dims[2] = {H5S_UNLIMITED, nitems}, chunk[2] = {fChunkRows, nitems};
+        hid_t space = H5Screate_simple(rank, dims, max_dims);
+        hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(dcpl, rank, chunk);
+        H5Pset_shuffle(dcpl);
+        H5Pset_deflate(dcpl, fLevel);
+        // all chunks are written, the space is allocated up front
+        H5Pset_alloc_time(dcpl, H5D_ALLOC_TIME_INCR);
+        H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER);
+        hid_t dataset = H5Dcreate2(fGroup, name.c_str(), type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+        H5Pclose(dcpl);
+        H5Sclose(space);
+        if (dataset < 0)
+            Fail("could not create " + name);
+        return dataset;
+    }
+
+    hid_t WriteNames(const std::string &name, const std::vector<std::string> &names)
+    {
+        std::size_t size = 1;
+        for (std::size_t i = 0; i < names.size(); i++)
+            size = std::max(size, names[i].size());
+        std::vector<char> buffer(names.size() * size, '\0');
+        for (std::size_t i = 0; i < names.size(); i++)
+            names[i].copy(&buffer[i * size], size);
+
+        hid_t type = H5Tcopy(H5T_C_S1);
+        H5Tset_size(type, size);
+        H5Tset_strpad(type, H5T_STR_NULLPAD);
+        hsize_t dims[1] = {names.size()};
+        hid_t space = H5Screate_simple(1, dims, NULL);
+        hid_t dataset = H5Dcreate2(fGroup, name.c_str(), type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (dataset < 0 || (!names.empty() && H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buffer.data()) < 0))
+            Fail("could not write " + name);
+        H5Sclose(space);
+        H5Tclose(type);
+        WriteStringAttribute(dataset, "kind", "string");
+        return dataset;
+    }
+
+    static void WriteStringAttribute(hid_t object, const std::string &name, const std::string &value)
+    {
+        hid_t type = H5Tcopy(H5T_C_S1);
+        H5Tset_size(type, std::max<std::size_t>(value.size(), 1));
+        hid_t space = H5Screate(H5S_SCALAR);
+        hid_t attribute = H5Acreate2(object, name.c_str(), type, space, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attribute, type, value.c_str());
+        H5Aclose(attribute);
+        H5Sclose(space);
+        H5Tclose(type);
+    }
+
+    static void WriteIntegerAttribute(hid_t object, const std::string &name, long long value)
+    {
+        hid_t space = H5Screate(H5S_SCALAR);
+        hid_t attribute = H5Acreate2(object, name.c_str(), H5T_NATIVE_LLONG, space, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attribute, H5T_NATIVE_LLONG, &value);
+        H5Aclose(attribute);
+        H5Sclose(space);
+    }
+
+    std::string fPath;
+    hid_t fFile, fGroup, fIndex;
+    hsize_t fNRows, fChunkRows;
+    int fLevel;
+    std::vector<hid_t> fBlocks;
+    std::vector<std::string> fColumns;
+};
+
+#endif // PANDASHDF5_H
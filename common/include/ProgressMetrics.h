@@ -0,0 +1,248 @@
+/**
+ * @file ProgressMetrics.h
+ * @brief Progress, throughput and ETA of a running step, printed and written as a metrics file.
+ * The event loop only adds to an atomic counter (Add, relaxed); a reporter
+ * thread wakes up twice a second, prints the progress every 5% of the
+ * entries and, with --metrics <file>, rewrites the file every
+ * --metrics-interval seconds (10 by default) in the Prometheus text format:
+ *
+ *   stage_entries_processed{stage="CorrectTree",phase="weights",output="out.root"} 1250000
+ *   stage_entries_total, stage_events_per_second, stage_eta_seconds, stage_elapsed_seconds,
+ *   stage_read_bytes, stage_written_bytes, stage_rss_bytes, stage_peak_rss_bytes, stage_done
+ *
+ * The file is replaced with a rename, so a reader never sees half of it:
+ * point the textfile collector of node_exporter at the directory of the
+ * array tasks, or simply `watch cat metrics/task_*.prom`. The bytes are the rchar
+ * and wchar of /proc/self/io (every read and write system call, as in
+ * benchmark/measure/MeasureStage.cc) and the memory comes from /proc/self/statm.
+ *
+ * Usage:
+ *   ProgressMetrics progress("CorrectTree", output_file, options);   // options {"metrics", "metrics-interval"}
+ *   progress.Begin("weights", ntot);
+ *   for (...) { ...; progress.Add(); }
+ *   progress.Finish();   // final line and file, stage_done 1
+ */
+
+#ifndef PROGRESSMETRICS_H
+#define PROGRESSMETRICS_H
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "StageOptions.h"
+
+class ProgressMetrics
+{
+public:
+    // --metrics <file> and --metrics-interval <seconds> must be in the valued options of the step
+    ProgressMetrics(const std::string &stage, const std::string &output, const StageOptions &options)
+        : fStage(stage), fOutput(output), fPath(options.Get("metrics")),
+          fInterval(atof(options.Get("metrics-interval", "10").c_str())),
+          fProcessed(0), fTotal(0), fNextPrint(1), fStop(false), fDone(false)
+    {
+        if (fInterval <= 0)
+            fInterval = 10;
+        std::string::size_type slash = fOutput.find_last_of('/');
+        if (slash != std::string::npos)
+            fOutput = fOutput.substr(slash + 1);
+        fStart = fPhaseStart = std::chrono::steady_clock::now();
+    }
+
+    ~ProgressMetrics() { Finish(); }
+
+    ProgressMetrics(const ProgressMetrics &) = delete;
+    ProgressMetrics &operator=(const ProgressMetrics &) = delete;
+
+    // Start counting a new pass over total entries; the reporter starts with the first one
+    void Begin(const std::string &phase, long long total)
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            Print(); // the end of the previous phase
+            fPhase = phase;
+            fPhaseStart = std::chrono::steady_clock::now();
+            fNextPrint = 1;
+            fTotal.store(total, std::memory_order_relaxed);
+            fProcessed.store(0, std::memory_order_relaxed);
+        }
+        if (!fReporter.joinable())
+            fReporter = std::thread(&ProgressMetrics::Report, this);
+    }
+
+    // Called from the event loop, by any number of threads
+    void Add(long long n = 1) { fProcessed.fetch_add(n, std::memory_order_relaxed); }
+
+    // For loops that count their entries themselves (TrackProgress in StageRDF.h)
+    void Set(long long n) { fProcessed.store(n, std::memory_order_relaxed); }
+
+    // Stop the reporter and write the final state
+    void Finish()
+    {
+        if (fDone)
+            return;
+        fDone = true;
+        if (fReporter.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(fMutex);
+                fStop = true;
+            }
+            fWake.notify_one();
+            fReporter.join();
+            Print();
+        }
+        if (!fPath.empty())
+            Write(true);
+    }
+
+private:
+    void Report()
+    {
+        std::chrono::steady_clock::time_point next_write = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(fMutex);
+        while (!fStop)
+        {
+            Print();
+            if (!fPath.empty() && std::chrono::steady_clock::now() >= next_write)
+            {
+                lock.unlock();
+                Write(false);
+                lock.lock();
+                next_write += std::chrono::milliseconds((long long)(1000 * fInterval));
+            }
+            fWake.wait_for(lock, std::chrono::milliseconds(500), [this] { return fStop; });
+        }
+    }
+
+    // Progress line at every 5% of the phase; called with fMutex held
+    void Print()
+    {
+        long long processed = fProcessed.load(std::memory_order_relaxed);
+        long long total = fTotal.load(std::memory_order_relaxed);
+        if (total <= 0 || 20 * processed < fNextPrint * total)
+            return;
+        while (fNextPrint <= 20 && 20 * processed >= fNextPrint * total)
+            fNextPrint++;
+        double rate = Rate(processed);
+        std::cout << "Processed " << processed << " events out of " << total << " (" << (long long)rate << " events/s, ETA "
+                  << (long long)Eta(processed, total, rate) << " s)" << std::endl;
+    }
+
+    double Rate(long long processed) const
+    {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - fPhaseStart).count();
+        return elapsed > 0 ? processed / elapsed : 0;
+    }
+
+    static double Eta(long long processed, long long total, double rate)
+    {
+        return rate > 0 && total > processed ? (total - processed) / rate : 0;
+    }
+
+    void Write(bool done)
+    {
+        std::string phase;
+        double rate;
+        long long processed = fProcessed.load(std::memory_order_relaxed);
+        long long total = fTotal.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            phase = fPhase;
+            rate = Rate(processed);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+        long long bytes_read = -1, bytes_written = -1;
+        ReadIO(bytes_read, bytes_written);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::string labels = "{stage=\"" + Escape(fStage) + "\",phase=\"" + Escape(phase) + "\",output=\"" + Escape(fOutput) + "\"}";
+        std::string tmp = fPath + ".tmp";
+        FILE *out = fopen(tmp.c_str(), "w");
+        if (!out)
+        {
+            std::cerr << "Warning: cannot write the metrics to " << tmp << std::endl;
+            return;
+        }
+        Metric(out, "stage_entries_processed", "counter", "Entries processed in the current phase", labels, processed);
+        Metric(out, "stage_entries_total", "gauge", "Entries of the current phase", labels, total);
+        Metric(out, "stage_events_per_second", "gauge", "Mean rate of the current phase", labels, rate);
+        Metric(out, "stage_eta_seconds", "gauge", "Estimated time left in the current phase", labels, done ? 0 : Eta(processed, total, rate));
+        Metric(out, "stage_elapsed_seconds", "gauge", "Time since the step started", labels, elapsed);
+        Metric(out, "stage_read_bytes", "counter", "Bytes read by system calls (rchar)", labels, bytes_read);
+        Metric(out, "stage_written_bytes", "counter", "Bytes written by system calls (wchar)", labels, bytes_written);
+        Metric(out, "stage_rss_bytes", "gauge", "Resident set size", labels, Rss());
+        Metric(out, "stage_peak_rss_bytes", "gauge", "Peak resident set size", labels, usage.ru_maxrss * 1024.);
+        Metric(out, "stage_done", "gauge", "1 once the step has finished", labels, done ? 1 : 0);
+        fclose(out);
+        if (rename(tmp.c_str(), fPath.c_str()) != 0)
+            std::cerr << "Warning: cannot write the metrics to " << fPath << std::endl;
+    }
+
+    static void Metric(FILE *out, const char *name, const char *type, const char *help, const std::string &labels, double value)
+    {
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s%s %.17g\n", name, help, name, type, name, labels.c_str(), value);
+    }
+
+    static std::string Escape(const std::string &value)
+    {
+        std::string escaped;
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+                escaped += '\\';
+            escaped += c == '\n' ? ' ' : c;
+        }
+        return escaped;
+    }
+
+    static void ReadIO(long long &bytes_read, long long &bytes_written)
+    {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        long long value;
+        while (io >> key >> value)
+        {
+            if (key == "rchar:")
+                bytes_read = value;
+            else if (key == "wchar:")
+                bytes_written = value;
+        }
+    }
+
+    static double Rss()
+    {
+        std::ifstream statm("/proc/self/statm");
+        long long size = 0, resident = -1;
+        statm >> size >> resident;
+        return resident < 0 ? -1 : (double)resident * sysconf(_SC_PAGESIZE);
+    }
+
+    std::string fStage, fOutput, fPath;
+    double fInterval;
+    std::atomic<long long> fProcessed, fTotal;
+
+    // guarded by fMutex
+    std::mutex fMutex;
+    std::condition_variable fWake;
+    std::string fPhase;
+    std::chrono::steady_clock::time_point fStart, fPhaseStart;
+    long long fNextPrint;
+    bool fStop;
+
+    bool fDone;
+    std::thread fReporter;
+};
+
+#endif // PROGRESSMETRICS_H
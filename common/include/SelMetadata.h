@@ -0,0 +1,205 @@
+/**
+ * @file SelMetadata.h
+ * @brief Metadata stored next to the sel tree by every stage that writes it.
+ * AnnotateSelFile() is called on a closed output file; it reads back only the
+ * summarised columns and adds the zone map as the small tree "sel_zones"
+ * (branches entry_first, entry_last, <column>_min, <column>_max), which is
+ * readable from ROOT and from uproot alike, and the event key index
+ * "sel_index" of EventIndex.h.
+ *
+ * A tree whose entries are sorted (MergeSel --sort) carries its sort key, the
+ * columns in order ("run_id,cos_zenith_true"), as the TNamed "sel_sort" of
+ * its user info. CloneTree copies the user info, so the steps that keep the
+ * order of their input (a selection keeps it too) keep the key; a tree filled
+ * in another order is created without it.
+ */
+
+#ifndef SELMETADATA_H
+#define SELMETADATA_H
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TList.h>
+#include <TNamed.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "EventIndex.h"
+#include "ZoneMap.h"
+
+const char *const kZoneMapTreeName = "sel_zones";
+const char *const kSortKeyName = "sel_sort";
+
+// Columns the entries of a tree are sorted by, comma separated; empty if it is not sorted
+inline std::string GetSortKey(TTree *tree)
+{
+    TNamed *key = dynamic_cast<TNamed *>(tree->GetUserInfo()->FindObject(kSortKeyName));
+    return key ? key->GetTitle() : "";
+}
+
+// Record the sort key of a tree before it is written; an empty key removes it
+inline void SetSortKey(TTree *tree, const std::string &key)
+{
+    TList *info = tree->GetUserInfo();
+    TObject *old = info->FindObject(kSortKeyName);
+    if (old)
+    {
+        info->Remove(old);
+        delete old;
+    }
+    if (!key.empty())
+        info->Add(new TNamed(kSortKeyName, key.c_str()));
+}
+
+// Compute the zone map of a tree, one zone per cluster, for the listed columns that exist
+inline ZoneMap BuildZoneMap(TTree *tree, const std::vector<std::string> &columns = DefaultZoneColumns())
+{
+    std::vector<std::string> present;
+    std::vector<TBranch *> branches;
+    std::vector<TLeaf *> leaves;
+    for (const std::string &column : columns)
+    {
+        TBranch *branch = tree->GetBranch(column.c_str());
+        if (!branch)
+            continue;
+        present.push_back(column);
+        branches.push_back(branch);
+        leaves.push_back(static_cast<TLeaf *>(branch->GetListOfLeaves()->At(0)));
+    }
+
+    ZoneMap zones;
+    Long64_t ntot = tree->GetEntries();
+    TTree::TClusterIterator clusters = tree->GetClusterIterator(0);
+    Long64_t first;
+    while ((first = clusters()) < ntot)
+    {
+        Long64_t last = std::min(clusters.GetNextEntry(), ntot);
+        zones.AddZone(first, last, present);
+
+        for (std::size_t c = 0; c < present.size(); c++)
+            for (Long64_t i = first; i < last; i++)
+            {
+                branches[c]->GetEntry(i);
+                zones.Update(present[c], leaves[c]->GetValue());
+            }
+    }
+    return zones;
+}
+
+inline void WriteZoneMap(TFile *file, const ZoneMap &zones)
+{
+    file->cd();
+    TTree zone_tree(kZoneMapTreeName, "Per-cluster min/max of selected sel branches");
+
+    Long64_t entry_first, entry_last;
+    std::vector<std::string> columns = zones.Columns();
+    std::vector<double> lo(columns.size()), hi(columns.size());
+
+    zone_tree.Branch("entry_first", &entry_first, "entry_first/L");
+    zone_tree.Branch("entry_last", &entry_last, "entry_last/L");
+    for (std::size_t c = 0; c < columns.size(); c++)
+    {
+        zone_tree.Branch((columns[c] + "_min").c_str(), &lo[c], (columns[c] + "_min/D").c_str());
+        zone_tree.Branch((columns[c] + "_max").c_str(), &hi[c], (columns[c] + "_max/D").c_str());
+    }
+
+    for (std::size_t z = 0; z < zones.NZones(); z++)
+    {
+        entry_first = zones.First(z);
+        entry_last = zones.Last(z);
+        for (std::size_t c = 0; c < columns.size(); c++)
+        {
+            lo[c] = zones.Min(columns[c], z);
+            hi[c] = zones.Max(columns[c], z);
+        }
+        zone_tree.Fill();
+    }
+    zone_tree.Write("", TObject::kOverwrite);
+}
+
+// Read the zone map of a file; returns an empty map if it is missing or does not match the sel tree
+inline ZoneMap ReadZoneMap(TFile *file, Long64_t entries)
+{
+    ZoneMap zones;
+    TTree *zone_tree = dynamic_cast<TTree *>(file->Get(kZoneMapTreeName));
+    if (!zone_tree)
+        return zones;
+
+    Long64_t entry_first, entry_last;
+    zone_tree->SetBranchAddress("entry_first", &entry_first);
+    zone_tree->SetBranchAddress("entry_last", &entry_last);
+
+    std::vector<std::string> columns;
+    TObjArray *branches = zone_tree->GetListOfBranches();
+    for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+    {
+        std::string name = branches->At(b)->GetName();
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, "_min") == 0)
+            columns.push_back(name.substr(0, name.size() - 4));
+    }
+
+    std::vector<double> lo(columns.size()), hi(columns.size());
+    for (std::size_t c = 0; c < columns.size(); c++)
+    {
+        zone_tree->SetBranchAddress((columns[c] + "_min").c_str(), &lo[c]);
+        zone_tree->SetBranchAddress((columns[c] + "_max").c_str(), &hi[c]);
+    }
+
+    for (Long64_t z = 0; z < zone_tree->GetEntries(); z++)
+    {
+        zone_tree->GetEntry(z);
+        zones.AddZone(entry_first, entry_last, columns);
+        for (std::size_t c = 0; c < columns.size(); c++)
+            zones.SetRange(columns[c], z, lo[c], hi[c]);
+    }
+    zone_tree->ResetBranchAddresses();
+
+    if (!zones.Covers(entries))
+    {
+        std::cerr << "Warning: zone map of " << file->GetName() << " does not match the sel tree, ignoring it" << std::endl;
+        return ZoneMap();
+    }
+    return zones;
+}
+
+// Add the sel metadata to a closed output file
+inline void AnnotateSelFile(const std::string &path, const std::string &tree_name = "sel")
+{
+    TFile *file = TFile::Open(path.c_str(), "UPDATE");
+    if (!file || file->IsZombie())
+    {
+        std::cerr << "Error: file " << path << " not found" << std::endl;
+        exit(1);
+    }
+
+    TTree *tree = dynamic_cast<TTree *>(file->Get(tree_name.c_str()));
+    if (!tree)
+    {
+        std::cerr << "Error: tree " << tree_name << " not found in " << path << std::endl;
+        exit(1);
+    }
+
+    ZoneMap zones = BuildZoneMap(tree);
+    WriteZoneMap(file, zones);
+    std::cout << "Zone map: " << zones.NZones() << " clusters, " << zones.Columns().size() << " columns" << std::endl;
+    if (!GetSortKey(tree).empty())
+        std::cout << "Sorted by: " << GetSortKey(tree) << std::endl;
+
+    if (EventKeyReader::HasKey(tree))
+    {
+        Long64_t duplicates = WriteEventIndex(file, tree);
+        std::cout << "Event index: " << tree->GetEntries() << " keys, " << duplicates << " duplicates" << std::endl;
+    }
+
+    file->Close();
+    delete file;
+}
+
+#endif // SELMETADATA_H
@@ -0,0 +1,265 @@
+/**
+ * @file SelSchema.h
+ * @brief Branches of the sel tree written by extract_dst, as an X-macro.
+ * SEL_SCHEMA(X) expands X(type, name, strategy) for every scalar branch, in
+ * the order of the extraction. strategy is the reconstruction strategy whose
+ * flag masks the branch in the corrections step, kNoStrategy otherwise; the
+ * flag branch of each strategy is listed by SEL_STRATEGY_FLAGS(S).
+ *
+ * Usage:
+ *   #define X(type, name, strategy) std::cout << #name << std::endl;
+ *   SEL_SCHEMA(X)
+ *   #undef X
+ */
+
+#ifndef SELSCHEMA_H
+#define SELSCHEMA_H
+
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TTree.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "ColumnReader.h"
+
+// Reconstruction strategies of the ANTDST
+enum ERecoStrategy
+{
+    kNoStrategy = -1,
+    kAAFit,
+    kBBFit,
+    kGridFit,
+    kBBFitShower,
+    kShowerDusj,
+    kShowerTantra,
+    kNRecoStrategies
+};
+
+#define SEL_STRATEGY_FLAGS(S)       \
+    S(kAAFit, aafit_flag)           \
+    S(kBBFit, bbfit_flag)           \
+    S(kGridFit, gridfit_flag)       \
+    S(kBBFitShower, bbfit_shower_flag) \
+    S(kShowerDusj, showerdusj_flag) \
+    S(kShowerTantra, showertantra_flag)
+
+#define SEL_SCHEMA(X)                                         \
+    /* run and data quality */                                \
+    X(double, MJD, kNoStrategy)                               \
+    X(int, Date, kNoStrategy)                                 \
+    X(int, run, kNoStrategy)                                  \
+    X(unsigned long long, event_id, kNoStrategy)              \
+    X(unsigned long long, event_counter_trigger, kNoStrategy) \
+    X(double, frame_index, kNoStrategy)                       \
+    X(double, BaselineRate, kNoStrategy)                      \
+    X(float, RatioActive, kNoStrategy)                        \
+    X(double, BurstFraction, kNoStrategy)                     \
+    X(double, run_duration, kNoStrategy)                      \
+    X(double, run_duration_dq, kNoStrategy)                   \
+    X(double, RunDurationYear, kNoStrategy)                   \
+    X(double, RunQuality, kNoStrategy)                        \
+    X(int, Scan, kNoStrategy)                                 \
+    /* true event and weights */                              \
+    X(int, run_id, kNoStrategy)                               \
+    X(int, type, kNoStrategy)                                 \
+    X(bool, is_neutrino, kNoStrategy)                         \
+    X(bool, is_cc, kNoStrategy)                               \
+    X(int, interaction_type, kNoStrategy)                     \
+    X(double, w2, kNoStrategy)                                \
+    X(double, w3, kNoStrategy)                                \
+    X(float, w_muon, kNoStrategy)                             \
+    X(double, w_honda, kNoStrategy)                           \
+    X(double, ngen, kNoStrategy)                              \
+    X(float, DataMCRatio, kNoStrategy)                        \
+    X(double, pos_x_true, kNoStrategy)                        \
+    X(double, pos_y_true, kNoStrategy)                        \
+    X(double, pos_z_true, kNoStrategy)                        \
+    X(double, energy_true, kNoStrategy)                       \
+    X(double, cos_zenith_true, kNoStrategy)                   \
+    X(double, azimuthdeg_true, kNoStrategy)                   \
+    X(double, bjorken_y_true, kNoStrategy)                    \
+    X(double, E_min_gen, kNoStrategy)                         \
+    X(double, E_max_gen, kNoStrategy)                         \
+    /* triggers */                                            \
+    X(bool, t3N_active, kNoStrategy)                          \
+    X(bool, tT2_active, kNoStrategy)                          \
+    X(bool, tT3_active, kNoStrategy)                          \
+    X(bool, tTQ_active, kNoStrategy)                          \
+    /* AAFit */                                               \
+    X(double, aafit_lambda, kAAFit)                           \
+    X(double, aafit_bjy, kAAFit)                              \
+    X(double, aafit_pos_x, kAAFit)                            \
+    X(double, aafit_pos_y, kAAFit)                            \
+    X(double, aafit_pos_z, kAAFit)                            \
+    X(double, aafit_angerr_deg, kAAFit)                       \
+    X(double, aafit_zenith_deg, kAAFit)                       \
+    X(double, aafit_cos_zenith, kAAFit)                       \
+    X(double, aafit_azimuth_deg, kAAFit)                      \
+    X(double, aafit_nusedlines, kAAFit)                       \
+    X(double, aafit_nusedhits, kAAFit)                        \
+    X(double, aafit_totalamp, kAAFit)                         \
+    X(double, aafit_zmin, kAAFit)                             \
+    X(double, aafit_zmax, kAAFit)                             \
+    X(double, energy_aafit_dEdX_CEA, kAAFit)                  \
+    X(double, energy_aafit_ANN_ECAP, kAAFit)                  \
+    X(double, aafit_tracklength, kAAFit)                      \
+    X(double, aafit_nhits, kAAFit)                            \
+    X(bool, aafit_flag, kNoStrategy)                          \
+    /* BBFit track */                                         \
+    X(double, bbfit_quality, kBBFit)                          \
+    X(double, bbfit_bjy, kBBFit)                              \
+    X(double, bbfit_pos_x, kBBFit)                            \
+    X(double, bbfit_pos_y, kBBFit)                            \
+    X(double, bbfit_pos_z, kBBFit)                            \
+    X(double, bbfit_angerr_deg, kBBFit)                       \
+    X(double, bbfit_zenith_deg, kBBFit)                       \
+    X(double, bbfit_cos_zenith, kBBFit)                       \
+    X(double, bbfit_azimuth_deg, kBBFit)                      \
+    X(double, bbfit_nusedlines, kBBFit)                       \
+    X(double, bbfit_nusedhits, kBBFit)                        \
+    X(double, bbfit_totalamp, kBBFit)                         \
+    X(double, bbfit_zmin, kBBFit)                             \
+    X(double, bbfit_zmax, kBBFit)                             \
+    X(double, bbfit_nhits, kBBFit)                            \
+    X(bool, bbfit_flag, kNoStrategy)                          \
+    /* GridFit */                                             \
+    X(double, gridfit_quality, kGridFit)                      \
+    X(double, gridfit_bjy, kGridFit)                          \
+    X(double, gridfit_pos_x, kGridFit)                        \
+    X(double, gridfit_pos_y, kGridFit)                        \
+    X(double, gridfit_pos_z, kGridFit)                        \
+    X(double, gridfit_angerr_deg, kGridFit)                   \
+    X(double, gridfit_zenith_deg, kGridFit)                   \
+    X(double, gridfit_cos_zenith, kGridFit)                   \
+    X(double, gridfit_azimuth_deg, kGridFit)                  \
+    X(double, gridfit_nusedlines, kGridFit)                   \
+    X(double, gridfit_nusedhits, kGridFit)                    \
+    X(double, gridfit_totalamp, kGridFit)                     \
+    X(double, gridfit_zmin, kGridFit)                         \
+    X(double, gridfit_zmax, kGridFit)                         \
+    X(double, gridfit_nhits, kGridFit)                        \
+    X(bool, gridfit_flag, kNoStrategy)                        \
+    /* BBFit shower */                                        \
+    X(double, bbfit_shower_quality, kBBFitShower)             \
+    X(double, bbfit_shower_bjy, kBBFitShower)                 \
+    X(double, bbfit_shower_pos_x, kBBFitShower)               \
+    X(double, bbfit_shower_pos_y, kBBFitShower)               \
+    X(double, bbfit_shower_pos_z, kBBFitShower)               \
+    X(double, bbfit_shower_angerr_deg, kBBFitShower)          \
+    X(double, bbfit_shower_zenith_deg, kBBFitShower)          \
+    X(double, bbfit_shower_cos_zenith, kBBFitShower)          \
+    X(double, bbfit_shower_azimuth_deg, kBBFitShower)         \
+    X(double, bbfit_shower_nusedlines, kBBFitShower)          \
+    X(double, bbfit_shower_nusedhits, kBBFitShower)           \
+    X(double, bbfit_shower_totalamp, kBBFitShower)            \
+    X(double, bbfit_shower_zmin, kBBFitShower)                \
+    X(double, bbfit_shower_zmax, kBBFitShower)                \
+    X(double, bbfit_shower_nhits, kBBFitShower)               \
+    X(bool, bbfit_shower_flag, kNoStrategy)                   \
+    /* Dusj shower */                                         \
+    X(double, showerdusj_quality, kShowerDusj)                \
+    X(double, showerdusj_bjy, kShowerDusj)                    \
+    X(double, showerdusj_pos_x, kShowerDusj)                  \
+    X(double, showerdusj_pos_y, kShowerDusj)                  \
+    X(double, showerdusj_pos_z, kShowerDusj)                  \
+    X(double, showerdusj_angerr_deg, kShowerDusj)             \
+    X(double, showerdusj_zenith_deg, kShowerDusj)             \
+    X(double, showerdusj_cos_zenith, kShowerDusj)             \
+    X(double, showerdusj_azimuth_deg, kShowerDusj)            \
+    X(double, showerdusj_nusedlines, kShowerDusj)             \
+    X(double, showerdusj_nusedhits, kShowerDusj)              \
+    X(double, showerdusj_totalamp, kShowerDusj)               \
+    X(double, showerdusj_energy, kShowerDusj)                 \
+    X(double, showerdusj_nhits, kShowerDusj)                  \
+    X(double, showerdusj_radius, kShowerDusj)                 \
+    X(double, showerdusj_height, kShowerDusj)                 \
+    X(bool, showerdusj_flag, kNoStrategy)                     \
+    /* Tantra shower */                                       \
+    X(double, showertantra_quality, kShowerTantra)            \
+    X(double, showertantra_bjy, kShowerTantra)                \
+    X(double, showertantra_pos_x, kShowerTantra)              \
+    X(double, showertantra_pos_y, kShowerTantra)              \
+    X(double, showertantra_pos_z, kShowerTantra)              \
+    X(double, showertantra_angerr_deg, kShowerTantra)         \
+    X(double, showertantra_zenith_deg, kShowerTantra)         \
+    X(double, showertantra_cos_zenith, kShowerTantra)         \
+    X(double, showertantra_azimuth_deg, kShowerTantra)        \
+    X(double, showertantra_nusedlines, kShowerTantra)         \
+    X(double, showertantra_nusedhits, kShowerTantra)          \
+    X(double, showertantra_totalamp, kShowerTantra)           \
+    X(double, showertantra_energy, kShowerTantra)             \
+    X(double, showertantra_radius, kShowerTantra)             \
+    X(double, showertantra_height, kShowerTantra)             \
+    X(double, showertantra_nhits, kShowerTantra)              \
+    X(bool, showertantra_flag, kNoStrategy)
+
+// One branch of the schema
+struct SelField
+{
+    const char *name;
+    const char *type; // ROOT leaf type name
+    ERecoStrategy strategy;
+};
+
+inline const SelField *SelFields()
+{
+#define X(type, name, strategy) {#name, RootTypeName<type>(), strategy},
+    static const SelField fields[] = {SEL_SCHEMA(X)};
+#undef X
+    return fields;
+}
+
+inline std::size_t NSelFields()
+{
+#define X(type, name, strategy) +1
+    return 0 SEL_SCHEMA(X);
+#undef X
+}
+
+// Flag branch of a reconstruction strategy
+inline const char *RecoFlag(ERecoStrategy strategy)
+{
+#define S(strategy_id, flag) if (strategy == strategy_id) return #flag;
+    SEL_STRATEGY_FLAGS(S)
+#undef S
+    return NULL;
+}
+
+/**
+ * @brief Compare the branches of a tree with the schema.
+ * Prints the branches of the schema that are missing or have another type.
+ * Branches added by later steps (weights, NNFit, ...) are not checked, nor
+ * the reconstruction columns of a sparse tree, which are in its strategy
+ * trees (SparseReco.h).
+ *
+ * @return Number of mismatches
+ */
+inline int CheckSelSchema(TTree *tree, bool sparse_reco = false)
+{
+    int mismatches = 0;
+    const SelField *fields = SelFields();
+    for (std::size_t f = 0; f < NSelFields(); f++)
+    {
+        if (sparse_reco && fields[f].strategy != kNoStrategy)
+            continue;
+        TBranch *branch = tree->GetBranch(fields[f].name);
+        TLeaf *leaf = branch ? static_cast<TLeaf *>(branch->GetListOfLeaves()->At(0)) : NULL;
+        if (!leaf)
+        {
+            std::cerr << "Schema: branch " << fields[f].name << " missing" << std::endl;
+            mismatches++;
+        }
+        else if (std::string(leaf->GetTypeName()) != fields[f].type)
+        {
+            std::cerr << "Schema: branch " << fields[f].name << " has type " << leaf->GetTypeName()
+                      << ", expected " << fields[f].type << std::endl;
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+#endif // SELSCHEMA_H
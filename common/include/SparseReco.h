@@ -0,0 +1,299 @@
+/**
+ * @file SparseReco.h
+ * @brief --sparse-reco: the reconstruction columns of each strategy in a tree of their own, for the events that have it.
+ * Most events are reconstructed by a few of the six strategies. In the dense
+ * sel tree every event still has the columns of all of them, with the values
+ * of an earlier event where the flag is false, which CorrectTree then masks
+ * as NaN.
+ *
+ * With --sparse-reco, the extraction writes the columns of a strategy
+ * (kAAFit, ... in SelSchema.h) to the tree <tree>_<strategy>, e.g. sel_aafit,
+ * one entry per event whose flag is true, with the branch "entry": the entry
+ * of the event in the main tree. The main tree keeps the other columns and
+ * the flags. The entries of a strategy tree are in the order of the main
+ * tree.
+ *
+ * SparseRecoReader gives the dense view back, one event at a time: the
+ * columns of a strategy are NaN where the event does not have it, and only
+ * the entries of the strategy trees that exist are read. CorrectTree and
+ * RunPipeline read a sparse input through it instead of masking the stale
+ * values. Their outputs are dense, since the later steps select and reorder
+ * the entries of the main tree.
+ *
+ * Usage:
+ *   SparseRecoWriter reco(tree, options);   // options {"sparse-reco"}
+ *   reco.Branch("aafit_lambda", &aafit_lambda);   // on the strategy tree, or on tree without --sparse-reco
+ *   ...
+ *   tree->Fill(); reco.Fill();
+ *
+ *   SparseRecoReader sparse(input_tree);    // Enabled() if the file has strategy trees
+ *   TTree *out = input_tree->CloneTree(0);
+ *   sparse.Branch(out);
+ *   for (...) { input_tree->GetEntry(i); sparse.GetEntry(i); out->Fill(); }
+ */
+
+#ifndef SPARSERECO_H
+#define SPARSERECO_H
+
+#include <TBranch.h>
+#include <TDirectory.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SelSchema.h"
+#include "StageOptions.h"
+
+// Name of the tree of a strategy: the name of its flag without "_flag", after that of the main tree
+inline std::string RecoTreeName(const std::string &tree, ERecoStrategy strategy)
+{
+    std::string flag = RecoFlag(strategy);
+    return tree + "_" + flag.substr(0, flag.size() - std::strlen("_flag"));
+}
+
+// Strategy of a column of the sel schema, kNoStrategy if it has none or is not in the schema
+inline ERecoStrategy RecoStrategyOf(const std::string &column)
+{
+    const SelField *fields = SelFields();
+    for (std::size_t f = 0; f < NSelFields(); f++)
+        if (column == fields[f].name)
+            return fields[f].strategy;
+    return kNoStrategy;
+}
+
+class SparseRecoWriter
+{
+public:
+    SparseRecoWriter(TTree *tree, const StageOptions &options)
+        : fTree(tree), fEnabled(options.Has("sparse-reco")), fFlags(kNRecoStrategies, NULL), fEntry(0)
+    {
+        if (!fEnabled)
+            return;
+        TDirectory *directory = tree->GetDirectory();
+        for (int s = 0; s < kNRecoStrategies; s++)
+        {
+            std::string name = RecoTreeName(tree->GetName(), static_cast<ERecoStrategy>(s));
+            TTree *strategy = new TTree(name.c_str(), (std::string(RecoFlag(static_cast<ERecoStrategy>(s))) + " true").c_str());
+            strategy->SetDirectory(directory);
+            strategy->Branch("entry", &fEntry);
+            fTrees.push_back(strategy);
+        }
+    }
+
+    bool Enabled() const { return fEnabled; }
+
+    // The strategy trees, empty without --sparse-reco
+    const std::vector<TTree *> &Trees() const { return fTrees; }
+
+    // A column of the extraction: on the tree of its strategy with --sparse-reco, on the main tree otherwise
+    template <typename T>
+    void Branch(const char *name, T *address)
+    {
+        ERecoStrategy strategy = RecoStrategyOf(name);
+        if (fEnabled && strategy != kNoStrategy)
+            fTrees[strategy]->Branch(name, address);
+        else
+            fTree->Branch(name, address);
+    }
+
+    // After each Fill of the main tree: the event goes to the trees of the strategies whose flag is true
+    void Fill()
+    {
+        if (!fEnabled)
+            return;
+        for (int s = 0; s < kNRecoStrategies; s++)
+        {
+            if (!fFlags[s])
+                fFlags[s] = FlagAddress(static_cast<ERecoStrategy>(s));
+            if (*fFlags[s])
+                fTrees[s]->Fill();
+        }
+        fEntry++;
+    }
+
+private:
+    const bool *FlagAddress(ERecoStrategy strategy) const
+    {
+        TBranch *branch = fTree->GetBranch(RecoFlag(strategy));
+        TLeaf *leaf = branch ? static_cast<TLeaf *>(branch->GetListOfLeaves()->At(0)) : NULL;
+        if (!leaf || !leaf->GetValuePointer())
+        {
+            std::cerr << "Error: --sparse-reco needs the branch " << RecoFlag(strategy) << " in " << fTree->GetName() << std::endl;
+            exit(1);
+        }
+        return static_cast<const bool *>(leaf->GetValuePointer());
+    }
+
+    TTree *fTree;
+    bool fEnabled;
+    std::vector<TTree *> fTrees;
+    std::vector<const bool *> fFlags;
+    // entry of the main tree being filled
+    Long64_t fEntry;
+};
+
+class SparseRecoReader
+{
+public:
+    // The strategy trees next to tree in its file; none for a dense tree
+    explicit SparseRecoReader(TTree *tree) : fTree(tree)
+    {
+        TDirectory *directory = tree->GetDirectory();
+        for (int s = 0; directory && s < kNRecoStrategies; s++)
+        {
+            ERecoStrategy id = static_cast<ERecoStrategy>(s);
+            TTree *strategy_tree = dynamic_cast<TTree *>(directory->Get(RecoTreeName(tree->GetName(), id).c_str()));
+            if (!strategy_tree)
+                continue;
+            fStrategies.emplace_back(new Strategy(strategy_tree, id));
+        }
+        if (!fStrategies.empty() && fStrategies.size() != kNRecoStrategies)
+        {
+            std::cerr << "Error: " << fStrategies.size() << " of the " << kNRecoStrategies << " strategy trees of "
+                      << tree->GetName() << " found" << std::endl;
+            exit(1);
+        }
+        for (const std::unique_ptr<Strategy> &strategy : fStrategies)
+            std::cout << "Sparse reconstruction: " << strategy->tree->GetName() << ", " << strategy->rows << " of "
+                      << tree->GetEntries() << " events" << std::endl;
+    }
+
+    SparseRecoReader(const SparseRecoReader &) = delete;
+    SparseRecoReader &operator=(const SparseRecoReader &) = delete;
+
+    bool Enabled() const { return !fStrategies.empty(); }
+
+    // The dense columns on an output tree, in the order of the schema
+    void Branch(TTree *out)
+    {
+        const SelField *fields = SelFields();
+        for (std::size_t f = 0; f < NSelFields(); f++)
+            for (const std::unique_ptr<Strategy> &strategy : fStrategies)
+                if (strategy->id == fields[f].strategy)
+                    out->Branch(fields[f].name, &strategy->values[strategy->Index(fields[f].name)]);
+    }
+
+    // Address of the value of a dense column, set by GetEntry
+    double *Address(const std::string &column)
+    {
+        for (const std::unique_ptr<Strategy> &strategy : fStrategies)
+            if (strategy->id == RecoStrategyOf(column))
+                return &strategy->values[strategy->Index(column)];
+        std::cerr << "Error: column " << column << " is not in the strategy trees of " << fTree->GetName() << std::endl;
+        exit(1);
+    }
+
+    // Values of entry i of the main tree: those of its strategy entries, NaN for the strategies it does not have
+    void GetEntry(Long64_t i)
+    {
+        for (const std::unique_ptr<Strategy> &strategy : fStrategies)
+            strategy->GetEntry(i);
+    }
+
+private:
+    struct Strategy
+    {
+        Strategy(TTree *t, ERecoStrategy s) : tree(t), id(s), rows(t->GetEntries()), row(0), last(-1), entry_row(-1)
+        {
+            entry_branch = tree->GetBranch("entry");
+            if (!entry_branch)
+            {
+                std::cerr << "Error: strategy tree " << tree->GetName() << " has no branch entry" << std::endl;
+                exit(1);
+            }
+            entry_branch->SetAddress(&entry);
+            const SelField *fields = SelFields();
+            for (std::size_t f = 0; f < NSelFields(); f++)
+                if (fields[f].strategy == id)
+                    names.push_back(fields[f].name);
+            values.assign(names.size(), NAN);
+            read.resize(names.size());
+            for (std::size_t c = 0; c < names.size(); c++)
+            {
+                TBranch *branch = tree->GetBranch(names[c].c_str());
+                if (!branch)
+                {
+                    std::cerr << "Error: strategy tree " << tree->GetName() << " has no branch " << names[c] << std::endl;
+                    exit(1);
+                }
+                branch->SetAddress(&read[c]);
+                branches.push_back(branch);
+            }
+        }
+
+        std::size_t Index(const std::string &name) const
+        {
+            for (std::size_t c = 0; c < names.size(); c++)
+                if (names[c] == name)
+                    return c;
+            return 0;
+        }
+
+        // Main tree entry of a row, only the entry branch is read
+        Long64_t RowEntry(Long64_t r)
+        {
+            if (r != entry_row)
+            {
+                entry_branch->GetEntry(r);
+                entry_row = r;
+            }
+            return entry;
+        }
+
+        void GetEntry(Long64_t i)
+        {
+            // the rows before row are those of the entries before the last one asked for;
+            // forward from there, by bisection for a jump back
+            if (i < last)
+            {
+                Long64_t low = 0, high = row;
+                while (low < high)
+                {
+                    Long64_t mid = low + (high - low) / 2;
+                    if (RowEntry(mid) < i)
+                        low = mid + 1;
+                    else
+                        high = mid;
+                }
+                row = low;
+            }
+            last = i;
+            while (row < rows && RowEntry(row) < i)
+                row++;
+            if (row < rows && RowEntry(row) == i)
+            {
+                for (std::size_t c = 0; c < branches.size(); c++)
+                    branches[c]->GetEntry(row);
+                values = read;
+            }
+            else
+                values.assign(values.size(), NAN);
+        }
+
+        TTree *tree;
+        ERecoStrategy id;
+        Long64_t rows;
+        // first row whose entry is not before the last one asked for
+        Long64_t row, last;
+        TBranch *entry_branch;
+        // value of the entry branch, read for entry_row
+        Long64_t entry, entry_row;
+        std::vector<std::string> names;
+        std::vector<TBranch *> branches;
+        // values as read from the strategy tree, and as given to the dense columns
+        std::vector<double> read, values;
+    };
+
+    TTree *fTree;
+    std::vector<std::unique_ptr<Strategy>> fStrategies;
+};
+
+#endif // SPARSERECO_H
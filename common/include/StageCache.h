@@ -0,0 +1,312 @@
+/**
+ * @file StageCache.h
+ * @brief --cache: skip a step whose outputs were already made from the same inputs, binary and parameters.
+ * With --cache, a step writes a manifest next to each of its outputs,
+ * <output>.manifest, once they are complete. The manifest records:
+ *
+ *   - the identity of every input: the UUID of a ROOT file (set when the file
+ *     is created, so a re-made file gets a new one), a hash of the content of
+ *     any other file (NNFit HDF5, flux tables, codec plan);
+ *   - the binary, by a hash of the executable;
+ *   - the parameters: the other positional arguments and the options, except
+ *     those that do not change the entries written (--trace, --metrics,
+ *     --threads, --mem-budget, ...);
+ *   - the key, a hash of all the above, and the identity of the output.
+ *
+ * The next run with --cache computes the key first. If every output is
+ * there, unchanged since its manifest, with the same key, the step prints
+ * "up to date" and does nothing. Otherwise the old manifests are removed
+ * before the step runs, so that an interrupted run leaves none.
+ *
+ * The key does not contain the paths: the same inputs at another place give
+ * the same key. A re-made output has a new UUID, so the steps that read it
+ * see a changed input. StageStatus (stage_cache/) reads the manifests and
+ * lists the outputs that a change of input or binary makes stale, following
+ * the chain of steps. Shared libraries (OscProb, ROOT) are not part of the
+ * binary hash.
+ *
+ * Usage:
+ *   StageCache cache("CorrectTree", options);   // options {"cache"}
+ *   cache.Input(input_file);
+ *   cache.Output(output_file);
+ *   if (cache.UpToDate()) return 0;
+ *   ...
+ *   cache.Commit();                             // once the outputs are closed
+ */
+
+#ifndef STAGECACHE_H
+#define STAGECACHE_H
+
+#include <TFile.h>
+#include <TUUID.h>
+
+#include <glob.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "StageOptions.h"
+
+// The content of a manifest file
+struct StageManifest
+{
+    std::string stage, key, binary, binary_id, output, output_id;
+    std::vector<std::pair<std::string, std::string>> parameters;
+    // path and identity of each input
+    std::vector<std::pair<std::string, std::string>> inputs;
+};
+
+class StageCache
+{
+public:
+    StageCache(const std::string &stage, const StageOptions &options)
+        : fStage(stage), fEnabled(options.Has("cache")), fOptions(options)
+    {
+        if (!fEnabled)
+            return;
+        // options whose value is a file that the output depends on
+        for (const char *name : {"flux", "codec-plan"})
+            if (options.Has(name))
+                Input(options.Get(name));
+    }
+
+    bool Enabled() const { return fEnabled; }
+
+    // A file read by the step; a pattern (AntDST*.root) stands for the files it matches
+    void Input(const std::string &path)
+    {
+        if (!fEnabled || fGiven.count(path))
+            return;
+        fGiven.insert(path);
+        for (const std::string &file : Expand(path))
+            fInputs.push_back(std::make_pair(Absolute(file), Identity(file)));
+    }
+
+    void Output(const std::string &path)
+    {
+        if (!fEnabled)
+            return;
+        fGiven.insert(path);
+        fOutputs.push_back(path);
+    }
+
+    // Whether every output is there with the key of this run; if not, their manifests are removed
+    bool UpToDate()
+    {
+        if (!fEnabled)
+            return false;
+        fKey = Key();
+        std::string reason;
+        for (const std::string &output : fOutputs)
+        {
+            reason = Check(output);
+            if (!reason.empty())
+                break;
+        }
+        if (reason.empty() && !fOutputs.empty())
+        {
+            std::cout << fStage << ": up to date (key " << fKey << "), nothing to do" << std::endl;
+            return true;
+        }
+        std::cout << fStage << ": running, " << (fOutputs.empty() ? "no output declared" : reason) << std::endl;
+        for (const std::string &output : fOutputs)
+            unlink(ManifestPath(output).c_str());
+        return false;
+    }
+
+    // Write the manifests, once every output is closed
+    void Commit() const
+    {
+        if (!fEnabled)
+            return;
+        for (const std::string &output : fOutputs)
+        {
+            std::string path = ManifestPath(output), tmp = path + ".tmp";
+            std::ofstream out(tmp);
+            out << "# manifest of " << output << ", written by " << fStage << " --cache (StageCache.h)\n"
+                << "stage\t" << fStage << "\n"
+                << "key\t" << fKey << "\n"
+                << "binary\t" << fBinary << "\t" << fBinaryId << "\n";
+            for (const std::pair<std::string, std::string> &parameter : fParameters)
+                out << "parameter\t" << parameter.first << "\t" << parameter.second << "\n";
+            for (const std::pair<std::string, std::string> &input : fInputs)
+                out << "input\t" << input.first << "\t" << input.second << "\n";
+            out << "output\t" << Absolute(output) << "\t" << Identity(output) << "\n";
+            out.close();
+            // replaced at once, a reader never sees half a manifest
+            if (!out || rename(tmp.c_str(), path.c_str()) != 0)
+            {
+                std::cerr << "Error: cannot write the manifest " << path << std::endl;
+                exit(1);
+            }
+        }
+        std::cout << fStage << ": " << fOutputs.size() << " manifest(s) written, key " << fKey << std::endl;
+    }
+
+    static std::string ManifestPath(const std::string &output) { return output + ".manifest"; }
+
+    // "uuid:<UUID>" for a ROOT file, "fnv:<hash of the content>" for any other file, "missing"
+    static std::string Identity(const std::string &path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return "missing";
+        if (path.size() > 5 && path.compare(path.size() - 5, 5, ".root") == 0)
+        {
+            TFile *file = TFile::Open(path.c_str(), "READ");
+            std::string id = file && !file->IsZombie() ? std::string("uuid:") + file->GetUUID().AsString() : "unreadable";
+            delete file;
+            return id;
+        }
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return "unreadable";
+        // FNV-1a, 64 bits
+        uint64_t hash = 14695981039346656037ULL;
+        std::vector<char> buffer(1 << 20);
+        for (;;)
+        {
+            in.read(&buffer[0], buffer.size());
+            std::streamsize n = in.gcount();
+            if (n <= 0)
+                break;
+            for (std::streamsize i = 0; i < n; i++)
+                hash = (hash ^ (unsigned char)buffer[i]) * 1099511628211ULL;
+        }
+        return "fnv:" + Hex(hash);
+    }
+
+    static bool Read(const std::string &path, StageManifest &manifest)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return false;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t'))
+                fields.push_back(field);
+            fields.resize(3);
+            if (fields[0] == "stage")
+                manifest.stage = fields[1];
+            else if (fields[0] == "key")
+                manifest.key = fields[1];
+            else if (fields[0] == "binary")
+            {
+                manifest.binary = fields[1];
+                manifest.binary_id = fields[2];
+            }
+            else if (fields[0] == "parameter")
+                manifest.parameters.push_back(std::make_pair(fields[1], fields[2]));
+            else if (fields[0] == "input")
+                manifest.inputs.push_back(std::make_pair(fields[1], fields[2]));
+            else if (fields[0] == "output")
+            {
+                manifest.output = fields[1];
+                manifest.output_id = fields[2];
+            }
+        }
+        return !manifest.key.empty();
+    }
+
+    static std::string Absolute(const std::string &path)
+    {
+        char resolved[PATH_MAX];
+        return realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+    }
+
+    static std::string Hex(uint64_t value)
+    {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+        return text;
+    }
+
+private:
+    // Empty if the output is there as its manifest describes it, with the key of this run
+    std::string Check(const std::string &output) const
+    {
+        StageManifest manifest;
+        if (!Read(ManifestPath(output), manifest))
+            return "no manifest for " + output;
+        if (manifest.key != fKey)
+            return "the inputs, binary or parameters of " + output + " changed";
+        if (Identity(output) != manifest.output_id)
+            return output + " changed since its manifest";
+        return "";
+    }
+
+    std::string Key()
+    {
+        char exe[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        fBinary = n > 0 ? std::string(exe, n) : fStage;
+        fBinaryId = Identity(fBinary);
+
+        // options that change how a step runs, not what it writes
+        static const std::set<std::string> ignored = {"cache", "trace", "metrics", "metrics-interval", "threads",
+                                                      "mem-budget", "mem-mb", "tmpdir", "read-cache", "prefetch",
+                                                      "async-write", "write-queue"};
+        fParameters.clear();
+        const std::vector<std::string> &args = fOptions.Positional();
+        for (std::size_t a = 0; a < args.size(); a++)
+            // @list stands for its files, given one by one to Input()
+            if (!fGiven.count(args[a]) && args[a][0] != '@')
+                fParameters.push_back(std::make_pair("arg" + std::to_string(a), args[a]));
+        for (const std::pair<const std::string, std::string> &option : fOptions.Options())
+            if (!ignored.count(option.first))
+                fParameters.push_back(std::make_pair("--" + option.first, fGiven.count(option.second) ? "(file)" : option.second));
+
+        std::string text = fStage + "\n" + fBinaryId + "\n";
+        for (const std::pair<std::string, std::string> &parameter : fParameters)
+            text += parameter.first + "=" + parameter.second + "\n";
+        for (const std::pair<std::string, std::string> &input : fInputs)
+            text += input.second + "\n";
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : text)
+            hash = (hash ^ c) * 1099511628211ULL;
+        return Hex(hash);
+    }
+
+    static std::vector<std::string> Expand(const std::string &pattern)
+    {
+        std::vector<std::string> files;
+        glob_t matches;
+        if (pattern.find_first_of("*?[") != std::string::npos && glob(pattern.c_str(), 0, NULL, &matches) == 0)
+        {
+            for (std::size_t m = 0; m < matches.gl_pathc; m++)
+                files.push_back(matches.gl_pathv[m]);
+            globfree(&matches);
+        }
+        else
+            files.push_back(pattern);
+        return files;
+    }
+
+    std::string fStage;
+    bool fEnabled;
+    const StageOptions &fOptions;
+    std::set<std::string> fGiven;
+    std::vector<std::pair<std::string, std::string>> fInputs;
+    std::vector<std::string> fOutputs;
+    std::vector<std::pair<std::string, std::string>> fParameters;
+    std::string fKey, fBinary, fBinaryId;
+};
+
+#endif // STAGECACHE_H
@@ -0,0 +1,101 @@
+/**
+ * @file StageContext.h
+ * @brief The options and objects that every pipeline executable sets up around its own work.
+ *
+ *   --cache                                     skip the step if its outputs are up to date (StageCache.h)
+ *   --trace out.json                            time the phases (Trace.h, make TRACE=1)
+ *   --metrics <file>, --metrics-interval 10     progress, rate and ETA for monitoring (ProgressMetrics.h)
+ *   --mem-budget <MB>                           cache, cluster and basket sizes from the memory of the job (MemoryBudget.h)
+ *   --codec-plan <file>                         compression of each output branch (CodecPlan.h)
+ *   --entries first:last, --shard k/N           process a part of the input only (EntryRange.h)
+ *   --read-cache <MB|off>, --prefetch           TTreeCache and asynchronous prefetch of the input (InputCache.h)
+ *   --async-write, --write-queue <MB>           fill the output on a writer thread (AsyncTreeWriter.h, per output tree)
+ *
+ * ParseStageOptions() knows the valued options of this list, a step adds
+ * only its own. The step gives its inputs and outputs to the cache, then
+ * Start() starts the trace and the progress metrics, unless --cache finds
+ * the outputs up to date. A step that does not process a part of its input
+ * or does not read through a TTreeCache leaves range or input unused.
+ *
+ * Usage:
+ *   StageOptions options = ParseStageOptions(argc, argv, {"threads"});
+ *   StageContext stage("CorrectTree", output_file, options);
+ *   stage.cache.Input(input_file);
+ *   stage.cache.Output(output_file);
+ *   if (!stage.Start())
+ *       return 0;
+ *   ... stage.Progress(), stage.memory, stage.codecs, stage.range, stage.input ...
+ *   stage.Finish();   // once the outputs are closed
+ */
+
+#ifndef STAGECONTEXT_H
+#define STAGECONTEXT_H
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include "CodecPlan.h"
+#include "EntryRange.h"
+#include "InputCache.h"
+#include "MemoryBudget.h"
+#include "ProgressMetrics.h"
+#include "StageCache.h"
+#include "StageOptions.h"
+#include "Trace.h"
+
+// Parse the command line with the valued options of the shared setup and those of the step
+inline StageOptions ParseStageOptions(int argc, char *argv[], std::set<std::string> valued_options = {})
+{
+    valued_options.insert({"trace", "metrics", "metrics-interval", "mem-budget", "codec-plan", "entries", "shard",
+                           "read-cache", "write-queue"});
+    return StageOptions(argc, argv, valued_options);
+}
+
+class StageContext
+{
+public:
+    // output names the metrics of the step
+    StageContext(const std::string &stage, const std::string &output, const StageOptions &options)
+        : cache(stage, options), memory(stage, options), codecs(options), range(options), input(options, memory),
+          fStage(stage), fOutput(output), fOptions(options)
+    {
+    }
+
+    StageContext(const StageContext &) = delete;
+    StageContext &operator=(const StageContext &) = delete;
+
+    // Once the inputs and outputs are given to cache: false if they are up to date and there is nothing to do
+    bool Start()
+    {
+        if (cache.UpToDate())
+            return false;
+        TRACE_START(fOptions.Get("trace"));
+        fProgress.reset(new ProgressMetrics(fStage, fOutput, fOptions));
+        return true;
+    }
+
+    ProgressMetrics &Progress() { return *fProgress; }
+
+    // Once the outputs are closed: record them in the cache and print the reports
+    void Finish()
+    {
+        cache.Commit();
+        fProgress->Finish();
+        memory.Report();
+        TRACE_STOP();
+    }
+
+    StageCache cache;
+    MemoryBudget memory;
+    CodecPlan codecs;
+    EntryRange range;
+    InputCache input;
+
+private:
+    std::string fStage, fOutput;
+    const StageOptions &fOptions;
+    std::unique_ptr<ProgressMetrics> fProgress;
+};
+
+#endif // STAGECONTEXT_H
@@ -0,0 +1,72 @@
+/**
+ * @file StageOptions.h
+ * @brief Minimal command line parser shared by the pipeline executables.
+ * Options of the form "--name" or "--name value" are separated from the
+ * positional arguments, so the existing positional interfaces keep working.
+ */
+
+#ifndef STAGEOPTIONS_H
+#define STAGEOPTIONS_H
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class StageOptions
+{
+public:
+    // valued_options lists the option names that consume the next argument
+    StageOptions(int argc, char *argv[], const std::set<std::string> &valued_options = {})
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg.size() < 3 || arg.compare(0, 2, "--") != 0)
+            {
+                fPositional.push_back(arg);
+                continue;
+            }
+
+            std::string name = arg.substr(2);
+            std::string value = "1";
+            std::string::size_type eq = name.find('=');
+            if (eq != std::string::npos)
+            {
+                value = name.substr(eq + 1);
+                name = name.substr(0, eq);
+            }
+            else if (valued_options.count(name))
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "Error: option --" << name << " requires a value" << std::endl;
+                    exit(1);
+                }
+                value = argv[++i];
+            }
+            fOptions[name] = value;
+        }
+    }
+
+    bool Has(const std::string &name) const { return fOptions.count(name) > 0; }
+
+    std::string Get(const std::string &name, const std::string &fallback = "") const
+    {
+        std::map<std::string, std::string>::const_iterator it = fOptions.find(name);
+        return it == fOptions.end() ? fallback : it->second;
+    }
+
+    const std::vector<std::string> &Positional() const { return fPositional; }
+
+    // every option given, by name
+    const std::map<std::string, std::string> &Options() const { return fOptions; }
+
+private:
+    std::vector<std::string> fPositional;
+    std::map<std::string, std::string> fOptions;
+};
+
+#endif // STAGEOPTIONS_H
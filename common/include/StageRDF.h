@@ -0,0 +1,102 @@
+/**
+ * @file StageRDF.h
+ * @brief Helpers of the RDataFrame paths of the stages (--rdf).
+ * The RDataFrame paths express a step as Define/Redefine/Filter nodes and
+ * write it with Snapshot, using ROOT's implicit multi-threading. They need
+ * ROOT >= 6.26 (Redefine) and libROOTDataFrame. The event loops of the steps
+ * stay the default and the reference for validation.
+ *
+ * With more than one thread Snapshot writes the entries in the order the
+ * threads finish them, not in the input order, and the order changes from
+ * run to run. Only the event key (EventKey.h) then identifies an event
+ * across outputs: the NNFit join and the event index go by key, but a
+ * --friend tree is aligned by entry number with the tree it was made from,
+ * and --entries and --shard take entries by number. Outputs are compared
+ * with the event loop by key (pipeline/compare/CompareSel.cc); --threads 1
+ * keeps the input order.
+ */
+
+#ifndef STAGERDF_H
+#define STAGERDF_H
+
+#include <ROOT/RDataFrame.hxx>
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ProgressMetrics.h"
+#include "StageOptions.h"
+#include "Trace.h"
+
+// --threads N: number of threads of the RDataFrame path, all cores when 0 or absent; 1 runs sequentially
+inline void EnableStageMT(const StageOptions &options)
+{
+    int threads = atoi(options.Get("threads", "0").c_str());
+    if (threads != 1)
+        ROOT::EnableImplicitMT(threads);
+    std::cout << "RDataFrame: " << (ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1) << " thread(s)" << std::endl;
+}
+
+/**
+ * @brief Write the columns of a node as tree_name in output_file.
+ * Every column (the input branches and the defined ones) is written except
+ * the helper columns listed in exclude. The baskets are compressed with the
+ * settings of the input file.
+ */
+inline void SnapshotStage(ROOT::RDF::RNode node, const std::string &tree_name, const std::string &output_file,
+                          const std::string &input_file, const std::vector<std::string> &exclude = {})
+{
+    std::vector<std::string> columns;
+    for (const std::string &column : node.GetColumnNames())
+        if (std::find(exclude.begin(), exclude.end(), column) == exclude.end())
+            columns.push_back(column);
+
+    ROOT::RDF::RSnapshotOptions snapshot_options;
+    TFile *input = TFile::Open(input_file.c_str(), "READ");
+    if (input && !input->IsZombie())
+    {
+        int settings = input->GetCompressionSettings();
+        snapshot_options.fCompressionAlgorithm = static_cast<ROOT::RCompressionSetting::EAlgorithm::EValues>(settings / 100);
+        snapshot_options.fCompressionLevel = settings % 100;
+    }
+    delete input;
+
+    // the event loop runs here, the Define/Filter nodes are lazy
+    TRACE_SCOPE("Snapshot");
+    node.Snapshot(tree_name, output_file, columns, snapshot_options);
+}
+
+// Entries of a slot between two updates of the progress
+const ULong64_t kProgressEvery = 10000;
+
+/**
+ * @brief Begin a phase of progress over the entries of tree_name and count them while the event loop runs.
+ * Each slot adds its entries every kProgressEvery; the result must be kept
+ * until the loop has run, its value then sets the exact count:
+ *   ROOT::RDF::RResultPtr<ULong64_t> counted = TrackProgress(df, progress, "cut", "sel", input_file);
+ *   SnapshotStage(...);
+ *   progress.Set(*counted);
+ */
+inline ROOT::RDF::RResultPtr<ULong64_t> TrackProgress(ROOT::RDF::RNode node, ProgressMetrics &progress, const std::string &phase,
+                                                      const std::string &tree_name, const std::string &input_file)
+{
+    Long64_t entries = 0;
+    TFile *input = TFile::Open(input_file.c_str(), "READ");
+    TTree *tree = input && !input->IsZombie() ? dynamic_cast<TTree *>(input->Get(tree_name.c_str())) : NULL;
+    if (tree)
+        entries = tree->GetEntries();
+    delete input;
+    progress.Begin(phase, entries);
+
+    ROOT::RDF::RResultPtr<ULong64_t> counted = node.Count();
+    counted.OnPartialResultSlot(kProgressEvery, [&progress](unsigned int, ULong64_t &) { progress.Add(kProgressEvery); });
+    return counted;
+}
+
+#endif // STAGERDF_H
@@ -0,0 +1,228 @@
+/**
+ * @file Trace.h
+ * @brief Scoped timers of the hot paths, written as a Chrome/Perfetto trace.
+ * Built with -DENABLE_TRACE (make TRACE=1), TRACE_SCOPE("phase") times the
+ * enclosing scope and records it in a ring buffer of the calling thread;
+ * --trace out.json starts the recording (TRACE_START) and TRACE_STOP writes
+ * the trace and prints the time spent per phase. Without ENABLE_TRACE the
+ * macros compile to nothing and --trace only prints a warning.
+ *
+ * The ring buffers keep the last kTraceRingSize scopes of each thread for the
+ * trace file; the per-phase table counts every scope. Phase names must be
+ * string literals (they are stored by pointer).
+ *
+ * Usage:
+ *   TRACE_START(options.Get("trace"));   // no-op for an empty path
+ *   for (...) { TRACE_SCOPE("Fill"); tree->Fill(); }
+ *   TRACE_STOP();
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <iostream>
+#include <string>
+
+#ifdef ENABLE_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Scopes kept per thread for the trace file
+const std::size_t kTraceRingSize = 1 << 18;
+
+class Trace
+{
+public:
+    static Trace &Instance()
+    {
+        static Trace trace;
+        return trace;
+    }
+
+    void Start(const std::string &path)
+    {
+        if (path.empty())
+            return;
+        fPath = path;
+        fOrigin = Now();
+        fEnabled.store(true, std::memory_order_release);
+    }
+
+    bool Enabled() const { return fEnabled.load(std::memory_order_relaxed); }
+
+    static std::uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Record(const char *name, std::uint64_t start, std::uint64_t end)
+    {
+        ThreadBuffer &buffer = Buffer();
+        Event &event = buffer.ring[buffer.next % kTraceRingSize];
+        event.name = name;
+        event.start = start;
+        event.duration = end - start;
+        buffer.next++;
+
+        Phase &phase = buffer.phases[name];
+        phase.count++;
+        phase.total += end - start;
+    }
+
+    // Write the trace and print the time per phase; recording stops
+    void Stop()
+    {
+        if (!Enabled())
+            return;
+        fEnabled.store(false, std::memory_order_release);
+        double wall = (Now() - fOrigin) * 1e-9;
+
+        std::lock_guard<std::mutex> lock(fMutex);
+        WriteChromeTrace();
+
+        std::map<std::string, Phase> phases;
+        for (const std::unique_ptr<ThreadBuffer> &buffer : fBuffers)
+            for (const std::pair<const char *const, Phase> &phase : buffer->phases)
+            {
+                phases[phase.first].count += phase.second.count;
+                phases[phase.first].total += phase.second.total;
+            }
+
+        std::vector<std::pair<std::string, Phase>> sorted(phases.begin(), phases.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Phase> &a, const std::pair<std::string, Phase> &b) {
+            return a.second.total > b.second.total;
+        });
+
+        std::cout << "\nTime per phase (" << fBuffers.size() << " thread(s), " << wall << " s wall, nested phases overlap):" << std::endl;
+        printf("  %-28s %12s %12s %10s %8s\n", "phase", "calls", "total [s]", "mean [us]", "% wall");
+        for (const std::pair<std::string, Phase> &phase : sorted)
+        {
+            double total = phase.second.total * 1e-9;
+            printf("  %-28s %12llu %12.3f %10.2f %7.1f%%\n", phase.first.c_str(), (unsigned long long)phase.second.count,
+                   total, 1e6 * total / phase.second.count, wall > 0 ? 100 * total / wall : 0.);
+        }
+        std::cout << "Trace written to " << fPath << std::endl;
+    }
+
+private:
+    struct Event
+    {
+        const char *name;
+        std::uint64_t start, duration;
+    };
+
+    struct Phase
+    {
+        std::uint64_t count = 0, total = 0;
+    };
+
+    struct ThreadBuffer
+    {
+        int tid;
+        std::vector<Event> ring;
+        std::uint64_t next = 0;
+        std::map<const char *, Phase> phases;
+    };
+
+    Trace() : fEnabled(false), fOrigin(0) {}
+
+    // Buffer of the calling thread, registered on first use
+    ThreadBuffer &Buffer()
+    {
+        thread_local ThreadBuffer *buffer = NULL;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fBuffers.emplace_back(new ThreadBuffer());
+            buffer = fBuffers.back().get();
+            buffer->tid = fBuffers.size();
+            buffer->ring.resize(kTraceRingSize);
+        }
+        return *buffer;
+    }
+
+    void WriteChromeTrace()
+    {
+        FILE *out = fopen(fPath.c_str(), "w");
+        if (!out)
+        {
+            std::cerr << "Error: cannot write the trace to " << fPath << std::endl;
+            return;
+        }
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (const std::unique_ptr<ThreadBuffer> &buffer : fBuffers)
+        {
+            std::uint64_t begin = buffer->next > kTraceRingSize ? buffer->next - kTraceRingSize : 0;
+            if (begin > 0)
+                std::cerr << "Warning: trace of thread " << buffer->tid << " keeps the last " << kTraceRingSize
+                          << " of " << buffer->next << " scopes" << std::endl;
+            for (std::uint64_t i = begin; i < buffer->next; i++)
+            {
+                const Event &event = buffer->ring[i % kTraceRingSize];
+                if (event.start < fOrigin)
+                    continue;
+                fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        first ? "" : ",\n", event.name, buffer->tid, (event.start - fOrigin) * 1e-3, event.duration * 1e-3);
+                first = false;
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+
+    std::atomic<bool> fEnabled;
+    std::uint64_t fOrigin;
+    std::string fPath;
+    std::mutex fMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> fBuffers;
+};
+
+// Times the enclosing scope while a trace is recording
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : fName(name), fStart(Trace::Instance().Enabled() ? Trace::Now() : 0) {}
+    ~TraceScope()
+    {
+        if (fStart && Trace::Instance().Enabled())
+            Trace::Instance().Record(fName, fStart, Trace::Now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *fName;
+    std::uint64_t fStart;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_START(path) Trace::Instance().Start(path)
+#define TRACE_STOP() Trace::Instance().Stop()
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_START(path) TraceDisabled(path)
+#define TRACE_STOP() ((void)0)
+
+inline void TraceDisabled(const std::string &path)
+{
+    if (!path.empty())
+        std::cerr << "Warning: built without ENABLE_TRACE (make TRACE=1), --trace " << path << " is ignored" << std::endl;
+}
+
+#endif // ENABLE_TRACE
+
+#endif // TRACE_H
@@ -0,0 +1,106 @@
+/**
+ * @file ZoneMap.h
+ * @brief Per-cluster min/max statistics ("zone map") of a few sel branches.
+ * Zone z covers the entries [First(z), Last(z)). NaN values are ignored, so a
+ * zone where a column is NaN everywhere has Min = +inf and Max = -inf and
+ * fails every range check on that column, exactly like the NaN values do.
+ */
+
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+// Columns summarised by default: the variables our range cuts and masks act on.
+// Keep in sync with ZONE_MAP_COLUMNS in external_library/file_management.py
+inline const std::vector<std::string> &DefaultZoneColumns()
+{
+    static const std::vector<std::string> columns = {
+        "run_id", "energy_true", "cos_zenith_true", "RunDurationYear",
+        "NNFitTrack_cos_zenith", "NNFitShower_cos_zenith",
+        "NNFitTrack_SigmaZClosest", "NNFitTrack_SigmaRClosest",
+        "NNFitShower_SigmaZVertex", "NNFitShower_SigmaRVertex"};
+    return columns;
+}
+
+class ZoneMap
+{
+public:
+    std::size_t NZones() const { return fFirst.size(); }
+    long long First(std::size_t zone) const { return fFirst[zone]; }
+    long long Last(std::size_t zone) const { return fLast[zone]; }
+
+    bool Has(const std::string &column) const { return fMin.count(column) > 0; }
+    double Min(const std::string &column, std::size_t zone) const { return fMin.at(column)[zone]; }
+    double Max(const std::string &column, std::size_t zone) const { return fMax.at(column)[zone]; }
+
+    std::vector<std::string> Columns() const
+    {
+        std::vector<std::string> columns;
+        for (std::map<std::string, std::vector<double>>::const_iterator it = fMin.begin(); it != fMin.end(); ++it)
+            columns.push_back(it->first);
+        return columns;
+    }
+
+    // Start a new zone [first, last) with empty ranges for every column
+    void AddZone(long long first, long long last, const std::vector<std::string> &columns)
+    {
+        fFirst.push_back(first);
+        fLast.push_back(last);
+        for (const std::string &column : columns)
+        {
+            fMin[column].push_back(std::numeric_limits<double>::infinity());
+            fMax[column].push_back(-std::numeric_limits<double>::infinity());
+        }
+    }
+
+    // Extend the range of a column in the last zone
+    void Update(const std::string &column, double value)
+    {
+        if (std::isnan(value))
+            return;
+        double &lo = fMin[column].back();
+        double &hi = fMax[column].back();
+        if (value < lo)
+            lo = value;
+        if (value > hi)
+            hi = value;
+    }
+
+    void SetRange(const std::string &column, std::size_t zone, double lo, double hi)
+    {
+        fMin[column].resize(NZones());
+        fMax[column].resize(NZones());
+        fMin[column][zone] = lo;
+        fMax[column][zone] = hi;
+    }
+
+    // The zones must tile [0, entries) contiguously, otherwise the map is stale
+    // (e.g. the tree was merged with hadd, which concatenates the zone trees)
+    bool Covers(long long entries) const
+    {
+        long long next = 0;
+        for (std::size_t z = 0; z < NZones(); z++)
+        {
+            if (fFirst[z] != next || fLast[z] < fFirst[z])
+                return false;
+            next = fLast[z];
+        }
+        return next == entries;
+    }
+
+    // Can any value of the column in the zone be below (above) x? Unknown columns always can.
+    bool MayBeBelow(const std::string &column, std::size_t zone, double x) const { return !Has(column) || Min(column, zone) < x; }
+    bool MayBeAbove(const std::string &column, std::size_t zone, double x) const { return !Has(column) || Max(column, zone) > x; }
+
+private:
+    std::vector<long long> fFirst, fLast;
+    std::map<std::string, std::vector<double>> fMin, fMax;
+};
+
+#endif // ZONEMAP_H
@@ -0,0 +1,328 @@
+/**
+ * @brief Choose the compression of every branch of a sel tree and write it as a codec plan (CodecPlan.h).
+ * The entries of the first clusters of the tree are read branch by branch and
+ * laid out as ROOT writes them in a basket (big-endian values, one basket
+ * size at a time). Each basket is compressed and decompressed with every
+ * candidate setting, through the same R__zip/R__unzip calls as TBasket, and
+ * each branch gets the setting that best meets the objective:
+ *
+ *   size    smallest compressed size
+ *   speed   fastest decompression
+ *   mix     weight * size / smallest size + (1 - weight) * time / fastest time
+ *
+ * The branch "*" of the plan, for the columns added by the later steps, is
+ * the setting that best meets the objective over all the sampled bytes. The
+ * current compression of each branch is measured too, for comparison.
+ *
+ * Usage: AutotuneCodecs <input rootfile> <plan file> [--tree sel] [--clusters 2] [--max-entries 200000]
+ *        [--objective size|speed|mix] [--weight 0.5] [--settings 101,106,207,404,501,505,509] [--repeat 3]
+ */
+
+#include <Compression.h>
+#include <RZip.h>
+#include <TBranch.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CodecPlan.h"
+#include "StageOptions.h"
+
+using namespace std;
+
+// Candidates when --settings is not given: fast (LZ4), balanced (ZSTD, ZLIB) and small (LZMA)
+const char *kDefaultSettings = "101,106,207,404,501,505,509";
+
+// Largest block R__zip compresses at once
+const int kMaxZipBlock = 0xffffff;
+
+struct Sample
+{
+    string branch;
+    vector<vector<char>> baskets;
+    Long64_t bytes;
+};
+
+struct Measure
+{
+    Long64_t compressed;
+    double decompress; // seconds, best of --repeat
+};
+
+// Entries of the first clusters, at most max_entries
+Long64_t SampleEntries(TTree *tree, int clusters, Long64_t max_entries)
+{
+    Long64_t nentries = tree->GetEntries();
+    TTree::TClusterIterator it = tree->GetClusterIterator(0);
+    Long64_t end = 0;
+    for (int c = 0; c < clusters && it.Next() < nentries; c++)
+        end = it.GetNextEntry();
+    return min(min(end, nentries), max_entries);
+}
+
+// Values of a branch for entries [0, n), as big-endian bytes cut in baskets
+bool ReadSample(TBranch *branch, Long64_t n, Sample &sample)
+{
+    TObjArray *leaves = branch->GetListOfLeaves();
+    sample.branch = branch->GetName();
+    sample.bytes = 0;
+    if (branch->GetListOfBranches()->GetEntriesFast() > 0 || leaves->GetEntriesFast() == 0)
+        return false;
+
+    size_t basket_size = min(max(branch->GetBasketSize(), 1024), kMaxZipBlock);
+    vector<char> basket;
+    basket.reserve(basket_size);
+    for (Long64_t i = 0; i < n; i++)
+    {
+        branch->GetEntry(i);
+        for (int l = 0; l < leaves->GetEntriesFast(); l++)
+        {
+            TLeaf *leaf = (TLeaf *)leaves->At(l);
+            const char *value = (const char *)leaf->GetValuePointer();
+            int size = leaf->GetLenType();
+            if (!value || size <= 0)
+                return false;
+            for (int k = 0; k < leaf->GetLen(); k++)
+                for (int b = size - 1; b >= 0; b--)
+                    basket.push_back(value[k * size + b]);
+        }
+        if (basket.size() >= basket_size)
+        {
+            sample.bytes += basket.size();
+            sample.baskets.push_back(basket);
+            basket.clear();
+        }
+    }
+    if (!basket.empty())
+    {
+        sample.bytes += basket.size();
+        sample.baskets.push_back(basket);
+    }
+    return true;
+}
+
+// Compressed size and decompression time of the baskets of a sample with a setting
+Measure Benchmark(const Sample &sample, int setting, int repeat)
+{
+    Measure measure = {0, 0};
+    ROOT::RCompressionSetting::EAlgorithm::EValues algorithm = static_cast<ROOT::RCompressionSetting::EAlgorithm::EValues>(setting / 100);
+    vector<char> zipped, unzipped;
+    for (const vector<char> &basket : sample.baskets)
+    {
+        int srcsize = basket.size();
+        int tgtsize = srcsize;
+        int irep = 0;
+        zipped.resize(srcsize);
+        unzipped.resize(srcsize);
+        R__zipMultipleAlgorithm(setting % 100, &srcsize, const_cast<char *>(basket.data()), &tgtsize, zipped.data(), &irep, algorithm);
+        // as TBasket, a basket that does not shrink is stored as it is
+        bool stored = irep <= 0 || irep >= srcsize;
+        measure.compressed += stored ? srcsize : irep;
+
+        double best = -1;
+        for (int r = 0; r < repeat; r++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if (stored)
+                memcpy(unzipped.data(), basket.data(), srcsize);
+            else
+            {
+                int zipsize = irep, rawsize = srcsize, nout = 0;
+                R__unzip(&zipsize, (unsigned char *)zipped.data(), &rawsize, (unsigned char *)unzipped.data(), &nout);
+                if (nout != srcsize)
+                {
+                    cerr << "Error: " << CodecPlan::Name(setting) << " does not decompress a basket of " << sample.branch << endl;
+                    exit(1);
+                }
+            }
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            best = best < 0 ? elapsed : min(best, elapsed);
+        }
+        measure.decompress += best;
+    }
+    return measure;
+}
+
+// Index of the candidate that best meets the objective
+size_t Choose(const vector<Measure> &measures, const string &objective, double weight)
+{
+    Long64_t smallest = measures[0].compressed;
+    double fastest = measures[0].decompress;
+    for (const Measure &m : measures)
+    {
+        smallest = min(smallest, m.compressed);
+        fastest = min(fastest, m.decompress);
+    }
+    size_t best = 0;
+    double best_score = 0;
+    for (size_t s = 0; s < measures.size(); s++)
+    {
+        double size = (double)measures[s].compressed / max(smallest, 1LL);
+        double time = measures[s].decompress / max(fastest, 1e-9);
+        double score = objective == "size" ? size + 1e-6 * time : objective == "speed" ? time + 1e-6 * size : weight * size + (1 - weight) * time;
+        if (s == 0 || score < best_score)
+        {
+            best = s;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+vector<int> ParseSettings(const string &list)
+{
+    vector<int> settings;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ','))
+    {
+        int setting = atoi(item.c_str());
+        if (!CodecPlan::Valid(setting))
+        {
+            cerr << "Error: " << item << " is not a compressing ROOT setting (100 * algorithm + level)" << endl;
+            exit(1);
+        }
+        if (find(settings.begin(), settings.end(), setting) == settings.end())
+            settings.push_back(setting);
+    }
+    return settings;
+}
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <input rootfile> <plan file> [--tree sel] [--clusters 2] [--max-entries 200000]"
+         << " [--objective size|speed|mix] [--weight 0.5] [--settings " << kDefaultSettings << "] [--repeat 3]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"tree", "clusters", "max-entries", "objective", "weight", "settings", "repeat"});
+    const vector<string> &args = options.Positional();
+    if (args.size() != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string input_file = args[0];
+    string plan_file = args[1];
+    string tree_name = options.Get("tree", "sel");
+    int clusters = max(atoi(options.Get("clusters", "2").c_str()), 1);
+    Long64_t max_entries = atoll(options.Get("max-entries", "200000").c_str());
+    string objective = options.Get("objective", "mix");
+    double weight = atof(options.Get("weight", "0.5").c_str());
+    int repeat = max(atoi(options.Get("repeat", "3").c_str()), 1);
+    vector<int> settings = ParseSettings(options.Get("settings", kDefaultSettings));
+    if (objective != "size" && objective != "speed" && objective != "mix")
+    {
+        cerr << "Error: unknown objective " << objective << ", use size, speed or mix" << endl;
+        return 1;
+    }
+    if (weight < 0 || weight > 1)
+    {
+        cerr << "Error: --weight must be between 0 and 1" << endl;
+        return 1;
+    }
+
+    TFile *infile = TFile::Open(input_file.c_str(), "READ");
+    if (!infile || infile->IsZombie())
+    {
+        cerr << "Error: file " << input_file << " not found" << endl;
+        return 1;
+    }
+    TTree *tree = dynamic_cast<TTree *>(infile->Get(tree_name.c_str()));
+    if (!tree)
+    {
+        cerr << "Error: tree " << tree_name << " not found" << endl;
+        return 1;
+    }
+    Long64_t nsample = SampleEntries(tree, clusters, max_entries);
+    if (nsample <= 0)
+    {
+        cerr << "Error: tree " << tree_name << " has no entries" << endl;
+        return 1;
+    }
+    cout << "Sampling " << nsample << " entries of " << tree->GetEntries() << " (" << clusters << " cluster(s)), "
+         << settings.size() << " settings, objective " << objective << endl;
+
+    //===========================================================
+    // Benchmark every branch with every setting
+    //===========================================================
+    CodecPlan plan;
+    vector<Measure> totals(settings.size(), Measure{0, 0});
+    Measure current_total = {0, 0}, plan_total = {0, 0};
+    Long64_t raw_total = 0;
+    TObjArray *branches = tree->GetListOfBranches();
+    printf("\n  %-32s %12s %10s %8s %12s\n", "branch", "raw [B]", "codec", "ratio", "unzip [MB/s]");
+    for (int b = 0; b < branches->GetEntriesFast(); b++)
+    {
+        TBranch *branch = (TBranch *)branches->At(b);
+        Sample sample;
+        if (!ReadSample(branch, nsample, sample))
+        {
+            cout << "  " << branch->GetName() << ": not a branch of simple leaves, not in the plan" << endl;
+            continue;
+        }
+
+        vector<Measure> measures;
+        for (size_t s = 0; s < settings.size(); s++)
+        {
+            measures.push_back(Benchmark(sample, settings[s], repeat));
+            totals[s].compressed += measures[s].compressed;
+            totals[s].decompress += measures[s].decompress;
+        }
+        size_t best = Choose(measures, objective, weight);
+        double ratio = (double)sample.bytes / max(measures[best].compressed, 1LL);
+        double speed = sample.bytes / max(measures[best].decompress, 1e-9) / 1e6;
+        char comment[128];
+        snprintf(comment, sizeof(comment), " %s, ratio %.1f, %.0f MB/s", CodecPlan::Name(settings[best]).c_str(), ratio, speed);
+        plan.Set(sample.branch, settings[best], comment);
+        printf("  %-32s %12lld %10s %8.1f %12.0f\n", sample.branch.c_str(), sample.bytes, CodecPlan::Name(settings[best]).c_str(), ratio, speed);
+
+        int current = branch->GetCompressionSettings();
+        Measure now = CodecPlan::Valid(current) ? Benchmark(sample, current, repeat) : Measure{sample.bytes, 0};
+        current_total.compressed += now.compressed;
+        current_total.decompress += now.decompress;
+        plan_total.compressed += measures[best].compressed;
+        plan_total.decompress += measures[best].decompress;
+        raw_total += sample.bytes;
+    }
+    if (raw_total == 0)
+    {
+        cerr << "Error: no branch of " << tree_name << " could be sampled" << endl;
+        return 1;
+    }
+
+    // the columns added later get what is best for the tree as a whole
+    size_t overall = Choose(totals, objective, weight);
+    plan.Set("*", settings[overall], " columns not listed");
+
+    ostringstream header;
+    header << "# Codec plan of " << tree_name << " in " << input_file << "\n"
+           << "# objective " << objective << (objective == "mix" ? " (weight " + to_string(weight) + ")" : "")
+           << ", " << nsample << " entries sampled, settings " << options.Get("settings", kDefaultSettings) << "\n"
+           << "# branch                        setting\n";
+    plan.Write(plan_file, header.str());
+    infile->Close();
+
+    cout << "\n========================================" << endl;
+    printf("Sampled bytes:        %lld\n", raw_total);
+    printf("Current compression:  %lld bytes, %.3f s to decompress\n", current_total.compressed, current_total.decompress);
+    printf("Codec plan:           %lld bytes, %.3f s to decompress\n", plan_total.compressed, plan_total.decompress);
+    printf("Other columns:        %s\n", CodecPlan::Name(settings[overall]).c_str());
+    cout << "Plan written to " << plan_file << endl;
+    cout << "========================================" << endl;
+
+    return 0;
+}
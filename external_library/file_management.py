@@ -1,5 +1,6 @@
 import h5py
 import uproot
+import numpy as np
 import pandas as pd
 from tqdm import tqdm
 from datetime import timedelta
@@ -7,7 +8,130 @@ import os
 import time
 import glob
 
-def load_rootfile_to_df(rootfile, columns=None, tree="sel"):
+# Per-cluster min/max summaries written next to the sel tree (see common/include/ZoneMap.h)
+ZONE_MAP_TREE = "sel_zones"
+ZONE_MAP_COLUMNS = [
+    "run_id", "energy_true", "cos_zenith_true", "RunDurationYear",
+    "NNFitTrack_cos_zenith", "NNFitShower_cos_zenith",
+    "NNFitTrack_SigmaZClosest", "NNFitTrack_SigmaRClosest",
+    "NNFitShower_SigmaZVertex", "NNFitShower_SigmaRVertex",
+]
+
+# Sel entries sorted by event key, written next to the sel tree (see common/include/EventIndex.h)
+EVENT_INDEX_TREE = "sel_index"
+EVENT_INDEX_SOURCE = "sel_index_source"
+EVENT_KEY_COLUMNS = ["run_id", "frame_index", "event_counter_trigger"]
+
+def zone_entry_ranges(f, zone_cuts, tree="sel"):
+    """
+    Entry ranges of the clusters that can contain events passing the zone cuts.
+
+    Args:
+        f (uproot.ReadOnlyDirectory): The opened ROOT file.
+        zone_cuts (dict): Maps a column to an open interval (low, high); None means unbounded.
+        tree (str, optional): The name of the tree in the ROOT file. Defaults to "sel".
+
+    Returns:
+        list: (entry_start, entry_stop) pairs. The whole tree if the file has no usable zone map.
+    """
+    num_entries = f[tree].num_entries
+    if not zone_cuts or ZONE_MAP_TREE not in f:
+        return [(0, num_entries)]
+
+    zones = f[ZONE_MAP_TREE].arrays(library="np")
+    first, last = zones["entry_first"], zones["entry_last"]
+
+    # The zones must tile the tree, e.g. hadd concatenates the zone trees of its inputs
+    if len(first) == 0 or first[0] != 0 or last[-1] != num_entries or np.any(first[1:] != last[:-1]):
+        print(f"Zone map does not match the tree, reading all {num_entries} entries")
+        return [(0, num_entries)]
+
+    keep = np.ones(len(first), dtype=bool)
+    for column, (low, high) in zone_cuts.items():
+        if f"{column}_min" not in zones:
+            continue
+        if low is not None:
+            keep &= zones[f"{column}_max"] > low
+        if high is not None:
+            keep &= zones[f"{column}_min"] < high
+
+    print(f"Zone map: reading {keep.sum()} of {len(keep)} clusters")
+    return [(int(a), int(b)) for a, b, k in zip(first, last, keep) if k]
+
+def keys_in_order(keys):
+    """
+    True if the key columns (a dict of equal length arrays, in EVENT_KEY_COLUMNS order) are sorted.
+    """
+    in_order = np.ones(max(len(keys[EVENT_KEY_COLUMNS[0]]) - 1, 0), dtype=bool)
+    # compare the consecutive keys column by column, from the last one
+    for column in reversed(EVENT_KEY_COLUMNS):
+        previous, current = keys[column][:-1], keys[column][1:]
+        in_order = (previous < current) | ((previous == current) & in_order)
+    return bool(np.all(in_order))
+
+def read_event_index(f, tree="sel"):
+    """
+    The event index of the file, if it was built for this tree and is consistent.
+
+    Args:
+        f (uproot.ReadOnlyDirectory): The opened ROOT file.
+        tree (str, optional): The name of the tree in the ROOT file. Defaults to "sel".
+
+    Returns:
+        dict or None: The key columns and "entry" in key order, None if the index cannot be used.
+    """
+    num_entries = f[tree].num_entries
+    if EVENT_INDEX_TREE not in f or EVENT_INDEX_SOURCE not in f:
+        return None
+
+    # hadd concatenates the index trees of its inputs, the merged file has another UUID
+    source = f"{tree} {num_entries} {f.file.uuid}"
+    if f[EVENT_INDEX_SOURCE].member("fTitle") != source or f[EVENT_INDEX_TREE].num_entries != num_entries:
+        print(f"Event index of {f.file_path} was not built for the tree {tree}, ignoring it")
+        return None
+
+    index = f[EVENT_INDEX_TREE].arrays(EVENT_KEY_COLUMNS + ["entry"], library="np")
+    if not keys_in_order(index) or not np.array_equal(np.sort(index["entry"]), np.arange(num_entries)):
+        print(f"Event index of {f.file_path} is not consistent with the tree {tree}, ignoring it")
+        return None
+    return index
+
+def find_event_entries(f, keys, tree="sel"):
+    """
+    Entries of the sel tree holding the given events, using the event index of the file.
+    Without a usable index, the key columns of the tree are read and sorted.
+
+    Args:
+        f (uproot.ReadOnlyDirectory): The opened ROOT file.
+        keys (pd.DataFrame or dict): Columns run_id, frame_index and event_counter_trigger of the events.
+        tree (str, optional): The name of the tree in the ROOT file. Defaults to "sel".
+
+    Returns:
+        np.ndarray: The entry of each event, -1 for events that are not in the tree.
+    """
+    num_entries = f[tree].num_entries
+    index = read_event_index(f, tree)
+    if index is None:
+        index = f[tree].arrays(EVENT_KEY_COLUMNS, library="np")
+        order = np.lexsort([index[column] for column in reversed(EVENT_KEY_COLUMNS)])
+        index = {column: index[column][order] for column in EVENT_KEY_COLUMNS}
+        index["entry"] = order
+
+    key_type = [(column, np.int64) for column in EVENT_KEY_COLUMNS]
+    sorted_keys = np.empty(num_entries, dtype=key_type)
+    wanted = np.empty(len(keys[EVENT_KEY_COLUMNS[0]]), dtype=key_type)
+    for column in EVENT_KEY_COLUMNS:
+        sorted_keys[column] = index[column]
+        wanted[column] = np.asarray(keys[column], dtype=np.int64)
+
+    if num_entries == 0:
+        return np.full(len(wanted), -1, dtype=np.int64)
+
+    # the index is in key order, structured arrays compare field by field
+    pos = np.minimum(np.searchsorted(sorted_keys, wanted), num_entries - 1)
+    return np.where(sorted_keys[pos] == wanted, index["entry"][pos], -1)
+
+def load_rootfile_to_df(rootfile, columns=None, tree="sel", zone_cuts=None):
     """
     Load a ROOT file to a pandas DataFrame.
 
@@ -15,6 +139,8 @@ def load_rootfile_to_df(rootfile, columns=None, tree="sel"):
         rootfile (str): The path to the ROOT file.
         columns (list, optional): The columns to be loaded. Defaults to None.
         tree (str, optional): The name of the tree in the ROOT file. Defaults to "sel".
+        zone_cuts (dict, optional): Range cuts used to skip whole clusters, e.g. {"energy_true": (10, 100)}.
+            Skipping is conservative: the cuts still have to be applied to the returned rows. Defaults to None.
 
     Returns:
         DataFrame: A DataFrame containing the data from the ROOT file.
@@ -23,12 +149,17 @@ def load_rootfile_to_df(rootfile, columns=None, tree="sel"):
     ctime = time.time()
     
     with uproot.open(rootfile) as f:
-        df = f[tree].arrays(columns, library="pd")
+        ranges = zone_entry_ranges(f, zone_cuts, tree)
+        df_list = [f[tree].arrays(columns, library="pd", entry_start=start, entry_stop=stop) for start, stop in ranges]
+        # the zone cuts can skip every cluster, the result is then empty with the requested columns
+        if not df_list:
+            df_list.append(f[tree].arrays(columns, library="pd", entry_stop=0))
+        df = pd.concat(df_list, ignore_index=True)
 
     print(f"ROOT file imported as a Dataframe in: {timedelta(seconds=time.time()-ctime)}")
     return df
 
-def load_large_rootfile_to_df(rootfile, columns=None, tree="sel", chunksize=100_000):
+def load_large_rootfile_to_df(rootfile, columns=None, tree="sel", chunksize=100_000, zone_cuts=None):
     """
     Load a large ROOT file into a pandas DataFrame while optimizing memory usage.
 
@@ -37,6 +168,7 @@ def load_large_rootfile_to_df(rootfile, columns=None, tree="sel", chunksize=100_
     tree_name (str): The name of the TTree to load.
     columns (list, optional): A list of columns to load. If None, all columns will be loaded.
     chunksize (int, optional): The number of rows to load in each chunk.
+    zone_cuts (dict, optional): Range cuts used to skip whole clusters, see load_rootfile_to_df.
 
     Returns:
     A pandas DataFrame containing the data from the TTree.
@@ -53,12 +185,17 @@ def load_large_rootfile_to_df(rootfile, columns=None, tree="sel", chunksize=100_
         if columns is None:
             columns = f[tree].keys()
 
-        # Load the data in chunks
-        for i in tqdm(range(0, f[tree].num_entries, chunksize)):
-            df = f["sel"].arrays(columns, library="pd", entry_start=i, entry_stop=i+chunksize)
+        # Load the data in chunks, only from the clusters that can pass the zone cuts
+        for start, stop in zone_entry_ranges(f, zone_cuts, tree):
+            for i in tqdm(range(start, stop, chunksize)):
+                df = f[tree].arrays(columns, library="pd", entry_start=i, entry_stop=min(i+chunksize, stop))
             
-            # Append the chunk to the list
-            df_list.append(df)
+                # Append the chunk to the list
+                df_list.append(df)
+
+        # the zone cuts can skip every cluster, the result is then empty with the requested columns
+        if not df_list:
+            df_list.append(f[tree].arrays(columns, library="pd", entry_stop=0))
     
     print(f"ROOT file imported as a Dataframe in: {timedelta(seconds=time.time()-ctime)}")
     # Concatenate the chunks into a single DataFrame
@@ -301,12 +438,48 @@ def rename_h5_df_cols(
 ):
     return df.rename(columns=mapper)
 
-def export_dataframe_to_rootfile(df, filename, tree = "sel", path = '/home/wecapstor3/capn/mppi133h/ANTARES/mc/cut_selection/low_energy'):
+def zone_map_arrays(df, chunksize):
+    """
+    Per-chunk min/max of the zone map columns present in the DataFrame, NaN values ignored.
+
+    Args:
+        df (DataFrame): The DataFrame written to the ROOT file.
+        chunksize (int): The number of rows per cluster.
+
+    Returns:
+        dict: Arrays of the zone map tree.
+    """
+    first = np.arange(0, len(df), chunksize, dtype=np.int64)
+    zones = {"entry_first": first, "entry_last": np.minimum(first + chunksize, len(df)).astype(np.int64)}
+
+    for column in ZONE_MAP_COLUMNS:
+        if column not in df.columns:
+            continue
+        values = df[column].to_numpy(dtype=np.float64)
+        lo, hi = [], []
+        for start in first:
+            chunk = values[start:start+chunksize]
+            chunk = chunk[~np.isnan(chunk)]
+            lo.append(chunk.min() if len(chunk) else np.inf)
+            hi.append(chunk.max() if len(chunk) else -np.inf)
+        zones[f"{column}_min"] = np.array(lo)
+        zones[f"{column}_max"] = np.array(hi)
+
+    return zones
+
+def export_dataframe_to_rootfile(df, filename, tree = "sel", path = '/home/wecapstor3/capn/mppi133h/ANTARES/mc/cut_selection/low_energy', chunksize=100_000):
     print(f"\nExporting the DataFrame to a ROOT file as: {filename}")
     ctime = time.time()
     
+    # Write in chunks so that every chunk is one cluster of the tree, summarised in the zone map
     with uproot.recreate(os.path.join(path, filename)) as f:
-        f[tree] = df.to_records(index = False)
+        f.mktree(tree, {column: df[column].dtype for column in df.columns})
+        for start in range(0, len(df), chunksize):
+            chunk = df.iloc[start:start+chunksize]
+            f[tree].extend({column: chunk[column].to_numpy() for column in df.columns})
+
+        if tree == "sel" and len(df) > 0:
+            f[ZONE_MAP_TREE] = zone_map_arrays(df, chunksize)
         
     print(f"DataFrame written to a ROOT file as: {filename}")
-    print('Exporting time:', timedelta(seconds=time.time()-ctime), '\n')
\ No newline at end of file
+    print('Exporting time:', timedelta(seconds=time.time()-ctime), '\n')
@@ -98,3 +98,17 @@ def get_cutrun(df):
     run_mask = df["run_id"] > 34348 #no tau production beforehand
 
     return run_mask
+
+# Zone cuts: the range form of the masks above, used to skip whole clusters when loading
+# a ROOT file (see load_rootfile_to_df). The masks still have to be applied to the loaded rows.
+def get_low_energy_zone_cuts():
+    return {"energy_true": (10, 100)}
+
+def get_upgoing_zone_cuts():
+    return {"cos_zenith_true": (None, 0)}
+
+def get_short_run_zone_cuts():
+    return {"RunDurationYear": (None, 3 / (365.25 * 24))}
+
+def get_cutrun_zone_cuts():
+    return {"run_id": (34348, None)}
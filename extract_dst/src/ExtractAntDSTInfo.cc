@@ -19,6 +19,13 @@
 #include <TTree.h>
 #include <TVector3.h>
 
+#include "AsyncTreeWriter.h"
+#include "MathKernels.h"
+#include "SelMetadata.h"
+#include "SparseReco.h"
+#include "StageContext.h"
+#include "Trace.h"
+
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -35,7 +42,9 @@ using namespace std;
 ==========================================================*/
 void usage()
 {
-  cerr << "\n  Usage: analyze <Outputfilename> <AntDSTfileName> \n"
+  cerr << "\n  Usage: analyze <Outputfilename> <AntDSTfileName> [--trace out.json]\n"
+       << "         [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]\n"
+       << "         [--entries first:last | --shard k/N] [--cache] [--async-write [--write-queue <MB>] | --sparse-reco]\n"
        << "         where <AntDSTfileName> is the name of an AntDST file, e.g. AntDST.root \n"
        << "         or a list of AntDST files, e.g. \"AntDST*.root\". \n " << endl;
 }
@@ -421,27 +430,38 @@ const double sec_to_year = 1./(3.6*1.e3*24*365.25);
 // ##############################################################
 int main(int argc, char **argv)
 {
+  StageOptions options = ParseStageOptions(argc, argv);
+  const vector<string> &args = options.Positional();
 
-  if (argc != 3)
+  if (args.size() != 2)
   {
     usage();
     exit(1);
   }
+  const char *output_name = args[0].c_str();
+  const char *input_name = args[1].c_str();
+
+  // --cache, --trace, --metrics, --mem-budget, --codec-plan, --entries, --shard (StageContext.h);
+  // the AntDST events are not read through a TTreeCache, --read-cache is ignored
+  StageContext stage("ExtractAntDSTInfo", output_name, options);
+  stage.cache.Input(input_name);
+  stage.cache.Input("muons/muon_weights.dat");
+  stage.cache.Output(output_name);
+  if (!stage.Start())
+    return 0;
 
   //  OUTPUT-Definitions
-  TFile *outFile = new TFile(argv[1], "RECREATE");
+  TFile *outFile = new TFile(output_name, "RECREATE");
   TTree *outTree = new TTree("sel", "TreeSelectedEvents");
-  AntDSTFile *dataFile = AntDSTFile::SmartOpen(argv[2]);
+  AntDSTFile *dataFile = AntDSTFile::SmartOpen(input_name);
   AntDST *theAntDST = new AntDST();
   dataFile->SetBuffers(&(theAntDST));
 
   unsigned int nsel = 0;
   unsigned int ntot = dataFile->GetNEvents();
-  int fivePercent = int(0.05 * ntot);
-  if (fivePercent < 1)
-    fivePercent = 1;
-  cout << " reading file(s) " << argv[2] << " with " << ntot << " events\n"
+  cout << " reading file(s) " << input_name << " with " << ntot << " events\n"
        << endl;
+  stage.range.Resolve(ntot);
 
   FileInfo theInfo;
   dataFile->ReadFileInfo(theInfo);
@@ -480,6 +500,16 @@ int main(int argc, char **argv)
   double showerdusj_quality = 0., showerdusj_bjy = 0, showerdusj_pos_x = 0, showerdusj_pos_y = 0, showerdusj_pos_z = 0, angerrordeg_showerdusj = 0., zenithdeg_showerdusj = 0., cos_zenith_showerdusj = 0, azimuthdeg_showerdusj = 0., nusedlines_showerdusj = 0., nusedhits_showerdusj = 0., showerdusj_totalamp = 0., showerdusj_energy = 0., showerdusj_nhits = 0., showerdusj_radius = 0., showerdusj_height = 0.;
   double showertantra_quality = 0., showertantra_bjy = 0, showertantra_pos_x = 0, showertantra_pos_y = 0, showertantra_pos_z = 0, angerrordeg_showertantra = 0., zenithdeg_showertantra = 0., cos_zenith_showertantra = 0, azimuthdeg_showertantra = 0., nusedlines_showertantra = 0., nusedhits_showertantra = 0., showertantra_totalamp = 0., showertantra_energy = 0., showertantra_radius = 0., showertantra_height = 0., showertantra_nhits = 0.;
 
+  // directions of the strategies, converted in one batch per event after the reconstruction blocks
+  enum { kAAFit, kBBFit, kGridFit, kBBFitShower, kShowerDusj, kShowerTantra, kNStrategies };
+  double angerror_rad[kNStrategies] = {0}, zenith_rad[kNStrategies] = {0}, azimuth_rad[kNStrategies] = {0};
+  double angerror_deg[kNStrategies], zenith_deg[kNStrategies], azimuth_deg[kNStrategies], cos_zenith_rec[kNStrategies];
+  bool *strategy_flag[kNStrategies] = {&aafit_flag, &bbfit_flag, &gridfit_flag, &bbfit_shower_flag, &showerdusj_flag, &showertantra_flag};
+  double *angerrordeg_out[kNStrategies] = {&angerrordeg_aafit, &angerrordeg_bbfit, &angerrordeg_gridfit, &angerrordeg_bbfit_shower, &angerrordeg_showerdusj, &angerrordeg_showertantra};
+  double *zenithdeg_out[kNStrategies] = {&zenithdeg_aafit, &zenithdeg_bbfit, &zenithdeg_gridfit, &zenithdeg_bbfit_shower, &zenithdeg_showerdusj, &zenithdeg_showertantra};
+  double *cos_zenith_out[kNStrategies] = {&cos_zenith_aafit, &cos_zenith_bbfit, &cos_zenith_gridfit, &cos_zenith_bbfit_shower, &cos_zenith_showerdusj, &cos_zenith_showertantra};
+  double *azimuthdeg_out[kNStrategies] = {&azimuthdeg_aafit, &azimuthdeg_bbfit, &azimuthdeg_gridfit, &azimuthdeg_bbfit_shower, &azimuthdeg_showerdusj, &azimuthdeg_showertantra};
+
   // check if file is Mupage
   bool isMupage = (currentFileName.find("mupage") != string::npos);
   std::map<int, int> m;
@@ -518,6 +548,13 @@ int main(int argc, char **argv)
   }
 
   /// Set the branches for the output tree
+  // --sparse-reco: the reconstruction columns in a tree per strategy, for the events it reconstructed (SparseReco.h)
+  SparseRecoWriter reco(outTree, options);
+  if (reco.Enabled() && options.Has("async-write"))
+  {
+    cerr << "Error: --sparse-reco and --async-write cannot be combined, the strategy trees are filled on the event loop thread" << endl;
+    exit(1);
+  }
   // General Info branches
   outTree->Branch("MJD", &MJD);
   outTree->Branch("Date", &Date);
@@ -562,112 +599,122 @@ int main(int argc, char **argv)
   outTree->Branch("tTQ_active", &tTQ_active);
 
   // Reconstruction parameters
-  outTree->Branch("aafit_lambda", &aafit_lambda);
-  outTree->Branch("aafit_bjy", &aafit_bjy);
-  outTree->Branch("aafit_pos_x", &aafit_pos_x);
-  outTree->Branch("aafit_pos_y", &aafit_pos_y);
-  outTree->Branch("aafit_pos_z", &aafit_pos_z);
-  outTree->Branch("aafit_angerr_deg", &angerrordeg_aafit);
-  outTree->Branch("aafit_zenith_deg", &zenithdeg_aafit);
-  outTree->Branch("aafit_cos_zenith", &cos_zenith_aafit);
-  outTree->Branch("aafit_azimuth_deg", &azimuthdeg_aafit);
-  outTree->Branch("aafit_nusedlines", &nusedlines_aafit);
-  outTree->Branch("aafit_nusedhits", &nusedhits_aafit);
-  outTree->Branch("aafit_totalamp", &aafit_totalamp);
-  outTree->Branch("aafit_zmin", &aafit_zmin);
-  outTree->Branch("aafit_zmax", &aafit_zmax);
-  outTree->Branch("energy_aafit_dEdX_CEA", &energy_aafit_dEdX_CEA);
-  outTree->Branch("energy_aafit_ANN_ECAP", &energy_aafit_ANN_ECAP);
-  outTree->Branch("aafit_tracklength", &aafit_tracklength);
-  outTree->Branch("aafit_nhits", &aafit_nhits);
+  reco.Branch("aafit_lambda", &aafit_lambda);
+  reco.Branch("aafit_bjy", &aafit_bjy);
+  reco.Branch("aafit_pos_x", &aafit_pos_x);
+  reco.Branch("aafit_pos_y", &aafit_pos_y);
+  reco.Branch("aafit_pos_z", &aafit_pos_z);
+  reco.Branch("aafit_angerr_deg", &angerrordeg_aafit);
+  reco.Branch("aafit_zenith_deg", &zenithdeg_aafit);
+  reco.Branch("aafit_cos_zenith", &cos_zenith_aafit);
+  reco.Branch("aafit_azimuth_deg", &azimuthdeg_aafit);
+  reco.Branch("aafit_nusedlines", &nusedlines_aafit);
+  reco.Branch("aafit_nusedhits", &nusedhits_aafit);
+  reco.Branch("aafit_totalamp", &aafit_totalamp);
+  reco.Branch("aafit_zmin", &aafit_zmin);
+  reco.Branch("aafit_zmax", &aafit_zmax);
+  reco.Branch("energy_aafit_dEdX_CEA", &energy_aafit_dEdX_CEA);
+  reco.Branch("energy_aafit_ANN_ECAP", &energy_aafit_ANN_ECAP);
+  reco.Branch("aafit_tracklength", &aafit_tracklength);
+  reco.Branch("aafit_nhits", &aafit_nhits);
   outTree->Branch("aafit_flag", &aafit_flag);
 
-  outTree->Branch("bbfit_quality", &bbfit_quality);
-  outTree->Branch("bbfit_bjy", &bbfit_bjy);
-  outTree->Branch("bbfit_pos_x", &bbfit_pos_x);
-  outTree->Branch("bbfit_pos_y", &bbfit_pos_y);
-  outTree->Branch("bbfit_pos_z", &bbfit_pos_z);
-  outTree->Branch("bbfit_angerr_deg", &angerrordeg_bbfit);
-  outTree->Branch("bbfit_zenith_deg", &zenithdeg_bbfit);
-  outTree->Branch("bbfit_cos_zenith", &cos_zenith_bbfit);
-  outTree->Branch("bbfit_azimuth_deg", &azimuthdeg_bbfit);
-  outTree->Branch("bbfit_nusedlines", &nusedlines_bbfit);
-  outTree->Branch("bbfit_nusedhits", &nusedhits_bbfit);
-  outTree->Branch("bbfit_totalamp", &bbfit_totalamp);
-  outTree->Branch("bbfit_zmin", &bbfit_zmin);
-  outTree->Branch("bbfit_zmax", &bbfit_zmax);
-  outTree->Branch("bbfit_nhits", &bbfit_nhits);
+  reco.Branch("bbfit_quality", &bbfit_quality);
+  reco.Branch("bbfit_bjy", &bbfit_bjy);
+  reco.Branch("bbfit_pos_x", &bbfit_pos_x);
+  reco.Branch("bbfit_pos_y", &bbfit_pos_y);
+  reco.Branch("bbfit_pos_z", &bbfit_pos_z);
+  reco.Branch("bbfit_angerr_deg", &angerrordeg_bbfit);
+  reco.Branch("bbfit_zenith_deg", &zenithdeg_bbfit);
+  reco.Branch("bbfit_cos_zenith", &cos_zenith_bbfit);
+  reco.Branch("bbfit_azimuth_deg", &azimuthdeg_bbfit);
+  reco.Branch("bbfit_nusedlines", &nusedlines_bbfit);
+  reco.Branch("bbfit_nusedhits", &nusedhits_bbfit);
+  reco.Branch("bbfit_totalamp", &bbfit_totalamp);
+  reco.Branch("bbfit_zmin", &bbfit_zmin);
+  reco.Branch("bbfit_zmax", &bbfit_zmax);
+  reco.Branch("bbfit_nhits", &bbfit_nhits);
   outTree->Branch("bbfit_flag", &bbfit_flag);
 
-  outTree->Branch("gridfit_quality", &gridfit_quality);
-  outTree->Branch("gridfit_bjy", &gridfit_bjy);
-  outTree->Branch("gridfit_pos_x", &gridfit_pos_x);
-  outTree->Branch("gridfit_pos_y", &gridfit_pos_y);
-  outTree->Branch("gridfit_pos_z", &gridfit_pos_z);
-  outTree->Branch("gridfit_angerr_deg", &angerrordeg_gridfit);
-  outTree->Branch("gridfit_zenith_deg", &zenithdeg_gridfit);
-  outTree->Branch("gridfit_cos_zenith", &cos_zenith_gridfit);
-  outTree->Branch("gridfit_azimuth_deg", &azimuthdeg_gridfit);
-  outTree->Branch("gridfit_nusedlines", &nusedlines_gridfit);
-  outTree->Branch("gridfit_nusedhits", &nusedhits_gridfit);
-  outTree->Branch("gridfit_totalamp", &gridfit_totalamp);
-  outTree->Branch("gridfit_zmin", &gridfit_zmin);
-  outTree->Branch("gridfit_zmax", &gridfit_zmax);
-  outTree->Branch("gridfit_nhits", &gridfit_nhits);
+  reco.Branch("gridfit_quality", &gridfit_quality);
+  reco.Branch("gridfit_bjy", &gridfit_bjy);
+  reco.Branch("gridfit_pos_x", &gridfit_pos_x);
+  reco.Branch("gridfit_pos_y", &gridfit_pos_y);
+  reco.Branch("gridfit_pos_z", &gridfit_pos_z);
+  reco.Branch("gridfit_angerr_deg", &angerrordeg_gridfit);
+  reco.Branch("gridfit_zenith_deg", &zenithdeg_gridfit);
+  reco.Branch("gridfit_cos_zenith", &cos_zenith_gridfit);
+  reco.Branch("gridfit_azimuth_deg", &azimuthdeg_gridfit);
+  reco.Branch("gridfit_nusedlines", &nusedlines_gridfit);
+  reco.Branch("gridfit_nusedhits", &nusedhits_gridfit);
+  reco.Branch("gridfit_totalamp", &gridfit_totalamp);
+  reco.Branch("gridfit_zmin", &gridfit_zmin);
+  reco.Branch("gridfit_zmax", &gridfit_zmax);
+  reco.Branch("gridfit_nhits", &gridfit_nhits);
   outTree->Branch("gridfit_flag", &gridfit_flag);
 
-  outTree->Branch("bbfit_shower_quality", &bbfit_shower_quality);
-  outTree->Branch("bbfit_shower_bjy", &bbfit_shower_bjy);
-  outTree->Branch("bbfit_shower_pos_x", &bbfit_shower_pos_x);
-  outTree->Branch("bbfit_shower_pos_y", &bbfit_shower_pos_y);
-  outTree->Branch("bbfit_shower_pos_z", &bbfit_shower_pos_z);
-  outTree->Branch("bbfit_shower_angerr_deg", &angerrordeg_bbfit);
-  outTree->Branch("bbfit_shower_zenith_deg", &zenithdeg_bbfit);
-  outTree->Branch("bbfit_shower_cos_zenith", &cos_zenith_bbfit);
-  outTree->Branch("bbfit_shower_azimuth_deg", &azimuthdeg_bbfit);
-  outTree->Branch("bbfit_shower_nusedlines", &nusedlines_bbfit);
-  outTree->Branch("bbfit_shower_nusedhits", &nusedhits_bbfit);
-  outTree->Branch("bbfit_shower_totalamp", &bbfit_shower_totalamp);
-  outTree->Branch("bbfit_shower_zmin", &bbfit_shower_zmin);
-  outTree->Branch("bbfit_shower_zmax", &bbfit_shower_zmax);
-  outTree->Branch("bbfit_shower_nhits", &bbfit_shower_nhits);
+  reco.Branch("bbfit_shower_quality", &bbfit_shower_quality);
+  reco.Branch("bbfit_shower_bjy", &bbfit_shower_bjy);
+  reco.Branch("bbfit_shower_pos_x", &bbfit_shower_pos_x);
+  reco.Branch("bbfit_shower_pos_y", &bbfit_shower_pos_y);
+  reco.Branch("bbfit_shower_pos_z", &bbfit_shower_pos_z);
+  reco.Branch("bbfit_shower_angerr_deg", &angerrordeg_bbfit);
+  reco.Branch("bbfit_shower_zenith_deg", &zenithdeg_bbfit);
+  reco.Branch("bbfit_shower_cos_zenith", &cos_zenith_bbfit);
+  reco.Branch("bbfit_shower_azimuth_deg", &azimuthdeg_bbfit);
+  reco.Branch("bbfit_shower_nusedlines", &nusedlines_bbfit);
+  reco.Branch("bbfit_shower_nusedhits", &nusedhits_bbfit);
+  reco.Branch("bbfit_shower_totalamp", &bbfit_shower_totalamp);
+  reco.Branch("bbfit_shower_zmin", &bbfit_shower_zmin);
+  reco.Branch("bbfit_shower_zmax", &bbfit_shower_zmax);
+  reco.Branch("bbfit_shower_nhits", &bbfit_shower_nhits);
   outTree->Branch("bbfit_shower_flag", &bbfit_shower_flag);  
 
-  outTree->Branch("showerdusj_quality", &showerdusj_quality);
-  outTree->Branch("showerdusj_bjy", &showerdusj_bjy);
-  outTree->Branch("showerdusj_pos_x", &showerdusj_pos_x);
-  outTree->Branch("showerdusj_pos_y", &showerdusj_pos_y);
-  outTree->Branch("showerdusj_pos_z", &showerdusj_pos_z);
-  outTree->Branch("showerdusj_angerr_deg", &angerrordeg_showerdusj);
-  outTree->Branch("showerdusj_zenith_deg", &zenithdeg_showerdusj);
-  outTree->Branch("showerdusj_cos_zenith", &cos_zenith_showerdusj);
-  outTree->Branch("showerdusj_azimuth_deg", &azimuthdeg_showerdusj);
-  outTree->Branch("showerdusj_nusedlines", &nusedlines_showerdusj);
-  outTree->Branch("showerdusj_nusedhits", &nusedhits_showerdusj);
-  outTree->Branch("showerdusj_totalamp", &showerdusj_totalamp);
-  outTree->Branch("showerdusj_energy", &showerdusj_energy);
-  outTree->Branch("showerdusj_nhits", &showerdusj_nhits);
-  outTree->Branch("showerdusj_radius", &showerdusj_radius);
-  outTree->Branch("showerdusj_height", &showerdusj_height);
+  reco.Branch("showerdusj_quality", &showerdusj_quality);
+  reco.Branch("showerdusj_bjy", &showerdusj_bjy);
+  reco.Branch("showerdusj_pos_x", &showerdusj_pos_x);
+  reco.Branch("showerdusj_pos_y", &showerdusj_pos_y);
+  reco.Branch("showerdusj_pos_z", &showerdusj_pos_z);
+  reco.Branch("showerdusj_angerr_deg", &angerrordeg_showerdusj);
+  reco.Branch("showerdusj_zenith_deg", &zenithdeg_showerdusj);
+  reco.Branch("showerdusj_cos_zenith", &cos_zenith_showerdusj);
+  reco.Branch("showerdusj_azimuth_deg", &azimuthdeg_showerdusj);
+  reco.Branch("showerdusj_nusedlines", &nusedlines_showerdusj);
+  reco.Branch("showerdusj_nusedhits", &nusedhits_showerdusj);
+  reco.Branch("showerdusj_totalamp", &showerdusj_totalamp);
+  reco.Branch("showerdusj_energy", &showerdusj_energy);
+  reco.Branch("showerdusj_nhits", &showerdusj_nhits);
+  reco.Branch("showerdusj_radius", &showerdusj_radius);
+  reco.Branch("showerdusj_height", &showerdusj_height);
   outTree->Branch("showerdusj_flag", &showerdusj_flag);
 
-  outTree->Branch("showertantra_quality", &showertantra_quality);
-  outTree->Branch("showertantra_bjy", &showertantra_bjy);
-  outTree->Branch("showertantra_pos_x", &showertantra_pos_x);
-  outTree->Branch("showertantra_pos_y", &showertantra_pos_y);
-  outTree->Branch("showertantra_pos_z", &showertantra_pos_z);
-  outTree->Branch("showertantra_angerr_deg", &angerrordeg_showertantra);
-  outTree->Branch("showertantra_zenith_deg", &zenithdeg_showertantra);
-  outTree->Branch("showertantra_cos_zenith", &cos_zenith_showertantra);
-  outTree->Branch("showertantra_azimuth_deg", &azimuthdeg_showertantra);
-  outTree->Branch("showertantra_nusedlines", &nusedlines_showertantra);
-  outTree->Branch("showertantra_nusedhits", &nusedhits_showertantra);
-  outTree->Branch("showertantra_totalamp", &showertantra_totalamp);
-  outTree->Branch("showertantra_energy", &showertantra_energy);
-  outTree->Branch("showertantra_radius", &showertantra_radius);
-  outTree->Branch("showertantra_height", &showertantra_height);
-  outTree->Branch("showertantra_nhits", &showertantra_nhits);
+  reco.Branch("showertantra_quality", &showertantra_quality);
+  reco.Branch("showertantra_bjy", &showertantra_bjy);
+  reco.Branch("showertantra_pos_x", &showertantra_pos_x);
+  reco.Branch("showertantra_pos_y", &showertantra_pos_y);
+  reco.Branch("showertantra_pos_z", &showertantra_pos_z);
+  reco.Branch("showertantra_angerr_deg", &angerrordeg_showertantra);
+  reco.Branch("showertantra_zenith_deg", &zenithdeg_showertantra);
+  reco.Branch("showertantra_cos_zenith", &cos_zenith_showertantra);
+  reco.Branch("showertantra_azimuth_deg", &azimuthdeg_showertantra);
+  reco.Branch("showertantra_nusedlines", &nusedlines_showertantra);
+  reco.Branch("showertantra_nusedhits", &nusedhits_showertantra);
+  reco.Branch("showertantra_totalamp", &showertantra_totalamp);
+  reco.Branch("showertantra_energy", &showertantra_energy);
+  reco.Branch("showertantra_radius", &showertantra_radius);
+  reco.Branch("showertantra_height", &showertantra_height);
+  reco.Branch("showertantra_nhits", &showertantra_nhits);
   outTree->Branch("showertantra_flag", &showertantra_flag);
+  // --async-write: the entries are filled and compressed on a writer thread (AsyncTreeWriter.h)
+  AsyncTreeWriter writer(outTree, options, stage.memory);
+  // the AntDST events are read by their own classes, the budget goes to the output
+  stage.memory.ConfigureOutput(outTree, reco.Enabled() ? 0.5 : 0.75);
+  stage.codecs.Apply(outTree);
+  for (TTree *strategy : reco.Trees())
+  {
+    stage.memory.ConfigureOutput(strategy, 0.25 / reco.Trees().size());
+    stage.codecs.Apply(strategy);
+  }
 
   int currentRun = -1, previousRun = -1;
   bool isSameRun = false; 
@@ -678,9 +725,17 @@ int main(int argc, char **argv)
   vector<int> counters(6,0);
 
   // loop over events
-  for (unsigned int i = 0; i < ntot; i++)
+  // the data quality is read again at the first event of every run, so a shard may start anywhere
+  stage.Progress().Begin("extract", stage.range.Entries());
+  for (unsigned int i = stage.range.First(); i < stage.range.Last(); i++)
   {
-    if (!dataFile->ReadEvent(i) == AntDSTFile::eSuccess) continue;
+    stage.Progress().Add();
+    bool read_failed;
+    {
+      TRACE_SCOPE("ReadEvent");
+      read_failed = (!dataFile->ReadEvent(i) == AntDSTFile::eSuccess);
+    }
+    if (read_failed) continue;
 
     // Reset flag status
     aafit_flag = false, bbfit_flag = false, gridfit_flag = false, showerdusj_flag = false, showertantra_flag = false, bbfit_shower_flag = false;
@@ -692,6 +747,7 @@ int main(int argc, char **argv)
 
     if(!isSameRun) // get dq quality
     {
+      TRACE_SCOPE("DataQuality");
       if(dataFile ->HasDataQuality(currentRun))
       {
         cout << "\nThere is data quality for run "<<currentRun<<"!"<<endl;
@@ -785,14 +841,14 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eAAFit) &&
           theAntDST->GetStrategy(eAAFit).HasRecParticle(eMuon))
       {
+        TRACE_SCOPE("Strategy AAFit");
         RecEvent &aafit = theAntDST->GetStrategy(eAAFit);
         RecParticle aafit_muon = aafit.GetRecParticle(eMuon);
 
         aafit_lambda = aafit.GetRecQuality();
-        angerrordeg_aafit = aafit_muon.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_aafit = aafit_muon.GetZenith() * TMath::RadToDeg();
-        cos_zenith_aafit = TMath::Cos(aafit_muon.GetZenith());
-        azimuthdeg_aafit = aafit_muon.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kAAFit] = aafit_muon.GetAngularError();
+        zenith_rad[kAAFit] = aafit_muon.GetZenith();
+        azimuth_rad[kAAFit] = aafit_muon.GetAzimuth();
         nusedlines_aafit = aafit_muon.GetNUsedLines();
         nusedhits_aafit = aafit_muon.GetNUsedHits();
         aafit_totalamp = aafit_muon.GetTotalUsedAmplitude();
@@ -815,13 +871,13 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eBBFit) &&
           theAntDST->GetStrategy(eBBFit).HasRecParticle(eMuon))
       {
+        TRACE_SCOPE("Strategy BBFit");
         RecEvent &bbfit = theAntDST->GetStrategy(eBBFit);
         RecParticle bbfit_muon = bbfit.GetRecParticle(eMuon);
         bbfit_quality = bbfit.GetRecQuality();
-        angerrordeg_bbfit = bbfit_muon.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_bbfit = bbfit_muon.GetZenith() * TMath::RadToDeg();
-        cos_zenith_bbfit = TMath::Cos(bbfit_muon.GetZenith());
-        azimuthdeg_bbfit = bbfit_muon.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kBBFit] = bbfit_muon.GetAngularError();
+        zenith_rad[kBBFit] = bbfit_muon.GetZenith();
+        azimuth_rad[kBBFit] = bbfit_muon.GetAzimuth();
         nusedlines_bbfit = bbfit_muon.GetNUsedLines();
         nusedhits_bbfit = bbfit_muon.GetNUsedHits();
         bbfit_totalamp = bbfit_muon.GetTotalUsedAmplitude();
@@ -841,13 +897,13 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eGridFit) &&
           theAntDST->GetStrategy(eGridFit).HasRecParticle(eMuon))
       {
+        TRACE_SCOPE("Strategy GridFit");
         RecEvent &gridfit = theAntDST->GetStrategy(eGridFit);
         RecParticle gridfit_muon = gridfit.GetRecParticle(eMuon);
         gridfit_quality = gridfit.GetRecQuality();
-        angerrordeg_gridfit = gridfit_muon.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_gridfit = gridfit_muon.GetZenith() * TMath::RadToDeg();
-        cos_zenith_gridfit = TMath::Cos(gridfit_muon.GetZenith());
-        azimuthdeg_gridfit = gridfit_muon.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kGridFit] = gridfit_muon.GetAngularError();
+        zenith_rad[kGridFit] = gridfit_muon.GetZenith();
+        azimuth_rad[kGridFit] = gridfit_muon.GetAzimuth();
         nusedlines_gridfit = gridfit_muon.GetNUsedLines();
         nusedhits_gridfit = gridfit_muon.GetNUsedHits();
         gridfit_zmin = gridfit_muon.GetZmin();
@@ -866,13 +922,13 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eBBFitBrightPoint) &&
           theAntDST->GetStrategy(eBBFitBrightPoint).HasRecParticle(eBrightPoint))
       {
+        TRACE_SCOPE("Strategy BBFitBrightPoint");
         RecEvent &bbfit_shower = theAntDST->GetStrategy(eBBFitBrightPoint);
         RecParticle bbfit_elec = bbfit_shower.GetRecParticle(eBrightPoint);
         bbfit_shower_quality = bbfit_shower.GetRecQuality();
-        angerrordeg_bbfit_shower = bbfit_elec.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_bbfit_shower = bbfit_elec.GetZenith() * TMath::RadToDeg();
-        cos_zenith_bbfit_shower = TMath::Cos(bbfit_elec.GetZenith());
-        azimuthdeg_bbfit_shower = bbfit_elec.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kBBFitShower] = bbfit_elec.GetAngularError();
+        zenith_rad[kBBFitShower] = bbfit_elec.GetZenith();
+        azimuth_rad[kBBFitShower] = bbfit_elec.GetAzimuth();
         nusedlines_bbfit_shower = bbfit_elec.GetNUsedLines();
         nusedhits_bbfit_shower = bbfit_elec.GetNUsedHits();
         bbfit_shower_totalamp = bbfit_elec.GetTotalUsedAmplitude();
@@ -892,13 +948,13 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eShowerDusjFit) &&
           theAntDST->GetStrategy(eShowerDusjFit).HasRecParticle(eBrightPoint))
       {
+        TRACE_SCOPE("Strategy ShowerDusjFit");
         RecEvent &showerdusj = theAntDST->GetStrategy(eShowerDusjFit);
         RecParticle showerdusj_elec = showerdusj.GetRecParticle(eBrightPoint);
         showerdusj_quality = showerdusj.GetRecQuality();
-        angerrordeg_showerdusj = showerdusj_elec.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_showerdusj = showerdusj_elec.GetZenith() * TMath::RadToDeg();
-        cos_zenith_showerdusj = TMath::Cos(showerdusj_elec.GetZenith());
-        azimuthdeg_showerdusj = showerdusj_elec.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kShowerDusj] = showerdusj_elec.GetAngularError();
+        zenith_rad[kShowerDusj] = showerdusj_elec.GetZenith();
+        azimuth_rad[kShowerDusj] = showerdusj_elec.GetAzimuth();
         nusedlines_showerdusj = showerdusj_elec.GetNUsedLines();
         nusedhits_showerdusj = showerdusj_elec.GetNUsedHits();
         showerdusj_energy = showerdusj_elec.GetEnergy(eDusjShowerEnergy);
@@ -919,13 +975,13 @@ int main(int argc, char **argv)
       if (theAntDST->HasStrategy(eShowerTantraFit) &&
           theAntDST->GetStrategy(eShowerTantraFit).HasRecParticle(eBrightPoint))
       {
+        TRACE_SCOPE("Strategy ShowerTantraFit");
         RecEvent &showertantra = theAntDST->GetStrategy(eShowerTantraFit);
         RecParticle showertantra_elec = showertantra.GetRecParticle(eBrightPoint);
         showertantra_quality = showertantra.GetRecQuality();
-        angerrordeg_showertantra = showertantra_elec.GetAngularError() * TMath::RadToDeg();
-        zenithdeg_showertantra = showertantra_elec.GetZenith() * TMath::RadToDeg();
-        cos_zenith_showertantra = TMath::Cos(showertantra_elec.GetZenith());
-        azimuthdeg_showertantra = showertantra_elec.GetAzimuth() * TMath::RadToDeg();
+        angerror_rad[kShowerTantra] = showertantra_elec.GetAngularError();
+        zenith_rad[kShowerTantra] = showertantra_elec.GetZenith();
+        azimuth_rad[kShowerTantra] = showertantra_elec.GetAzimuth();
         nusedlines_showertantra = showertantra_elec.GetNUsedLines();
         nusedhits_showertantra = showertantra_elec.GetNUsedHits();
         showertantra_energy = showertantra_elec.GetEnergy(eTantraShowerEnergy);
@@ -942,18 +998,42 @@ int main(int argc, char **argv)
         showertantra_flag = true;
       }
 
-      if (type != 0 || IsMC == false) outTree->Fill();
+      // angles of all strategies in one batch, stored for the strategies found in this event
+      {
+        TRACE_SCOPE("StrategyAngles");
+        RadToDeg(angerror_rad, angerror_deg, kNStrategies);
+        RadToDeg(zenith_rad, zenith_deg, kNStrategies);
+        RadToDeg(azimuth_rad, azimuth_deg, kNStrategies);
+        Cos(zenith_rad, cos_zenith_rec, kNStrategies);
+        for (int k = 0; k < kNStrategies; k++)
+        {
+          if (!*strategy_flag[k]) continue;
+          *angerrordeg_out[k] = angerror_deg[k];
+          *zenithdeg_out[k] = zenith_deg[k];
+          *cos_zenith_out[k] = cos_zenith_rec[k];
+          *azimuthdeg_out[k] = azimuth_deg[k];
+        }
+      }
 
-    } // end selection
+      if (type != 0 || IsMC == false)
+      {
+        TRACE_SCOPE("Fill");
+        writer.Fill();
+        reco.Fill();
+      }
 
-    const int currentEventNumber = dataFile->GetCurrentEvent();
-    if (currentEventNumber && currentEventNumber % fivePercent == 0)
-      cout << " " << currentEventNumber << " out of " << ntot << " events processed" << endl;
+    } // end selection
   }
+  writer.Finish();
 
   outFile->cd();
-  outFile->Write();
+  {
+    TRACE_SCOPE("Write");
+    outFile->Write();
+  }
   outFile->Close();
+  AnnotateSelFile(output_name);
+  stage.Finish();
 
   cout << "\n total number of events: " << ntot << "\n"
        << " total selected events: " << nsel  << "\n"
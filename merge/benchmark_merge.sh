@@ -0,0 +1,50 @@
+#!/bin/bash
+## Usage:
+#   ./benchmark_merge.sh <INPUT_LIST> [THREADS]
+#
+## Example:
+#   ./benchmark_merge.sh lists/filename/list_anue_a_CC_end_all_runs.txt 8
+#
+## Arguments:
+#   INPUT_LIST: list of the files to merge, one per line, as given to hadd with @
+#   THREADS: number of threads for hadd -j and MergeSel (default 4)
+#
+# Times hadd, hadd -j and bin/MergeSel on the same inputs and checks that
+# all outputs hold the same number of entries. Outputs go to $TMPDIR.
+
+INPUT_LIST=${1}
+THREADS=${2:-4}
+OUTDIR=${TMPDIR:-/tmp}/benchmark_merge_$$
+MERGER=$(dirname $0)/bin/MergeSel
+
+if [ ! -f "${INPUT_LIST}" ] || [ ! -x "${MERGER}" ]; then
+    echo "Usage: $0 <INPUT_LIST> [THREADS] (build ${MERGER} with make first)"
+    exit 1
+fi
+mkdir -p ${OUTDIR}
+
+echo "Input list: ${INPUT_LIST} ($(wc -l < ${INPUT_LIST}) files)"
+echo "Threads: ${THREADS}"
+
+# run <name> <output> <command...>: time the command and count the entries of the output
+results=""
+run() {
+    local name=$1 output=$2
+    shift 2
+    local start=$(date +%s.%N)
+    "$@" > ${OUTDIR}/${name// /_}.log 2>&1 || echo "${name} failed, see ${OUTDIR}/${name// /_}.log"
+    local end=$(date +%s.%N)
+    local entries=$(root -l -b -q -e "TFile f(\"${output}\"); cout << ((TTree*)f.Get(\"sel\"))->GetEntries() << endl;" 2>/dev/null | tail -1)
+    results+=$(printf "%-28s %10.1f s %14s entries %10s MB" "${name}" $(echo "${end} - ${start}" | bc) "${entries}" $(du -m ${output} | cut -f1))"\n"
+}
+
+run "hadd" ${OUTDIR}/hadd.root hadd -f ${OUTDIR}/hadd.root @${INPUT_LIST}
+run "hadd -j ${THREADS}" ${OUTDIR}/hadd_j.root hadd -f -j ${THREADS} ${OUTDIR}/hadd_j.root @${INPUT_LIST}
+run "MergeSel" ${OUTDIR}/mergesel.root ${MERGER} ${OUTDIR}/mergesel.root @${INPUT_LIST}
+run "MergeSel --threads ${THREADS}" ${OUTDIR}/mergesel_mt.root ${MERGER} ${OUTDIR}/mergesel_mt.root @${INPUT_LIST} --threads ${THREADS}
+run "MergeSel --compression 505" ${OUTDIR}/mergesel_zstd.root ${MERGER} ${OUTDIR}/mergesel_zstd.root @${INPUT_LIST} --threads ${THREADS} --compression 505
+run "MergeSel --sort-run" ${OUTDIR}/mergesel_sorted.root ${MERGER} ${OUTDIR}/mergesel_sorted.root @${INPUT_LIST} --threads ${THREADS} --sort-run
+
+echo
+echo -e "${results}"
+echo "Outputs and logs in ${OUTDIR}"
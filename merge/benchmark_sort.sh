@@ -0,0 +1,56 @@
+#!/bin/bash
+## Usage:
+#   ./benchmark_sort.sh <INPUT_LIST> [THREADS]
+#
+## Example:
+#   ./benchmark_sort.sh lists/filename/list_anue_a_CC_end_all_runs.txt 8
+#
+## Arguments:
+#   INPUT_LIST: list of the files to merge, one per line, as given to hadd with @
+#   THREADS: number of threads for MergeSel (default 4)
+#   CUTS: selections of CutSelection to run on each output (default "muon_free nnfit_loose_cuts nnfit_hard_cuts")
+#
+# Merges the inputs with bin/MergeSel in the order of the list, with
+# --sort run_id and with --sort run_id,cos_zenith_true, then runs
+# CutSelection on each output. For each order, prints the time of the merge,
+# the size of the output and, for each selection, how many clusters the zone
+# map let it skip. Outputs go to $TMPDIR.
+# Build first: make in merge/ and apply_cuts/.
+
+INPUT_LIST=${1}
+THREADS=${2:-4}
+CUTS=${CUTS:-"muon_free nnfit_loose_cuts nnfit_hard_cuts"}
+BASE=$(cd $(dirname $0)/.. && pwd)
+OUTDIR=${TMPDIR:-/tmp}/benchmark_sort_$$
+MERGER=${BASE}/merge/bin/MergeSel
+CUTTER=${BASE}/apply_cuts/bin/CutSelection
+
+if [ ! -f "${INPUT_LIST}" ] || [ ! -x "${MERGER}" ] || [ ! -x "${CUTTER}" ]; then
+    echo "Usage: $0 <INPUT_LIST> [THREADS] (build ${MERGER} and ${CUTTER} with make first)"
+    exit 1
+fi
+mkdir -p ${OUTDIR}
+
+echo "Input list: ${INPUT_LIST} ($(wc -l < ${INPUT_LIST}) files)"
+
+# run <name> <sort options...>: merge, then the selections on the output
+run() {
+    local name=$1
+    shift
+    local output=${OUTDIR}/${name}.root
+    local start=$(date +%s.%N)
+    ${MERGER} ${output} @${INPUT_LIST} --threads ${THREADS} "$@" > ${OUTDIR}/${name}.log 2>&1 \
+        || echo "MergeSel ${name} failed, see ${OUTDIR}/${name}.log"
+    local end=$(date +%s.%N)
+    printf "%-26s %8.1f s %10s MB\n" "${name}" $(echo "${end} - ${start}" | bc) $(du -m ${output} | cut -f1)
+    for cut in ${CUTS}; do
+        ${CUTTER} ${output} ${OUTDIR}/${name}_${cut}.root ${cut} > ${OUTDIR}/${name}_${cut}.log 2>&1
+        printf "    %-22s %s\n" "${cut}" "$(grep "^Zone map: skipping" ${OUTDIR}/${name}_${cut}.log | sed 's/^Zone map: skipping //')"
+    done
+}
+
+run unsorted
+run run_id --sort run_id
+run run_id_cos_zenith_true --sort run_id,cos_zenith_true
+
+echo "Outputs and logs in ${OUTDIR}"
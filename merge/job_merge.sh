@@ -14,6 +14,10 @@ cd ${ANTARES}/mc/${FILE_FOLDER}/
 # Load ROOT 
 source $HOME/bash_init/root_env.sh
 
+# MergeSel copies the baskets like hadd and rebuilds the sel metadata; USE_HADD=1 runs hadd instead,
+# which cannot merge --sparse-reco files (the entry branch of their strategy trees is not offset)
+MERGER=${WORK}/master_thesis/antares_dst/merge/bin/MergeSel
+
 echo "-----------------------------"
 echo "Starting script:" $(basename $BASH_SOURCE)
 echo "----------------------------- 0"
@@ -21,5 +25,9 @@ echo "Input list: ${INPUT_LIST}"
 echo "Input folder: ${FILE_FOLDER}"
 echo "Output folder: ${END_FOLDER}"
 
-hadd -f ${INPUT_LIST%.txt}.root @${INPUT_LIST}
+if [ "${USE_HADD}" = "1" ]; then
+    hadd -f ${INPUT_LIST%.txt}.root @${INPUT_LIST}
+else
+    ${MERGER} ${INPUT_LIST%.txt}.root @${INPUT_LIST} --threads ${SLURM_CPUS_PER_TASK:-1}
+fi
 mv ${INPUT_LIST%.txt}.root ${ANTARES}/mc/${END_FOLDER}/
\ No newline at end of file
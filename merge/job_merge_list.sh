@@ -14,6 +14,10 @@ cd ${ANTARES}/mc/${FILE_FOLDER}/
 # Load ROOT 
 source $HOME/bash_init/root_env.sh
 
+# MergeSel copies the baskets like hadd and rebuilds the sel metadata; USE_HADD=1 runs hadd instead,
+# which cannot merge --sparse-reco files (the entry branch of their strategy trees is not offset)
+MERGER=${WORK}/master_thesis/antares_dst/merge/bin/MergeSel
+
 
 echo "-----------------------------"
 echo "Starting script:" $(basename $BASH_SOURCE)
@@ -28,7 +32,11 @@ do
     FILE=${WORK}/master_thesis/antares_dst/merge/lists/files/${line}
     
     echo "Merging file: ${FILE}"
-    hadd -f ${FILE%.txt}.root @${FILE}
+    if [ "${USE_HADD}" = "1" ]; then
+        hadd -f ${FILE%.txt}.root @${FILE}
+    else
+        ${MERGER} ${FILE%.txt}.root @${FILE} --threads ${SLURM_CPUS_PER_TASK:-1}
+    fi
     mv ${FILE%.txt}.root ${ANTARES}/mc/${END_FOLDER}/
 
     echo -e "Done merging file: ${FILE} \n"
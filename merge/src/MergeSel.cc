@@ -0,0 +1,683 @@
+/**
+ * @brief Merge the sel trees of many ROOT files, as a replacement of hadd in the merge stage.
+ * Inputs whose branches and compression match the output are merged by
+ * copying their compressed baskets without decompressing them (the "fast"
+ * copy of hadd). The compression is compared branch by branch: that of the
+ * output is --compression, or else that of each branch of the first input,
+ * then the codec plan. Inputs with another compression are read and recompressed,
+ * with ROOT implicit multi-threading decompressing and compressing the
+ * branches in parallel. Inputs with different branches are rejected.
+ *
+ * With --sort <columns> the output is ordered by the given columns, e.g.
+ * --sort run_id,cos_zenith_true: each run is stored contiguously, and within
+ * a run the events go from upgoing to downgoing. The clusters then hold few
+ * runs and a narrow range of zenith, so the run-level columns compress better
+ * and the zone map lets run masks and zenith cuts skip more clusters. The key
+ * columns are compared as doubles, NaN last; equal keys keep the order of the
+ * inputs. --sort-run is --sort run_id. A single input is sorted the same way.
+ *
+ * When every input is sorted and their key ranges do not overlap (e.g. one
+ * run per file with --sort run_id), reordering the inputs is enough and the
+ * fast copy is kept. Otherwise the keys and entry numbers are sorted with
+ * half of --mem-mb (1024 MB by default), spilling to --tmpdir beyond it
+ * (ExternalSort.h). The entries are then gathered in windows of consecutive
+ * output entries that fit the other half: for each window the inputs are read
+ * forward once, taking the entries of the window, which are then written in
+ * key order. A tree whose branches are not each one scalar or fixed array of
+ * a basic type is copied entry by entry in key order instead.
+ * The sort key is recorded in the user info of the output tree (SelMetadata.h);
+ * a merge without --sort of several inputs removes it.
+ *
+ * The metadata trees (sel_zones, sel_index) of the inputs are not merged,
+ * they are rebuilt for the output by AnnotateSelFile().
+ *
+ * The strategy trees of --sparse-reco inputs (sel_aafit, ..., SparseReco.h)
+ * are merged in the order of the inputs, the branch "entry" of each row
+ * moved by the entries of the inputs before it. hadd would only concatenate
+ * them. Sorting such inputs entry by entry is refused, since the rows would
+ * have to follow the entries.
+ *
+ * Usage: MergeSel <output rootfile> <input rootfile | @list> [...]
+ *        [--tree sel] [--threads N] [--sort <columns> | --sort-run] [--mem-mb 1024] [--tmpdir <dir>]
+ *        [--compression <ROOT setting>] [--trace out.json]
+ *        [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>] [--cache]
+ */
+
+#include <Compression.h>
+#include <TBranch.h>
+#include <TChain.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TStopwatch.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ExternalSort.h"
+#include "SelMetadata.h"
+#include "SparseReco.h"
+#include "StageContext.h"
+#include "Trace.h"
+
+using namespace std;
+
+struct InputFile
+{
+    string path;
+    Long64_t entries;
+    // compression of each branch
+    vector<Int_t> compression;
+    // keys of the first and last entries, and whether the entries are in key order
+    vector<double> key_first, key_last;
+    bool sorted;
+    // the file has the strategy trees of --sparse-reco
+    bool sparse;
+};
+
+// Branch names with their leaf lists, the layout that must match for a merge
+string Schema(TTree *tree)
+{
+    string schema;
+    TObjArray *branches = tree->GetListOfBranches();
+    for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+    {
+        TBranch *branch = (TBranch *)branches->At(b);
+        schema += string(branch->GetName()) + ":" + branch->GetTitle() + ";";
+    }
+    return schema;
+}
+
+// Compression of the baskets of each branch of a tree, in the order of the branches
+vector<Int_t> BranchCompressions(TTree *tree)
+{
+    vector<Int_t> compression;
+    TObjArray *branches = tree->GetListOfBranches();
+    for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+        compression.push_back(((TBranch *)branches->At(b))->GetCompressionSettings());
+    return compression;
+}
+
+// Compression of the branches of a new output tree: --compression, if given, then the codec plan.
+// A clone keeps the compression of the branches it was cloned from, not that of its file.
+void SetOutputCompression(TTree *tree, Int_t compression, const CodecPlan &codecs)
+{
+    if (compression >= 0)
+    {
+        TObjArray *branches = tree->GetListOfBranches();
+        for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+            ((TBranch *)branches->At(b))->SetCompressionSettings(compression);
+    }
+    codecs.Apply(tree);
+}
+
+// Order of two keys of n columns: negative, 0 or positive; NaN sorts after every number
+int CompareKeys(const double *a, const double *b, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        bool a_nan = std::isnan(a[k]), b_nan = std::isnan(b[k]);
+        if (a_nan || b_nan)
+        {
+            if (a_nan != b_nan)
+                return a_nan ? 1 : -1;
+            continue;
+        }
+        if (a[k] != b[k])
+            return a[k] < b[k] ? -1 : 1;
+    }
+    return 0;
+}
+
+// Size of one entry of a flat tree, whose branches each have one leaf of a basic type and fixed length;
+// offsets gets the position of each branch in the entry. 0 if the tree is not flat.
+size_t FlatRowLayout(TTree *tree, vector<size_t> &offsets)
+{
+    static const set<string> basic_types = {"Bool_t", "Char_t", "UChar_t", "Short_t", "UShort_t", "Int_t", "UInt_t",
+                                            "Float_t", "Double_t", "Long64_t", "ULong64_t"};
+    size_t size = 0;
+    offsets.clear();
+    TObjArray *branches = tree->GetListOfBranches();
+    for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+    {
+        TBranch *branch = (TBranch *)branches->At(b);
+        if (branch->GetListOfLeaves()->GetEntriesFast() != 1 || string(branch->GetTitle()).find("/C") != string::npos)
+            return 0;
+        TLeaf *leaf = (TLeaf *)branch->GetListOfLeaves()->At(0);
+        if (leaf->GetLeafCount() || !basic_types.count(leaf->GetTypeName()))
+            return 0;
+        // 8-byte aligned, the entry buffers are allocated with new
+        size = (size + 7) / 8 * 8;
+        offsets.push_back(size);
+        size += (size_t)leaf->GetLenType() * leaf->GetLenStatic();
+    }
+    return size;
+}
+
+// Leaves of the key columns of a tree
+vector<TLeaf *> KeyLeaves(TTree *tree, const vector<string> &columns, const string &path)
+{
+    vector<TLeaf *> leaves;
+    for (const string &column : columns)
+    {
+        TBranch *branch = tree->GetBranch(column.c_str());
+        if (!branch)
+        {
+            cerr << "Error: " << path << " has no branch " << column << ", needed by --sort" << endl;
+            exit(1);
+        }
+        leaves.push_back((TLeaf *)branch->GetListOfLeaves()->At(0));
+    }
+    return leaves;
+}
+
+// Keys of the first and last entries of the tree and whether its entries are in key order
+void ScanKeys(TTree *tree, const vector<string> &columns, InputFile &input)
+{
+    vector<TLeaf *> leaves = KeyLeaves(tree, columns, input.path);
+    vector<double> key(columns.size()), previous(columns.size());
+    input.sorted = true;
+    for (Long64_t i = 0; i < input.entries; i++)
+    {
+        for (size_t k = 0; k < leaves.size(); k++)
+        {
+            leaves[k]->GetBranch()->GetEntry(i);
+            key[k] = leaves[k]->GetValue();
+        }
+        if (i == 0)
+            input.key_first = key;
+        else if (CompareKeys(key.data(), previous.data(), key.size()) < 0)
+            input.sorted = false;
+        previous.swap(key);
+    }
+    input.key_last = previous;
+}
+
+// Number of the strategy trees of tree_name in file, kNRecoStrategies for a --sparse-reco file
+int CountStrategyTrees(TFile *file, const string &tree_name)
+{
+    int n = 0;
+    for (int s = 0; s < kNRecoStrategies; s++)
+        n += dynamic_cast<TTree *>(file->Get(RecoTreeName(tree_name, static_cast<ERecoStrategy>(s)).c_str())) != NULL;
+    return n;
+}
+
+// Merge the strategy trees of --sparse-reco inputs into outfile, in the order of inputs: the entry of each row
+// is moved by the entries of the inputs before it. The rows are read and filled one by one.
+void MergeStrategyTrees(const vector<InputFile> &inputs, const string &tree_name, TFile *outfile, Int_t compression,
+                        const CodecPlan &codecs)
+{
+    for (int s = 0; s < kNRecoStrategies; s++)
+    {
+        string name = RecoTreeName(tree_name, static_cast<ERecoStrategy>(s));
+        TTree *merged = NULL;
+        string schema;
+        vector<size_t> offsets;
+        vector<char> row;
+        size_t entry_offset = 0;
+        Long64_t first_entry = 0, rows = 0;
+        for (const InputFile &input : inputs)
+        {
+            TFile *file = TFile::Open(input.path.c_str(), "READ");
+            TTree *tree = dynamic_cast<TTree *>(file->Get(name.c_str()));
+            if (!merged)
+            {
+                schema = Schema(tree);
+                row.resize(max<size_t>(FlatRowLayout(tree, offsets), 1));
+                Int_t entry_branch = -1;
+                for (size_t b = 0; b < offsets.size(); b++)
+                    if (string(tree->GetListOfBranches()->At(b)->GetName()) == "entry")
+                        entry_branch = b;
+                if (entry_branch < 0)
+                {
+                    cerr << "Error: strategy tree " << name << " of " << input.path << " is not flat or has no branch entry" << endl;
+                    exit(1);
+                }
+                entry_offset = offsets[entry_branch];
+            }
+            else if (Schema(tree) != schema)
+            {
+                cerr << "Error: the branches of " << name << " in " << input.path << " differ from those of " << inputs[0].path << endl;
+                exit(1);
+            }
+
+            TObjArray *branches = tree->GetListOfBranches();
+            for (size_t b = 0; b < offsets.size(); b++)
+                tree->SetBranchAddress(branches->At(b)->GetName(), &row[offsets[b]]);
+            if (!merged)
+            {
+                outfile->cd();
+                merged = tree->CloneTree(0);
+                SetOutputCompression(merged, compression, codecs);
+            }
+            // the clone is reset when its source is closed, it reads the row again for every input
+            for (size_t b = 0; b < offsets.size(); b++)
+                merged->SetBranchAddress(branches->At(b)->GetName(), &row[offsets[b]]);
+
+            for (Long64_t r = 0; r < tree->GetEntries(); r++)
+            {
+                tree->GetEntry(r);
+                Long64_t entry;
+                memcpy(&entry, &row[entry_offset], sizeof(entry));
+                entry += first_entry;
+                memcpy(&row[entry_offset], &entry, sizeof(entry));
+                merged->Fill();
+            }
+            rows += tree->GetEntries();
+            first_entry += input.entries;
+            file->Close();
+            delete file;
+        }
+        outfile->cd();
+        merged->Write("", TObject::kOverwrite);
+        cout << "Merged " << name << ": " << rows << " rows" << endl;
+    }
+}
+
+vector<string> SplitColumns(const string &list)
+{
+    vector<string> columns;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = min(list.find(',', start), list.size());
+        if (end > start)
+            columns.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return columns;
+}
+
+vector<string> ReadInputs(const vector<string> &args)
+{
+    // as hadd, @file reads the inputs from a list
+    vector<string> paths;
+    for (size_t a = 1; a < args.size(); a++)
+    {
+        if (args[a][0] != '@')
+        {
+            paths.push_back(args[a]);
+            continue;
+        }
+        ifstream list(args[a].substr(1).c_str());
+        if (!list)
+        {
+            cerr << "Error: list " << args[a].substr(1) << " not found" << endl;
+            exit(1);
+        }
+        string line;
+        while (list >> line)
+            paths.push_back(line);
+    }
+    return paths;
+}
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <output rootfile> <input rootfile | @list> [...]"
+         << " [--tree sel] [--threads N] [--sort <columns> | --sort-run] [--mem-mb 1024] [--tmpdir <dir>]"
+         << " [--compression <ROOT setting>] [--trace out.json]"
+         << " [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>] [--cache]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options = ParseStageOptions(argc, argv, {"tree", "threads", "sort", "mem-mb", "tmpdir", "compression"});
+    const vector<string> &args = options.Positional();
+    if (args.size() < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string output_file = args[0];
+    vector<string> paths = ReadInputs(args);
+    string tree_name = options.Get("tree", "sel");
+    int nthreads = atoi(options.Get("threads", "1").c_str());
+    // --sort run_id,cos_zenith_true: the columns of the sort key, --sort-run is --sort run_id
+    string sort_key = options.Has("sort-run") ? "run_id" : options.Get("sort");
+    vector<string> key_columns = SplitColumns(sort_key);
+    bool sort = !key_columns.empty();
+    if (paths.empty())
+    {
+        cerr << "Error: no input files" << endl;
+        return 1;
+    }
+    if (options.Has("sort") && (options.Has("sort-run") || !sort))
+    {
+        cerr << "Error: --sort takes a list of columns, e.g. run_id,cos_zenith_true, and excludes --sort-run" << endl;
+        return 1;
+    }
+
+    // --cache, --trace, --metrics, --mem-budget, --codec-plan (StageContext.h); the baskets are copied, --read-cache is ignored
+    StageContext stage("MergeSel", output_file, options);
+    if (stage.range.Enabled())
+    {
+        cerr << "Error: MergeSel merges whole trees, --entries and --shard are not supported" << endl;
+        return 1;
+    }
+    for (const string &path : paths)
+        stage.cache.Input(path);
+    stage.cache.Output(output_file);
+    if (!stage.Start())
+        return 0;
+
+    TStopwatch timer;
+    if (nthreads > 1)
+        ROOT::EnableImplicitMT(nthreads);
+
+    //===========================================================
+    // Inputs: schema, compression and runs
+    //===========================================================
+    vector<InputFile> inputs;
+    string schema;
+    Long64_t total = 0;
+    for (size_t f = 0; f < paths.size(); f++)
+    {
+        TRACE_SCOPE("ScanInput");
+        TFile *file = TFile::Open(paths[f].c_str(), "READ");
+        if (!file || file->IsZombie())
+        {
+            cerr << "Error: file " << paths[f] << " not found" << endl;
+            return 1;
+        }
+        TTree *tree = dynamic_cast<TTree *>(file->Get(tree_name.c_str()));
+        if (!tree)
+        {
+            cerr << "Error: tree " << tree_name << " not found in " << paths[f] << endl;
+            return 1;
+        }
+
+        string this_schema = Schema(tree);
+        if (f == 0)
+            schema = this_schema;
+        else if (this_schema != schema)
+        {
+            cerr << "Error: the branches of " << paths[f] << " differ from those of " << paths[0] << endl;
+            return 1;
+        }
+
+        InputFile input = {paths[f], tree->GetEntries(), BranchCompressions(tree), {}, {}, true, false};
+        int nstrategies = CountStrategyTrees(file, tree_name);
+        input.sparse = nstrategies > 0;
+        if (nstrategies > 0 && nstrategies != kNRecoStrategies)
+        {
+            cerr << "Error: " << paths[f] << " has " << nstrategies << " of the " << kNRecoStrategies << " strategy trees of --sparse-reco" << endl;
+            return 1;
+        }
+        if (f > 0 && input.sparse != inputs[0].sparse)
+        {
+            cerr << "Error: " << paths[f] << " and " << paths[0] << " are not both --sparse-reco files" << endl;
+            return 1;
+        }
+        if (sort)
+            ScanKeys(tree, key_columns, input);
+        inputs.push_back(input);
+        total += input.entries;
+        file->Close();
+        delete file;
+    }
+
+    // reordering whole files gives key order if each is sorted and their keys do not overlap
+    bool sort_entries = false;
+    size_t nkeys = key_columns.size();
+    if (sort)
+    {
+        // the empty files go first, they have no key
+        stable_sort(inputs.begin(), inputs.end(), [nkeys](const InputFile &a, const InputFile &b) {
+            if (a.entries == 0 || b.entries == 0)
+                return a.entries == 0 && b.entries > 0;
+            return CompareKeys(a.key_first.data(), b.key_first.data(), nkeys) < 0;
+        });
+        const InputFile *previous = NULL;
+        for (size_t f = 0; f < inputs.size(); f++)
+        {
+            if (inputs[f].entries == 0)
+                continue;
+            sort_entries |= !inputs[f].sorted ||
+                            (previous && CompareKeys(inputs[f].key_first.data(), previous->key_last.data(), nkeys) < 0);
+            previous = &inputs[f];
+        }
+        cout << "Sorting by " << sort_key << ": " << (sort_entries ? "entry by entry" : "by reordering the input files") << endl;
+    }
+    bool sparse = inputs[0].sparse;
+    if (sparse && sort_entries)
+    {
+        cerr << "Error: --sort " << sort_key << " has to reorder the entries of the --sparse-reco inputs, which is not supported;"
+             << " merge them without --sort or sort dense inputs" << endl;
+        return 1;
+    }
+
+    // without --compression the branches keep the compression of the first input
+    Int_t compression = -1;
+    if (options.Has("compression"))
+        compression = atoi(options.Get("compression").c_str());
+    Int_t file_compression = compression;
+    if (file_compression < 0)
+        file_compression = inputs[0].compression.empty() ? (Int_t)ROOT::RCompressionSetting::EDefaults::kUseGeneralPurpose
+                                                         : inputs[0].compression[0];
+
+    //===========================================================
+    // Merge
+    //===========================================================
+    TFile *outfile = new TFile(output_file.c_str(), "RECREATE", "", file_compression);
+    TTree *newtree = NULL;
+    vector<Int_t> output_compression;
+    int nfast = 0, nslow = 0;
+
+    if (!sort_entries)
+    {
+        stage.Progress().Begin("merge", total);
+        for (size_t f = 0; f < inputs.size(); f++)
+        {
+            TFile *file = TFile::Open(inputs[f].path.c_str(), "READ");
+            TTree *tree = (TTree *)file->Get(tree_name.c_str());
+            if (!newtree)
+            {
+                outfile->cd();
+                newtree = tree->CloneTree(0);
+                stage.memory.ConfigureOutput(newtree, 1.);
+                SetOutputCompression(newtree, compression, stage.codecs);
+                output_compression = BranchCompressions(newtree);
+                // one input keeps its order, a merge has the order of the key only
+                if (sort || inputs.size() > 1)
+                    SetSortKey(newtree, sort_key);
+            }
+
+            // baskets are copied as they are only when every branch is already compressed as wanted
+            bool fast = inputs[f].compression == output_compression;
+            cout << "Merging " << inputs[f].path << " (" << inputs[f].entries << " entries, "
+                 << (fast ? "basket copy" : "recompressing") << ")" << endl;
+            Long64_t before = newtree->GetEntries();
+            TRACE_SCOPE("CopyEntries");
+            newtree->CopyEntries(tree, -1, fast ? "fast" : "", kTRUE);
+            // a file that cannot be fast copied is skipped by ROOT, copy it entry by entry
+            if (fast && newtree->GetEntries() - before != inputs[f].entries)
+            {
+                cout << "  basket copy not possible, recompressing" << endl;
+                newtree->CopyEntries(tree, -1, "", kTRUE);
+                fast = false;
+            }
+            fast ? nfast++ : nslow++;
+            stage.Progress().Add(inputs[f].entries);
+
+            file->Close();
+            delete file;
+        }
+        if (sparse)
+        {
+            TRACE_SCOPE("MergeStrategyTrees");
+            MergeStrategyTrees(inputs, tree_name, outfile, compression, stage.codecs);
+        }
+    }
+    else
+    {
+        TChain chain(tree_name.c_str());
+        for (size_t f = 0; f < inputs.size(); f++)
+            chain.Add(inputs[f].path.c_str());
+
+        // records of the key columns and the entry in the chain; the sorter is stable,
+        // entries with the same key keep the order of the inputs
+        // half of what --mem-budget leaves if --mem-mb is not given, one half for the keys and one for the gather window
+        size_t budget = (size_t)atol(options.Get("mem-mb", "1024").c_str()) << 20;
+        if (stage.memory.Enabled() && !options.Has("mem-mb"))
+            budget = max(stage.memory.TreeBytes() / 2, 64LL << 20);
+        stage.memory.Reserve("sort buffers", budget);
+        size_t record_size = nkeys * sizeof(double) + sizeof(Long64_t);
+        ExternalSorter sorter(record_size, budget / 2, [nkeys](const char *a, const char *b) {
+            return CompareKeys((const double *)a, (const double *)b, nkeys) < 0;
+        }, options.Get("tmpdir"));
+
+        vector<char> record(record_size);
+        double *key = (double *)record.data();
+        Long64_t offset = 0;
+        for (size_t f = 0; f < inputs.size(); f++)
+        {
+            TRACE_SCOPE("ReadKeys");
+            TFile *file = TFile::Open(inputs[f].path.c_str(), "READ");
+            TTree *tree = (TTree *)file->Get(tree_name.c_str());
+            vector<TLeaf *> leaves = KeyLeaves(tree, key_columns, inputs[f].path);
+            for (Long64_t i = 0; i < inputs[f].entries; i++)
+            {
+                for (size_t k = 0; k < nkeys; k++)
+                {
+                    leaves[k]->GetBranch()->GetEntry(i);
+                    key[k] = leaves[k]->GetValue();
+                }
+                Long64_t entry = offset + i;
+                memcpy(record.data() + nkeys * sizeof(double), &entry, sizeof(entry));
+                sorter.Add(record.data());
+            }
+            offset += inputs[f].entries;
+            file->Close();
+            delete file;
+        }
+        {
+            TRACE_SCOPE("SortKeys");
+            sorter.Finish();
+        }
+        if (sorter.NRuns() > 0)
+            cout << "Sorted " << sorter.NRecords() << " keys in " << sorter.NRuns() << " files spilled to " << options.Get("tmpdir", "$TMPDIR") << endl;
+        else
+            cout << "Sorted " << sorter.NRecords() << " keys in memory" << endl;
+
+        // a flat entry is read into row, which the output tree shares
+        vector<size_t> offsets;
+        chain.LoadTree(0);
+        size_t row_size = FlatRowLayout(chain.GetTree(), offsets);
+        vector<char> row(max<size_t>(row_size, 1));
+        TObjArray *branches = chain.GetTree()->GetListOfBranches();
+        for (size_t b = 0; row_size > 0 && b < offsets.size(); b++)
+            chain.SetBranchAddress(branches->At(b)->GetName(), &row[offsets[b]]);
+
+        outfile->cd();
+        newtree = chain.CloneTree(0);
+        stage.memory.ConfigureInput(&chain, 0.25);
+        stage.memory.ConfigureOutput(newtree, 0.75);
+        SetOutputCompression(newtree, compression, stage.codecs);
+        SetSortKey(newtree, sort_key);
+        stage.Progress().Begin("merge", total);
+
+        if (row_size == 0)
+        {
+            cout << "The branches of " << tree_name << " are not flat, copying the entries one by one in key order" << endl;
+            while (sorter.Next(record.data()))
+            {
+                Long64_t entry;
+                memcpy(&entry, record.data() + nkeys * sizeof(double), sizeof(entry));
+                {
+                    TRACE_SCOPE("ReadEvent");
+                    chain.GetEntry(entry);
+                }
+                {
+                    TRACE_SCOPE("Fill");
+                    newtree->Fill();
+                }
+                stage.Progress().Add();
+            }
+        }
+        else
+        {
+            // the output entries [first, first + window) are gathered in one forward pass over the inputs
+            Long64_t window = max<Long64_t>((budget / 2) / (row_size + sizeof(pair<Long64_t, Long64_t>)), 1);
+            window = min(window, max<Long64_t>(total, 1));
+            cout << "Gathering " << total << " entries of " << row_size << " bytes in " << (total + window - 1) / window
+                 << " passes of " << window << " entries" << endl;
+            vector<char> rows(window * row_size);
+            // entry in the chain and position in the window
+            vector<pair<Long64_t, Long64_t>> slots;
+            slots.reserve(window);
+            for (Long64_t first = 0; first < total; first += window)
+            {
+                slots.clear();
+                Long64_t entry;
+                for (Long64_t i = 0; i < window && sorter.Next(record.data()); i++)
+                {
+                    memcpy(&entry, record.data() + nkeys * sizeof(double), sizeof(entry));
+                    slots.push_back(make_pair(entry, i));
+                }
+                std::sort(slots.begin(), slots.end());
+                {
+                    TRACE_SCOPE("GatherWindow");
+                    for (const pair<Long64_t, Long64_t> &slot : slots)
+                    {
+                        chain.GetEntry(slot.first);
+                        memcpy(&rows[slot.second * row_size], row.data(), row_size);
+                    }
+                }
+                {
+                    TRACE_SCOPE("Fill");
+                    for (size_t i = 0; i < slots.size(); i++)
+                    {
+                        memcpy(row.data(), &rows[i * row_size], row_size);
+                        newtree->Fill();
+                    }
+                }
+                stage.Progress().Add(slots.size());
+            }
+        }
+        nslow = inputs.size();
+    }
+
+    outfile->cd();
+    {
+        TRACE_SCOPE("Write");
+        newtree->Write("", TObject::kOverwrite);
+    }
+    Long64_t merged = newtree->GetEntries();
+    outfile->Close();
+    delete outfile;
+
+    if (merged != total)
+    {
+        cerr << "Error: merged " << merged << " entries, expected " << total << endl;
+        return 1;
+    }
+    {
+        TRACE_SCOPE("AnnotateSelFile");
+        AnnotateSelFile(output_file, tree_name);
+    }
+    stage.Finish();
+
+    timer.Stop();
+    cout << "\n========================================" << endl;
+    cout << "Files:              " << inputs.size() << endl;
+    cout << "Entries:            " << total << endl;
+    cout << "Basket copy:        " << nfast << " files" << endl;
+    cout << "Recompressed:       " << nslow << " files" << endl;
+    if (sort)
+        cout << "Sorted by:          " << sort_key << (sort_entries ? " (entry by entry)" : " (input files reordered)") << endl;
+    cout << "Time:               " << timer.RealTime() << " s" << endl;
+    cout << "========================================" << endl;
+
+    return 0;
+}
@@ -18,6 +18,7 @@ using namespace std;
 #include <map>
 #include <iostream>
 #include <math.h>       /* cos */
+#include <vector>
 
 // ROOT
 #include "TTree.h"
@@ -26,19 +27,26 @@ using namespace std;
 #include "TMath.h"
 #include "TH2D.h"
 
+// Pipeline
+#include "AlignedVector.h"
+#include "AppendColumns.h"
+#include "ColumnReader.h"
+#include "MathKernels.h"
+#include "OscillationKernels.h"
+#include "SelMetadata.h"
+#include "StageContext.h"
+#include "Trace.h"
+
 // OscProb
 #include "PremModel.h"
 #include "PMNS_Fast.h"
 #include "PMNS_Base.h"
 
 // Constants
-const int scm_to_sm = 1e+4;
+const Long64_t block_size = 4096; // events per batch of flux evaluations
 
 // declare functions
-double GetFlux(TH2D** FluxHist_copy, int flavour , double E , double cos_zen);
-pair<double, double> Get_Osc_Prob( OscProb::PMNS_Fast pmns , OscProb::PremModel prem , map<int,int> flavour_cor, int flv_f , double E , double cos_zen ); 
 void TestOscProb( OscProb::PMNS_Fast pmns , OscProb::PremModel prem , map<int,int> flavour_cor, int type_i , double E , double cos_zen );
-int sgn( double x );
 void usage();
 
 
@@ -46,28 +54,27 @@ int main(int argc, char* argv[]){
   cout << "\nStarting OscillationWeights.cc" << endl;
   cout << "Running code:" << "\nYour input parameters are the following:"<< endl;
   for(int i = 1; i < argc; i++) { cout << i << " \t " << argv[i] << endl; }
-  string input_file = argv[1];
-  string out_file = argv[2];
-  string cluster = argv[3];
-
-  string hist_names[4] = {"h_nue_logElogF", "h_anue_logElogF", "h_numu_logElogF", "h_anumu_logElogF"};
-  string hist_names_clone[4] = {"clone_h_nue_logElogF", "clone_h_anue_logElogF", "clone_h_numu_logElogF", "clone_h_anumu_logElogF"};
-  string hist_path, flux_file;
-
-  if (cluster == "woody"){
-    cout << "Running on Woody" << endl;
-    hist_path = "/home/saturn/capn/mppi133h/master_thesis/antares_dst/oscillation_weights/models/";
-  }
-  else if (cluster == "in2p3"){
-    cout << "Running on IN2P3" << endl;
-    hist_path = "/sps/km3net/users/mchadoli/masters_thesis/antares_dst/oscillation_weights/models/";
-  }
-  flux_file = hist_path + "Honda2014_frj-solmin-aa_ORCA6_hist.root";
 
-  if( argc != 4){
+  // --flux <root file>: flux tables replacing those of the cluster (e.g. the stand-in of the benchmark)
+  StageOptions options = ParseStageOptions(argc, argv, {"flux"});
+  const vector<string> &args = options.Positional();
+  if( args.size() != 3){
     usage();
     exit(1);
   }
+  string input_file = args[0];
+  string out_file = args[1];
+  string cluster = args[2];
+
+  string flux_file = options.Has("flux") ? options.Get("flux") : FluxModelFile(cluster);
+
+  // --cache, --trace, --metrics, --mem-budget, --codec-plan, --entries, --shard, --read-cache (StageContext.h)
+  StageContext stage("OscillationWeights", out_file, options);
+  stage.cache.Input(input_file);
+  stage.cache.Input(flux_file);
+  stage.cache.Output(out_file);
+  if (!stage.Start())
+    return 0;
   //===========================================================
   // input root file
   //===========================================================
@@ -79,33 +86,19 @@ int main(int argc, char* argv[]){
     cerr << "Error: Could not open the input ROOT file." << std::endl;
     exit(1);;
   }
+  stage.range.Resolve(oldtree);
 
-  // get the histogram that contain the flux values
-  TFile* FluxInput =  TFile::Open(flux_file.c_str());
-  TH2D* FluxHist[4];
-
-  if (!FluxInput || FluxInput->IsZombie()){
-    cerr << "Error: Could not open the input ROOT file." << std::endl;
-    exit(1);
-  }
-  
-  cout  << "Retrieving Histograms" << endl;
-  for (int i=0; i<4; i++){
-    FluxInput -> GetObject(hist_names[i].c_str(), FluxHist[i]);
-  }
+  // get the histograms that contain the flux values
+  TH2D* FluxHist_copy[4];
+  LoadFluxHistograms(flux_file, FluxHist_copy);
+  stage.memory.Reserve("flux histograms", FluxHistogramBytes(FluxHist_copy));
 
   //===========================================================
   // Output root file
   //===========================================================
   TFile *f_out = new TFile(out_file.c_str(), "RECREATE");
-  TTree *event_tree = oldtree->CloneTree(0, "fast");
-  TH2D* FluxHist_copy[4];
-
-  cout  << "Copying Histograms" << endl;
-  for (int i=0; i<4; i++){
-    FluxHist_copy[i] =  dynamic_cast<TH2D*>(FluxHist[i] -> Clone(hist_names_clone[i].c_str()));
-  }  
-  FluxInput->Close();
+  // the existing branches are copied basket by basket, only the weights are written
+  AppendColumnsWriter event_tree(oldtree, {}, stage.range.First(), stage.range.Last());
 
   if (!f_out || f_out->IsZombie()){
     cerr << "Error: Could not open the output ROOT file." << std::endl;
@@ -116,88 +109,122 @@ int main(int argc, char* argv[]){
   // analysis
   //===========================================================
   // Variables
-  int run_id, type;
-  double run_duration, w2, w3, energy_true, cos_zenith_true, w_non_osc, ngen;
+  double run_duration, w2, w_non_osc, ngen;
 
   // New variables
   double w_osc, prob_nue, prob_numu, w2_norm, flux_nue, flux_numu;
 
-  // Branches from old tree
-  oldtree->SetBranchAddress("run_id", &run_id);
-  oldtree->SetBranchAddress("type", &type);
+  // Branches from old tree, only these are read
+  oldtree->SetBranchStatus("*", 0);
+  // read once per block, column by column (ColumnReader.h)
+  Column<int> type(oldtree, "type");
+  Column<double> energy_true(oldtree, "energy_true"); // check the units of the energy
+  Column<double> cos_zenith_true(oldtree, "cos_zenith_true");
+  // read for each entry
+  vector<TBranch *> entry_branches;
+  for (const char *name : {"RunDurationYear", "ngen", "w2", "w_non_osc"})
+  {
+    oldtree->SetBranchStatus(name, 1);
+    entry_branches.push_back(oldtree->GetBranch(name));
+  }
   oldtree->SetBranchAddress("RunDurationYear", &run_duration);
   oldtree->SetBranchAddress("ngen", &ngen);
   oldtree->SetBranchAddress("w2", &w2);
-  oldtree->SetBranchAddress("w3", &w3);
-  oldtree->SetBranchAddress("energy_true", &energy_true); // check the units of the energy 
-  oldtree->SetBranchAddress("cos_zenith_true", &cos_zenith_true);
   oldtree->SetBranchAddress("w_non_osc", &w_non_osc);
 
   // New Branches added in tree
-  event_tree->Branch("w_osc", &w_osc, "w_osc/D");
-  event_tree->Branch("prob_nue", &prob_nue, "prob_nue/D");
-  event_tree->Branch("prob_numu", &prob_numu, "prob_numuu/D");
-
-  Int_t ntot = (Int_t)oldtree->GetEntries();
+  event_tree.AddColumn("w_osc", &w_osc, "w_osc/D");
+  event_tree.AddColumn("prob_nue", &prob_nue, "prob_nue/D");
+  event_tree.AddColumn("prob_numu", &prob_numu, "prob_numuu/D");
+  stage.memory.ConfigureInput(oldtree, 0.25);
+  stage.input.Configure(oldtree);
+  stage.memory.ConfigureOutput(event_tree.Tree(), 0.75);
+  stage.codecs.Apply(event_tree.Tree());
+
+  Long64_t ntot = stage.range.Entries();
   Int_t nsel = 0; Int_t nsample = 0;
 
   // weight calculation - oscillation parameters
   OscProb::PMNS_Fast pmns;
   OscProb::PremModel prem;
+  SetOscillationParameters(pmns);
 
   // input neutrino flavour corresponding to OscProb arguments
-  map<int, int> flavour_cor;
-  flavour_cor.insert(pair<int, int>(12, 0));
-  flavour_cor.insert(pair<int, int>(-12, 0));
-  flavour_cor.insert(pair<int, int>(14, 1));
-  flavour_cor.insert(pair<int, int>(-14, 1));
-  flavour_cor.insert(pair<int, int>(16, 2));
-  flavour_cor.insert(pair<int, int>(-16, 2));
+  map<int, int> flavour_cor = OscProbFlavours();
+
+  // Flux inputs of a block of events, converted in batch (log10 E in, 10^logF out)
+  AlignedVector<double> log_energy_block(block_size);
+  AlignedVector<double> log_flux_nue(block_size), log_flux_numu(block_size);
+  AlignedVector<double> flux_nue_block(block_size), flux_numu_block(block_size);
 
   cout << "\nStarting loop" << endl;
-  for (unsigned int i = 0; i < ntot; i++)
+  stage.Progress().Begin("weights", ntot);
+  for (Long64_t first = stage.range.First(); first < stage.range.Last(); first += block_size)
   {
-    oldtree->GetEntry(i);
+    Long64_t n = min(block_size, stage.range.Last() - first);
 
-    if (cos_zenith_true < 0 &&  energy_true < TMath::Power(10, 4))
     {
-
-      // Data according to  JHEP 09 (2020) 178 ---> assuming Normal Ordering without SK atmospheric data
-      double dm_21 = 7.42e-5;
-      double dm_31 = 2.514e-3;
-      double theta_12 = 0.5836;
-      double theta_23 = 0.8552;
-      double theta_13 = 0.1496;
-      double dcp = (195 * TMath::Pi()) / 180;
-
-      // Apply data to OscProb objects
-      pmns.SetDm(2, dm_21);
-      pmns.SetDm(3, dm_31);
-      pmns.SetAngle(1, 2, theta_12);
-      pmns.SetAngle(1, 3, theta_13);
-      pmns.SetAngle(2, 3, theta_23);
-      pmns.SetDelta(1, 3, dcp);
-
-      // oscillation weight calculation
-      w2_norm = (w2 * scm_to_sm) / ngen; // normalized weight
-
-      pair<double, double> prob = Get_Osc_Prob(pmns, prem, flavour_cor, type, energy_true, cos_zenith_true);
-      prob_nue = prob.first;  // oscillation probability for nu_e to transition to nu_final
-      prob_numu = prob.second; // oscillation probability for nu_mu to transition to nu_final
-
-      flux_nue = GetFlux(FluxHist_copy, sgn(type) * 12, energy_true, cos_zenith_true);  // flux for initial nu_e
-      flux_numu = GetFlux(FluxHist_copy, sgn(type) * 14, energy_true, cos_zenith_true); // flux for initial nu_mu
-
-      w_osc = w2_norm * (flux_nue * prob_nue + flux_numu * prob_numu) * run_duration; // oscillated atmospheric weight for nu_final
+      TRACE_SCOPE("LoadBlock");
+      type.Read(first, n);
+      energy_true.Read(first, n);
+      cos_zenith_true.Read(first, n);
     }
-    else{ w_osc = w_non_osc;}
+    Log10(energy_true.Data(), log_energy_block.data(), n);
 
-    event_tree->Fill();
-    nsel++;
+    // the histograms are only looked up for the events that are reweighted
+    for (Long64_t j = 0; j < n; j++)
+    {
+      log_flux_nue[j] = log_flux_numu[j] = 0;
+      if (cos_zenith_true[j] < 0 && energy_true[j] < TMath::Power(10, 4))
+      {
+        TRACE_SCOPE("FluxInterpolation");
+        log_flux_nue[j] = GetLogFlux(FluxHist_copy, sgn(type[j]) * 12, log_energy_block[j], cos_zenith_true[j]);
+        log_flux_numu[j] = GetLogFlux(FluxHist_copy, sgn(type[j]) * 14, log_energy_block[j], cos_zenith_true[j]);
+      }
+    }
+    Pow10(log_flux_nue.data(), flux_nue_block.data(), n);
+    Pow10(log_flux_numu.data(), flux_numu_block.data(), n);
 
-    if (i % (ntot / 50) == 0)
+    for (Long64_t j = 0; j < n; j++)
     {
-      cout << "Current Event: \t" << i << "\t\t Total Number of Events: \t" << ntot << endl;
+      Long64_t i = first + j;
+      {
+        TRACE_SCOPE("ReadEvent");
+        for (TBranch *branch : entry_branches)
+          branch->GetEntry(i);
+      }
+
+      if (cos_zenith_true[j] < 0 && energy_true[j] < TMath::Power(10, 4))
+      {
+
+        // oscillation weight calculation
+        w2_norm = (w2 * scm_to_sm) / ngen; // normalized weight
+
+        pair<double, double> prob;
+        {
+          TRACE_SCOPE("PMNS_Fast::Prob");
+          prob = Get_Osc_Prob(pmns, prem, flavour_cor, type[j], energy_true[j], cos_zenith_true[j]);
+        }
+        prob_nue = prob.first;  // oscillation probability for nu_e to transition to nu_final
+        prob_numu = prob.second; // oscillation probability for nu_mu to transition to nu_final
+
+        flux_nue = flux_nue_block[j];   // flux for initial nu_e
+        flux_numu = flux_numu_block[j]; // flux for initial nu_mu
+
+        w_osc = w2_norm * (flux_nue * prob_nue + flux_numu * prob_numu) * run_duration; // oscillated atmospheric weight for nu_final
+      }
+      else{
+        // not reweighted, no oscillation probabilities
+        prob_nue = prob_numu = NAN;
+        w_osc = w_non_osc;
+      }
+
+      {
+        TRACE_SCOPE("Fill");
+        event_tree.Fill();
+      }
+      nsel++;
+      stage.Progress().Add();
     }
   }
 
@@ -205,84 +232,33 @@ int main(int argc, char* argv[]){
 
   // WRITE OUTPUT
   f_out->cd();
-  event_tree->Write();
+  {
+    TRACE_SCOPE("Write");
+    event_tree.Write();
+  }
+  stage.input.Report(oldtree);
   f_out->Close();
   f->Close();
+  delete f_out;
+  delete f;
+  for (int i = 0; i < 4; i++)
+    delete FluxHist_copy[i];
+  AnnotateSelFile(out_file);
+  stage.Finish();
   cout << endl;
   cout << "||========= Successful execution! =========||" << endl;
 
 } // end of main
 
-/**
- * @brief Function to calculate the neutrino flux 
- * 
- * @param flavour 
- * @param E 
- * @param cos_zen run_duration_calc
- * @return Honda flux for the current E and cos_zenith
- */
-double GetFlux(TH2D** FluxHist_copy, int flavour , double E , double cos_zen ){
-  int i; // option
-
-  if( flavour==12 ){ i=0; }
-  if( flavour==-12 ){ i=1; }
-  if( flavour==14 ){ i=2; }
-  if( flavour==-14 ){ i=3; }
-
-  double flux = FluxHist_copy[i]-> Interpolate(TMath::Log10(E), cos_zen); // it's in logF form
-  flux = TMath::Power(10, flux);
-  return flux;
-}
-
-/**
- * @brief Function to calculate neutrino oscillation probability
- * 
- * @param pmns The PMNS matrix
- * @param prem  The PREM (Earth model)
- * @param flavour_cor The mapping of the neutrino flavours
- * @param type_i  The initial neutrino flavour
- * @param type_f  The final neutrino flavour
- * @param E       The neutrino energy
- * @param cos_zen  The cosine of the zenith angle 
- * @return Calculate oscillation probability from OscProb  
- */
-pair<double, double> Get_Osc_Prob( OscProb::PMNS_Fast pmns , OscProb::PremModel prem , map<int,int> flavour_cor, int type_f , double E , double cos_zen ){
-
-  bool is_nubar;
-  int flv_f = flavour_cor[type_f];
-  if( type_f < 0 ){ 
-    is_nubar = 1;
-    }
-
-  prem.FillPath( cos_zen );
-  pmns.SetPath( prem.GetNuPath() );
-  pmns.SetIsNuBar( is_nubar ); // in case of antiparticle
-
-  double prob_nue = pmns.Prob( 0, flv_f, E );
-  double prob_numu = pmns.Prob( 1, flv_f, E );
-
-  return make_pair(prob_nue, prob_numu);
-}
-
-/**
- * @brief Typical sgn function 
- * 
- * @param x 
- * @return -1 for negative values and +1 for positive ones 
- */
-int sgn( double x ){
-  int sign ;
-  if( x > 0 ){ sign = 1; }
-  if( x < 0 ){ sign = -1; }
-  return sign;
-}
-
 /**
  * @brief Statement print in case something fails due to wrong input parameters
  * 
  */
 void usage(){
   cerr << "A problem arose while running ExpectedEvents.CC" << endl;
+  cerr << "Usage: OscillationWeights <input_file> <output_file> <woody|in2p3> [--flux <root file>] [--trace out.json]"
+       << " [--metrics <file> [--metrics-interval 10]] [--mem-budget <MB>] [--codec-plan <file>]"
+       << " [--entries first:last | --shard k/N] [--cache] [--read-cache <MB|off>] [--prefetch]" << endl;
 }
 
 
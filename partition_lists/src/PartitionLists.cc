@@ -0,0 +1,344 @@
+/**
+ * @brief Split input files into N lists of balanced predicted run time, for the array jobs.
+ * The entries of every file are read from the tree header and its compressed
+ * size from the file, without reading any event. The run time of a file is
+ * predicted from the benchmark reports of earlier runs (benchmark/run_benchmark.sh):
+ * for each stage, wall = overhead + entries / rate is fitted over the measured
+ * sizes, and the cost of a file is the sum over the stages that the jobs
+ * run. Without a report the cost is the number of entries.
+ *
+ * The files are packed with the longest processing time first rule: sorted
+ * by decreasing cost, each goes to the list with the least cost so far. The
+ * longest list is then at most 4/3 of the best possible one. With
+ * --time-limit, N is increased until the longest list fits in the limit.
+ *
+ * The lists are <prefix>_part00.txt, <prefix>_part01.txt, ... with the names
+ * as given (the job scripts prepend their input directory, see --dir).
+ *
+ * Usage: PartitionLists <N> <output prefix> <input rootfile | @list> [...]
+ *        [--dir <input dir>] [--tree <name>] [--benchmark <report.json>[,<report.json>...]]
+ *        [--stages CorrectTree,OscillationWeights,...] [--time-limit <s>]
+ */
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "StageOptions.h"
+
+using namespace std;
+
+struct InputFile
+{
+    string name;
+    Long64_t entries;
+    Long64_t zip_bytes;
+    double cost;
+};
+
+// wall = overhead + per_entry * entries, fitted on the benchmark of a stage
+struct StageModel
+{
+    double overhead;
+    double per_entry;
+    int points;
+};
+
+struct Partition
+{
+    vector<vector<size_t>> lists;
+    vector<double> costs;
+    double longest;
+};
+
+vector<string> Split(const string &list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+vector<string> ReadInputs(const vector<string> &args)
+{
+    // as hadd, @file reads the inputs from a list
+    vector<string> paths;
+    for (size_t a = 2; a < args.size(); a++)
+    {
+        if (args[a][0] != '@')
+        {
+            paths.push_back(args[a]);
+            continue;
+        }
+        ifstream list(args[a].substr(1).c_str());
+        if (!list)
+        {
+            cerr << "Error: list " << args[a].substr(1) << " not found" << endl;
+            exit(1);
+        }
+        string line;
+        while (list >> line)
+            paths.push_back(line);
+    }
+    return paths;
+}
+
+// Entries of the tree from its header; without a name, the largest tree of the file
+Long64_t TreeEntries(TFile *file, const string &tree_name)
+{
+    if (!tree_name.empty())
+    {
+        TTree *tree = dynamic_cast<TTree *>(file->Get(tree_name.c_str()));
+        return tree ? tree->GetEntries() : -1;
+    }
+    Long64_t entries = -1;
+    TIter next(file->GetListOfKeys());
+    while (TKey *key = (TKey *)next())
+    {
+        if (string(key->GetClassName()) != "TTree")
+            continue;
+        TTree *tree = dynamic_cast<TTree *>(key->ReadObj());
+        if (tree)
+            entries = max(entries, tree->GetEntries());
+    }
+    return entries;
+}
+
+// Per-stage models from the results of MeasureStage in the benchmark reports
+map<string, StageModel> ReadBenchmarks(const vector<string> &paths)
+{
+    map<string, vector<pair<double, double>>> points;
+    const regex result("\\{\"stage\": \"([^\"]+)\", \"entries\": ([0-9]+), \"exit_code\": ([0-9]+), \"wall_seconds\": ([0-9.eE+-]+)");
+    for (const string &path : paths)
+    {
+        ifstream in(path);
+        if (!in)
+        {
+            cerr << "Error: benchmark report " << path << " not found" << endl;
+            exit(1);
+        }
+        string line;
+        smatch match;
+        while (getline(in, line))
+            if (regex_search(line, match, result) && match[3] == "0" && atof(match[2].str().c_str()) > 0)
+                points[match[1]].push_back(make_pair(atof(match[2].str().c_str()), atof(match[4].str().c_str())));
+    }
+
+    map<string, StageModel> models;
+    for (const pair<const string, vector<pair<double, double>>> &stage : points)
+    {
+        const vector<pair<double, double>> &p = stage.second;
+        double n = p.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (const pair<double, double> &xy : p)
+        {
+            sx += xy.first;
+            sy += xy.second;
+            sxx += xy.first * xy.first;
+            sxy += xy.first * xy.second;
+        }
+        StageModel model = {0, sy / sx, (int)p.size()};
+        double denominator = n * sxx - sx * sx;
+        // a least squares line needs two sizes and a positive start-up time
+        if (p.size() > 1 && denominator > 0)
+        {
+            double slope = (n * sxy - sx * sy) / denominator;
+            double intercept = (sy - slope * sx) / n;
+            if (slope > 0 && intercept >= 0)
+                model = {intercept, slope, (int)p.size()};
+        }
+        models[stage.first] = model;
+    }
+    return models;
+}
+
+// Longest processing time first: the most costly file goes to the least loaded list
+Partition PackLPT(const vector<InputFile> &files, int nlists)
+{
+    vector<size_t> order(files.size());
+    for (size_t f = 0; f < files.size(); f++)
+        order[f] = f;
+    stable_sort(order.begin(), order.end(), [&files](size_t a, size_t b) { return files[a].cost > files[b].cost; });
+
+    Partition partition;
+    partition.lists.resize(nlists);
+    partition.costs.assign(nlists, 0.);
+    for (size_t f : order)
+    {
+        size_t least = min_element(partition.costs.begin(), partition.costs.end()) - partition.costs.begin();
+        partition.lists[least].push_back(f);
+        partition.costs[least] += files[f].cost;
+    }
+    partition.longest = *max_element(partition.costs.begin(), partition.costs.end());
+    return partition;
+}
+
+// Longest list of a split by file count in input order, as make_list.sh and split do
+double LongestByCount(const vector<InputFile> &files, int nlists)
+{
+    double longest = 0;
+    size_t per_list = (files.size() + nlists - 1) / nlists;
+    for (size_t first = 0; first < files.size(); first += per_list)
+    {
+        double cost = 0;
+        for (size_t f = first; f < min(first + per_list, files.size()); f++)
+            cost += files[f].cost;
+        longest = max(longest, cost);
+    }
+    return longest;
+}
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <N> <output prefix> <input rootfile | @list> [...]"
+         << " [--dir <input dir>] [--tree <name>] [--benchmark <report.json>[,<report.json>...]]"
+         << " [--stages CorrectTree,OscillationWeights,...] [--time-limit <s>]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"dir", "tree", "benchmark", "stages", "time-limit"});
+    const vector<string> &args = options.Positional();
+    if (args.size() < 3 || atoi(args[0].c_str()) < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int nlists = atoi(args[0].c_str());
+    string prefix = args[1];
+    vector<string> names = ReadInputs(args);
+    string dir = options.Get("dir");
+    string tree_name = options.Get("tree");
+    double time_limit = atof(options.Get("time-limit", "0").c_str());
+    if (names.empty())
+    {
+        cerr << "Error: no input files" << endl;
+        return 1;
+    }
+
+    //===========================================================
+    // Cost model
+    //===========================================================
+    map<string, StageModel> models = ReadBenchmarks(Split(options.Get("benchmark")));
+    vector<string> stages = Split(options.Get("stages"));
+    if (stages.empty())
+    {
+        // the synthetic input of the benchmark is not a stage of the jobs
+        for (const pair<const string, StageModel> &model : models)
+            if (model.first != "GenerateSel")
+                stages.push_back(model.first);
+    }
+    for (const string &stage : stages)
+    {
+        if (models.find(stage) == models.end())
+        {
+            cerr << "Error: no successful run of " << stage << " in the benchmark reports" << endl;
+            return 1;
+        }
+        printf("%-20s %8.2f s + %10.0f entries/s (%d sizes)\n", stage.c_str(), models[stage].overhead,
+               1. / models[stage].per_entry, models[stage].points);
+    }
+    if (stages.empty() && options.Has("benchmark"))
+    {
+        cerr << "Error: no stage in the benchmark reports" << endl;
+        return 1;
+    }
+    bool seconds = !stages.empty();
+    if (!seconds)
+        cout << "No benchmark report, the cost of a file is its number of entries" << endl;
+    if (time_limit > 0 && !seconds)
+    {
+        cerr << "Error: --time-limit needs --benchmark" << endl;
+        return 1;
+    }
+
+    //===========================================================
+    // Entries and sizes of the inputs, from their headers
+    //===========================================================
+    vector<InputFile> files;
+    Long64_t total_entries = 0;
+    for (const string &name : names)
+    {
+        string path = dir.empty() ? name : dir + "/" + name;
+        TFile *file = TFile::Open(path.c_str(), "READ");
+        if (!file || file->IsZombie())
+        {
+            cerr << "Error: file " << path << " not found" << endl;
+            return 1;
+        }
+        Long64_t entries = TreeEntries(file, tree_name);
+        if (entries < 0)
+        {
+            cerr << "Error: no tree " << tree_name << " in " << path << endl;
+            return 1;
+        }
+        InputFile input = {name, entries, file->GetSize(), (double)entries};
+        if (seconds)
+        {
+            input.cost = 0;
+            for (const string &stage : stages)
+                input.cost += models[stage].overhead + models[stage].per_entry * entries;
+        }
+        files.push_back(input);
+        total_entries += entries;
+        file->Close();
+        delete file;
+    }
+
+    //===========================================================
+    // Packing
+    //===========================================================
+    Partition partition = PackLPT(files, nlists);
+    while (time_limit > 0 && partition.longest > time_limit && nlists < (int)files.size())
+        partition = PackLPT(files, ++nlists);
+    if (time_limit > 0 && partition.longest > time_limit)
+        cerr << "Warning: a single file takes " << partition.longest << " s, more than --time-limit " << time_limit << endl;
+
+    const char *unit = seconds ? "s" : "entries";
+    printf("\n  %-40s %6s %14s %12s %12s\n", "list", "files", "entries", "MB", seconds ? "predicted s" : "cost");
+    for (int l = 0; l < nlists; l++)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s_part%02d.txt", prefix.c_str(), l);
+        ofstream out(path);
+        if (!out)
+        {
+            cerr << "Error: cannot write the list " << path << endl;
+            return 1;
+        }
+        Long64_t entries = 0, bytes = 0;
+        for (size_t f : partition.lists[l])
+        {
+            out << files[f].name << "\n";
+            entries += files[f].entries;
+            bytes += files[f].zip_bytes;
+        }
+        printf("  %-40s %6zu %14lld %12.1f %12.0f\n", path, partition.lists[l].size(), entries, bytes / 1048576., partition.costs[l]);
+    }
+
+    double mean = 0;
+    for (double cost : partition.costs)
+        mean += cost / nlists;
+    cout << "\n========================================" << endl;
+    cout << "Files:                   " << files.size() << " (" << total_entries << " entries)" << endl;
+    cout << "Lists:                   " << nlists << endl;
+    printf("Longest list:            %.0f %s (mean %.0f, %.2fx)\n", partition.longest, unit, mean, mean > 0 ? partition.longest / mean : 1.);
+    printf("Longest, split by count: %.0f %s\n", LongestByCount(files, nlists), unit);
+    cout << "========================================" << endl;
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#!/bin/bash
+## Usage:
+#   ./check_append.sh <BASELINE_REV> [ENTRIES] [SHARDS]
+#
+## Example:
+#   ./check_append.sh e36bf87 1000000 3
+#
+## Arguments:
+#   BASELINE_REV: git revision to compare with, whose steps copy the whole tree with CloneTree(0) and Fill
+#   ENTRIES: size of the synthetic sel tree (default 1000000)
+#   SHARDS: number of shards of the range path (default 2)
+#   WORKDIR: where the trees and the baseline checkout are written (default $TMPDIR)
+#
+# Checks the outputs of the steps that append columns to a copy of their
+# input (common/include/AppendColumns.h) on a generated sel tree
+# (benchmark/bin/GenerateSel), event by event and branch by branch with
+# bin/CompareSel:
+#   copy of the whole tree   CorrectTree and add_SWIM_Branches against BASELINE_REV,
+#                            built in a git worktree (OscillationWeights of the
+#                            baseline cannot read the generated flux tables)
+#   range of entries         CorrectTree, OscillationWeights and add_SWIM_Branches
+#                            run with --shard k/SHARDS, merged with MergeSel, against
+#                            the output of the whole tree
+# CompareSel also reports when the branches are not in the same order.
+# Against a baseline from before CorrectTree bound the bbfit_shower angle and
+# hit columns to their own variables, those columns and the bbfit ones differ.
+# Build first: make all in benchmark/ and pipeline/, and make in corrections/,
+# oscillation_weights/, add_SWIM_Branches/ and merge/.
+
+BASELINE_REV=${1}
+ENTRIES=${2:-1000000}
+SHARDS=${3:-2}
+BASE=$(cd $(dirname $0)/.. && pwd)
+WORKDIR=${WORKDIR:-${TMPDIR:-/tmp}}/check_append_$$
+COMPARE=${BASE}/pipeline/bin/CompareSel
+
+for exe in benchmark/bin/GenerateSel pipeline/bin/CompareSel corrections/bin/CorrectTree \
+           oscillation_weights/bin/OscillationWeights add_SWIM_Branches/bin/main merge/bin/MergeSel; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 <BASELINE_REV> [ENTRIES] [SHARDS] (build ${exe} with make first)"
+        exit 1
+    fi
+done
+if [ -z "${BASELINE_REV}" ] || ! git -C ${BASE} rev-parse --verify -q ${BASELINE_REV} > /dev/null; then
+    echo "Usage: $0 <BASELINE_REV> [ENTRIES] [SHARDS]"
+    exit 1
+fi
+mkdir -p ${WORKDIR}
+
+# Baseline executables
+BASELINE=${WORKDIR}/baseline
+git -C ${BASE} worktree add --detach ${BASELINE} ${BASELINE_REV} > ${WORKDIR}/worktree.log 2>&1
+for dir in corrections add_SWIM_Branches; do
+    if ! make -C ${BASELINE}/${dir} > ${WORKDIR}/make_${dir}.log 2>&1; then
+        echo "Cannot build ${dir} of ${BASELINE_REV}, see ${WORKDIR}/make_${dir}.log"
+        exit 1
+    fi
+done
+
+# step <name> <command...>: run a step, stop on failure
+step() {
+    local name=$1
+    shift
+    if ! "$@" > ${WORKDIR}/${name}.log 2>&1; then
+        echo "${name} failed, see ${WORKDIR}/${name}.log"
+        exit 1
+    fi
+}
+
+# compare <name> <reference> <output>: CompareSel, with its summary
+failed=0
+compare() {
+    local log=${WORKDIR}/compare_$1.log
+    if ${COMPARE} $2 $3 > ${log} 2>&1; then
+        printf "  %-36s same events and values\n" "$1"
+    else
+        printf "  %-36s differs, see %s\n" "$1" ${log}
+        failed=1
+    fi
+    grep -h "^Only in\|^Differs\|different order" ${log} | sed 's/^/    /'
+}
+
+step GenerateSel ${BASE}/benchmark/bin/GenerateSel ${WORKDIR}/sel.root --entries ${ENTRIES} --flux ${WORKDIR}/flux.root
+
+echo "Copy of the whole tree, against ${BASELINE_REV}"
+step CorrectTree ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected.root 0
+step CorrectTree_baseline ${BASELINE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_baseline.root 0
+compare CorrectTree ${WORKDIR}/corrected_baseline.root ${WORKDIR}/corrected.root
+compare CorrectTree_weighted ${WORKDIR}/corrected_baseline_weighted.root ${WORKDIR}/corrected_weighted.root
+step OscillationWeights ${BASE}/oscillation_weights/bin/OscillationWeights ${WORKDIR}/corrected_weighted.root \
+    ${WORKDIR}/oscillated.root woody --flux ${WORKDIR}/flux.root
+step add_SWIM_Branches ${BASE}/add_SWIM_Branches/bin/main ${WORKDIR}/oscillated.root ${WORKDIR}/swim.root
+step add_SWIM_Branches_baseline ${BASELINE}/add_SWIM_Branches/bin/main ${WORKDIR}/oscillated.root ${WORKDIR}/swim_baseline.root
+compare add_SWIM_Branches ${WORKDIR}/swim_baseline.root ${WORKDIR}/swim.root
+
+echo "Range of entries, ${SHARDS} shards merged, against the whole tree"
+corrected="" weighted="" oscillated="" swim=""
+for ((k = 0; k < SHARDS; k++)); do
+    shard="--shard ${k}/${SHARDS}"
+    step CorrectTree_${k} ${BASE}/corrections/bin/CorrectTree ${WORKDIR}/sel.root sel ${WORKDIR}/corrected_${k}.root 0 ${shard}
+    step OscillationWeights_${k} ${BASE}/oscillation_weights/bin/OscillationWeights ${WORKDIR}/corrected_weighted.root \
+        ${WORKDIR}/oscillated_${k}.root woody --flux ${WORKDIR}/flux.root ${shard}
+    step add_SWIM_Branches_${k} ${BASE}/add_SWIM_Branches/bin/main ${WORKDIR}/oscillated.root ${WORKDIR}/swim_${k}.root ${shard}
+    corrected+=" ${WORKDIR}/corrected_${k}.root"
+    weighted+=" ${WORKDIR}/corrected_${k}_weighted.root"
+    oscillated+=" ${WORKDIR}/oscillated_${k}.root"
+    swim+=" ${WORKDIR}/swim_${k}.root"
+done
+step MergeSel_corrected ${BASE}/merge/bin/MergeSel ${WORKDIR}/corrected_shards.root ${corrected}
+step MergeSel_weighted ${BASE}/merge/bin/MergeSel ${WORKDIR}/corrected_shards_weighted.root ${weighted}
+step MergeSel_oscillated ${BASE}/merge/bin/MergeSel ${WORKDIR}/oscillated_shards.root ${oscillated}
+step MergeSel_swim ${BASE}/merge/bin/MergeSel ${WORKDIR}/swim_shards.root ${swim}
+compare CorrectTree_shards ${WORKDIR}/corrected.root ${WORKDIR}/corrected_shards.root
+compare CorrectTree_weighted_shards ${WORKDIR}/corrected_weighted.root ${WORKDIR}/corrected_shards_weighted.root
+compare OscillationWeights_shards ${WORKDIR}/oscillated.root ${WORKDIR}/oscillated_shards.root
+compare add_SWIM_Branches_shards ${WORKDIR}/swim.root ${WORKDIR}/swim_shards.root
+
+git -C ${BASE} worktree remove --force ${BASELINE}
+echo "Outputs and logs in ${WORKDIR}"
+exit ${failed}
@@ -0,0 +1,259 @@
+/**
+ * @brief Compare two sel trees event by event, matching the events by key.
+ * The entries of both trees are sorted by the event key (run_id,
+ * frame_index, event_counter_trigger, EventKey.h) and paired in key order,
+ * so a tree written in another entry order, such as the output of an
+ * RDataFrame path with several threads, compares equal to the event loop.
+ * Events whose key is in only one tree are counted, not compared.
+ *
+ * Every branch of both trees with one numeric value per entry is read as a
+ * double and compared over the paired events. Two NaN are equal; two values
+ * differ when |a - b| > tolerance * max(1, |a|). The branches of only one of
+ * the trees, those with arrays and those given to --ignore are listed and
+ * skipped. Each compared branch is read in a pass of its own over the tree.
+ * A different order of the branches of both trees is reported, not counted
+ * as a difference.
+ *
+ * The exit code is 0 when both trees have the same keys and every compared
+ * branch matches, else 1.
+ *
+ * Usage: CompareSel <reference rootfile> <rootfile> [--tree sel] [--tolerance 1e-9] [--ignore <branch,...>]
+ */
+
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EventKey.h"
+#include "StageOptions.h"
+
+using namespace std;
+
+struct SelFile
+{
+    string path;
+    TFile *file;
+    TTree *tree;
+    // entries in key order
+    vector<Long64_t> order;
+    vector<EventKey> keys;
+};
+
+// Open path and find tree_name in it, or exit
+void OpenSel(SelFile &sel, const string &path, const string &tree_name)
+{
+    sel.path = path;
+    sel.file = TFile::Open(path.c_str(), "READ");
+    if (!sel.file || sel.file->IsZombie())
+    {
+        cerr << "Error: file " << path << " not found" << endl;
+        exit(1);
+    }
+    sel.tree = dynamic_cast<TTree *>(sel.file->Get(tree_name.c_str()));
+    if (!sel.tree)
+    {
+        cerr << "Error: tree " << tree_name << " not found in " << path << endl;
+        exit(1);
+    }
+}
+
+// The branch holds one value per entry, of a numeric type
+bool IsScalar(TTree *tree, const string &name)
+{
+    TLeaf *leaf = tree->GetLeaf(name.c_str());
+    if (!leaf || leaf->GetLeafCount() || leaf->GetLenStatic() != 1)
+        return false;
+    string type = leaf->GetTypeName();
+    return type != "char" && type != "Char_t" && type != "TString" && type != "string";
+}
+
+// Values of one branch, in entry order, reading that branch only
+vector<double> ReadColumn(TTree *tree, const string &name)
+{
+    tree->SetBranchStatus("*", 0);
+    tree->SetBranchStatus(name.c_str(), 1);
+    TLeaf *leaf = tree->GetLeaf(name.c_str());
+    vector<double> values(tree->GetEntries());
+    for (Long64_t e = 0; e < tree->GetEntries(); e++)
+    {
+        tree->GetEntry(e);
+        values[e] = leaf->GetValue(0);
+    }
+    return values;
+}
+
+// Keys of the entries and the entries in key order; equal keys keep the entry order
+void SortByKey(SelFile &sel)
+{
+    vector<double> columns[3];
+    for (int k = 0; k < 3; k++)
+    {
+        if (!IsScalar(sel.tree, kEventKeyBranches[k]))
+        {
+            cerr << "Error: " << sel.path << " has no key branch " << kEventKeyBranches[k] << endl;
+            exit(1);
+        }
+        columns[k] = ReadColumn(sel.tree, kEventKeyBranches[k]);
+    }
+    Long64_t n = sel.tree->GetEntries();
+    sel.keys.resize(n);
+    sel.order.resize(n);
+    for (Long64_t e = 0; e < n; e++)
+    {
+        sel.keys[e] = {(int64_t)columns[0][e], (int64_t)columns[1][e], (int64_t)columns[2][e]};
+        sel.order[e] = e;
+    }
+    const vector<EventKey> &keys = sel.keys;
+    stable_sort(sel.order.begin(), sel.order.end(), [&keys](Long64_t a, Long64_t b) { return keys[a] < keys[b]; });
+}
+
+// Number of entries whose key repeats that of the entry before, in key order
+Long64_t CountRepeatedKeys(const SelFile &sel)
+{
+    Long64_t n = 0;
+    for (size_t i = 1; i < sel.order.size(); i++)
+        n += sel.keys[sel.order[i]] == sel.keys[sel.order[i - 1]];
+    return n;
+}
+
+vector<string> BranchNames(TTree *tree)
+{
+    vector<string> names;
+    TObjArray *branches = tree->GetListOfBranches();
+    for (Int_t b = 0; b < branches->GetEntriesFast(); b++)
+        names.push_back(branches->At(b)->GetName());
+    return names;
+}
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <reference rootfile> <rootfile> [--tree sel] [--tolerance 1e-9] [--ignore <branch,...>]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"tree", "tolerance", "ignore"});
+    const vector<string> &args = options.Positional();
+    if (args.size() != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    string tree_name = options.Get("tree", "sel");
+    double tolerance = atof(options.Get("tolerance", "1e-9").c_str());
+    set<string> ignore;
+    string list = options.Get("ignore") + ",";
+    for (size_t start = 0, end; (end = list.find(',', start)) != string::npos; start = end + 1)
+        if (end > start)
+            ignore.insert(list.substr(start, end - start));
+
+    SelFile reference, other;
+    OpenSel(reference, args[0], tree_name);
+    OpenSel(other, args[1], tree_name);
+    SortByKey(reference);
+    SortByKey(other);
+
+    // pair the entries of equal keys, in key order
+    vector<pair<Long64_t, Long64_t>> pairs;
+    Long64_t only_reference = 0, only_other = 0;
+    size_t i = 0, j = 0;
+    while (i < reference.order.size() || j < other.order.size())
+    {
+        if (j == other.order.size() || (i < reference.order.size() && reference.keys[reference.order[i]] < other.keys[other.order[j]]))
+        {
+            only_reference++;
+            i++;
+        }
+        else if (i == reference.order.size() || other.keys[other.order[j]] < reference.keys[reference.order[i]])
+        {
+            only_other++;
+            j++;
+        }
+        else
+        {
+            pairs.push_back(make_pair(reference.order[i], other.order[j]));
+            i++;
+            j++;
+        }
+    }
+
+    cout << "Reference: " << reference.path << " (" << reference.order.size() << " entries)" << endl;
+    cout << "Compared:  " << other.path << " (" << other.order.size() << " entries)" << endl;
+    cout << "Events in both: " << pairs.size() << ", only in the reference: " << only_reference
+         << ", only in the other: " << only_other << endl;
+    Long64_t repeated = CountRepeatedKeys(reference) + CountRepeatedKeys(other);
+    if (repeated > 0)
+        cout << "Warning: " << repeated << " entries repeat a key, they are paired in entry order" << endl;
+
+    // branches of both trees, in the order of the reference
+    vector<string> names = BranchNames(reference.tree), other_names = BranchNames(other.tree);
+    set<string> in_other(other_names.begin(), other_names.end()), in_reference(names.begin(), names.end());
+    for (const string &name : names)
+        if (!in_other.count(name))
+            cout << "Only in the reference: " << name << endl;
+    for (const string &name : other_names)
+        if (!in_reference.count(name))
+            cout << "Only in the other:     " << name << endl;
+    vector<string> common, other_common;
+    for (const string &name : names)
+        if (in_other.count(name))
+            common.push_back(name);
+    for (const string &name : other_names)
+        if (in_reference.count(name))
+            other_common.push_back(name);
+    if (common != other_common)
+        cout << "The branches of both trees are in a different order" << endl;
+
+    int compared = 0, differing = 0;
+    for (const string &name : names)
+    {
+        if (!in_other.count(name) || ignore.count(name))
+            continue;
+        if (!IsScalar(reference.tree, name) || !IsScalar(other.tree, name))
+        {
+            cout << "Not compared (not a scalar): " << name << endl;
+            continue;
+        }
+        vector<double> a = ReadColumn(reference.tree, name), b = ReadColumn(other.tree, name);
+        Long64_t ndiff = 0;
+        double max_diff = 0;
+        for (const pair<Long64_t, Long64_t> &p : pairs)
+        {
+            double x = a[p.first], y = b[p.second];
+            if (std::isnan(x) && std::isnan(y))
+                continue;
+            double diff = fabs(x - y);
+            if (std::isnan(x) != std::isnan(y) || diff > tolerance * max(1., fabs(x)))
+            {
+                ndiff++;
+                if (!std::isnan(diff))
+                    max_diff = max(max_diff, diff);
+            }
+        }
+        compared++;
+        if (ndiff > 0)
+        {
+            differing++;
+            cout << "Differs: " << name << ": " << ndiff << " events, largest difference " << max_diff << endl;
+        }
+    }
+
+    cout << "\n========================================" << endl;
+    cout << "Branches compared:  " << compared << endl;
+    cout << "Branches differing: " << differing << endl;
+    cout << "========================================" << endl;
+
+    reference.file->Close();
+    other.file->Close();
+    return differing == 0 && only_reference == 0 && only_other == 0 ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#!/bin/bash
+## Usage:
+#   ./compare_chain.sh <INPUT_FILE> <CUT> <CLUSTER> <NNFIT_HDF5...>
+#
+## Example:
+#   ./compare_chain.sh mc/anue_a_CC_1234.root nnfit_hard_cuts woody nnfit/anue_a_CC_1234.hdf5
+#
+## Arguments:
+#   INPUT_FILE: extracted sel file (output of extract_dst)
+#   CUT: muon_free, nnfit_loose_cuts or nnfit_hard_cuts
+#   CLUSTER: woody or in2p3, selects the flux tables
+#   NNFIT_HDF5: NNFit reconstructions of the file
+#
+# Runs the separate executables one after the other, with a ROOT file between
+# each step, then bin/RunPipeline on the same input. Prints the wall time and
+# the bytes written of both, then compares their outputs event by event with
+# bin/CompareSel (make all), which matches the events by key. Outputs go to
+# $TMPDIR.
+
+INPUT_FILE=${1}
+CUT=${2}
+CLUSTER=${3}
+shift 3
+NNFIT_FILES="$@"
+BASE=$(cd $(dirname $0)/.. && pwd)
+OUTDIR=${TMPDIR:-/tmp}/compare_chain_$$
+
+for exe in corrections/bin/CorrectTree oscillation_weights/bin/OscillationWeights add_NNFit/bin/MergeNNFit \
+           add_SWIM_Branches/bin/main apply_cuts/bin/CutSelection pipeline/bin/RunPipeline pipeline/bin/CompareSel; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 <INPUT_FILE> <CUT> <CLUSTER> <NNFIT_HDF5...> (build ${exe} with make first)"
+        exit 1
+    fi
+done
+if [ ! -f "${INPUT_FILE}" ] || [ -z "${NNFIT_FILES}" ]; then
+    echo "Usage: $0 <INPUT_FILE> <CUT> <CLUSTER> <NNFIT_HDF5...>"
+    exit 1
+fi
+mkdir -p ${OUTDIR}
+
+# step <name> <command...>: time the command, logging its output
+total=0
+results=""
+step() {
+    local name=$1
+    shift
+    local start=$(date +%s.%N)
+    "$@" > ${OUTDIR}/${name}.log 2>&1 || echo "${name} failed, see ${OUTDIR}/${name}.log"
+    local end=$(date +%s.%N)
+    local seconds=$(echo "${end} - ${start}" | bc)
+    total=$(echo "${total} + ${seconds}" | bc)
+    results+=$(printf "  %-22s %10.1f s" "${name}" ${seconds})"\n"
+}
+
+# bytes <files...>: total size of the files
+bytes() {
+    stat -c %s "$@" | awk '{ s += $1 } END { print s }'
+}
+
+entries() {
+    root -l -b -q -e "TFile f(\"$1\"); cout << ((TTree*)f.Get(\"sel\"))->GetEntries() << endl;" 2>/dev/null | tail -1
+}
+
+echo "Input: ${INPUT_FILE} ($(du -m ${INPUT_FILE} | cut -f1) MB)"
+
+# Separate executables, as run by the job scripts
+step CorrectTree ${BASE}/corrections/bin/CorrectTree ${INPUT_FILE} sel ${OUTDIR}/corrected.root 0
+step OscillationWeights ${BASE}/oscillation_weights/bin/OscillationWeights ${OUTDIR}/corrected_weighted.root ${OUTDIR}/oscillated.root ${CLUSTER}
+step MergeNNFit ${BASE}/add_NNFit/bin/MergeNNFit ${OUTDIR}/oscillated.root ${OUTDIR}/nnfit.root ${NNFIT_FILES}
+step add_SWIM_Branches ${BASE}/add_SWIM_Branches/bin/main ${OUTDIR}/nnfit.root ${OUTDIR}/swim.root
+step CutSelection ${BASE}/apply_cuts/bin/CutSelection ${OUTDIR}/swim.root ${OUTDIR}/chain.root ${CUT}
+chain_time=${total}
+chain_bytes=$(bytes ${OUTDIR}/corrected.root ${OUTDIR}/corrected_weighted.root ${OUTDIR}/oscillated.root \
+                    ${OUTDIR}/nnfit.root ${OUTDIR}/swim.root ${OUTDIR}/chain.root)
+
+# One process
+total=0
+step RunPipeline ${BASE}/pipeline/bin/RunPipeline ${INPUT_FILE} ${OUTDIR}/pipeline.root ${CUT} ${NNFIT_FILES} --cluster ${CLUSTER}
+pipeline_time=${total}
+pipeline_bytes=$(bytes ${OUTDIR}/pipeline.root)
+
+echo
+echo -e "${results}"
+printf "%-24s %10.1f s %12d MB written %12s entries\n" "Separate executables" ${chain_time} $((chain_bytes >> 20)) $(entries ${OUTDIR}/chain.root)
+printf "%-24s %10.1f s %12d MB written %12s entries\n" "RunPipeline" ${pipeline_time} $((pipeline_bytes >> 20)) $(entries ${OUTDIR}/pipeline.root)
+echo
+${BASE}/pipeline/bin/CompareSel ${OUTDIR}/chain.root ${OUTDIR}/pipeline.root
+echo "Outputs and logs in ${OUTDIR}"
@@ -0,0 +1,95 @@
+#!/bin/bash
+## Usage:
+#   ./scale_rdf.sh <MERGED_SEL> <MERGED_NNFIT> <CUT>
+#
+## Example:
+#   THREADS="1 2 4 8 16" ./scale_rdf.sh merged/sel_2015.root merged/nnfit_2015.root nnfit_hard_cuts
+#
+## Arguments:
+#   MERGED_SEL: merged extracted sel file (input of CorrectTree)
+#   MERGED_NNFIT: merged file with the NNFit columns (input of add_SWIM_Branches)
+#   CUT: muon_free, nnfit_loose_cuts or nnfit_hard_cuts
+#   THREADS: thread counts of the RDataFrame runs (default "1 2 4 8")
+#
+# Runs CorrectTree, add_SWIM_Branches and CutSelection with their event loop,
+# then with --rdf for each thread count, and prints the wall time, the speed-up
+# over the event loop and the entries written. CutSelection reads the SWIM
+# output of the event loop. With more than one thread the RDataFrame outputs
+# are not in input order, so each is compared with the output of the event
+# loop by event key (pipeline/bin/CompareSel, make all). Outputs go to $TMPDIR.
+
+MERGED_SEL=${1}
+MERGED_NNFIT=${2}
+CUT=${3}
+THREADS=${THREADS:-"1 2 4 8"}
+BASE=$(cd $(dirname $0)/.. && pwd)
+OUTDIR=${TMPDIR:-/tmp}/scale_rdf_$$
+
+for exe in corrections/bin/CorrectTree add_SWIM_Branches/bin/main apply_cuts/bin/CutSelection pipeline/bin/CompareSel; do
+    if [ ! -x "${BASE}/${exe}" ]; then
+        echo "Usage: $0 <MERGED_SEL> <MERGED_NNFIT> <CUT> (build ${exe} with make first)"
+        exit 1
+    fi
+done
+if [ ! -f "${MERGED_SEL}" ] || [ ! -f "${MERGED_NNFIT}" ] || [ -z "${CUT}" ]; then
+    echo "Usage: $0 <MERGED_SEL> <MERGED_NNFIT> <CUT>"
+    exit 1
+fi
+mkdir -p ${OUTDIR}
+
+# run <name> <output> <command...>: time the command and print a line of the table
+reference=0
+run() {
+    local name=$1
+    local output=$2
+    shift 2
+    local start=$(date +%s.%N)
+    "$@" > ${OUTDIR}/${name}.log 2>&1 || echo "${name} failed, see ${OUTDIR}/${name}.log"
+    local end=$(date +%s.%N)
+    local seconds=$(echo "${end} - ${start}" | bc)
+    if [ "${reference}" == "0" ]; then reference=${seconds}; fi
+    printf "  %-28s %10.1f s %8.2fx %12s entries\n" "${name}" ${seconds} $(echo "${reference} / ${seconds}" | bc -l) $(entries ${output})
+}
+
+# compare <reference> <output>: same events and values as the event loop, matched by key
+compare() {
+    local log=${OUTDIR}/compare_$(basename $2 .root).log
+    if ${BASE}/pipeline/bin/CompareSel $1 $2 > ${log} 2>&1; then
+        echo "    same events and values as the event loop"
+    else
+        echo "    differs from the event loop, see ${log}"
+    fi
+}
+
+entries() {
+    root -l -b -q -e "TFile f(\"$1\"); cout << ((TTree*)f.Get(\"sel\"))->GetEntries() << endl;" 2>/dev/null | tail -1
+}
+
+echo "CorrectTree: ${MERGED_SEL} ($(du -m ${MERGED_SEL} | cut -f1) MB)"
+reference=0
+run CorrectTree ${OUTDIR}/corrected_weighted.root ${BASE}/corrections/bin/CorrectTree ${MERGED_SEL} sel ${OUTDIR}/corrected.root 0
+for n in ${THREADS}; do
+    run CorrectTree_rdf_${n} ${OUTDIR}/corrected_rdf_${n}_weighted.root \
+        ${BASE}/corrections/bin/CorrectTree ${MERGED_SEL} sel ${OUTDIR}/corrected_rdf_${n}.root 0 --rdf --threads ${n}
+    compare ${OUTDIR}/corrected_weighted.root ${OUTDIR}/corrected_rdf_${n}_weighted.root
+done
+
+echo "add_SWIM_Branches: ${MERGED_NNFIT} ($(du -m ${MERGED_NNFIT} | cut -f1) MB)"
+reference=0
+run add_SWIM_Branches ${OUTDIR}/swim.root ${BASE}/add_SWIM_Branches/bin/main ${MERGED_NNFIT} ${OUTDIR}/swim.root
+for n in ${THREADS}; do
+    run add_SWIM_Branches_rdf_${n} ${OUTDIR}/swim_rdf_${n}.root \
+        ${BASE}/add_SWIM_Branches/bin/main ${MERGED_NNFIT} ${OUTDIR}/swim_rdf_${n}.root --rdf --threads ${n}
+    compare ${OUTDIR}/swim.root ${OUTDIR}/swim_rdf_${n}.root
+done
+
+echo "CutSelection ${CUT}: ${OUTDIR}/swim.root"
+reference=0
+run CutSelection ${OUTDIR}/cut.root ${BASE}/apply_cuts/bin/CutSelection ${OUTDIR}/swim.root ${OUTDIR}/cut.root ${CUT}
+for n in ${THREADS}; do
+    run CutSelection_rdf_${n} ${OUTDIR}/cut_rdf_${n}.root \
+        ${BASE}/apply_cuts/bin/CutSelection ${OUTDIR}/swim.root ${OUTDIR}/cut_rdf_${n}.root ${CUT} --rdf --threads ${n}
+    compare ${OUTDIR}/cut.root ${OUTDIR}/cut_rdf_${n}.root
+done
+
+echo "Outputs and logs in ${OUTDIR}"
@@ -0,0 +1,590 @@
+/**
+ * @brief Run the per-file steps of the pipeline in one process, without intermediate ROOT files.
+ * The steps that otherwise each read and write the full sel tree are chained
+ * in memory, one block of entries at a time:
+ *
+ *   CorrectTree         NaN for the reconstructions whose flag is false, weight correction
+ *                       (from the strategy trees of a sparse input, SparseReco.h)
+ *   OscillationWeights  w_osc, prob_nue, prob_numu
+ *   MergeNNFit          NNFit columns, joined by event key (NNFitJoin.h)
+ *   add_SWIM_Branches   NNFit energies and cos zenith, true copies, CanDimensions
+ *   CutSelection        cut selection
+ *
+ * The cut needs the NNFit cos zenith of the SWIM step, so the derived columns
+ * are computed before it. The cut is decided first from a few columns, as in
+ * CutSelection; only the selected entries are then read in full, corrected,
+ * weighted and written to the final, SWIM-ready tree.
+ *
+ * For debugging, the --tap-* options write the tree as it is after a step,
+ * before the cut. The taps hold every entry, which are then all read in full.
+ *
+ * With --entries or --shard, only those entries are processed and written;
+ * the NNFit join still reads the keys of the whole tree.
+ *
+ * Usage: RunPipeline <input rootfile> <output rootfile> <cut_selection> <nnfit hdf5> [<nnfit hdf5> ...]
+ *        [--cluster woody|in2p3 | --flux <root file>] [--weighted] [--key <hdf5 group>] [--tree sel]
+ *        [--mem-mb 1024] [--tmpdir <dir>] [--trace out.json] [--metrics <file> [--metrics-interval 10]]
+ *        [--mem-budget <MB>] [--codec-plan <file>] [--entries first:last | --shard k/N] [--cache]
+ *        [--read-cache <MB|off>] [--prefetch] [--async-write [--write-queue <MB>]]
+ *        [--tap-corrected <rootfile>] [--tap-oscillated <rootfile>] [--tap-nnfit <rootfile>] [--tap-swim <rootfile>]
+ */
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TH2D.h>
+#include <TLeaf.h>
+#include <TMath.h>
+#include <TStopwatch.h>
+#include <TTree.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "addCanANTARES.h"
+#include "AlignedVector.h"
+#include "AsyncTreeWriter.h"
+#include "ColumnReader.h"
+#include "Corrections.h"
+#include "CutKernels.h"
+#include "MathKernels.h"
+#include "NNFitJoin.h"
+#include "OscillationKernels.h"
+#include "SelMetadata.h"
+#include "SparseReco.h"
+#include "StageContext.h"
+#include "Trace.h"
+
+using namespace std;
+
+// Number of entries processed per batch
+const Long64_t kBlockSize = 4096;
+
+// Step after which a column exists, in the order of the separate executables
+enum EStep
+{
+    kCorrected,
+    kOscillated,
+    kNNFit,
+    kSwim
+};
+
+// Column added to the input tree
+struct NewColumn
+{
+    EStep step;
+    string name;
+    void *address;
+    string leaflist;
+};
+
+// Tree with all entries written after a step
+struct Tap
+{
+    string option, path;
+    EStep step;
+    TFile *file;
+    TTree *tree;
+    AsyncTreeWriter *writer;
+};
+
+// Bind a branch of the input to address, checking its type. The clones of the tree share the address.
+template <typename T>
+void Bind(TTree *tree, const char *name, T *address)
+{
+    TBranch *branch = tree->GetBranch(name);
+    if (!branch)
+    {
+        cerr << "Error: branch " << name << " not found" << endl;
+        exit(1);
+    }
+    TLeaf *leaf = (TLeaf *)branch->GetListOfLeaves()->At(0);
+    if (!leaf || string(leaf->GetTypeName()) != RootTypeName<T>())
+    {
+        cerr << "Error: branch " << name << " has type " << (leaf ? leaf->GetTypeName() : "unknown")
+             << ", expected " << RootTypeName<T>() << endl;
+        exit(1);
+    }
+    tree->SetBranchAddress(name, address);
+}
+
+// Position of an NNFit column; float_only as the steps that read it as Float_t
+int FindNNFitColumn(const NNFitJoin &join, const string &name, bool float_only)
+{
+    int c = join.Find(name);
+    if (c < 0)
+    {
+        cerr << "Error: the NNFit files have no column " << name << endl;
+        exit(1);
+    }
+    if (float_only && !join.IsFloat()[c])
+    {
+        cerr << "Error: NNFit column " << name << " is not float32" << endl;
+        exit(1);
+    }
+    return c;
+}
+
+Long64_t FileSize(const string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? (Long64_t)info.st_size : 0;
+}
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <input rootfile> <output rootfile> <cut_selection> <nnfit hdf5> [<nnfit hdf5> ...]"
+         << " [--cluster woody|in2p3 | --flux <root file>] [--weighted] [--key <hdf5 group>] [--tree sel]"
+         << " [--mem-mb 1024] [--tmpdir <dir>] [--trace out.json] [--metrics <file> [--metrics-interval 10]]"
+         << " [--mem-budget <MB>] [--codec-plan <file>] [--entries first:last | --shard k/N] [--cache]"
+         << " [--read-cache <MB|off>] [--prefetch] [--async-write [--write-queue <MB>]]"
+         << " [--tap-corrected <rootfile>] [--tap-oscillated <rootfile>] [--tap-nnfit <rootfile>] [--tap-swim <rootfile>]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options = ParseStageOptions(argc, argv, {"cluster", "flux", "key", "tree", "mem-mb", "tmpdir",
+                                                          "tap-corrected", "tap-oscillated", "tap-nnfit", "tap-swim"});
+    const vector<string> &args = options.Positional();
+    if (args.size() < 4 || (!options.Has("cluster") && !options.Has("flux")))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string input_file = args[0];
+    string output_file = args[1];
+    ECutSelection cut = ParseCutSelection(args[2]);
+    vector<string> nnfit_files(args.begin() + 3, args.end());
+    string flux_file = options.Has("flux") ? options.Get("flux") : FluxModelFile(options.Get("cluster"));
+    // the input already has the corrected weights (CorrectTree with is_weighted = 1)
+    bool weighted = options.Has("weighted");
+    string tree_name = options.Get("tree", "sel");
+
+    vector<Tap> taps;
+    const Tap tap_options[] = {{"tap-corrected", "", kCorrected, NULL, NULL, NULL},
+                               {"tap-oscillated", "", kOscillated, NULL, NULL, NULL},
+                               {"tap-nnfit", "", kNNFit, NULL, NULL, NULL},
+                               {"tap-swim", "", kSwim, NULL, NULL, NULL}};
+    for (const Tap &option : tap_options)
+    {
+        if (!options.Has(option.option))
+            continue;
+        taps.push_back(option);
+        taps.back().path = options.Get(option.option);
+    }
+    // without taps only the selected entries are read in full
+    bool read_all = !taps.empty();
+
+    // --cache, --trace, --metrics, --mem-budget, --codec-plan, --entries, --shard, --read-cache (StageContext.h)
+    StageContext stage("RunPipeline", output_file, options);
+    stage.cache.Input(input_file);
+    for (const string &nnfit_file : nnfit_files)
+        stage.cache.Input(nnfit_file);
+    stage.cache.Input(flux_file);
+    stage.cache.Output(output_file);
+    for (const Tap &tap : taps)
+        stage.cache.Output(tap.path);
+    if (!stage.Start())
+        return 0;
+
+    // shared by the three sorters; half of what --mem-budget leaves if --mem-mb is not given
+    size_t budget = (size_t)atol(options.Get("mem-mb", "1024").c_str()) << 20;
+    if (stage.memory.Enabled() && !options.Has("mem-mb"))
+        budget = max(stage.memory.TreeBytes() / 2, 64LL << 20);
+    stage.memory.Reserve("NNFit sort buffers", budget);
+
+    TStopwatch timer;
+
+    //===========================================================
+    // Input tree and NNFit reconstructions
+    //===========================================================
+    TFile *infile = TFile::Open(input_file.c_str(), "READ");
+    if (!infile || infile->IsZombie())
+    {
+        cerr << "Error: file " << input_file << " not found" << endl;
+        return 1;
+    }
+    TTree *tree = dynamic_cast<TTree *>(infile->Get(tree_name.c_str()));
+    if (!tree)
+    {
+        cerr << "Error: tree " << tree_name << " not found" << endl;
+        return 1;
+    }
+    Long64_t nentries = tree->GetEntries();
+    stage.range.Resolve(tree);
+    Long64_t ntot = stage.range.Entries();
+
+    NNFitJoin join(nnfit_files, options.Get("key"), budget, options.Get("tmpdir"));
+    size_t ncols = join.NColumns();
+    int c_shower_theta = FindNNFitColumn(join, "NNFitShower_Theta", true);
+    int c_track_theta = FindNNFitColumn(join, "NNFitTrack_Theta", true);
+    int c_shower_logE = FindNNFitColumn(join, "NNFitShower_Log10Energy", true);
+    int c_track_logE = FindNNFitColumn(join, "NNFitTrack_Log10Energy", true);
+    int c_sigma[4] = {-1, -1, -1, -1};
+    if (cut == kNNFitHardCuts)
+    {
+        c_sigma[0] = FindNNFitColumn(join, "NNFitTrack_SigmaZClosest", true);
+        c_sigma[1] = FindNNFitColumn(join, "NNFitTrack_SigmaRClosest", true);
+        c_sigma[2] = FindNNFitColumn(join, "NNFitShower_SigmaZVertex", true);
+        c_sigma[3] = FindNNFitColumn(join, "NNFitShower_SigmaRVertex", true);
+    }
+
+    tree->SetBranchStatus("*", 0);
+    join.Start(infile, tree);
+    tree->SetBranchStatus("*", 1);
+
+    //===========================================================
+    // Input columns, bound before the output trees are cloned so that they share them
+    //===========================================================
+    // CorrectTree: reconstruction columns masked by their flag, or read as NaN where absent from a sparse input
+    SparseRecoReader sparse(tree);
+    const vector<RecoStrategy> &strategies = RecoStrategies();
+    unique_ptr<bool[]> flags(new bool[strategies.size()]);
+    size_t nmasked = 0;
+    for (const RecoStrategy &strategy : strategies)
+        nmasked += strategy.columns.size();
+    vector<double> masked(nmasked);
+    for (size_t s = 0, k = 0; s < strategies.size(); s++)
+    {
+        Bind(tree, strategies[s].flag, &flags[s]);
+        for (const char *column : strategies[s].columns)
+            if (!sparse.Enabled())
+                Bind(tree, column, &masked[k++]);
+    }
+
+    // CorrectTree and OscillationWeights: weights, corrected in place
+    EventWeights w;
+    Bind(tree, "w2", &w.w2);
+    Bind(tree, "w3", &w.w3);
+    Bind(tree, "w_honda", &w.w_honda);
+    Bind(tree, "w_muon", &w.w_muon);
+    Bind(tree, "ngen", &w.ngen);
+    Bind(tree, "RunDurationYear", &w.run_duration);
+    Bind(tree, "Date", &w.date);
+    Bind(tree, "DataMCRatio", &w.DataMCRatio);
+    Bind(tree, "run_id", &w.run_id);
+    if (weighted)
+        Bind(tree, "w_non_osc", &w.w_non_osc);
+
+    // Columns of the cut, the flux and the SWIM copies, read for a whole block
+    Column<int> type(tree, "type");
+    Column<int> interaction_type(tree, "interaction_type");
+    Column<double> energy_true(tree, "energy_true");
+    Column<double> cos_zenith_true(tree, "cos_zenith_true");
+
+    //===========================================================
+    // New columns
+    //===========================================================
+    double w_osc, prob_nue, prob_numu;
+    vector<double> dvalues(ncols);
+    vector<float> fvalues(ncols);
+    Double_t energy_recoTrue, cos_zenith_recoTrue, bjorken_y_recoTrue;
+    Double_t nnfit_shower_cos_zenith, nnfit_track_cos_zenith, nnfit_shower_energy, nnfit_track_energy, nnfit_bjorken_y;
+
+    vector<NewColumn> columns;
+    if (!weighted)
+    {
+        columns.push_back({kCorrected, "Year", &w.year, "Year/I"});
+        columns.push_back({kCorrected, "w_non_osc", &w.w_non_osc, "w_non_osc/D"});
+        columns.push_back({kCorrected, "weight_one_year", &w.weight_one_year, "weight_one_year/D"});
+    }
+    // leaf lists as written by OscillationWeights and addBranches
+    columns.push_back({kOscillated, "w_osc", &w_osc, "w_osc/D"});
+    columns.push_back({kOscillated, "prob_nue", &prob_nue, "prob_nue/D"});
+    columns.push_back({kOscillated, "prob_numu", &prob_numu, "prob_numuu/D"});
+    for (size_t c = 0; c < ncols; c++)
+    {
+        const string &name = join.Columns()[c];
+        if (join.IsFloat()[c])
+            columns.push_back({kNNFit, name, &fvalues[c], name + "/F"});
+        else
+            columns.push_back({kNNFit, name, &dvalues[c], name + "/D"});
+    }
+    columns.push_back({kSwim, "NNFitShower_Energy", &nnfit_shower_energy, "NNFitShower_Energy/D"});
+    columns.push_back({kSwim, "NNFitTrack_Energy", &nnfit_track_energy, "NNFitTrack_Energy/D"});
+    columns.push_back({kSwim, "NNFitShower_cos_zenith", &nnfit_shower_cos_zenith, "NNFitShower_CosZenith/D"});
+    columns.push_back({kSwim, "NNFitTrack_cos_zenith", &nnfit_track_cos_zenith, "NNFitTrack_CosZenith/D"});
+    columns.push_back({kSwim, "NNFit_Bjorken_y", &nnfit_bjorken_y, "NNFit_Bjorken_y/D"});
+    columns.push_back({kSwim, "energy_recoTrue", &energy_recoTrue, "energy_recoTrue/D"});
+    columns.push_back({kSwim, "cos_zenith_recoTrue", &cos_zenith_recoTrue, "cos_zenith_recoTrue/D"});
+    columns.push_back({kSwim, "bjorken_y_recoTrue", &bjorken_y_recoTrue, "bjorken_y_recoTrue/D"});
+
+    for (const NewColumn &column : columns)
+    {
+        if (tree->GetBranch(column.name.c_str()))
+        {
+            cerr << "Error: branch " << column.name << " already exists in " << input_file << endl;
+            return 1;
+        }
+    }
+
+    //===========================================================
+    // Output tree and taps
+    //===========================================================
+    TFile *outfile = new TFile(output_file.c_str(), "RECREATE");
+    TTree *newtree = tree->CloneTree(0);
+    sparse.Branch(newtree);
+    for (const NewColumn &column : columns)
+        newtree->Branch(column.name.c_str(), column.address, column.leaflist.c_str());
+
+    for (Tap &tap : taps)
+    {
+        tap.file = new TFile(tap.path.c_str(), "RECREATE");
+        tap.tree = tree->CloneTree(0);
+        sparse.Branch(tap.tree);
+        for (const NewColumn &column : columns)
+            if (column.step <= tap.step)
+                tap.tree->Branch(column.name.c_str(), column.address, column.leaflist.c_str());
+        cout << "Tap after " << tap.option.substr(4) << ": " << tap.path << endl;
+    }
+
+    //===========================================================
+    // Flux and oscillations
+    //===========================================================
+    TH2D *FluxHist_copy[4];
+    LoadFluxHistograms(flux_file, FluxHist_copy);
+    OscProb::PMNS_Fast pmns;
+    OscProb::PremModel prem;
+    SetOscillationParameters(pmns);
+    map<int, int> flavour_cor = OscProbFlavours();
+
+    //===========================================================
+    // Event loop
+    //===========================================================
+    vector<double> nnfit_block(kBlockSize * ncols);
+    AlignedVector<float> shower_theta(kBlockSize), track_theta(kBlockSize), shower_logE(kBlockSize), track_logE(kBlockSize);
+    AlignedVector<float> sigma[4];
+    for (int k = 0; k < 4; k++)
+        sigma[k].resize(kBlockSize);
+    AlignedVector<double> shower_energy(kBlockSize), track_energy(kBlockSize), shower_cos_zenith(kBlockSize), track_cos_zenith(kBlockSize);
+    AlignedVector<double> log_energy(kBlockSize), log_flux_nue(kBlockSize), log_flux_numu(kBlockSize), flux_nue(kBlockSize), flux_numu(kBlockSize);
+    AlignedVector<uint8_t> selected(kBlockSize);
+    Long64_t nsel = 0;
+    size_t n_unknown = 0;
+
+    // the trees share what is left after the histograms and the block arrays, the taps as much as the output
+    stage.memory.Reserve("flux histograms", FluxHistogramBytes(FluxHist_copy));
+    stage.memory.Reserve("block arrays", kBlockSize * (Long64_t)(ncols * sizeof(double) + 8 * sizeof(float) + 13 * sizeof(double) + 2 * sizeof(int) + 1));
+    // --async-write: the entries are filled and compressed on a writer thread per tree (AsyncTreeWriter.h)
+    AsyncTreeWriter writer(newtree, options, stage.memory);
+    for (Tap &tap : taps)
+        tap.writer = new AsyncTreeWriter(tap.tree, options, stage.memory);
+    stage.memory.ConfigureInput(tree, 0.25);
+    stage.input.Configure(tree);
+    stage.memory.ConfigureOutput(newtree, 0.75 / (1 + taps.size()));
+    stage.codecs.Apply(newtree);
+    for (Tap &tap : taps)
+    {
+        stage.memory.ConfigureOutput(tap.tree, 0.75 / (1 + taps.size()));
+        stage.codecs.Apply(tap.tree);
+    }
+
+    // the join returns every entry in order, those before the range are skipped
+    Long64_t entry;
+    const double *values;
+    for (Long64_t i = 0; i < stage.range.First(); i++)
+        join.Next(entry, values);
+
+    cout << "\nProcessing " << ntot << " events" << endl;
+    stage.Progress().Begin("pipeline", ntot);
+    for (Long64_t first = stage.range.First(); first < stage.range.Last(); first += kBlockSize)
+    {
+        Long64_t n = min(kBlockSize, stage.range.Last() - first);
+
+        // MergeNNFit: NNFit values of the block, in entry order
+        {
+            TRACE_SCOPE("JoinNext");
+            for (Long64_t j = 0; j < n; j++)
+            {
+                if (!join.Next(entry, values))
+                {
+                    cerr << "Error: NNFit join ended at entry " << first + j << " of " << nentries << endl;
+                    return 1;
+                }
+                copy(values, values + ncols, &nnfit_block[j * ncols]);
+                shower_theta[j] = (float)values[c_shower_theta];
+                track_theta[j] = (float)values[c_track_theta];
+                shower_logE[j] = (float)values[c_shower_logE];
+                track_logE[j] = (float)values[c_track_logE];
+                for (int k = 0; k < 4; k++)
+                    if (c_sigma[k] >= 0)
+                        sigma[k][j] = (float)values[c_sigma[k]];
+            }
+        }
+
+        // add_SWIM_Branches: derived NNFit columns
+        {
+            TRACE_SCOPE("SwimBlock");
+            Pow10(shower_logE.data(), shower_energy.data(), n);
+            Pow10(track_logE.data(), track_energy.data(), n);
+            CosDeg(shower_theta.data(), shower_cos_zenith.data(), n);
+            CosDeg(track_theta.data(), track_cos_zenith.data(), n);
+            // theta is the direction of origin, the zenith of the track is its opposite
+            for (Long64_t j = 0; j < n; j++)
+            {
+                shower_cos_zenith[j] = -shower_cos_zenith[j];
+                track_cos_zenith[j] = -track_cos_zenith[j];
+            }
+        }
+
+        // CutSelection: decide the block from the cut columns only
+        {
+            TRACE_SCOPE("LoadBlock");
+            type.Read(first, n);
+            interaction_type.Read(first, n);
+            energy_true.Read(first, n);
+            cos_zenith_true.Read(first, n);
+        }
+        CutColumns cut_columns = {energy_true.Data(), type.Data(), interaction_type.Data(),
+                                  track_cos_zenith.data(), shower_cos_zenith.data(),
+                                  sigma[0].data(), sigma[1].data(), sigma[2].data(), sigma[3].data()};
+        {
+            TRACE_SCOPE("EvaluateCuts");
+            n_unknown += EvaluateCuts(cut, cut_columns, n, selected.data());
+        }
+
+        // OscillationWeights: flux of the events that are reweighted, in batch
+        {
+            TRACE_SCOPE("FluxInterpolation");
+            Log10(energy_true.Data(), log_energy.data(), n);
+            for (Long64_t j = 0; j < n; j++)
+            {
+                log_flux_nue[j] = log_flux_numu[j] = 0;
+                if ((selected[j] || read_all) && cos_zenith_true.Data()[j] < 0 && energy_true.Data()[j] < TMath::Power(10, 4))
+                {
+                    log_flux_nue[j] = GetLogFlux(FluxHist_copy, sgn(type.Data()[j]) * 12, log_energy[j], cos_zenith_true.Data()[j]);
+                    log_flux_numu[j] = GetLogFlux(FluxHist_copy, sgn(type.Data()[j]) * 14, log_energy[j], cos_zenith_true.Data()[j]);
+                }
+            }
+            Pow10(log_flux_nue.data(), flux_nue.data(), n);
+            Pow10(log_flux_numu.data(), flux_numu.data(), n);
+        }
+
+        for (Long64_t j = 0; j < n; j++)
+        {
+            if (!selected[j] && !read_all)
+                continue;
+            Long64_t i = first + j;
+            {
+                TRACE_SCOPE("ReadEvent");
+                tree->GetEntry(i);
+            }
+
+            // CorrectTree: reconstructions without a result
+            if (sparse.Enabled())
+            {
+                TRACE_SCOPE("ReadSparseReco");
+                sparse.GetEntry(i);
+            }
+            else
+                for (size_t s = 0, k = 0; s < strategies.size(); k += strategies[s].columns.size(), s++)
+                    if (!flags[s])
+                        for (size_t c = 0; c < strategies[s].columns.size(); c++)
+                            masked[k + c] = NAN;
+            if (!weighted)
+                CorrectWeights(w);
+
+            // OscillationWeights
+            if (cos_zenith_true.Data()[j] < 0 && energy_true.Data()[j] < TMath::Power(10, 4))
+            {
+                double w2_norm = (w.w2 * scm_to_sm) / w.ngen; // normalized weight
+                TRACE_SCOPE("PMNS_Fast::Prob");
+                pair<double, double> prob = Get_Osc_Prob(pmns, prem, flavour_cor, type.Data()[j], energy_true.Data()[j], cos_zenith_true.Data()[j]);
+                prob_nue = prob.first;
+                prob_numu = prob.second;
+                w_osc = w2_norm * (flux_nue[j] * prob_nue + flux_numu[j] * prob_numu) * w.run_duration;
+            }
+            else
+            {
+                prob_nue = prob_numu = NAN;
+                w_osc = w.w_non_osc;
+            }
+
+            // MergeNNFit
+            for (size_t c = 0; c < ncols; c++)
+            {
+                dvalues[c] = nnfit_block[j * ncols + c];
+                fvalues[c] = (float)dvalues[c];
+            }
+
+            // add_SWIM_Branches
+            energy_recoTrue = energy_true.Data()[j];
+            cos_zenith_recoTrue = cos_zenith_true.Data()[j];
+            bjorken_y_recoTrue = 0.5;
+            nnfit_bjorken_y = 0.5;
+            nnfit_shower_energy = shower_energy[j];
+            nnfit_track_energy = track_energy[j];
+            nnfit_shower_cos_zenith = shower_cos_zenith[j];
+            nnfit_track_cos_zenith = track_cos_zenith[j];
+
+            TRACE_SCOPE("Fill");
+            for (Tap &tap : taps)
+                tap.writer->Fill();
+            if (selected[j])
+            {
+                writer.Fill();
+                nsel++;
+            }
+        }
+        stage.Progress().Add(n);
+    }
+
+    if (n_unknown > 0)
+        cerr << "Warning: " << n_unknown << " events without a track or shower topology" << endl;
+    // and those after it, so that the counts of the join are those of the whole tree
+    while (join.Next(entry, values))
+        ;
+    if (join.Duplicates() > 0)
+        cerr << "Warning: " << join.Duplicates() << " NNFit rows repeat the key of an earlier row, only the first one is joined"
+             << endl;
+
+    //===========================================================
+    // Write
+    //===========================================================
+    Long64_t tap_bytes = 0;
+    for (Tap &tap : taps)
+    {
+        TRACE_SCOPE("Write");
+        tap.writer->Finish();
+        delete tap.writer;
+        tap.file->cd();
+        tap.tree->Write();
+        tap.file->Close();
+        AnnotateSelFile(tap.path, tree_name);
+        tap_bytes += FileSize(tap.path);
+    }
+
+    writer.Finish();
+    outfile->cd();
+    {
+        TRACE_SCOPE("Write");
+        newtree->Write();
+    }
+    stage.input.Report(tree);
+    outfile->Close();
+    infile->Close();
+    AnnotateSelFile(output_file, tree_name);
+    addCanANTARES(output_file);
+    stage.Finish();
+
+    timer.Stop();
+    cout << "\n========================================" << endl;
+    cout << "Entries:                 " << ntot << endl;
+    if (stage.range.Enabled())
+        cout << "Range:                   [" << stage.range.First() << ", " << stage.range.Last() << ") of " << nentries << endl;
+    cout << "Selected:                " << nsel << endl;
+    cout << "With NNFit:              " << join.Matched() << endl;
+    cout << "Bytes written:           " << FileSize(output_file) << " (output), " << tap_bytes << " (taps)" << endl;
+    cout << "Time:                    " << timer.RealTime() << " s" << endl;
+    cout << "========================================" << endl;
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * @brief List the outputs of the pipeline that are stale, from the manifests written with --cache.
+ * For each output, its manifest (<output>.manifest, see StageCache.h) is
+ * compared with the files as they are now. An output is stale when:
+ *
+ *   - it or its manifest is missing, or it was written again without --cache;
+ *   - the binary of its step changed;
+ *   - one of its inputs changed (a new UUID or content) or is missing;
+ *   - one of its inputs is the output of another step that is stale, since
+ *     that step runs first and re-makes it.
+ *
+ * A change of parameters is not seen here: it is the command line of the
+ * next run that differs, and the step itself then runs instead of skipping.
+ *
+ * The outputs are given as files, lists (@list) or directories, which are
+ * searched for manifests. With --list, the stale outputs are written one per
+ * line, e.g. for the job scripts or PartitionLists.
+ *
+ * Usage: StageStatus <output rootfile | @list | directory> [...] [--list <file>] [--stale]
+ */
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "StageCache.h"
+#include "StageOptions.h"
+
+using namespace std;
+
+const string kManifestSuffix = ".manifest";
+
+bool IsDirectory(const string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// Outputs of the manifests found under a directory
+void FindManifests(const string &dir, vector<string> &outputs)
+{
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        return;
+    vector<string> names;
+    while (struct dirent *entry = readdir(handle))
+        names.push_back(entry->d_name);
+    closedir(handle);
+    sort(names.begin(), names.end());
+
+    for (const string &name : names)
+    {
+        if (name == "." || name == "..")
+            continue;
+        string path = dir + "/" + name;
+        if (IsDirectory(path))
+            FindManifests(path, outputs);
+        else if (name.size() > kManifestSuffix.size() &&
+                 name.compare(name.size() - kManifestSuffix.size(), kManifestSuffix.size(), kManifestSuffix) == 0)
+            outputs.push_back(path.substr(0, path.size() - kManifestSuffix.size()));
+    }
+}
+
+vector<string> ReadOutputs(const vector<string> &args)
+{
+    vector<string> outputs;
+    for (const string &arg : args)
+    {
+        if (IsDirectory(arg))
+            FindManifests(arg, outputs);
+        else if (arg[0] != '@')
+            outputs.push_back(arg);
+        else
+        {
+            // as hadd, @file reads the outputs from a list
+            ifstream list(arg.substr(1).c_str());
+            if (!list)
+            {
+                cerr << "Error: list " << arg.substr(1) << " not found" << endl;
+                exit(1);
+            }
+            string line;
+            while (list >> line)
+                outputs.push_back(line);
+        }
+    }
+    return outputs;
+}
+
+class StatusChecker
+{
+public:
+    // Empty if the output is up to date, else why it is stale
+    string Check(const string &output)
+    {
+        string path = StageCache::Absolute(output);
+        map<string, string>::iterator known = fStatus.find(path);
+        if (known != fStatus.end())
+            return known->second;
+        // a cycle of manifests cannot be built by the steps, it is stale if it happens
+        fStatus[path] = "cycle of manifests";
+        return fStatus[path] = Evaluate(output);
+    }
+
+private:
+    string Evaluate(const string &output)
+    {
+        StageManifest manifest;
+        if (Identity(output) == "missing")
+            return "missing";
+        if (!StageCache::Read(StageCache::ManifestPath(output), manifest))
+            return "no manifest";
+        if (Identity(output) != manifest.output_id)
+            return "written again since its manifest";
+        if (Identity(manifest.binary) != manifest.binary_id)
+            return "binary " + manifest.binary + " changed";
+        for (const pair<string, string> &input : manifest.inputs)
+        {
+            if (Identity(input.first) != input.second)
+                return "input " + input.first + " changed";
+            // the input is the output of an earlier step
+            if (Identity(StageCache::ManifestPath(input.first)) != "missing" && !Check(input.first).empty())
+                return "input " + input.first + " is stale";
+        }
+        return "";
+    }
+
+    // identities are computed once, a binary or flux table is shared by many outputs
+    string Identity(const string &path)
+    {
+        map<string, string>::iterator known = fIdentities.find(path);
+        if (known != fIdentities.end())
+            return known->second;
+        return fIdentities[path] = StageCache::Identity(path);
+    }
+
+    map<string, string> fStatus;
+    map<string, string> fIdentities;
+};
+
+void usage(const char *name)
+{
+    cout << "Usage: " << name << " <output rootfile | @list | directory> [...] [--list <file>] [--stale]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    StageOptions options(argc, argv, {"list"});
+    const vector<string> &args = options.Positional();
+    if (args.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vector<string> outputs = ReadOutputs(args);
+    if (outputs.empty())
+    {
+        cerr << "Error: no output and no manifest found" << endl;
+        return 1;
+    }
+
+    StatusChecker checker;
+    vector<string> stale;
+    map<string, int> reasons;
+    for (const string &output : outputs)
+    {
+        string reason = checker.Check(output);
+        if (!reason.empty())
+        {
+            stale.push_back(output);
+            // "input <path> changed" counts as "input changed"
+            string kind = reason.substr(0, reason.find(' '));
+            reasons[kind == "input" || kind == "binary" ? kind + reason.substr(reason.rfind(' ')) : reason]++;
+        }
+        if (!reason.empty() || !options.Has("stale"))
+            printf("  %-10s %s%s%s\n", reason.empty() ? "ok" : "stale", output.c_str(), reason.empty() ? "" : ": ", reason.c_str());
+    }
+
+    if (options.Has("list"))
+    {
+        ofstream list(options.Get("list"));
+        if (!list)
+        {
+            cerr << "Error: cannot write the list " << options.Get("list") << endl;
+            return 1;
+        }
+        for (const string &output : stale)
+            list << output << "\n";
+    }
+
+    cout << "\n========================================" << endl;
+    cout << "Outputs:                 " << outputs.size() << endl;
+    cout << "Up to date:              " << outputs.size() - stale.size() << endl;
+    cout << "Stale:                   " << stale.size() << endl;
+    for (const pair<const string, int> &reason : reasons)
+        printf("  %-22s %d\n", reason.first.c_str(), reason.second);
+    cout << "========================================" << endl;
+
+    return 0;
+}
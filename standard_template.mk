@@ -1,18 +1,28 @@
 CXX = $(shell root-config --cxx)
-CXXFLAGS = $(shell root-config --cflags) -fPIC
+# SIMDFLAGS selects the vector ISA of the kernels, e.g. make SIMDFLAGS=-march=native
+CXXFLAGS = $(shell root-config --cflags) -fPIC -fopenmp-simd $(SIMDFLAGS)
 LDFLAGS = $(shell root-config --glibs)
 
+# make TRACE=1 compiles the scoped timers of common/include/Trace.h (--trace out.json)
+ifeq ($(TRACE),1)
+CXXFLAGS += -DENABLE_TRACE
+endif
+
+# Shared headers, located relative to this template
+COMMON_DIR := $(dir $(lastword $(MAKEFILE_LIST)))common
+
 BINDIR = bin
 
-INCDIRS = -I$(ROOTSYS)/include
+INCDIRS = -I$(COMMON_DIR)/include -I$(ROOTSYS)/include
 
+# Extra sources (e.g. of another step) can be added as prerequisites of the target
 SOURCE = $(wildcard src/*.cc)
 TARGET = $(patsubst %.cc,%,$(shell basename $(SOURCE)))
 
 $(BINDIR)/$(TARGET): $(SOURCE)
 	@mkdir -p ${BINDIR}
 	@echo "Compiling ${TARGET} from ${SOURCE}..."
-	@$(CXX) -O3 -o $@ $< $(LDFLAGS) $(CXXFLAGS) $(INCDIRS)
+	@$(CXX) -O3 -o $@ $^ $(LDFLAGS) $(CXXFLAGS) $(INCDIRS)
 
 phony:
 